@@ -0,0 +1,503 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * dt-authserv: a small, self-contained authoritative name server that
+ * answers from (signed) zone files.  It exists so that the validator
+ * and the replay harness in dt-validate can be exercised offline and
+ * repeatably, without depending on the state of the live DNS.
+ *
+ * The server understands enough of the master file format to load the
+ * output of zonesigner/dnssec-signzone and implements the parts of
+ * the authoritative answering algorithm that matter for validation:
+ * referrals (with DS or a denial of DS), CNAME and DNAME processing,
+ * wildcard synthesis, NODATA/NXDOMAIN responses with NSEC or NSEC3
+ * proofs, EDNS0 with the DO bit, and truncation over UDP with TCP
+ * fallback.  A zone may also be marked "bogus", in which case every
+ * signature served from it is corrupted on the way out.  The zone
+ * loader and the answering code are exported by libval (see
+ * validator/val_zone.h), where the validator also uses them to answer
+ * from local zone mirrors.
+ *
+ * When several zones are loaded, a query is answered from the deepest
+ * zone that contains the query name (DS queries for a zone apex are
+ * answered from the parent), so a single instance can stand in for a
+ * complete chain of trust from the root down when it is listed as the
+ * recursive name server in the validator's resolv.conf, e.g.
+ *
+ *      nameserver [127.0.0.1]:5300
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+#include <validator/val_zone.h>
+
+#include <signal.h>
+
+#ifdef HAVE_GETOPT_H
+#include <getopt.h>
+#endif
+
+#define	NAME	"dt-authserv"
+#define	VERS	"version: 1.0"
+#define	DTVERS	"DNSSEC-Tools Version: 1.8"
+
+#define AZ_DEFAULT_PORT     5300
+#define AZ_MAX_TCP          16
+
+static struct val_zone *zones = NULL;
+static int      verbose = 0;
+static volatile sig_atomic_t done = 0;
+
+/*
+ * Bogus zone names are collected from the command line and applied
+ * after all zone files have been loaded.
+ */
+static char    *bogus_zones[32];
+static int      nbogus = 0;
+
+/*
+ * Every response sent can be appended to a capture file, each one
+ * preceded by its length as a two octet value in network byte order
+ * (the same framing as DNS over TCP).
+ */
+static FILE    *capture = NULL;
+
+#ifdef HAVE_GETOPT_LONG
+// Program options
+static struct option prog_options[] = {
+    {"address", 1, 0, 'a'},
+    {"bogus", 1, 0, 'b'},
+    {"help", 0, 0, 'h'},
+    {"port", 1, 0, 'p'},
+    {"udp-size", 1, 0, 'u'},
+    {"verbose", 0, 0, 'v'},
+    {"Version", 0, 0, 'V'},
+    {"write", 1, 0, 'w'},
+    {0, 0, 0, 0}
+};
+#endif
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options] zonefile [zonefile ...]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-a, --address=<addr>   address to listen on (default 127.0.0.1)\n");
+    fprintf(stderr,
+            "\t-p, --port=<port>      port to listen on (default %d)\n",
+            AZ_DEFAULT_PORT);
+    fprintf(stderr,
+            "\t-u, --udp-size=<n>     largest UDP response to send; larger\n"
+            "\t                       responses are truncated (default 512,\n"
+            "\t                       or the client's EDNS0 buffer size)\n");
+    fprintf(stderr,
+            "\t-b, --bogus=<zone>     corrupt all signatures served for <zone>\n");
+    fprintf(stderr,
+            "\t-v, --verbose          log every query to stdout\n");
+    fprintf(stderr,
+            "\t-w, --write=<file>     append every response sent to <file>\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+    fprintf(stderr,
+            "\t-V, --Version          display version and exit\n");
+}
+
+static void
+version(void)
+{
+    fprintf(stderr, "%s: %s\n", NAME, VERS);
+    fprintf(stderr, "%s\n", DTVERS);
+}
+
+static void
+az_sighandler(int sig)
+{
+    done = 1;
+}
+
+/*
+ * ==================================================================
+ * Network loop
+ * ==================================================================
+ */
+
+static int
+az_read_full(int fd, u_char *buf, size_t len)
+{
+    size_t          got = 0;
+
+    while (got < len) {
+        ssize_t         n = read(fd, buf + got, len - got);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return 0;
+}
+
+static int
+az_write_full(int fd, const u_char *buf, size_t len)
+{
+    size_t          put = 0;
+
+    while (put < len) {
+        ssize_t         n = write(fd, buf + put, len - put);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        put += n;
+    }
+    return 0;
+}
+
+/*
+ * Handle one length-prefixed query on a TCP connection.  Returns -1
+ * if the connection should be closed.
+ */
+static void
+az_capture(const u_char *resp, int n)
+{
+    u_char          lenbuf[2];
+
+    if (capture == NULL || n <= 0)
+        return;
+    lenbuf[0] = (n >> 8) & 0xff;
+    lenbuf[1] = n & 0xff;
+    if (fwrite(lenbuf, 1, 2, capture) != 2 ||
+        fwrite(resp, 1, n, capture) != (size_t) n) {
+        perror("capture");
+        fclose(capture);
+        capture = NULL;
+    }
+}
+
+/*
+ * Print a one line summary of a response on stdout
+ */
+static void
+az_log_response(const u_char *resp, int n, int is_tcp)
+{
+    ns_msg          handle;
+    ns_rr           rr;
+    HEADER         *rh = (HEADER *) resp;
+    char            nbuf[NS_MAXDNAME];
+    const char     *edns = "";
+    int             i;
+
+    if (ns_initparse(resp, n, &handle) < 0 ||
+        ns_parserr(&handle, ns_s_qd, 0, &rr) < 0)
+        return;
+    strncpy(nbuf, ns_rr_name(rr), sizeof(nbuf) - 1);
+    nbuf[sizeof(nbuf) - 1] = '\0';
+    for (i = 0; i < ns_msg_count(handle, ns_s_ar); i++) {
+        ns_rr           opt;
+
+        if (ns_parserr(&handle, ns_s_ar, i, &opt) == 0 &&
+            ns_rr_type(opt) == ns_t_opt) {
+            edns = (ns_rr_ttl(opt) & 0x8000) ? " +edns +do" : " +edns";
+            break;
+        }
+    }
+    printf("%s %s %s%s -> %s%s an=%d ns=%d ar=%d len=%d\n",
+           is_tcp ? "tcp" : "udp", nbuf[0] ? nbuf : ".",
+           p_sres_type(ns_rr_type(rr)), edns, p_rcode(rh->rcode),
+           rh->tc ? " TC" : "", ntohs(rh->ancount), ntohs(rh->nscount),
+           ntohs(rh->arcount), n);
+    fflush(stdout);
+}
+
+static int
+az_serve_tcp(int fd, u_char *query, u_char *resp)
+{
+    u_char          lenbuf[2];
+    u_int16_t       qlen;
+    int             n;
+
+    if (az_read_full(fd, lenbuf, 2) < 0)
+        return -1;
+    qlen = (lenbuf[0] << 8) | lenbuf[1];
+    if (az_read_full(fd, query, qlen) < 0)
+        return -1;
+    n = val_zone_respond(zones, query, qlen, resp + 2, 65535, 1, 0);
+    if (n < 0)
+        return 0;
+    if (verbose)
+        az_log_response(resp + 2, n, 1);
+    az_capture(resp + 2, n);
+    resp[0] = (n >> 8) & 0xff;
+    resp[1] = n & 0xff;
+    return az_write_full(fd, resp, n + 2);
+}
+
+static int
+az_open_socket(struct sockaddr_storage *ss, socklen_t sslen, int type)
+{
+    int             fd, on = 1;
+
+    fd = socket(ss->ss_family, type, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *) ss, sslen) < 0 ||
+        (type == SOCK_STREAM && listen(fd, 16) < 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char     *addr = "127.0.0.1";
+    int             port = AZ_DEFAULT_PORT;
+    size_t          udp_limit = 0;
+    struct sockaddr_storage ss;
+    socklen_t       sslen;
+    int             udp, tcp, tcpfds[AZ_MAX_TCP];
+    u_char         *query, *resp;
+    struct val_zone *z;
+    int             i, ret = 1;
+    const char     *capture_file = NULL;
+
+    while (1) {
+        int             c;
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+#ifdef HAVE_GETOPT_LONG_ONLY
+        c = getopt_long_only(argc, argv, "a:b:hp:u:vVw:",
+                             prog_options, &opt_index);
+#else
+        c = getopt_long(argc, argv, "a:b:hp:u:vVw:", prog_options,
+                        &opt_index);
+#endif
+#else                           /* only have getopt */
+        c = getopt(argc, argv, "a:b:hp:u:vVw:");
+#endif
+
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'a':
+            addr = optarg;
+            break;
+        case 'b':
+            if (nbogus == sizeof(bogus_zones) / sizeof(bogus_zones[0])) {
+                fprintf(stderr, "Too many bogus zones\n");
+                return 1;
+            }
+            bogus_zones[nbogus++] = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        case 'p':
+            port = atoi(optarg);
+            if (port <= 0 || port > 65535) {
+                fprintf(stderr, "Invalid port %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'u':
+            udp_limit = strtoul(optarg, NULL, 10);
+            if (udp_limit < HFIXEDSZ) {
+                fprintf(stderr, "Invalid UDP size %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'V':
+            version();
+            return 0;
+        case 'w':
+            capture_file = optarg;
+            break;
+        default:
+            fprintf(stderr, "Invalid option %s\n", argv[optind - 1]);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Error: no zone files specified\n");
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (; optind < argc; optind++) {
+        char            buf[NS_MAXDNAME];
+
+        if (val_zone_load(argv[optind], &z) < 0)
+            goto done;
+        z->next = zones;
+        zones = z;
+        ns_name_ntop(z->apex, buf, sizeof(buf));
+        printf("loaded %s from %s: %d records, %d names, %s\n", buf,
+               z->file, z->nrrs, z->nnodes,
+               z->nnsec3 ? "NSEC3" : (z->has_nsec ? "NSEC" : "unsigned"));
+    }
+
+    for (i = 0; i < nbogus; i++) {
+        u_char          n[NS_MAXCDNAME];
+
+        if (val_zone_text2name(bogus_zones[i], ".", n) < 0) {
+            fprintf(stderr, "Invalid zone name %s\n", bogus_zones[i]);
+            goto done;
+        }
+        for (z = zones; z; z = z->next)
+            if (namecmp(z->apex, n) == 0)
+                break;
+        if (z == NULL) {
+            fprintf(stderr, "Zone %s is not loaded\n", bogus_zones[i]);
+            goto done;
+        }
+        z->bogus = 1;
+    }
+
+    memset(&ss, 0, sizeof(ss));
+    if (inet_pton(AF_INET, addr, &((struct sockaddr_in *) &ss)->sin_addr)
+        == 1) {
+        ((struct sockaddr_in *) &ss)->sin_family = AF_INET;
+        ((struct sockaddr_in *) &ss)->sin_port = htons(port);
+        sslen = sizeof(struct sockaddr_in);
+    }
+#ifdef VAL_IPV6
+    else if (inet_pton(AF_INET6, addr,
+                       &((struct sockaddr_in6 *) &ss)->sin6_addr) == 1) {
+        ((struct sockaddr_in6 *) &ss)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6 *) &ss)->sin6_port = htons(port);
+        sslen = sizeof(struct sockaddr_in6);
+    }
+#endif
+    else {
+        fprintf(stderr, "Invalid address %s\n", addr);
+        goto done;
+    }
+
+    udp = az_open_socket(&ss, sslen, SOCK_DGRAM);
+    tcp = az_open_socket(&ss, sslen, SOCK_STREAM);
+    if (udp < 0 || tcp < 0) {
+        fprintf(stderr, "Could not listen on %s port %d: %s\n", addr, port,
+                strerror(errno));
+        goto done;
+    }
+    for (i = 0; i < AZ_MAX_TCP; i++)
+        tcpfds[i] = -1;
+
+    if (capture_file && (capture = fopen(capture_file, "ab")) == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", capture_file,
+                strerror(errno));
+        goto done;
+    }
+
+    query = (u_char *) MALLOC(65536);
+    resp = (u_char *) MALLOC(65536 + 2);
+    if (query == NULL || resp == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+
+    signal(SIGINT, az_sighandler);
+    signal(SIGTERM, az_sighandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("listening on %s port %d\n", addr, port);
+    fflush(stdout);
+
+    while (!done) {
+        fd_set          rfds;
+        int             maxfd = (udp > tcp) ? udp : tcp;
+
+        FD_ZERO(&rfds);
+        FD_SET(udp, &rfds);
+        FD_SET(tcp, &rfds);
+        for (i = 0; i < AZ_MAX_TCP; i++) {
+            if (tcpfds[i] < 0)
+                continue;
+            FD_SET(tcpfds[i], &rfds);
+            if (tcpfds[i] > maxfd)
+                maxfd = tcpfds[i];
+        }
+        if (select(maxfd + 1, &rfds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("select");
+            break;
+        }
+
+        if (FD_ISSET(udp, &rfds)) {
+            struct sockaddr_storage from;
+            socklen_t       fromlen = sizeof(from);
+            ssize_t         qlen;
+            int             n;
+
+            qlen = recvfrom(udp, query, 65536, 0,
+                            (struct sockaddr *) &from, &fromlen);
+            if (qlen > 0) {
+                n = val_zone_respond(zones, query, qlen, resp, 65535, 0,
+                                     udp_limit);
+                if (n > 0) {
+                    if (verbose)
+                        az_log_response(resp, n, 0);
+                    az_capture(resp, n);
+                    sendto(udp, resp, n, 0, (struct sockaddr *) &from,
+                           fromlen);
+                }
+            }
+        }
+
+        if (FD_ISSET(tcp, &rfds)) {
+            int             fd = accept(tcp, NULL, NULL);
+
+            if (fd >= 0) {
+                for (i = 0; i < AZ_MAX_TCP; i++)
+                    if (tcpfds[i] < 0)
+                        break;
+                if (i == AZ_MAX_TCP)
+                    close(fd);
+                else
+                    tcpfds[i] = fd;
+            }
+        }
+
+        for (i = 0; i < AZ_MAX_TCP; i++) {
+            if (tcpfds[i] >= 0 && FD_ISSET(tcpfds[i], &rfds) &&
+                az_serve_tcp(tcpfds[i], query, resp) < 0) {
+                close(tcpfds[i]);
+                tcpfds[i] = -1;
+            }
+        }
+    }
+
+    for (i = 0; i < AZ_MAX_TCP; i++)
+        if (tcpfds[i] >= 0)
+            close(tcpfds[i]);
+    close(udp);
+    close(tcp);
+    FREE(query);
+    FREE(resp);
+    ret = 0;
+
+  done:
+    if (capture)
+        fclose(capture);
+    while (zones) {
+        z = zones;
+        zones = z->next;
+        val_zone_free(z);
+    }
+    return ret;
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Warm the caches of a validator context from a list of queries with
+ * val_cache_warm(), so that a new instance can be filled before it is
+ * put into service.  The list is read from a file or stdin, one query
+ * per line:
+ *
+ *      <name> [<class>] [<type>]
+ *
+ * as for the batch lookups of dt-getrrset.  Progress goes to stderr
+ * about once a second, and a summary with the time to full warm, the
+ * validation statuses and the cache statistics at the end.  With -o
+ * the caches are then saved with val_cache_save(), for an application
+ * to load at startup (see the cache-file option of dnsval.conf).
+ */
+
+#include "validator-internal.h"
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define WARM_DEFAULT_CONCURRENCY    100
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options] <file>\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-c, --concurrency=<n>  queries in flight at most (default %d)\n",
+            WARM_DEFAULT_CONCURRENCY);
+    fprintf(stderr,
+            "\t-T, --type=<type>      type of lines without one (default A)\n");
+    fprintf(stderr,
+            "\t-o, --output=<file>    save the caches to <file> when done\n");
+    fprintf(stderr,
+            "\t-q, --quiet            do not report progress\n");
+    fprintf(stderr,
+            "\t-v, --dnsval-conf=<file> dnsval.conf to create the context with\n");
+    fprintf(stderr,
+            "\t-r, --resolv-conf=<file> resolv.conf to create the context with\n");
+    fprintf(stderr,
+            "\t-i, --root-hints=<file> root.hints to create the context with\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+    fprintf(stderr, "<file> holds one \"<name> [<class>] [<type>]\" per "
+            "line, \"-\" for stdin\n");
+}
+
+/*
+ * Read the whole list.  Returns the number of queries, or -1; lines
+ * that cannot be parsed are reported and skipped.
+ */
+static int
+read_queries(const char *file, int def_type, val_warm_query_t **queries)
+{
+    char            line[NS_MAXDNAME + 64];
+    val_warm_query_t *list = NULL, *tmp;
+    FILE           *fp;
+    int             count = 0, alloc = 0, lineno = 0;
+
+    if (!strcmp(file, "-"))
+        fp = stdin;
+    else if ((fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char           *tok, *save = NULL, *name = NULL;
+        int             qc = ns_c_in, qt = def_type, success, v;
+
+        ++lineno;
+        for (tok = strtok_r(line, " \t\r\n", &save); tok;
+             tok = strtok_r(NULL, " \t\r\n", &save)) {
+            if (NULL == name) {
+                if (*tok == '#' || *tok == ';')
+                    break;
+                name = tok;
+                continue;
+            }
+            v = res_nametoclass(tok, &success);
+            if (success) {
+                qc = v;
+                continue;
+            }
+            v = res_nametotype(tok, &success);
+            if (success) {
+                qt = v;
+                continue;
+            }
+            fprintf(stderr, "%s:%d: unknown class or type %s\n", file,
+                    lineno, tok);
+            name = NULL;
+            break;
+        }
+        if (NULL == name)
+            continue;
+
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 1024;
+            tmp = (val_warm_query_t *)
+                realloc(list, alloc * sizeof(val_warm_query_t));
+            if (NULL == tmp)
+                goto oom;
+            list = tmp;
+        }
+        memset(&list[count], 0, sizeof(val_warm_query_t));
+        if ((list[count].vw_name = strdup(name)) == NULL)
+            goto oom;
+        list[count].vw_class_h = qc;
+        list[count].vw_type_h = qt;
+        count++;
+    }
+
+    if (fp != stdin)
+        fclose(fp);
+    *queries = list;
+    return count;
+
+  oom:
+    fprintf(stderr, "Out of memory\n");
+    while (count > 0)
+        free((char *) list[--count].vw_name);
+    free(list);
+    if (fp != stdin)
+        fclose(fp);
+    return -1;
+}
+
+static void
+warm_progress(val_context_t *context, const val_warm_progress_t *p,
+              void *cb_data)
+{
+    fprintf(stderr, "%8.1f sec  %d/%d done (%.1f%%), %d failed, "
+            "%d in flight\n", p->vwp_elapsed, p->vwp_done, p->vwp_total,
+            p->vwp_total ? 100.0 * p->vwp_done / p->vwp_total : 100.0,
+            p->vwp_failed, p->vwp_in_flight);
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"concurrency", 1, 0, 'c'},
+    {"type", 1, 0, 'T'},
+    {"output", 1, 0, 'o'},
+    {"quiet", 0, 0, 'q'},
+    {"dnsval-conf", 1, 0, 'v'},
+    {"resolv-conf", 1, 0, 'r'},
+    {"root-hints", 1, 0, 'i'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    char           *dnsval_conf = NULL, *resolv_conf = NULL;
+    char           *root_conf = NULL, *output = NULL;
+    int             concurrency = WARM_DEFAULT_CONCURRENCY;
+    int             def_type = ns_t_a, quiet = 0;
+    val_context_t  *context = NULL;
+    val_warm_query_t *queries = NULL;
+    val_stats_t     before, after;
+    struct timeval  start, end;
+    unsigned long   status_count[256];
+    unsigned long   lookups, hits;
+    double          elapsed;
+    int             c, i, count, success, rc, failed = 0;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "hc:T:o:qv:r:i:", prog_options,
+                        &opt_index);
+#else
+        c = getopt(argc, argv, "hc:T:o:qv:r:i:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'c':
+            concurrency = atoi(optarg);
+            break;
+        case 'T':
+            def_type = res_nametotype(optarg, &success);
+            if (!success) {
+                fprintf(stderr, "unknown type %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'v':
+            dnsval_conf = optarg;
+            break;
+        case 'r':
+            resolv_conf = optarg;
+            break;
+        case 'i':
+            root_conf = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || concurrency < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((count = read_queries(argv[optind], def_type, &queries)) < 0)
+        return 1;
+
+    if (val_create_context_with_conf(NULL, dnsval_conf, resolv_conf,
+                                     root_conf, &context) != VAL_NO_ERROR) {
+        fprintf(stderr, "could not create the validator context\n");
+        return 1;
+    }
+
+    val_get_stats(&before, sizeof(before));
+    gettimeofday(&start, NULL);
+    rc = val_cache_warm(context, queries, count, concurrency, 0,
+                        quiet ? NULL : &warm_progress, NULL);
+    gettimeofday(&end, NULL);
+    val_get_stats(&after, sizeof(after));
+    elapsed = (end.tv_sec - start.tv_sec) +
+        (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    if (rc != VAL_NO_ERROR)
+        fprintf(stderr, "warm-up stopped: %s\n", p_val_err(rc));
+
+    memset(status_count, 0, sizeof(status_count));
+    for (i = 0; i < count; i++) {
+        if (queries[i].vw_retval != VAL_NO_ERROR) {
+            if (!quiet)
+                fprintf(stderr, "  %s %s %s: %s\n", queries[i].vw_name,
+                        p_class(queries[i].vw_class_h),
+                        p_sres_type(queries[i].vw_type_h),
+                        p_val_err(queries[i].vw_retval));
+            failed++;
+        } else
+            status_count[queries[i].vw_status]++;
+    }
+
+    fprintf(stderr, "%d queries warmed in %.3f sec (%.1f queries/sec), "
+            "%d failed\n", count - failed, elapsed,
+            elapsed > 0 ? count / elapsed : 0.0, failed);
+    hits = after.vs_cache_hits - before.vs_cache_hits;
+    lookups = hits + (after.vs_cache_misses - before.vs_cache_misses);
+    fprintf(stderr, "  %lu network queries, %lu of %lu lookups from cache, "
+            "%lu joined one in flight\n",
+            after.vs_net_queries - before.vs_net_queries, hits, lookups,
+            after.vs_coalesced_queries - before.vs_coalesced_queries);
+    fprintf(stderr, "  %lu signatures checked, %lu chains ended at a "
+            "trusted key set, %lu insecure walks avoided\n",
+            after.vs_sig_checks - before.vs_sig_checks,
+            after.vs_trust_cache_hits - before.vs_trust_cache_hits,
+            after.vs_insecure_cache_hits - before.vs_insecure_cache_hits);
+    for (i = 0; i < 256; i++)
+        if (status_count[i])
+            fprintf(stderr, "  %-30s %lu\n", p_val_status(i),
+                    status_count[i]);
+
+    if (output && rc == VAL_NO_ERROR) {
+        if ((rc = val_cache_save(output)) != VAL_NO_ERROR)
+            fprintf(stderr, "could not save the caches to %s: %s\n",
+                    output, p_val_err(rc));
+        else
+            fprintf(stderr, "caches saved to %s\n", output);
+    }
+
+    val_free_context(context);
+    for (i = 0; i < count; i++)
+        free((char *) queries[i].vw_name);
+    free(queries);
+    val_free_validator_state();
+
+    return (rc != VAL_NO_ERROR || failed) ? 1 : 0;
+}
@@ -0,0 +1,612 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Headless version of dnssec-check.  The same checks the graphical
+ * tool runs are run against a list of resolvers, all of them at once
+ * over one libsres select() loop with a cap on the number of queries
+ * in flight, and the result and time of every check are written out
+ * as JSON or CSV, one record per line, followed by a summary record
+ * for every resolver.
+ */
+
+#include <validator/validator-config.h>
+#include <validator/resolver.h>
+#include <validator/validator.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#include "dnssec_checks.h"
+
+#define AUDIT_PENDING   -3      /* set before the check's callback has run */
+#define AUDIT_TIMEOUT   -4      /* overall time limit reached */
+#define AUDIT_INVALID   -5      /* resolver address could not be parsed */
+
+#define AUDIT_DEFAULT_INFLIGHT  64
+#define AUDIT_DEFAULT_TIMEOUT   30
+
+typedef int (audit_check_fn) (char *ns_name, char *buf, size_t buf_len,
+                              int *testStatus);
+
+static const struct audit_check {
+    const char     *name;
+    audit_check_fn *fn;
+} audit_checks[] = {
+    {"basic_dns", check_basic_dns_async},
+    {"basic_tcp", check_basic_tcp_async},
+    {"do_bit", check_do_bit_async},
+    {"ad_bit", check_ad_bit_async},
+    {"do_has_rrsigs", check_do_has_rrsigs_async},
+    {"small_edns0", check_small_edns0_async},
+    {"can_get_nsec", check_can_get_nsec_async},
+    {"can_get_nsec3", check_can_get_nsec3_async},
+    {"can_get_dnskey", check_can_get_dnskey_async},
+    {"can_get_ds", check_can_get_ds_async},
+    {"can_get_signed_dname", check_can_get_signed_dname_async},
+};
+#define AUDIT_NUM_CHECKS (sizeof(audit_checks) / sizeof(audit_checks[0]))
+
+struct audit_job {
+    int             resolver;
+    int             check;
+    int             status;
+    int             reported;
+    struct timeval  start;
+    struct timeval  end;
+    char            msg[512];
+};
+
+static int      csv_output = 0;
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"help", 0, 0, 'h'},
+    {"file", 1, 0, 'f'},
+    {"inflight", 1, 0, 'c'},
+    {"tests", 1, 0, 't'},
+    {"timeout", 1, 0, 'T'},
+    {"csv", 0, 0, 'C'},
+    {"list", 0, 0, 'l'},
+    {"dnsval-conf", 1, 0, 'v'},
+    {"resolv-conf", 1, 0, 'r'},
+    {"root-hints", 1, 0, 'i'},
+    {0, 0, 0, 0}
+};
+#endif
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options] [resolver ...]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-f, --file=<file>      read the resolvers to check from <file>\n"
+            "\t                       (\"-\" for standard input)\n");
+    fprintf(stderr,
+            "\t-c, --inflight=<n>     at most <n> queries in flight (default %d)\n",
+            AUDIT_DEFAULT_INFLIGHT);
+    fprintf(stderr,
+            "\t-t, --tests=<list>     comma separated checks to run (default all)\n");
+    fprintf(stderr,
+            "\t-T, --timeout=<sec>    give up on the checks still running after\n"
+            "\t                       <sec> seconds (default %d)\n",
+            AUDIT_DEFAULT_TIMEOUT);
+    fprintf(stderr,
+            "\t-C, --csv              write CSV instead of JSON\n");
+    fprintf(stderr,
+            "\t-l, --list             list the checks and exit\n");
+    fprintf(stderr,
+            "\t-v, --dnsval-conf=<file> dnsval.conf to create the context with\n");
+    fprintf(stderr,
+            "\t-r, --resolv-conf=<file> resolv.conf to create the context with\n");
+    fprintf(stderr,
+            "\t-i, --root-hints=<file> root.hints to create the context with\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+    fprintf(stderr,
+            "Without -f or resolvers on the command line, the name servers\n"
+            "of the validator context are checked.\n");
+}
+
+static double
+elapsed_ms(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000.0 +
+        (to->tv_usec - from->tv_usec) / 1000.0;
+}
+
+static const char *
+status_name(int status)
+{
+    switch (status) {
+    case CHECK_SUCCEEDED:
+        return "ok";
+    case CHECK_WARNING:
+        return "warning";
+    case CHECK_FAILED:
+        return "failed";
+    case AUDIT_TIMEOUT:
+        return "timeout";
+    case AUDIT_INVALID:
+        return "invalid";
+    default:
+        return "critical";
+    }
+}
+
+static void
+print_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (csv_output) {
+            if (*s == '"')
+                putchar('"');
+            putchar(*s);
+        } else if (*s == '"' || *s == '\\') {
+            printf("\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            printf("\\u%04x", (unsigned char) *s);
+        } else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void
+print_record(const char *resolver, const char *check, int status,
+             double ms, const char *msg)
+{
+    if (csv_output) {
+        print_string(resolver);
+        printf(",%s,%s,%.3f,", check, status_name(status), ms);
+        print_string(msg);
+        putchar('\n');
+        return;
+    }
+    printf("{\"resolver\":");
+    print_string(resolver);
+    printf(",\"check\":\"%s\",\"status\":\"%s\",\"ms\":%.3f,\"message\":",
+           check, status_name(status), ms);
+    print_string(msg);
+    printf("}\n");
+}
+
+static void
+report_job(char **resolvers, struct audit_job *job)
+{
+    job->reported = 1;
+    print_record(resolvers[job->resolver], audit_checks[job->check].name,
+                 job->status, elapsed_ms(&job->start, &job->end), job->msg);
+}
+
+/*
+ * Add the resolvers listed in file, one per line.  Anything after a
+ * '#' or ';' is ignored, and so that a resolv.conf can be given as
+ * well, a leading "nameserver" is skipped and so are other lines of
+ * more than one word.
+ */
+static int
+read_resolvers(const char *file, char ***resolvers, int *count, int *alloc)
+{
+    FILE           *fp;
+    char            line[1024];
+
+    if (!strcmp(file, "-"))
+        fp = stdin;
+    else if ((fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char           *cp = line, *end;
+
+        cp[strcspn(cp, "#;\r\n")] = '\0';
+        while (isspace((unsigned char) *cp))
+            cp++;
+        if (!strncmp(cp, "nameserver", 10) &&
+            isspace((unsigned char) cp[10])) {
+            cp += 10;
+            while (isspace((unsigned char) *cp))
+                cp++;
+        }
+        for (end = cp; *end && !isspace((unsigned char) *end); end++);
+        if (*end) {
+            *end++ = '\0';
+            while (isspace((unsigned char) *end))
+                end++;
+            if (*end)
+                continue;
+        }
+        if (*cp == '\0')
+            continue;
+
+        if (*count == *alloc) {
+            char          **tmp;
+            *alloc = *alloc ? *alloc * 2 : 64;
+            tmp = (char **) realloc(*resolvers, *alloc * sizeof(char *));
+            if (tmp == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                break;
+            }
+            *resolvers = tmp;
+        }
+        (*resolvers)[(*count)++] = strdup(cp);
+    }
+
+    if (fp != stdin)
+        fclose(fp);
+    return 0;
+}
+
+/*
+ * Add the name servers of the default validator context, the same list
+ * the graphical tool starts with.
+ */
+static int
+context_resolvers(val_context_t *ctx, char ***resolvers, int *count)
+{
+    struct name_server *ns;
+    char            addr[INET6_ADDRSTRLEN];
+    char            buf[INET6_ADDRSTRLEN + 16];
+    int             n = 0;
+
+    for (ns = val_get_nameservers(ctx); ns; ns = ns->ns_next)
+        n++;
+    if (n == 0)
+        return 0;
+    *resolvers = (char **) malloc(n * sizeof(char *));
+    if (*resolvers == NULL)
+        return -1;
+
+    for (ns = val_get_nameservers(ctx); ns; ns = ns->ns_next) {
+        struct sockaddr_storage *ss = ns->ns_address[0];
+        int             port;
+
+        if (ss->ss_family == AF_INET) {
+            struct sockaddr_in *sa = (struct sockaddr_in *) ss;
+            inet_ntop(AF_INET, &sa->sin_addr, addr, sizeof(addr));
+            port = ntohs(sa->sin_port);
+        } else {
+            struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) ss;
+            inet_ntop(AF_INET6, &sa6->sin6_addr, addr, sizeof(addr));
+            port = ntohs(sa6->sin6_port);
+        }
+        if (port == 0 || port == NS_DEFAULTPORT)
+            snprintf(buf, sizeof(buf), "%s", addr);
+        else
+            snprintf(buf, sizeof(buf), "[%s]:%d", addr, port);
+        (*resolvers)[(*count)++] = strdup(buf);
+    }
+    return 0;
+}
+
+static int
+select_tests(char *list, int *selected)
+{
+    char           *name;
+    unsigned int    i;
+
+    memset(selected, 0, AUDIT_NUM_CHECKS * sizeof(int));
+    for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        for (i = 0; i < AUDIT_NUM_CHECKS; i++) {
+            if (!strcmp(name, audit_checks[i].name)) {
+                selected[i] = 1;
+                break;
+            }
+        }
+        if (i == AUDIT_NUM_CHECKS) {
+            fprintf(stderr, "Unknown check: %s\n", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+start_job(char **resolvers, struct audit_job *job)
+{
+    int             before = async_requests_remaining();
+
+    job->status = AUDIT_PENDING;
+    gettimeofday(&job->start, NULL);
+    (*audit_checks[job->check].fn) (resolvers[job->resolver], job->msg,
+                                    sizeof(job->msg), &job->status);
+    if (job->status == AUDIT_PENDING &&
+        async_requests_remaining() == before) {
+        job->status = CHECK_CRITICAL;
+        snprintf(job->msg, sizeof(job->msg),
+                 "Critical: the query could not be sent");
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    char          **resolvers = NULL;
+    int             nresolvers = 0, ralloc = 0;
+    int             selected[AUDIT_NUM_CHECKS];
+    int             inflight = AUDIT_DEFAULT_INFLIGHT;
+    int             timeout = AUDIT_DEFAULT_TIMEOUT;
+    char           *file = NULL, *tests = NULL;
+    char           *dnsval_conf = NULL, *resolv_conf = NULL;
+    char           *root_conf = NULL;
+    struct audit_job *jobs;
+    int             njobs, next = 0, oldest = 0, done = 0, bad = 0;
+    struct timeval  start, now, deadline, next_evt;
+    unsigned int    i;
+    int             c, r, j;
+
+    for (i = 0; i < AUDIT_NUM_CHECKS; i++)
+        selected[i] = 1;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "hf:c:t:T:Clv:r:i:", prog_options,
+                        &opt_index);
+#else
+        c = getopt(argc, argv, "hf:c:t:T:Clv:r:i:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'f':
+            file = optarg;
+            break;
+        case 'c':
+            inflight = atoi(optarg);
+            break;
+        case 't':
+            tests = optarg;
+            break;
+        case 'T':
+            timeout = atoi(optarg);
+            break;
+        case 'C':
+            csv_output = 1;
+            break;
+        case 'l':
+            for (i = 0; i < AUDIT_NUM_CHECKS; i++)
+                printf("%s\n", audit_checks[i].name);
+            return 0;
+        case 'v':
+            dnsval_conf = optarg;
+            break;
+        case 'r':
+            resolv_conf = optarg;
+            break;
+        case 'i':
+            root_conf = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (inflight < 1 || timeout < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (inflight > ASYNC_MAX_OUTSTANDING)
+        inflight = ASYNC_MAX_OUTSTANDING;
+    if (tests && select_tests(tests, selected) < 0)
+        return 1;
+
+    if (file && read_resolvers(file, &resolvers, &nresolvers, &ralloc) < 0)
+        return 1;
+    for (; optind < argc; optind++) {
+        if (nresolvers == ralloc) {
+            ralloc = ralloc ? ralloc * 2 : 64;
+            resolvers = (char **) realloc(resolvers, ralloc * sizeof(char *));
+            if (resolvers == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+        resolvers[nresolvers++] = strdup(argv[optind]);
+    }
+    if (nresolvers == 0) {
+        val_context_t  *ctx = NULL;
+
+        if (val_create_context_with_conf(NULL, dnsval_conf, resolv_conf,
+                                         root_conf, &ctx) != VAL_NO_ERROR
+            || context_resolvers(ctx, &resolvers, &nresolvers) < 0) {
+            fprintf(stderr, "Could not get the name servers to check\n");
+            return 1;
+        }
+        val_free_context(ctx);
+    }
+    if (nresolvers == 0) {
+        fprintf(stderr, "No resolvers to check\n");
+        return 1;
+    }
+
+    /*
+     * Interleave the resolvers, so that the in-flight cap is shared
+     * between all of them rather than spent on one resolver at a time.
+     */
+    jobs = (struct audit_job *) calloc(nresolvers * AUDIT_NUM_CHECKS,
+                                       sizeof(struct audit_job));
+    if (jobs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    njobs = 0;
+    for (i = 0; i < AUDIT_NUM_CHECKS; i++) {
+        if (!selected[i])
+            continue;
+        for (r = 0; r < nresolvers; r++) {
+            jobs[njobs].resolver = r;
+            jobs[njobs].check = i;
+            jobs[njobs].status = AUDIT_PENDING;
+            njobs++;
+        }
+    }
+
+    /* a resolver closing a TCP connection must not end the audit */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (csv_output)
+        printf("resolver,check,status,ms,message\n");
+
+    gettimeofday(&start, NULL);
+    for (r = 0; r < nresolvers; r++) {
+        struct name_server *ns = parse_name_server(resolvers[r], NULL, 0);
+        if (ns != NULL) {
+            free_name_server(&ns);
+            continue;
+        }
+        for (j = 0; j < njobs; j++) {
+            if (jobs[j].resolver != r)
+                continue;
+            jobs[j].status = AUDIT_INVALID;
+            jobs[j].start = jobs[j].end = start;
+            snprintf(jobs[j].msg, sizeof(jobs[j].msg),
+                     "Error: could not parse the resolver address");
+        }
+    }
+
+    deadline = start;
+    deadline.tv_sec += timeout;
+    next_evt = deadline;
+
+    while (done < njobs) {
+        fd_set          fds, tcp_fds;
+        int             nfds = 0, ntcp_fds = 0, fd;
+        struct timeval  wake, tv;
+
+        /* start as many checks as the cap allows */
+        while (next < njobs && async_requests_remaining() < inflight) {
+            if (jobs[next].status != AUDIT_INVALID)
+                start_job(resolvers, &jobs[next]);
+            next++;
+        }
+
+        FD_ZERO(&fds);
+        FD_ZERO(&tcp_fds);
+        collect_async_query_select_info(&fds, &nfds, &tcp_fds, &ntcp_fds);
+        for (fd = 0; fd < ntcp_fds; fd++)
+            if (FD_ISSET(fd, &tcp_fds))
+                FD_SET(fd, &fds);
+        if (ntcp_fds > nfds)
+            nfds = ntcp_fds;
+
+        /*
+         * Sleep until an answer arrives or the next retry or timeout of
+         * a query is due; queries started since the last pass have not
+         * been looked at yet, but none of them is due within a second.
+         */
+        gettimeofday(&now, NULL);
+        wake = now;
+        wake.tv_sec++;
+        if (timercmp(&next_evt, &wake, <))
+            wake = next_evt;
+        timersub(&wake, &now, &tv);
+        if (tv.tv_sec < 0 || async_requests_remaining() == 0)
+            tv.tv_sec = tv.tv_usec = 0;
+        if (select(nfds, &fds, NULL, NULL, &tv) < 0) {
+            if (errno != EINTR) {
+                perror("select");
+                break;
+            }
+            FD_ZERO(&fds);
+        }
+
+        next_evt = deadline;
+        check_outstanding_async_ready(&fds, &next_evt);
+
+        /* report the checks that have finished, in the order they did */
+        gettimeofday(&now, NULL);
+        for (j = oldest; j < next; j++) {
+            if (jobs[j].reported || jobs[j].status == AUDIT_PENDING)
+                continue;
+            if (jobs[j].status != AUDIT_INVALID)
+                jobs[j].end = now;
+            report_job(resolvers, &jobs[j]);
+            done++;
+        }
+        while (oldest < next && jobs[oldest].reported)
+            oldest++;
+
+        if (!timercmp(&now, &deadline, <)) {
+            async_cancel_outstanding();
+            for (j = oldest; j < njobs; j++) {
+                if (jobs[j].reported)
+                    continue;
+                if (j >= next)
+                    jobs[j].start = now;
+                jobs[j].end = now;
+                jobs[j].status = AUDIT_TIMEOUT;
+                snprintf(jobs[j].msg, sizeof(jobs[j].msg),
+                         "Error: no answer within %d seconds", timeout);
+                report_job(resolvers, &jobs[j]);
+                done++;
+            }
+        }
+    }
+
+    /* one summary record per resolver */
+    for (r = 0; r < nresolvers; r++) {
+        int             passed = 0, warned = 0, failed = 0;
+        int             worst = CHECK_SUCCEEDED;
+        struct timeval *first = NULL, *last = NULL;
+        char            msg[128];
+
+        for (j = 0; j < njobs; j++) {
+            if (jobs[j].resolver != r)
+                continue;
+            if (first == NULL || timercmp(&jobs[j].start, first, <))
+                first = &jobs[j].start;
+            if (last == NULL || timercmp(&jobs[j].end, last, >))
+                last = &jobs[j].end;
+            if (jobs[j].status == CHECK_SUCCEEDED)
+                passed++;
+            else if (jobs[j].status == CHECK_WARNING) {
+                warned++;
+                if (worst == CHECK_SUCCEEDED)
+                    worst = CHECK_WARNING;
+            } else {
+                failed++;
+                if (worst != AUDIT_INVALID)
+                    worst = jobs[j].status == AUDIT_INVALID ?
+                        AUDIT_INVALID : CHECK_FAILED;
+            }
+        }
+        if (failed)
+            bad = 1;
+        snprintf(msg, sizeof(msg), "%d passed, %d warnings, %d failed",
+                 passed, warned, failed);
+        print_record(resolvers[r], "all", worst,
+                     first ? elapsed_ms(first, last) : 0.0, msg);
+    }
+
+    gettimeofday(&now, NULL);
+    fprintf(stderr, "%d checks of %d resolvers in %.3f ms "
+            "(at most %d queries in flight)\n",
+            njobs, nresolvers, elapsed_ms(&start, &now), inflight);
+
+    for (r = 0; r < nresolvers; r++)
+        free(resolvers[r]);
+    free(resolvers);
+    free(jobs);
+    return bad;
+}
@@ -11,9 +11,13 @@
 #define CHECK_FAILED    1
 #define CHECK_WARNING   2
 
+/* the most async queries that can be outstanding at once */
+#define ASYNC_MAX_OUTSTANDING 1024
+
 int async_requests_remaining();
 void async_cancel_outstanding();
 void check_outstanding_async();
+void check_outstanding_async_ready(fd_set *ready, struct timeval *next_evt);
 void check_queued_sends();
 void collect_async_query_select_info(fd_set *fds, int *numfds, fd_set *tcp_fds, int *numUdpFds);
 
@@ -8,6 +8,7 @@
  */
 #include "validator/validator-config.h"
 #include <validator/validator.h>
+#include "lookup_batch.h"
 
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
@@ -24,6 +25,8 @@ static struct option prog_options[] = {
     {"canonname", 0, 0, 'c'},
     {"nodnssec", 0, 0, 'n'},
     {"service", 0, 0, 's'},
+    {"batch", 1, 0, 'b'},
+    {"window", 1, 0, 'w'},
     {"Version", 0, 0, 'V'},
 #ifndef VAL_NO_ASYNC
     {"async", 0, 0, 'a'},
@@ -36,8 +39,9 @@ void
 usage(char *progname)
 {
     fprintf(stderr,
-            "Usage: %s [options] <hostname|IPv4 address|IPv6 address>\n",
-            progname);
+            "Usage: %s [options] <hostname|IPv4 address|IPv6 address>\n"
+            "       %s [options] -b <file>\n",
+            progname, progname);
     fprintf(stderr, "Options:\n");
     fprintf(stderr,
             "\t-h, --help                      display usage and exit\n");
@@ -47,6 +51,12 @@ usage(char *progname)
             "\t-n, --nodnssec                  no DNSSEC validation\n");
     fprintf(stderr,
             "\t-s, --service=<PORT|SERVICE>    transport-layer port or service name\n");
+    fprintf(stderr,
+            "\t-b, --batch=<file>              look up the A and AAAA records of every\n"
+            "\t                                name in <file> (\"-\" for stdin)\n"
+            "\t-w, --window=<n>                with -b, keep <n> queries in flight\n"
+            "\t                                (default %d)\n",
+            LOOKUP_BATCH_WINDOW);
     fprintf(stderr,
             "\t-o, --output=<debug-level>:<dest-type>[:<dest-options>]\n"
             "\t          <debug-level> is 1-7, corresponding to syslog levels\n"
@@ -185,7 +195,7 @@ main(int argc, char *argv[])
 #ifndef VAL_NO_ASYNC
         "a"
 #endif
-        "hco:s:Vv:r:i:n";
+        "hco:s:b:w:Vv:r:i:n";
     char           *node = NULL;
     char           *service = NULL;
     struct addrinfo hints;
@@ -194,6 +204,8 @@ main(int argc, char *argv[])
     int             getcanonname = 0;
     int             async = 0;
     int             nodnssec_flag = 0;
+    char           *batch = NULL;
+    int             window = LOOKUP_BATCH_WINDOW;
     val_log_t      *logp;
     val_status_t val_status;
 
@@ -235,6 +247,14 @@ main(int argc, char *argv[])
             getcanonname = 1;
             break;
 
+        case 'b':
+            batch = optarg;
+            break;
+
+        case 'w':
+            window = atoi(optarg);
+            break;
+
 #ifndef VAL_NO_ASYNC
         case 'a':
             async = 1;
@@ -267,6 +287,14 @@ main(int argc, char *argv[])
         }
     }
 
+    if (batch) {
+        int             types[2] = { ns_t_a, ns_t_aaaa };
+
+        return lookup_batch(batch, types, 2,
+                            nodnssec_flag ? VAL_QUERY_DONT_VALIDATE : 0,
+                            window) ? -1 : 0;
+    }
+
     if (optind < argc) {
         node = argv[optind++];
     } else {
@@ -9,6 +9,7 @@
 
 #include "validator/validator-config.h"
 #include <validator/validator.h>
+#include "lookup_batch.h"
 
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
@@ -25,6 +26,8 @@ static struct option prog_options[] = {
     {"family", 0, 0, 'f'},
     {"reentrant", 0, 0, 'r'},
     {"output", 0, 0, 'o'},
+    {"batch", 1, 0, 'b'},
+    {"window", 1, 0, 'w'},
     {"Version", 0, 0, 'V'},
     {0, 0, 0, 0}
 };
@@ -37,12 +40,17 @@ usage(char *progname)
 {
     /* *INDENT-OFF* */
     fprintf(stderr, "Usage: %s [options] name\n", progname);
+    fprintf(stderr, "       %s [options] -b <file>\n", progname);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "\t-h, --help                      display usage and exit\n");
     fprintf(stderr, "\t-r, --reentrant                 use reentrant versions of functions\n");
     fprintf(stderr, "\t-f, --family=[AF_INET|AF_INET6] address family\n");
     fprintf(stderr, "\t                                AF_INET for IPv4 addresses,\n");
     fprintf(stderr, "\t                                and AF_INET6 for IPv6 addresses\n");
+    fprintf(stderr, "\t-b, --batch=<file>              look up every name in <file>\n");
+    fprintf(stderr, "\t                                (\"-\" for stdin)\n");
+    fprintf(stderr, "\t-w, --window=<n>                with -b, keep <n> queries in flight\n");
+    fprintf(stderr, "\t                                (default %d)\n", LOOKUP_BATCH_WINDOW);
     fprintf(stderr,
             "\t-o, --output=<debug-level>:<dest-type>[:<dest-options>]\n"
             "\t          <debug-level> is 1-7, corresponding to syslog levels\n"
@@ -78,6 +86,8 @@ main(int argc, char *argv[])
     int             af = AF_INET;
     char            buf[INET6_ADDRSTRLEN];
     size_t          buflen = INET6_ADDRSTRLEN;
+    char           *batch = NULL;
+    int             window = LOOKUP_BATCH_WINDOW;
     val_log_t  *logp;
 
     memset(&hentry, 0, sizeof(struct hostent));
@@ -90,13 +100,13 @@ main(int argc, char *argv[])
 #ifdef HAVE_GETOPT_LONG
         int             opt_index = 0;
 #ifdef HAVE_GETOPT_LONG_ONLY
-        c = getopt_long_only(argc, argv, "hrf:o:V",
+        c = getopt_long_only(argc, argv, "hrf:o:b:w:V",
                              prog_options, &opt_index);
 #else
-        c = getopt_long(argc, argv, "hrf:o:V", prog_options, &opt_index);
+        c = getopt_long(argc, argv, "hrf:o:b:w:V", prog_options, &opt_index);
 #endif
 #else                           /* only have getopt */
-        c = getopt(argc, argv, "hrf:o:V");
+        c = getopt(argc, argv, "hrf:o:b:w:V");
 #endif
 
         if (c == -1) {
@@ -109,9 +119,9 @@ main(int argc, char *argv[])
             return -1;
         case 'f':
             familyspecified = 1;
-            if (strncasecmp(optarg, "AF_INET", strlen("AF_INET")) == 0) {
+            if (strcasecmp(optarg, "AF_INET") == 0) {
                 af = AF_INET;
-            } else if (strncasecmp(optarg, "AF_INET6", strlen("AF_INET6")) == 0) {
+            } else if (strcasecmp(optarg, "AF_INET6") == 0) {
                 af = AF_INET6;
             } else {
                 fprintf(stderr, "Invalid family %s\n", optarg);
@@ -122,6 +132,12 @@ main(int argc, char *argv[])
         case 'r':
             usereentrant = 1;
             break;
+        case 'b':
+            batch = optarg;
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
         case 'o':
             logp = val_log_add_optarg(optarg, 1);
             if (NULL == logp) { /* err msg already logged */
@@ -141,6 +157,12 @@ main(int argc, char *argv[])
     }
 
 
+    if (batch) {
+        int             type = (af == AF_INET6) ? ns_t_aaaa : ns_t_a;
+
+        return lookup_batch(batch, &type, 1, 0, window) ? -1 : 0;
+    }
+
     if (optind < argc) {
         name = argv[optind++];
     } else {
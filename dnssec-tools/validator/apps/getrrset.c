@@ -8,6 +8,7 @@
 #include "validator/validator-config.h"
 #include <validator/validator.h>
 #include <validator/resolver.h>
+#include "lookup_batch.h"
 
 #ifdef HAVE_GETOPT_H
 #include <getopt.h>
@@ -23,6 +24,11 @@ static struct option prog_options[] = {
     {"help", 0, 0, 'h'},
     {"type", 0, 0, 't'},
     {"output", 0, 0, 'o'},
+    {"batch", 1, 0, 'b'},
+    {"window", 1, 0, 'w'},
+    {"dnsval-conf", 1, 0, 'v'},
+    {"resolv-conf", 1, 0, 'r'},
+    {"root-hints", 1, 0, 'i'},
     {"Version", 0, 0, 'V'},
     {0, 0, 0, 0}
 };
@@ -32,13 +38,22 @@ void
 usage(char *progname)
 {
     fprintf(stderr,
-            "Usage: %s [options] hostname\n",
-            progname);
+            "Usage: %s [options] hostname\n"
+            "       %s [options] -b <file>\n",
+            progname, progname);
     fprintf(stderr, "Options:\n");
     fprintf(stderr,
             "\t-h, --help          display usage and exit\n");
     fprintf(stderr,
             "\t-t, --type=<type>   record type. Defaults to A record.\n");
+    fprintf(stderr,
+            "\t-b, --batch=<file>  look up every name in <file> (\"-\" for stdin)\n"
+            "\t-w, --window=<n>    with -b, keep <n> queries in flight (default %d)\n",
+            LOOKUP_BATCH_WINDOW);
+    fprintf(stderr,
+            "\t-v, --dnsval-conf=<file> use <file> as dnsval.conf\n"
+            "\t-r, --resolv-conf=<file> use <file> as resolv.conf\n"
+            "\t-i, --root-hints=<file>  use <file> as root.hints\n");
     fprintf(stderr,
             "\t-o, --output=<debug-level>:<dest-type>[:<dest-options>]\n"
             "\t          <debug-level> is 1-7, corresponding to syslog levels\n"
@@ -123,19 +138,21 @@ main(int argc, char *argv[])
     int      type_h = ns_t_a;
     struct val_answer_chain *results = NULL;
     int success = 0;
+    char           *batch = NULL;
+    int             window = LOOKUP_BATCH_WINDOW;
 
     while (1) {
         int             c;
 #ifdef HAVE_GETOPT_LONG
         int             opt_index = 0;
 #ifdef HAVE_GETOPT_LONG_ONLY
-        c = getopt_long_only(argc, argv, "ho:t:V",
+        c = getopt_long_only(argc, argv, "ho:t:b:w:v:r:i:V",
                              prog_options, &opt_index);
 #else
-        c = getopt_long(argc, argv, "ho:t:V", prog_options, &opt_index);
+        c = getopt_long(argc, argv, "ho:t:b:w:v:r:i:V", prog_options, &opt_index);
 #endif
 #else                           /* only have getopt */
-        c = getopt(argc, argv, "ho:t:V");
+        c = getopt(argc, argv, "ho:t:b:w:v:r:i:V");
 #endif
 
         if (c == -1) {
@@ -162,6 +179,21 @@ main(int argc, char *argv[])
                 return -1;
             }
             break;
+        case 'b':
+            batch = optarg;
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'v':
+            dnsval_conf_set(optarg);
+            break;
+        case 'r':
+            resolv_conf_set(optarg);
+            break;
+        case 'i':
+            root_hints_set(optarg);
+            break;
         case 'V':
             version();
             return 0;
@@ -173,6 +205,9 @@ main(int argc, char *argv[])
         }
     }
 
+    if (batch)
+        return lookup_batch(batch, &type_h, 1, 0, window) ? -1 : 0;
+
     if (optind < argc) {
         node = argv[optind++];
     } else {
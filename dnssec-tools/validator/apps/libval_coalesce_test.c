@@ -0,0 +1,482 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Thundering herd benchmark for libval.  A number of threads, each with
+ * a validator context of its own (or all sharing one with -c), look up
+ * the same name at the same moment, as happens when a popular name
+ * expires from many caches at once.  Every burst uses a name that has
+ * not been asked for before, built from a template such as
+ * "b%d.wild.example.com".
+ *
+ * For each burst the number of queries sent to name servers and the
+ * number of queries that joined an identical one already in flight are
+ * reported, along with the time the burst took.  Every thread must get
+ * the same validation status.
+ *
+ * Unless a resolv.conf is given with -r, the lookups go to a server
+ * inside the test that answers from a built-in zone on the loopback
+ * interface, so no network is needed.  The server holds every answer
+ * back for a moment, so that the queries of a burst are in flight
+ * together; each burst must then finish well before the resolver would
+ * retry, and some lookups must have joined a query already in flight.
+ */
+
+#include "validator-internal.h"
+#include <validator/val_zone.h>
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define COALESCE_TEST_NAME      "b%d.wild.example.com"
+#define COALESCE_MAX_THREADS    256
+
+/* how long the built-in server holds back every answer */
+#define LOCAL_DELAY_USEC        50000
+/* a burst that takes longer waited for a retry timer */
+#define LOCAL_BURST_MSEC        2000
+
+static const char *local_zone =
+    "$ORIGIN example.com.\n"
+    "$TTL 1h\n"
+    "@ IN SOA ns admin 1 1800 900 604800 300\n"
+    "  IN NS ns\n"
+    "ns A 127.0.0.1\n"
+    "*.wild A 192.0.2.1\n"
+    "*.wild AAAA 2001:db8::1\n";
+
+static int      failures = 0;
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-t, --threads=<n>      number of threads (default 16)\n");
+    fprintf(stderr,
+            "\t-b, --bursts=<n>       number of bursts (default 10)\n");
+    fprintf(stderr,
+            "\t-n, --name=<template>  name to look up, %%d is replaced by\n"
+            "\t                       the burst number (default %s)\n",
+            COALESCE_TEST_NAME);
+    fprintf(stderr,
+            "\t-T, --type=<type>      type to look up (default A)\n");
+    fprintf(stderr,
+            "\t-c, --shared-context   all threads use the same context\n");
+    fprintf(stderr,
+            "\t-v, --dnsval-conf=<file> dnsval.conf to create contexts with\n");
+    fprintf(stderr,
+            "\t-r, --resolv-conf=<file> resolv.conf to create contexts with\n"
+            "\t                       (default: answer from a built-in zone)\n");
+    fprintf(stderr,
+            "\t-i, --root-hints=<file> root.hints to create contexts with\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+}
+
+static void
+check(const char *what, int ok)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+#ifndef VAL_NO_THREADS
+
+struct herd_thread {
+    pthread_t       tid;
+    val_context_t  *context;
+    val_status_t    status;
+    int             ret;
+};
+
+static pthread_barrier_t start_line, finish_line;
+static char     burst_name[NS_MAXDNAME];
+static int      burst_type = ns_t_a;
+static int      nbursts = 10;
+
+/*
+ * The built-in server, and the directory with the zone and the
+ * configuration files that point the contexts at it
+ */
+static struct val_zone *local_zones = NULL;
+static int      local_sock = -1;
+static volatile int local_stop = 0;
+static pthread_t local_tid;
+static char     local_dir[] = "/tmp/coalesceXXXXXX";
+static char     local_zone_file[sizeof(local_dir) + 16];
+static char     local_resolv[sizeof(local_dir) + 16];
+static char     local_dnsval[sizeof(local_dir) + 16];
+static char     local_hints[sizeof(local_dir) + 16];
+
+static void    *
+local_server(void *arg)
+{
+    static u_char   query[65536], resp[65536];
+    struct sockaddr_storage from;
+    socklen_t       fromlen;
+    struct timeval  tv;
+    fd_set          rfds;
+    ssize_t         qlen;
+    int             n;
+
+    while (!local_stop) {
+        FD_ZERO(&rfds);
+        FD_SET(local_sock, &rfds);
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (select(local_sock + 1, &rfds, NULL, NULL, &tv) <= 0)
+            continue;
+
+        fromlen = sizeof(from);
+        qlen = recvfrom(local_sock, query, sizeof(query), 0,
+                        (struct sockaddr *) &from, &fromlen);
+        if (qlen <= 0)
+            continue;
+        n = val_zone_respond(local_zones, query, qlen, resp, sizeof(resp),
+                             0, 0);
+        if (n <= 0)
+            continue;
+        usleep(LOCAL_DELAY_USEC);
+        sendto(local_sock, resp, n, 0, (struct sockaddr *) &from, fromlen);
+    }
+    return NULL;
+}
+
+static int
+write_file(const char *file, const char *text)
+{
+    FILE           *fp;
+    int             ok;
+
+    if (NULL == (fp = fopen(file, "w")))
+        return -1;
+    ok = (fputs(text, fp) >= 0);
+    if (fclose(fp) != 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+static void
+local_cleanup(void)
+{
+    unlink(local_zone_file);
+    unlink(local_resolv);
+    unlink(local_dnsval);
+    unlink(local_hints);
+    rmdir(local_dir);
+}
+
+/*
+ * Start the built-in server on a free port of the loopback interface,
+ * and write the configuration files for it.
+ */
+static int
+local_start(void)
+{
+    struct sockaddr_in sa;
+    socklen_t       salen = sizeof(sa);
+    char            conf[64];
+
+    if (NULL == mkdtemp(local_dir)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    atexit(local_cleanup);
+    snprintf(local_zone_file, sizeof(local_zone_file), "%s/example.zone",
+             local_dir);
+    snprintf(local_resolv, sizeof(local_resolv), "%s/resolv.conf",
+             local_dir);
+    snprintf(local_dnsval, sizeof(local_dnsval), "%s/dnsval.conf",
+             local_dir);
+    snprintf(local_hints, sizeof(local_hints), "%s/root.hints", local_dir);
+
+    if (write_file(local_zone_file, local_zone) < 0 ||
+        val_zone_load(local_zone_file, &local_zones) < 0) {
+        fprintf(stderr, "could not load the built-in zone\n");
+        goto err;
+    }
+
+    local_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (local_sock < 0) {
+        perror("socket");
+        goto err;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(local_sock, (struct sockaddr *) &sa, sizeof(sa)) < 0 ||
+        getsockname(local_sock, (struct sockaddr *) &sa, &salen) < 0) {
+        perror("bind");
+        goto err;
+    }
+
+    snprintf(conf, sizeof(conf), "nameserver [127.0.0.1]:%d\n",
+             ntohs(sa.sin_port));
+    if (write_file(local_resolv, conf) < 0 ||
+        write_file(local_dnsval, ": trust-anchor\n;\n"
+                   ": zone-security-expectation\n. ignore\n;\n") < 0 ||
+        write_file(local_hints, "") < 0) {
+        fprintf(stderr, "could not write the configuration files\n");
+        goto err;
+    }
+
+    if (pthread_create(&local_tid, NULL, local_server, NULL) != 0) {
+        fprintf(stderr, "could not start the built-in server\n");
+        goto err;
+    }
+    printf("answering from a built-in zone on 127.0.0.1:%d\n",
+           ntohs(sa.sin_port));
+    return 0;
+
+  err:
+    if (local_sock >= 0)
+        close(local_sock);
+    local_sock = -1;
+    if (local_zones)
+        val_zone_free(local_zones);
+    local_zones = NULL;
+    return -1;
+}
+
+static void
+local_shutdown(void)
+{
+    local_stop = 1;
+    pthread_join(local_tid, NULL);
+    close(local_sock);
+    val_zone_free(local_zones);
+}
+
+static void    *
+herd_member(void *arg)
+{
+    struct herd_thread *t = (struct herd_thread *) arg;
+    struct val_result_chain *results;
+    int             i;
+
+    for (i = 0; i < nbursts; i++) {
+        pthread_barrier_wait(&start_line);
+
+        results = NULL;
+        t->ret = val_resolve_and_check(t->context, burst_name, ns_c_in,
+                                       burst_type, 0, &results);
+        t->status = results ? results->val_rc_status : VAL_DNS_ERROR;
+        val_free_result_chain(results);
+
+        pthread_barrier_wait(&finish_line);
+    }
+    return NULL;
+}
+
+#endif /* VAL_NO_THREADS */
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"threads", 1, 0, 't'},
+    {"bursts", 1, 0, 'b'},
+    {"name", 1, 0, 'n'},
+    {"type", 1, 0, 'T'},
+    {"shared-context", 0, 0, 'c'},
+    {"dnsval-conf", 1, 0, 'v'},
+    {"resolv-conf", 1, 0, 'r'},
+    {"root-hints", 1, 0, 'i'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int             nthreads = 16, shared = 0;
+    char           *name = COALESCE_TEST_NAME;
+    char           *dnsval_conf = NULL, *resolv_conf = NULL;
+    char           *root_conf = NULL;
+    int             c, success;
+#ifndef VAL_NO_THREADS
+    struct herd_thread *threads;
+    val_context_t  *context = NULL;
+    val_stats_t     before, after;
+    unsigned long   sent, joined, total_sent = 0, total_joined = 0;
+    struct timeval  start, end;
+    double          ms;
+    int             i, b, same, local;
+    char            label[32];
+#endif
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "ht:b:n:T:cv:r:i:", prog_options,
+                        &opt_index);
+#else
+        c = getopt(argc, argv, "ht:b:n:T:cv:r:i:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'b':
+#ifndef VAL_NO_THREADS
+            nbursts = atoi(optarg);
+#endif
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'T':
+#ifndef VAL_NO_THREADS
+            burst_type = res_nametotype(optarg, &success);
+            if (!success) {
+                fprintf(stderr, "unknown type %s\n", optarg);
+                return 1;
+            }
+#endif
+            break;
+        case 'c':
+            shared = 1;
+            break;
+        case 'v':
+            dnsval_conf = optarg;
+            break;
+        case 'r':
+            resolv_conf = optarg;
+            break;
+        case 'i':
+            root_conf = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+#ifdef VAL_NO_THREADS
+    fprintf(stderr, "libval was built without thread support\n");
+    return 1;
+#else
+    if (nthreads < 1 || nthreads > COALESCE_MAX_THREADS || nbursts < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    local = (resolv_conf == NULL);
+    if (local) {
+        if (local_start() < 0)
+            return 1;
+        resolv_conf = local_resolv;
+        if (dnsval_conf == NULL)
+            dnsval_conf = local_dnsval;
+        if (root_conf == NULL)
+            root_conf = local_hints;
+    }
+
+    threads = (struct herd_thread *)
+        calloc(nthreads, sizeof(struct herd_thread));
+    if (threads == NULL)
+        return 1;
+    for (i = 0; i < nthreads; i++) {
+        if (shared && context) {
+            threads[i].context = context;
+            continue;
+        }
+        /*
+         * Contexts created without a label are all the same default
+         * context, so give each thread a label of its own
+         */
+        snprintf(label, sizeof(label), "herd-%d", i);
+        if (val_create_context_with_conf(shared ? NULL : label,
+                                         dnsval_conf, resolv_conf,
+                                         root_conf, &threads[i].context)
+            != VAL_NO_ERROR) {
+            fprintf(stderr, "could not create the validator context\n");
+            return 1;
+        }
+        context = threads[i].context;
+    }
+
+    printf("%d threads, %s, looking up %s %s\n", nthreads,
+           shared ? "one shared context" : "one context each", name,
+           p_type(burst_type));
+
+    pthread_barrier_init(&start_line, NULL, nthreads + 1);
+    pthread_barrier_init(&finish_line, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i].tid, NULL, herd_member,
+                           &threads[i]) != 0) {
+            fprintf(stderr, "could not start thread %d\n", i);
+            return 1;
+        }
+    }
+
+    for (b = 0; b < nbursts; b++) {
+        snprintf(burst_name, sizeof(burst_name), name, b);
+        val_get_stats(&before, sizeof(before));
+        gettimeofday(&start, NULL);
+
+        pthread_barrier_wait(&start_line);
+        pthread_barrier_wait(&finish_line);
+
+        gettimeofday(&end, NULL);
+        val_get_stats(&after, sizeof(after));
+        sent = after.vs_net_queries - before.vs_net_queries;
+        joined = after.vs_coalesced_queries - before.vs_coalesced_queries;
+        total_sent += sent;
+        total_joined += joined;
+        ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+            (end.tv_usec - start.tv_usec) / 1000.0;
+
+        same = 1;
+        for (i = 0; i < nthreads; i++) {
+            if (threads[i].ret != VAL_NO_ERROR ||
+                threads[i].status != threads[0].status)
+                same = 0;
+        }
+        printf("%-32s %4lu queries sent %4lu joined %9.3f ms  %s\n",
+               burst_name, sent, joined, ms,
+               p_val_status(threads[0].status));
+        check("every thread gets the same answer", same);
+        if (local)
+            check("the burst does not wait for a retry",
+                  ms < LOCAL_BURST_MSEC);
+    }
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i].tid, NULL);
+    pthread_barrier_destroy(&start_line);
+    pthread_barrier_destroy(&finish_line);
+
+    printf("%.1f queries sent and %.1f joined per burst of %d lookups\n",
+           (double) total_sent / nbursts, (double) total_joined / nbursts,
+           nthreads);
+    if (local && !shared && nthreads > 1)
+        check("lookups join queries in flight", total_joined > 0);
+
+    for (i = 0; i < nthreads; i++) {
+        if (!shared || i == 0)
+            val_free_context(threads[i].context);
+    }
+    free(threads);
+    if (local)
+        local_shutdown();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+#endif
+}
@@ -0,0 +1,410 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * DANE matching benchmark and check for libval.  A self-signed server
+ * certificate is generated along with a TLSA RRset for it: a number of
+ * records that do not match the certificate, of every selector and
+ * matching type, followed by one that does.  TLS handshakes are then
+ * run in memory between a server using the certificate and a client
+ * whose SSL_CTX has been set up with val_enable_dane_ssl(), so that
+ * every handshake goes through the library's certificate check.
+ *
+ * The handshakes are checked to succeed against the good RRset and to
+ * fail once the matching record is removed, and then timed with and
+ * without the library's cache of match results.
+ */
+
+#include "validator-internal.h"
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <validator/val_dane.h>
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define DANE_TEST_NAME  "www.example.com"
+#define DANE_TEST_TTL   3600
+
+static int      failures = 0;
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-n, --iterations=<n>   run <n> handshakes (default 500)\n");
+    fprintf(stderr,
+            "\t-t, --tlsa=<n>         number of TLSA records that do not\n"
+            "\t                       match (default 12)\n");
+    fprintf(stderr,
+            "\t-s, --seed=<n>         random seed for the TLSA records\n");
+    fprintf(stderr,
+            "\t-v, --dnsval-conf=<file> dnsval.conf to create the context with\n");
+    fprintf(stderr,
+            "\t-r, --resolv-conf=<file> resolv.conf to create the context with\n");
+    fprintf(stderr,
+            "\t-i, --root-hints=<file> root.hints to create the context with\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+}
+
+/*
+ * A self-signed certificate for the test name, with a P-256 key so
+ * that the handshake itself is cheap next to the DANE checks
+ */
+static int
+make_cert(EVP_PKEY ** pkey, X509 ** cert)
+{
+    EVP_PKEY_CTX   *pctx;
+    X509_NAME      *name;
+    int             ret = -1;
+
+    *pkey = NULL;
+    *cert = NULL;
+    if ((pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL)) == NULL)
+        return -1;
+    if (EVP_PKEY_keygen_init(pctx) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx,
+                                               NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(pctx, pkey) <= 0)
+        goto done;
+    if ((*cert = X509_new()) == NULL)
+        goto done;
+    X509_set_version(*cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(*cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(*cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(*cert), 86400);
+    X509_set_pubkey(*cert, *pkey);
+    name = X509_get_subject_name(*cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const u_char *) DANE_TEST_NAME, -1, -1, 0);
+    X509_set_issuer_name(*cert, name);
+    if (X509_sign(*cert, *pkey, EVP_sha256()) <= 0)
+        goto done;
+    ret = 0;
+
+  done:
+    EVP_PKEY_CTX_free(pctx);
+    return ret;
+}
+
+static struct val_danestatus *
+make_tlsa(int selector, int type, const u_char * data, size_t len,
+          struct val_danestatus *next)
+{
+    struct val_danestatus *d;
+
+    if ((d = (struct val_danestatus *)
+         MALLOC(sizeof(struct val_danestatus))) == NULL)
+        return NULL;
+    if ((d->data = (u_char *) MALLOC(len)) == NULL) {
+        FREE(d);
+        return NULL;
+    }
+    memcpy(d->data, data, len);
+    d->datalen = len;
+    d->ttl = DANE_TEST_TTL;
+    d->usage = DANE_USE_DOMAIN_ISSUED;
+    d->selector = selector;
+    d->type = type;
+    d->next = next;
+    return d;
+}
+
+/*
+ * The TLSA RRset: "others" records of random data of the right length
+ * for each selector and matching type, and, if good is set, a SHA-256
+ * of the certificate's key at the end
+ */
+static struct val_danestatus *
+make_tlsa_set(X509 * cert, int others, int good)
+{
+    struct val_danestatus *head = NULL, *d;
+    u_char          buf[SHA512_DIGEST_LENGTH + 256];
+    u_char         *spki = NULL, *cp;
+    int             spki_len, i, j, len, type;
+
+    if (good) {
+        if ((spki_len = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert),
+                                        NULL)) <= 0 ||
+            (spki = (u_char *) MALLOC(spki_len)) == NULL)
+            return NULL;
+        cp = spki;
+        i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), &cp);
+        SHA256(spki, spki_len, buf);
+        FREE(spki);
+        if ((head = make_tlsa(DANE_SEL_PUBKEY, DANE_MATCH_SHA256, buf,
+                              SHA256_DIGEST_LENGTH, NULL)) == NULL)
+            return NULL;
+    }
+    for (i = 0; i < others; i++) {
+        type = i % 3;
+        len = type == DANE_MATCH_SHA256 ? SHA256_DIGEST_LENGTH :
+            type == DANE_MATCH_SHA512 ? SHA512_DIGEST_LENGTH :
+            64 + random() % 192;
+        for (j = 0; j < len; j++)
+            buf[j] = (u_char) random();
+        if ((d = make_tlsa((i / 3) % 2, type, buf, len, head)) == NULL) {
+            val_free_dane(head);
+            return NULL;
+        }
+        head = d;
+    }
+    return head;
+}
+
+/*
+ * Run one handshake between the two contexts over a BIO pair.
+ * Returns 1 if the client accepted the server's certificate.
+ */
+static int
+handshake(SSL_CTX * cctx, SSL_CTX * sctx)
+{
+    SSL            *client = NULL, *server = NULL;
+    BIO            *cbio = NULL, *sbio = NULL;
+    int             cdone = 0, sdone = 0, i, rc, ok = 0;
+
+    if ((client = SSL_new(cctx)) == NULL ||
+        (server = SSL_new(sctx)) == NULL ||
+        !BIO_new_bio_pair(&cbio, 0, &sbio, 0))
+        goto done;
+    SSL_set_bio(client, cbio, cbio);
+    SSL_set_bio(server, sbio, sbio);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+
+    for (i = 0; i < 100 && !(cdone && sdone); i++) {
+        if (!cdone) {
+            rc = SSL_do_handshake(client);
+            if (rc == 1)
+                cdone = 1;
+            else if (SSL_get_error(client, rc) != SSL_ERROR_WANT_READ)
+                break;
+        }
+        if (!sdone) {
+            rc = SSL_do_handshake(server);
+            if (rc == 1)
+                sdone = 1;
+            else if (SSL_get_error(server, rc) != SSL_ERROR_WANT_READ)
+                break;
+        }
+    }
+    ok = cdone && SSL_get_verify_result(client) == X509_V_OK;
+
+  done:
+    ERR_clear_error();
+    if (client)
+        SSL_free(client);
+    if (server)
+        SSL_free(server);
+    return ok;
+}
+
+static void
+check(const char *what, int ok)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static double
+elapsed_ns(const struct timeval *start, int count)
+{
+    struct timeval  end;
+
+    gettimeofday(&end, NULL);
+    return ((end.tv_sec - start->tv_sec) * 1e9 +
+            (end.tv_usec - start->tv_usec) * 1e3) / (count ? count : 1);
+}
+
+/*
+ * Time handshakes against the RRset.  With nocache set the RRset is
+ * given no lifetime, so that nothing is remembered between handshakes.
+ */
+static double
+time_handshakes(val_context_t * context, SSL_CTX * sctx,
+                struct val_danestatus *tlsa, int iterations, int nocache,
+                unsigned long *hits)
+{
+    SSL_CTX        *cctx;
+    struct val_ssl_data *ssl_dane_data = NULL;
+    val_stats_t     before, after;
+    struct timeval  start;
+    double          ns = 0;
+    int             i, ok = 1;
+
+    if ((cctx = SSL_CTX_new(TLS_client_method())) == NULL)
+        return 0;
+    SSL_CTX_set_verify(cctx, SSL_VERIFY_PEER, NULL);
+    if (val_enable_dane_ssl(context, cctx, DANE_TEST_NAME, tlsa,
+                            &ssl_dane_data) != VAL_NO_ERROR) {
+        SSL_CTX_free(cctx);
+        return 0;
+    }
+    if (nocache)
+        ssl_dane_data->tlsa_expiry = 0;
+
+    val_get_stats(&before, sizeof(before));
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+        if (!handshake(cctx, sctx))
+            ok = 0;
+    ns = elapsed_ns(&start, iterations);
+    val_get_stats(&after, sizeof(after));
+    check(nocache ? "handshakes without the cache succeed" :
+          "handshakes with the cache succeed", ok);
+    *hits = after.vs_dane_cache_hits - before.vs_dane_cache_hits;
+
+    val_free_dane_ssl(ssl_dane_data);
+    SSL_CTX_free(cctx);
+    return ns;
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"iterations", 1, 0, 'n'},
+    {"tlsa", 1, 0, 't'},
+    {"seed", 1, 0, 's'},
+    {"dnsval-conf", 1, 0, 'v'},
+    {"resolv-conf", 1, 0, 'r'},
+    {"root-hints", 1, 0, 'i'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int             iterations = 500, others = 12;
+    unsigned int    seed = (unsigned int) time(NULL);
+    char           *dnsval_conf = NULL, *resolv_conf = NULL;
+    char           *root_conf = NULL;
+    val_context_t  *context = NULL;
+    SSL_CTX        *sctx = NULL, *cctx = NULL;
+    struct val_ssl_data *ssl_dane_data = NULL;
+    struct val_danestatus *good, *bad;
+    EVP_PKEY       *pkey;
+    X509           *cert;
+    unsigned long   hits, nohits;
+    double          ns, nons;
+    int             c;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "hn:t:s:v:r:i:", prog_options,
+                        &opt_index);
+#else
+        c = getopt(argc, argv, "hn:t:s:v:r:i:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 't':
+            others = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            dnsval_conf = optarg;
+            break;
+        case 'r':
+            resolv_conf = optarg;
+            break;
+        case 'i':
+            root_conf = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (others < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    srandom(seed);
+
+    if (val_create_context_with_conf(NULL, dnsval_conf, resolv_conf,
+                                     root_conf, &context) != VAL_NO_ERROR) {
+        fprintf(stderr, "could not create the validator context\n");
+        return 1;
+    }
+
+    if (make_cert(&pkey, &cert) != 0 ||
+        (good = make_tlsa_set(cert, others, 1)) == NULL ||
+        (bad = make_tlsa_set(cert, others, 0)) == NULL) {
+        fprintf(stderr, "could not build the certificate and TLSA records\n");
+        return 1;
+    }
+
+    if ((sctx = SSL_CTX_new(TLS_server_method())) == NULL ||
+        SSL_CTX_use_certificate(sctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey(sctx, pkey) != 1) {
+        fprintf(stderr, "could not set up the TLS server\n");
+        return 1;
+    }
+
+    printf("%d TLSA records that do not match and one that does (seed %u)\n",
+           others, seed);
+
+    /*
+     * A set without the matching record must be refused, before and
+     * after its result has been cached
+     */
+    if ((cctx = SSL_CTX_new(TLS_client_method())) == NULL ||
+        val_enable_dane_ssl(context, cctx, DANE_TEST_NAME, bad,
+                            &ssl_dane_data) != VAL_NO_ERROR) {
+        fprintf(stderr, "could not set up the TLS client\n");
+        return 1;
+    }
+    SSL_CTX_set_verify(cctx, SSL_VERIFY_PEER, NULL);
+    check("certificate without a matching TLSA record is refused",
+          !handshake(cctx, sctx));
+    check("certificate without a matching TLSA record is refused again",
+          !handshake(cctx, sctx));
+    val_free_dane_ssl(ssl_dane_data);
+    SSL_CTX_free(cctx);
+
+    nons = time_handshakes(context, sctx, good, iterations, 1, &nohits);
+    ns = time_handshakes(context, sctx, good, iterations, 0, &hits);
+
+    printf("%12.0f ns per handshake without the match cache (%lu hits)\n",
+           nons, nohits);
+    printf("%12.0f ns per handshake with the match cache (%lu hits)\n",
+           ns, hits);
+    check("the match cache is used", iterations < 2 || hits > 0);
+
+    val_free_dane(good);
+    val_free_dane(bad);
+    SSL_CTX_free(sctx);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    val_free_context(context);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all handshakes checked as expected\n");
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Microbenchmarks for the domain name primitives used throughout libval
+ * and libsres.  A set of random names with shared suffixes and mixed
+ * case is generated, every primitive is timed over all pairs of names,
+ * and the results are checked against straightforward reference
+ * implementations.  The references do no bounds checking on the names,
+ * so they only give a lower bound for the timings of namecmp() and
+ * namename().
+ */
+
+#include "validator-internal.h"
+#include "val_support.h"
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define NAME_TEST_NAMES 512
+
+static u_char   names[NAME_TEST_NAMES][NS_MAXCDNAME];
+static struct canon_name canon[NAME_TEST_NAMES];
+static int      failures = 0;
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-n, --iterations=<n>   passes over all name pairs "
+            "(default 20)\n");
+    fprintf(stderr,
+            "\t-s, --seed=<n>         random seed for the names\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+}
+
+/*
+ * Reference implementations
+ */
+static int
+ref_label_cmp(const u_char * l1, size_t len1, const u_char * l2,
+              size_t len2)
+{
+    size_t          i, min_len = len1 < len2 ? len1 : len2;
+    int             d;
+
+    for (i = 0; i < min_len; i++) {
+        d = tolower(l1[i]) - tolower(l2[i]);
+        if (d)
+            return d;
+    }
+    return (int) len1 - (int) len2;
+}
+
+static int
+ref_namecmp(const u_char * n1, const u_char * n2)
+{
+    const u_char   *lab1[NS_MAXCDNAME], *lab2[NS_MAXCDNAME];
+    int             c1 = 0, c2 = 0, d;
+    const u_char   *p;
+
+    for (p = n1; *p; p += *p + 1)
+        lab1[c1++] = p;
+    for (p = n2; *p; p += *p + 1)
+        lab2[c2++] = p;
+    while (c1 > 0 && c2 > 0) {
+        c1--;
+        c2--;
+        d = ref_label_cmp(lab1[c1] + 1, lab1[c1][0], lab2[c2] + 1,
+                          lab2[c2][0]);
+        if (d)
+            return d;
+    }
+    return c1 - c2;
+}
+
+static u_char  *
+ref_namename(u_char * big, u_char * little)
+{
+    u_char         *p;
+
+    for (p = big;; p += *p + 1) {
+        if (ref_namecmp(p, little) == 0)
+            return p;
+        if (*p == '\0')
+            return NULL;
+    }
+}
+
+static int
+sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+/*
+ * Build names from a small set of labels so that many of them share
+ * suffixes, with random upper/lower case.
+ */
+static void
+make_names(void)
+{
+    static const char *labels[] = {
+        "com", "net", "org", "example", "www", "mail", "a", "b",
+        "dnssec-tools", "sub", "deep", "host1", "host2", "x", "zz"
+    };
+    int             nlabels = sizeof(labels) / sizeof(labels[0]);
+    int             i, j, k, depth;
+    size_t          len, off;
+    const char     *l;
+
+    for (i = 0; i < NAME_TEST_NAMES; i++) {
+        depth = random() % 8;
+        off = 0;
+        for (j = 0; j < depth; j++) {
+            l = labels[random() % nlabels];
+            len = strlen(l);
+            names[i][off++] = (u_char) len;
+            for (k = 0; k < (int) len; k++) {
+                names[i][off++] = (random() % 3 == 0) ?
+                    (u_char) toupper(l[k]) : (u_char) l[k];
+            }
+        }
+        names[i][off] = '\0';
+        if (canon_name_init(&canon[i], names[i]) != 0) {
+            fprintf(stderr, "canon_name_init failed for name %d\n", i);
+            failures++;
+        }
+    }
+}
+
+static void
+report(const char *what, struct timeval *start, long ops)
+{
+    struct timeval  stop;
+    double          secs;
+
+    gettimeofday(&stop, NULL);
+    secs = (stop.tv_sec - start->tv_sec) +
+        (stop.tv_usec - start->tv_usec) / 1000000.0;
+    printf("%-24s %10ld ops %8.2f ns/op\n", what, ops,
+           ops ? secs * 1e9 / ops : 0.0);
+    gettimeofday(start, NULL);
+}
+
+static void
+check(const char *what, int i, int j, int ok)
+{
+    if (!ok) {
+        fprintf(stderr, "%s differs from reference for names %d, %d\n",
+                what, i, j);
+        failures++;
+    }
+}
+
+static void
+verify(void)
+{
+    int             i, j, off;
+    u_char         *p;
+
+    for (i = 0; i < NAME_TEST_NAMES; i++) {
+        for (j = 0; j < NAME_TEST_NAMES; j++) {
+            int             r = sign(ref_namecmp(names[i], names[j]));
+
+            check("namecmp", i, j,
+                  sign(namecmp(names[i], names[j])) == r);
+            check("canon_namecmp", i, j,
+                  sign(canon_namecmp(&canon[i], &canon[j])) == r);
+            check("canon_namecmp_wire", i, j,
+                  sign(canon_namecmp_wire(&canon[i], names[j])) == r);
+            check("canon_name_equal", i, j,
+                  canon_name_equal(&canon[i], names[j]) == (r == 0));
+
+            p = ref_namename(names[i], names[j]);
+            check("namename", i, j, namename(names[i], names[j]) == p);
+            check("is_tail", i, j,
+                  is_tail(names[i], names[j]) == (p != NULL));
+            off = canon_name_tail(&canon[i], names[j]);
+            check("canon_name_tail", i, j,
+                  p ? (off == p - names[i]) : (off < 0));
+        }
+    }
+}
+
+static void
+benchmark(int iterations)
+{
+    struct timeval  start;
+    long            ops = (long) iterations * NAME_TEST_NAMES *
+        NAME_TEST_NAMES;
+    volatile long   sink = 0;
+    int             it, i, j;
+
+#define NAME_BENCH(what, expr) do {                         \
+        gettimeofday(&start, NULL);                         \
+        for (it = 0; it < iterations; it++)                 \
+            for (i = 0; i < NAME_TEST_NAMES; i++)           \
+                for (j = 0; j < NAME_TEST_NAMES; j++)       \
+                    sink += (long) (expr);                  \
+        report(what, &start, ops);                          \
+    } while (0)
+
+    NAME_BENCH("reference namecmp", ref_namecmp(names[i], names[j]));
+    NAME_BENCH("namecmp", namecmp(names[i], names[j]));
+    NAME_BENCH("canon_namecmp", canon_namecmp(&canon[i], &canon[j]));
+    NAME_BENCH("canon_namecmp_wire",
+               canon_namecmp_wire(&canon[i], names[j]));
+    NAME_BENCH("canon_name_equal", canon_name_equal(&canon[i], names[j]));
+    NAME_BENCH("reference namename",
+               ref_namename(names[i], names[j]) != NULL);
+    NAME_BENCH("namename", namename(names[i], names[j]) != NULL);
+    NAME_BENCH("is_tail", is_tail(names[i], names[j]));
+    NAME_BENCH("canon_name_tail", canon_name_tail(&canon[i], names[j]));
+
+#undef NAME_BENCH
+
+    gettimeofday(&start, NULL);
+    for (it = 0; it < iterations * NAME_TEST_NAMES; it++)
+        for (i = 0; i < NAME_TEST_NAMES; i++)
+            sink += wire_name_length(names[i]);
+    report("wire_name_length", &start, ops);
+
+    for (it = 0; it < iterations * NAME_TEST_NAMES; it++) {
+        struct canon_name cn;
+        for (i = 0; i < NAME_TEST_NAMES; i++)
+            sink += canon_name_init(&cn, names[i]);
+    }
+    report("canon_name_init", &start, ops);
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"iterations", 1, 0, 'n'},
+    {"seed", 1, 0, 's'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int             iterations = 20;
+    unsigned int    seed = (unsigned int) time(NULL);
+    int             c;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "hn:s:", prog_options, &opt_index);
+#else
+        c = getopt(argc, argv, "hn:s:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    srandom(seed);
+    printf("%d names (seed %u)\n", NAME_TEST_NAMES, seed);
+    make_names();
+    verify();
+    if (iterations > 0)
+        benchmark(iterations);
+
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("all primitives agree with the reference implementations\n");
+    return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Parse throughput benchmark and fuzz test for the libval response
+ * parser.  Responses are read from a capture file written by
+ * "dt-authserv -w <file>": each message is preceded by its length as a
+ * two octet value in network byte order.
+ *
+ * Every message is broken into RRsets the way digest_response() does
+ * it, once with RDATA copied out of the packet by decompress() and once
+ * with RDATA referenced in place by rdata_view().  In fuzz mode the
+ * captured messages are randomly damaged before being parsed; both
+ * parses must accept or reject a message alike and produce the same
+ * RRsets.
+ */
+
+#include "validator-internal.h"
+#include "val_support.h"
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define PARSE_COPY 0
+#define PARSE_VIEW 1
+
+struct captured_msg {
+    u_char         *buf;
+    size_t          len;
+};
+
+static struct captured_msg *msgs = NULL;
+static int      nmsgs = 0;
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture-file\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-n, --iterations=<n>   parse the capture <n> times in each\n"
+            "\t                       mode (default 1000)\n");
+    fprintf(stderr,
+            "\t-f, --fuzz=<n>         parse <n> randomly damaged messages\n");
+    fprintf(stderr,
+            "\t-s, --seed=<n>         random seed for fuzzing\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+}
+
+static int
+load_capture(const char *file)
+{
+    FILE           *fp;
+    u_char          lenbuf[2];
+    size_t          len;
+    int             alloc = 0;
+    struct captured_msg *tmp;
+
+    if ((fp = fopen(file, "rb")) == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    while (fread(lenbuf, 1, 2, fp) == 2) {
+        len = (lenbuf[0] << 8) | lenbuf[1];
+        if (nmsgs == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            tmp = (struct captured_msg *)
+                MALLOC(alloc * sizeof(struct captured_msg));
+            if (tmp == NULL)
+                break;
+            if (msgs) {
+                memcpy(tmp, msgs, nmsgs * sizeof(struct captured_msg));
+                FREE(msgs);
+            }
+            msgs = tmp;
+        }
+        msgs[nmsgs].buf = (u_char *) MALLOC(len ? len : 1);
+        if (msgs[nmsgs].buf == NULL)
+            break;
+        if (fread(msgs[nmsgs].buf, 1, len, fp) != len) {
+            FREE(msgs[nmsgs].buf);
+            fprintf(stderr, "%s: truncated message %d\n", file, nmsgs);
+            break;
+        }
+        msgs[nmsgs++].len = len;
+    }
+    fclose(fp);
+    return nmsgs;
+}
+
+/*
+ * Break a response into RRsets.  Returns 0 on success, -1 if the
+ * message could not be parsed.  *nviews counts the records whose
+ * RDATA did not have to be copied.
+ */
+static int
+parse_msg(u_char *msg, size_t len, int mode, struct rrset_rec **sets,
+          int *nrrs, int *nviews)
+{
+    u_char          name_n[NS_MAXCDNAME];
+    u_char          rdata_buf[2 * NS_MAXCDNAME + NS_RRFIXEDSZ];
+    u_char         *rdata;
+    u_char         *end = msg + len;
+    int             rdata_allocated;
+    size_t          index = HFIXEDSZ;
+    size_t          rdata_len_h;
+    size_t          rdata_index;
+    u_int16_t       type_h, set_type_h, class_h;
+    u_int32_t       ttl_h;
+    int             qd, rrs, i, n, ret;
+    struct rrset_rec *set;
+    HEADER         *header = (HEADER *) msg;
+
+    *sets = NULL;
+    if (len < HFIXEDSZ)
+        return -1;
+
+    qd = ntohs(header->qdcount);
+    rrs = ntohs(header->ancount) + ntohs(header->nscount) +
+        ntohs(header->arcount);
+
+    for (i = 0; i < qd; i++) {
+        n = ns_name_unpack(msg, end, &msg[index], name_n, sizeof(name_n));
+        if (n < 0 || index + n + QFIXEDSZ > len)
+            return -1;
+        index += n + QFIXEDSZ;
+    }
+
+    for (i = 0; i < rrs; i++) {
+        if (extract_from_rr(msg, &index, end, name_n, &type_h, &set_type_h,
+                            &class_h, &ttl_h, &rdata_len_h,
+                            &rdata_index) != VAL_NO_ERROR)
+            return -1;
+        if (type_h == ns_t_opt)
+            continue;
+
+        rdata = NULL;
+        rdata_allocated = 0;
+        if (mode == PARSE_VIEW) {
+            ret = rdata_view(&rdata, &rdata_allocated, rdata_buf,
+                             sizeof(rdata_buf), msg, rdata_index, end,
+                             type_h, &rdata_len_h);
+            if (ret == VAL_NO_ERROR && rdata != NULL && !rdata_allocated &&
+                rdata >= msg && rdata < end)
+                (*nviews)++;
+        } else {
+            ret = decompress(&rdata, msg, rdata_index, end, type_h,
+                             &rdata_len_h);
+            rdata_allocated = 1;
+        }
+        if (ret != VAL_NO_ERROR || rdata == NULL) {
+            if (rdata && rdata_allocated)
+                FREE(rdata);
+            return -1;
+        }
+
+        set = find_rr_set(NULL, sets, name_n, type_h, set_type_h, class_h,
+                          ttl_h, msg, rdata, VAL_FROM_ANSWER, 0, 0, NULL);
+        if (set == NULL)
+            ret = VAL_OUT_OF_MEMORY;
+        else if (type_h == ns_t_rrsig)
+            ret = add_as_sig(set, rdata_len_h, rdata);
+        else
+            ret = add_to_set(set, rdata_len_h, rdata);
+        if (rdata_allocated)
+            FREE(rdata);
+        if (ret != VAL_NO_ERROR)
+            return -1;
+        (*nrrs)++;
+    }
+    return 0;
+}
+
+static int
+same_rrs(struct rrset_rr *a, struct rrset_rr *b)
+{
+    for (; a && b; a = a->rr_next, b = b->rr_next) {
+        if (a->rr_rdata_length != b->rr_rdata_length ||
+            memcmp(a->rr_rdata, b->rr_rdata, a->rr_rdata_length))
+            return 0;
+    }
+    return (a == NULL && b == NULL);
+}
+
+static int
+same_sets(struct rrset_rec *a, struct rrset_rec *b)
+{
+    for (; a && b; a = a->rrs_next, b = b->rrs_next) {
+        if (a->rrs_type_h != b->rrs_type_h ||
+            a->rrs_class_h != b->rrs_class_h ||
+            namecmp(a->rrs_name_n, b->rrs_name_n) ||
+            !same_rrs(a->rrs_data, b->rrs_data) ||
+            !same_rrs(a->rrs_sig, b->rrs_sig))
+            return 0;
+    }
+    return (a == NULL && b == NULL);
+}
+
+static void
+benchmark(int iterations)
+{
+    static const char *modes[] = { "copy", "view" };
+    struct rrset_rec *sets;
+    struct timeval  start, stop;
+    double          secs;
+    int             mode, i, j, nrrs, nviews, bad;
+
+    for (mode = PARSE_COPY; mode <= PARSE_VIEW; mode++) {
+        nrrs = nviews = bad = 0;
+        gettimeofday(&start, NULL);
+        for (i = 0; i < iterations; i++) {
+            for (j = 0; j < nmsgs; j++) {
+                if (parse_msg(msgs[j].buf, msgs[j].len, mode, &sets,
+                              &nrrs, &nviews) < 0)
+                    bad++;
+                res_sq_free_rrset_recs(&sets);
+            }
+        }
+        gettimeofday(&stop, NULL);
+        secs = (stop.tv_sec - start.tv_sec) +
+            (stop.tv_usec - start.tv_usec) / 1000000.0;
+        if (secs <= 0)
+            secs = 0.000001;
+        printf("%s: %d messages, %d records in %.3f sec, "
+               "%.1f messages/sec, %.1f records/sec",
+               modes[mode], iterations * nmsgs, nrrs, secs,
+               iterations * nmsgs / secs, nrrs / secs);
+        if (mode == PARSE_VIEW)
+            printf(", %.1f%% of RDATA used in place",
+                   nrrs ? 100.0 * nviews / nrrs : 0.0);
+        printf("\n");
+        if (bad)
+            printf("%s: %d messages could not be parsed\n", modes[mode],
+                   bad);
+    }
+}
+
+/*
+ * Damage a message: flip bits, overwrite octets, plant compression
+ * pointers to random offsets or cut the message short.
+ */
+static size_t
+mutate(u_char *buf, size_t len)
+{
+    int             i, n = 1 + random() % 4;
+    size_t          off;
+
+    for (i = 0; i < n && len > 0; i++) {
+        off = random() % len;
+        switch (random() % 4) {
+        case 0:
+            buf[off] ^= 1 << (random() % 8);
+            break;
+        case 1:
+            buf[off] = random() & 0xff;
+            break;
+        case 2:
+            if (off + 1 < len) {
+                buf[off] = 0xc0 | ((random() % len) >> 8 & 0x3f);
+                buf[off + 1] = random() % len & 0xff;
+            }
+            break;
+        default:
+            len = off;
+            break;
+        }
+    }
+    return len;
+}
+
+static int
+fuzz(int count, unsigned int seed)
+{
+    u_char          buf[65536];
+    struct rrset_rec *copy_sets, *view_sets;
+    size_t          len;
+    int             i, m, r1, r2, nrrs = 0, nviews = 0;
+    int             rejected = 0, mismatches = 0;
+
+    srandom(seed);
+    for (i = 0; i < count; i++) {
+        m = random() % nmsgs;
+        memcpy(buf, msgs[m].buf, msgs[m].len);
+        len = mutate(buf, msgs[m].len);
+
+        r1 = parse_msg(buf, len, PARSE_COPY, &copy_sets, &nrrs, &nviews);
+        r2 = parse_msg(buf, len, PARSE_VIEW, &view_sets, &nrrs, &nviews);
+        if (r1 != r2 || (r1 == 0 && !same_sets(copy_sets, view_sets))) {
+            fprintf(stderr, "fuzz case %d (message %d): copy and view "
+                    "parses differ (%d %d)\n", i, m, r1, r2);
+            mismatches++;
+        } else if (r1 < 0)
+            rejected++;
+        res_sq_free_rrset_recs(&copy_sets);
+        res_sq_free_rrset_recs(&view_sets);
+    }
+    printf("fuzz: %d messages (seed %u), %d rejected, %d mismatches\n",
+           count, seed, rejected, mismatches);
+    return mismatches ? 1 : 0;
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"iterations", 1, 0, 'n'},
+    {"fuzz", 1, 0, 'f'},
+    {"seed", 1, 0, 's'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int             iterations = 1000;
+    int             fuzzcount = 0;
+    unsigned int    seed = (unsigned int) time(NULL);
+    int             c, i, ret;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "f:hn:s:", prog_options, &opt_index);
+#else
+        c = getopt(argc, argv, "f:hn:s:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'f':
+            fuzzcount = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (load_capture(argv[optind]) <= 0) {
+        fprintf(stderr, "No messages in %s\n", argv[optind]);
+        return 1;
+    }
+
+    if (iterations > 0)
+        benchmark(iterations);
+    ret = fuzzcount > 0 ? fuzz(fuzzcount, seed) : 0;
+
+    for (i = 0; i < nmsgs; i++)
+        FREE(msgs[i].buf);
+    FREE(msgs);
+    return ret;
+}
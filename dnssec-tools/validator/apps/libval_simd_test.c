@@ -0,0 +1,476 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Equivalence tests and benchmarks for the vector (SSE2/AVX2) versions
+ * of the name and encoding primitives.  Random inputs are run through
+ * lower(), ns_name_ntop(), ns_name_pton(), base32hex_encode(),
+ * b64_ntop() and b64_pton() once with the scalar code and once with
+ * each vector instruction set the CPU supports, and the results must be
+ * identical.  Each primitive is then timed at every level.
+ */
+
+#include "validator-internal.h"
+#include "val_support.h"
+#include "base64.h"
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define SIMD_TEST_CASES 20000
+#define SIMD_BENCH_INPUTS 64
+
+static const char *level_names[] = { "scalar", "sse2", "avx2" };
+static int      failures = 0;
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-n, --iterations=<n>   benchmark passes (default 2000)\n");
+    fprintf(stderr,
+            "\t-s, --seed=<n>         random seed for the inputs\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+}
+
+static void
+mismatch(const char *what, int level, int n)
+{
+    fprintf(stderr, "%s: %s differs from scalar for case %d\n", what,
+            level_names[level], n);
+    failures++;
+}
+
+/*
+ * Random input generators
+ */
+
+static u_char
+random_label_byte(void)
+{
+    static const char specials[] = "\".;\\()@$ ";
+
+    switch (random() % 8) {
+    case 0:
+        return (u_char) specials[random() % (sizeof(specials) - 1)];
+    case 1:
+        return (u_char) (random() & 0xff);
+    default:
+        return (u_char) ("abcdefghijklmnopqrstuvwxyz"
+                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_"
+                         [random() % 64]);
+    }
+}
+
+/*
+ * Wire format name with long labels (such as NSEC3 owner names) as well
+ * as short ones, some of them with characters that need escaping.
+ */
+static size_t
+random_wire_name(u_char * name)
+{
+    size_t          off = 0, len, i;
+    int             plain = random() % 2;
+
+    while (off < NS_MAXCDNAME - 64 && random() % 4) {
+        len = 1 + (random() % 2 ? random() % 63 : random() % 8);
+        if (off + len + 2 > NS_MAXCDNAME)
+            break;
+        name[off++] = (u_char) len;
+        for (i = 0; i < len; i++)
+            name[off++] = plain ? (u_char) ("abcdefghijklmnopqrstuvwxyz"
+                                            "0123456789ABCDEFGHIJKLMNOP"
+                                            [random() % 52]) :
+                random_label_byte();
+    }
+    name[off++] = 0;
+    return off;
+}
+
+/*
+ * Presentation format name, mostly valid, with escapes of both kinds.
+ */
+static void
+random_text_name(char *text, size_t size)
+{
+    size_t          off = 0;
+    u_char          c;
+
+    while (off + 5 < size && random() % 64) {
+        switch (random() % 16) {
+        case 0:
+            text[off++] = '.';
+            break;
+        case 1:
+            c = random() & 0xff;
+            off += snprintf(text + off, size - off, "\\%03u", c);
+            break;
+        case 2:
+            text[off++] = '\\';
+            text[off++] = random_label_byte() | 0x20;
+            break;
+        default:
+            text[off++] = "abcdefghijklmnopqrstuvwxyz0123456789-"
+                [random() % 37];
+            break;
+        }
+    }
+    text[off] = '\0';
+}
+
+/*
+ * Base64 text with white space, padding and the odd stray character
+ * mixed in.
+ */
+static void
+random_b64_text(char *text, size_t size)
+{
+    u_char          bin[512];
+    size_t          len = random() % sizeof(bin), i, off;
+    int             n;
+
+    for (i = 0; i < len; i++)
+        bin[i] = random() & 0xff;
+    n = b64_ntop(bin, len, text, size);
+    if (n < 0)
+        n = 0;
+    off = n;
+    switch (random() % 4) {
+    case 0:
+        /* as is */
+        break;
+    case 1:
+        for (i = 0; i < 4 && off > 0; i++)
+            text[random() % off] = " \n\t=*A"[random() % 6];
+        break;
+    case 2:
+        /* line breaks every 56 characters */
+        for (i = 56; i < off && off + 1 < size; i += 57) {
+            memmove(text + i + 1, text + i, off - i + 1);
+            text[i] = '\n';
+            off++;
+        }
+        break;
+    default:
+        if (off > 0)
+            off = random() % off;
+        break;
+    }
+    text[off] = '\0';
+}
+
+/*
+ * Equivalence tests
+ */
+
+static void
+test_lower(int level, int n)
+{
+    u_char          a[300], b[300];
+    size_t          len = random() % sizeof(a), i;
+
+    for (i = 0; i < len; i++)
+        a[i] = random() & 0xff;
+    memcpy(b, a, len);
+    res_simd_set_level(RES_SIMD_SCALAR);
+    res_lower_bytes(a, len);
+    res_simd_set_level(level);
+    res_lower_bytes(b, len);
+    if (memcmp(a, b, len))
+        mismatch("res_lower_bytes", level, n);
+}
+
+static void
+test_ntop(int level, int n)
+{
+    u_char          name[NS_MAXCDNAME];
+    char            a[NS_MAXDNAME * 4], b[NS_MAXDNAME * 4];
+    size_t          dstsiz;
+    int             ra, rb;
+
+    random_wire_name(name);
+    dstsiz = random() % 2 ? sizeof(a) : (size_t) (random() % sizeof(a));
+    memset(a, 0x55, sizeof(a));
+    memset(b, 0x55, sizeof(b));
+    res_simd_set_level(RES_SIMD_SCALAR);
+    ra = ns_name_ntop(name, a, dstsiz);
+    res_simd_set_level(level);
+    rb = ns_name_ntop(name, b, dstsiz);
+    if (ra != rb || (ra > 0 && memcmp(a, b, ra)))
+        mismatch("ns_name_ntop", level, n);
+}
+
+static void
+test_pton(int level, int n)
+{
+    char            text[NS_MAXDNAME * 2];
+    u_char          a[NS_MAXCDNAME + 64], b[NS_MAXCDNAME + 64];
+    size_t          dstsiz;
+    int             ra, rb;
+
+    random_text_name(text, sizeof(text));
+    dstsiz = random() % 2 ? NS_MAXCDNAME : (size_t) (random() % sizeof(a));
+    memset(a, 0x55, sizeof(a));
+    memset(b, 0x55, sizeof(b));
+    res_simd_set_level(RES_SIMD_SCALAR);
+    ra = ns_name_pton(text, a, dstsiz);
+    res_simd_set_level(level);
+    rb = ns_name_pton(text, b, dstsiz);
+    if (ra != rb || (ra >= 0 && memcmp(a, b, dstsiz)))
+        mismatch("ns_name_pton", level, n);
+}
+
+#ifdef LIBVAL_NSEC3
+static void
+test_base32hex(int level, int n)
+{
+    u_char          in[64];
+    u_char         *a, *b;
+    size_t          alen, blen, len = 1 + random() % sizeof(in), i;
+
+    /* mostly SHA-1 sized hashes */
+    if (random() % 2)
+        len = 20;
+    for (i = 0; i < len; i++)
+        in[i] = random() & 0xff;
+    res_simd_set_level(RES_SIMD_SCALAR);
+    base32hex_encode(in, len, &a, &alen);
+    res_simd_set_level(level);
+    base32hex_encode(in, len, &b, &blen);
+    if (a == NULL || b == NULL || alen != blen || memcmp(a, b, alen))
+        mismatch("base32hex_encode", level, n);
+    if (a)
+        FREE(a);
+    if (b)
+        FREE(b);
+}
+#endif
+
+static void
+test_b64_ntop(int level, int n)
+{
+    u_char          in[600];
+    char            a[1024], b[1024];
+    size_t          len = random() % sizeof(in), targsize, i;
+    int             ra, rb;
+
+    for (i = 0; i < len; i++)
+        in[i] = random() & 0xff;
+    targsize = random() % 4 ? sizeof(a) : (size_t) (random() % sizeof(a));
+    res_simd_set_level(RES_SIMD_SCALAR);
+    ra = b64_ntop(in, len, a, targsize);
+    res_simd_set_level(level);
+    rb = b64_ntop(in, len, b, targsize);
+    if (ra != rb || (ra >= 0 && memcmp(a, b, ra + 1)))
+        mismatch("b64_ntop", level, n);
+}
+
+static void
+test_b64_pton(int level, int n)
+{
+    char            text[1024];
+    u_char          a[600], b[600];
+    size_t          targsize;
+    int             ra, rb;
+
+    random_b64_text(text, sizeof(text));
+    targsize = random() % 4 ? sizeof(a) : (size_t) (random() % sizeof(a));
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    res_simd_set_level(RES_SIMD_SCALAR);
+    ra = b64_pton(text, a, targsize);
+    res_simd_set_level(level);
+    rb = b64_pton(text, b, targsize);
+    if (ra != rb || (ra > 0 && memcmp(a, b, ra)))
+        mismatch("b64_pton", level, n);
+}
+
+static void
+verify(int max_level)
+{
+    int             level, i;
+
+    for (level = RES_SIMD_SCALAR + 1; level <= max_level; level++) {
+        for (i = 0; i < SIMD_TEST_CASES; i++) {
+            test_lower(level, i);
+            test_ntop(level, i);
+            test_pton(level, i);
+#ifdef LIBVAL_NSEC3
+            test_base32hex(level, i);
+#endif
+            test_b64_ntop(level, i);
+            test_b64_pton(level, i);
+        }
+    }
+}
+
+/*
+ * Benchmarks, run over a fixed set of typical inputs
+ */
+
+static u_char   bench_names[SIMD_BENCH_INPUTS][NS_MAXCDNAME];
+static char     bench_texts[SIMD_BENCH_INPUTS][NS_MAXDNAME];
+static u_char   bench_keys[SIMD_BENCH_INPUTS][256];
+static char     bench_b64[SIMD_BENCH_INPUTS][400];
+
+static void
+make_bench_inputs(void)
+{
+    int             i, j;
+    u_char          hash[20];
+    u_char         *b32;
+    size_t          b32len;
+
+    for (i = 0; i < SIMD_BENCH_INPUTS; i++) {
+        /* NSEC3 owner names: a 32 character hash under a zone */
+        for (j = 0; j < 20; j++)
+            hash[j] = random() & 0xff;
+#ifdef LIBVAL_NSEC3
+        base32hex_encode(hash, sizeof(hash), &b32, &b32len);
+#else
+        b32 = NULL;
+#endif
+        if (b32 != NULL) {
+            snprintf(bench_texts[i], sizeof(bench_texts[i]),
+                     "%.*s.Example-Zone.COM", (int) b32len, b32);
+            FREE(b32);
+        } else
+            snprintf(bench_texts[i], sizeof(bench_texts[i]),
+                     "www.Example-Zone.COM");
+        ns_name_pton(bench_texts[i], bench_names[i], NS_MAXCDNAME);
+
+        for (j = 0; j < (int) sizeof(bench_keys[i]); j++)
+            bench_keys[i][j] = random() & 0xff;
+        b64_ntop(bench_keys[i], sizeof(bench_keys[i]), bench_b64[i],
+                 sizeof(bench_b64[i]));
+    }
+}
+
+static void
+report(const char *what, int level, struct timeval *start, long ops)
+{
+    struct timeval  stop;
+    double          secs;
+
+    gettimeofday(&stop, NULL);
+    secs = (stop.tv_sec - start->tv_sec) +
+        (stop.tv_usec - start->tv_usec) / 1000000.0;
+    printf("%-18s %-7s %10ld ops %8.2f ns/op\n", what, level_names[level],
+           ops, ops ? secs * 1e9 / ops : 0.0);
+    gettimeofday(start, NULL);
+}
+
+static void
+benchmark(int iterations, int max_level)
+{
+    struct timeval  start;
+    long            ops = (long) iterations * SIMD_BENCH_INPUTS;
+    volatile long   sink = 0;
+    u_char          wire[NS_MAXCDNAME];
+    char            text[NS_MAXDNAME];
+    u_char          key[256 + 32];
+    char            b64[400];
+    int             level, it, i;
+
+#define SIMD_BENCH(what, expr) do {                         \
+        gettimeofday(&start, NULL);                         \
+        for (it = 0; it < iterations; it++)                 \
+            for (i = 0; i < SIMD_BENCH_INPUTS; i++)         \
+                sink += (long) (expr);                      \
+        report(what, level, &start, ops);                   \
+    } while (0)
+
+    for (level = RES_SIMD_SCALAR; level <= max_level; level++) {
+        res_simd_set_level(level);
+        SIMD_BENCH("lower_name", (memcpy(wire, bench_names[i],
+                                         NS_MAXCDNAME),
+                                  lower(ns_t_ns, wire, NS_MAXCDNAME),
+                                  wire[1]));
+        SIMD_BENCH("ns_name_ntop", ns_name_ntop(bench_names[i], text,
+                                                sizeof(text)));
+        SIMD_BENCH("ns_name_pton", ns_name_pton(bench_texts[i], wire,
+                                                sizeof(wire)));
+#ifdef LIBVAL_NSEC3
+        {
+            u_char         *b32;
+            size_t          b32len;
+
+            SIMD_BENCH("base32hex_encode",
+                       (base32hex_encode(bench_keys[i], 20, &b32,
+                                         &b32len), FREE(b32), b32len));
+        }
+#endif
+        SIMD_BENCH("b64_ntop", b64_ntop(bench_keys[i],
+                                        sizeof(bench_keys[i]), b64,
+                                        sizeof(b64)));
+        SIMD_BENCH("b64_pton", b64_pton(bench_b64[i], key, sizeof(key)));
+    }
+
+#undef SIMD_BENCH
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"iterations", 1, 0, 'n'},
+    {"seed", 1, 0, 's'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int             iterations = 2000;
+    unsigned int    seed = (unsigned int) time(NULL);
+    int             c, max_level;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "hn:s:", prog_options, &opt_index);
+#else
+        c = getopt(argc, argv, "hn:s:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    max_level = res_simd_set_level(-1);
+    printf("vector level %s (seed %u)\n", level_names[max_level], seed);
+
+    srandom(seed);
+    verify(max_level);
+    make_bench_inputs();
+    if (iterations > 0)
+        benchmark(iterations, max_level);
+    res_simd_set_level(-1);
+
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("all vector primitives agree with the scalar code\n");
+    return 0;
+}
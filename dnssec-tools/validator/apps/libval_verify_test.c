@@ -0,0 +1,691 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * Signature verification benchmark and check for libval.  A set of
+ * zone keys is generated, a large TXT RRset is signed with every one of
+ * them, and the set is run through verify_next_assertion() the way the
+ * validator checks an answer, with VAL_QUERY_CHECK_ALL_RRSIGS so that
+ * every signature is verified.
+ *
+ * Each round checks the set both as an ordinary answer and as a
+ * wildcard expansion, and checks that a damaged RR is caught.  The
+ * report gives the time taken per validated answer and the number of
+ * bytes copied to build the signed data, compared with the number a
+ * separate buffer per signature would need, and the number of bytes
+ * hashed.  Optionally every key gets a decoy key with the same key tag,
+ * as happens when tags collide, so that the validator has to try two
+ * keys for every RRSIG; the hash made for the first is used again for
+ * the second.  Checking a set again, without rebuilding it, is timed
+ * separately.
+ */
+
+#include "validator-internal.h"
+#include "val_support.h"
+#include "val_verify.h"
+#include "val_parse.h"
+
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#endif
+
+#ifdef HAVE_GETOPT_LONG
+#include <getopt.h>
+#endif
+
+#define VERIFY_TEST_TTL     3600
+#define VERIFY_TEST_MAXKEYS 16
+
+/*
+ * a.example.com. and the *.example.com. name it is expanded from
+ */
+static u_char   owner_n[] = "\001a\007example\003com";
+static u_char   wcard_n[] = "\001*\007example\003com";
+static u_char   signer_n[] = "\007example\003com";
+
+struct test_key {
+    EVP_PKEY       *pkey;
+    u_char          rdata[1024];
+    size_t          rdata_len;
+    u_int16_t       tag;
+};
+
+static int      algorithm = ALG_RSASHA256;
+static int      decoys = 0;
+static int      failures = 0;
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-n, --iterations=<n>   validate the RRset <n> times (default 200)\n");
+    fprintf(stderr,
+            "\t-r, --records=<n>      number of RRs in the set (default 64)\n");
+    fprintf(stderr,
+            "\t-k, --keys=<n>         number of keys signing the set (default 2)\n");
+    fprintf(stderr,
+            "\t-a, --algorithm=<n>    DNSSEC algorithm number: 5 (RSASHA1), 8\n"
+            "\t                       (RSASHA256, the default), 10 (RSASHA512)"
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+            ",\n\t                       13 (ECDSAP256SHA256), 14 (ECDSAP384SHA384)"
+#endif
+#ifdef HAVE_EDDSA
+            ",\n\t                       15 (ED25519), 16 (ED448)"
+#endif
+            "\n");
+    fprintf(stderr,
+            "\t-c, --collide          give every key a decoy key with the\n"
+            "\t                       same key tag\n");
+    fprintf(stderr,
+            "\t-s, --seed=<n>         random seed for the RDATA\n");
+    fprintf(stderr,
+            "\t-h, --help             display usage and exit\n");
+}
+
+static const EVP_MD *
+algorithm_md(void)
+{
+    switch (algorithm) {
+    case ALG_RSASHA1:
+#ifdef LIBVAL_NSEC3
+    case ALG_NSEC3_RSASHA1:
+#endif
+        return EVP_sha1();
+    case ALG_RSASHA512:
+        return EVP_sha512();
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+    case ALG_ECDSAP384SHA384:
+        return EVP_sha384();
+#endif
+#ifdef HAVE_EDDSA
+    case ALG_ED25519:
+    case ALG_ED448:
+        /* EdDSA signs the message itself */
+        return NULL;
+#endif
+    default:
+        return EVP_sha256();
+    }
+}
+
+/*
+ * Generate a key for the algorithm and its DNSKEY RDATA
+ */
+static int
+make_key(struct test_key *key)
+{
+    EVP_PKEY_CTX   *pctx = NULL;
+    val_dnskey_rdata_t dnskey;
+    u_char         *cp = key->rdata;
+    int             ret = -1;
+
+    *cp++ = 0x01;               /* flags: zone key */
+    *cp++ = 0x00;
+    *cp++ = 3;                  /* protocol */
+    *cp++ = (u_char) algorithm;
+
+    key->pkey = NULL;
+    if (algorithm == ALG_RSASHA1 ||
+#ifdef LIBVAL_NSEC3
+        algorithm == ALG_NSEC3_RSASHA1 ||
+#endif
+        algorithm == ALG_RSASHA256 || algorithm == ALG_RSASHA512) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        BIGNUM         *n = NULL, *e = NULL;
+#else
+        RSA            *rsa;
+        const BIGNUM   *n, *e;
+#endif
+
+        if ((pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL)) == NULL ||
+            EVP_PKEY_keygen_init(pctx) <= 0 ||
+            EVP_PKEY_CTX_set_rsa_keygen_bits(pctx, 2048) <= 0 ||
+            EVP_PKEY_keygen(pctx, &key->pkey) <= 0)
+            goto done;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        if (!EVP_PKEY_get_bn_param(key->pkey, OSSL_PKEY_PARAM_RSA_N, &n) ||
+            !EVP_PKEY_get_bn_param(key->pkey, OSSL_PKEY_PARAM_RSA_E, &e)) {
+            BN_free(n);
+            BN_free(e);
+            goto done;
+        }
+#else
+        rsa = EVP_PKEY_get1_RSA(key->pkey);
+        RSA_get0_key(rsa, &n, &e, NULL);
+#endif
+        *cp++ = (u_char) BN_num_bytes(e);
+        cp += BN_bn2bin(e, cp);
+        cp += BN_bn2bin(n, cp);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        BN_free(n);
+        BN_free(e);
+#else
+        RSA_free(rsa);
+#endif
+    }
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+    else if (algorithm == ALG_ECDSAP256SHA256 ||
+             algorithm == ALG_ECDSAP384SHA384) {
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+        EC_KEY         *eckey;
+#endif
+        u_char          point[1 + 2 * 48];
+        size_t          len;
+
+        if ((pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL)) == NULL ||
+            EVP_PKEY_keygen_init(pctx) <= 0 ||
+            EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx,
+                    algorithm == ALG_ECDSAP256SHA256 ?
+                    NID_X9_62_prime256v1 : NID_secp384r1) <= 0 ||
+            EVP_PKEY_keygen(pctx, &key->pkey) <= 0)
+            goto done;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        /* generated keys encode their point uncompressed */
+        if (!EVP_PKEY_get_octet_string_param(key->pkey,
+                                             OSSL_PKEY_PARAM_PUB_KEY,
+                                             point, sizeof(point), &len))
+            goto done;
+#else
+        eckey = EVP_PKEY_get1_EC_KEY(key->pkey);
+        len = EC_POINT_point2oct(EC_KEY_get0_group(eckey),
+                                 EC_KEY_get0_public_key(eckey),
+                                 POINT_CONVERSION_UNCOMPRESSED, point,
+                                 sizeof(point), NULL);
+        EC_KEY_free(eckey);
+#endif
+        if (len < 1 || point[0] != POINT_CONVERSION_UNCOMPRESSED)
+            goto done;
+        /* DNSSEC keeps only x | y */
+        memcpy(cp, point + 1, len - 1);
+        cp += len - 1;
+    }
+#endif
+#ifdef HAVE_EDDSA
+    else if (algorithm == ALG_ED25519 || algorithm == ALG_ED448) {
+        size_t          len = algorithm == ALG_ED25519 ? 32 : 57;
+
+        if ((pctx = EVP_PKEY_CTX_new_id(algorithm == ALG_ED25519 ?
+                                        EVP_PKEY_ED25519 : EVP_PKEY_ED448,
+                                        NULL)) == NULL ||
+            EVP_PKEY_keygen_init(pctx) <= 0 ||
+            EVP_PKEY_keygen(pctx, &key->pkey) <= 0 ||
+            EVP_PKEY_get_raw_public_key(key->pkey, cp, &len) <= 0)
+            goto done;
+        cp += len;
+    }
+#endif
+    else {
+        fprintf(stderr, "algorithm %d is not supported\n", algorithm);
+        goto done;
+    }
+
+    key->rdata_len = cp - key->rdata;
+    if (val_parse_dnskey_rdata(key->rdata, key->rdata_len, &dnskey) !=
+        VAL_NO_ERROR)
+        goto done;
+    key->tag = dnskey.key_tag;
+    FREE(dnskey.public_key);
+    ret = 0;
+
+  done:
+    if (pctx)
+        EVP_PKEY_CTX_free(pctx);
+    return ret;
+}
+
+/*
+ * A DNSKEY with the same tag as key but a different public key.  The
+ * key tag is a sum of the RDATA taken 16 bits at a time, so adding one
+ * to a high octet near the end of the key and taking one from another
+ * leaves it unchanged.  The result is not a usable key, but the
+ * validator only finds that out once it has tried it.
+ */
+static int
+make_decoy(struct test_key *decoy, const struct test_key *key)
+{
+    size_t          up, down;
+
+    memcpy(decoy->rdata, key->rdata, key->rdata_len);
+    decoy->rdata_len = key->rdata_len;
+    decoy->pkey = NULL;
+    decoy->tag = key->tag;
+
+    for (up = (key->rdata_len - 1) & ~1; up > 4; up -= 2)
+        if (decoy->rdata[up] != 0xff)
+            break;
+    for (down = up - 2; down > 4; down -= 2)
+        if (decoy->rdata[down] != 0)
+            break;
+    if (up <= 4 || down <= 4)
+        return -1;
+    decoy->rdata[up]++;
+    decoy->rdata[down]--;
+    return 0;
+}
+
+/*
+ * Append one RR of the set, in canonical form, to buf
+ */
+static size_t
+canon_rr(u_char * buf, const u_char * name_n, struct rrset_rr *rr)
+{
+    size_t          len = wire_name_length(name_n);
+    u_char         *cp = buf;
+
+    memcpy(cp, name_n, len);
+    cp += len;
+    NS_PUT16(ns_t_txt, cp);
+    NS_PUT16(ns_c_in, cp);
+    NS_PUT32(VERIFY_TEST_TTL, cp);
+    NS_PUT16(rr->rr_rdata_length, cp);
+    memcpy(cp, rr->rr_rdata, rr->rr_rdata_length);
+    cp += rr->rr_rdata_length;
+    return cp - buf;
+}
+
+/*
+ * Sign the set with the key, with the RRSIG labels field set for
+ * name_n, and add the RRSIG to the set.  The signed data is assembled
+ * here independently of the library.
+ */
+static int
+sign_set(struct rrset_rec *set, struct test_key *key, const u_char * name_n,
+         size_t *signed_len)
+{
+    u_char          rrsig[SIGNBY + sizeof(signer_n) + 512];
+    u_char         *data, *cp;
+    size_t          len, siglen;
+    struct rrset_rr *rr;
+    EVP_MD_CTX     *mdctx;
+    time_t          now = time(NULL);
+    int             labels, ret = -1;
+
+    for (labels = 0, cp = (u_char *) name_n; *cp; cp += *cp + 1)
+        if (cp[0] != 1 || cp[1] != '*')
+            labels++;
+
+    cp = rrsig;
+    NS_PUT16(ns_t_txt, cp);
+    *cp++ = (u_char) algorithm;
+    *cp++ = (u_char) labels;
+    NS_PUT32(VERIFY_TEST_TTL, cp);
+    NS_PUT32(now + 86400, cp);
+    NS_PUT32(now - 3600, cp);
+    NS_PUT16(key->tag, cp);
+    memcpy(cp, signer_n, sizeof(signer_n));
+    cp += sizeof(signer_n);
+
+    len = cp - rrsig;
+    for (rr = set->rrs_data; rr; rr = rr->rr_next)
+        len += wire_name_length(name_n) + ENVELOPE + rr->rr_rdata_length;
+    if ((data = (u_char *) MALLOC(len)) == NULL)
+        return -1;
+    memcpy(data, rrsig, cp - rrsig);
+    len = cp - rrsig;
+    for (rr = set->rrs_data; rr; rr = rr->rr_next)
+        len += canon_rr(data + len, name_n, rr);
+    *signed_len = len;
+
+    if ((mdctx = EVP_MD_CTX_new()) == NULL)
+        goto done;
+    if (EVP_DigestSignInit(mdctx, NULL, algorithm_md(), NULL,
+                           key->pkey) <= 0)
+        goto done;
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+    if (algorithm == ALG_ECDSAP256SHA256 ||
+        algorithm == ALG_ECDSAP384SHA384) {
+        u_char          der[160];
+        const u_char   *dp = der;
+        ECDSA_SIG      *esig;
+        const BIGNUM   *r, *s;
+        int             half = algorithm == ALG_ECDSAP256SHA256 ? 32 : 48;
+
+        siglen = sizeof(der);
+        if (EVP_DigestSign(mdctx, der, &siglen, data, len) <= 0 ||
+            (esig = d2i_ECDSA_SIG(NULL, &dp, siglen)) == NULL)
+            goto done;
+        /* DNSSEC keeps r | s, not the DER encoding */
+        ECDSA_SIG_get0(esig, &r, &s);
+        BN_bn2binpad(r, cp, half);
+        BN_bn2binpad(s, cp + half, half);
+        ECDSA_SIG_free(esig);
+        siglen = 2 * half;
+    } else
+#endif
+    {
+        siglen = sizeof(rrsig) - (cp - rrsig);
+        if (EVP_DigestSign(mdctx, cp, &siglen, data, len) <= 0)
+            goto done;
+    }
+    cp += siglen;
+
+    if ((rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr) +
+                                         (cp - rrsig))) == NULL)
+        goto done;
+    memset(rr, 0, sizeof(struct rrset_rr));
+    rr->rr_rdata = RR_INLINE_RDATA(rr);
+    rr->rr_rdata_length = cp - rrsig;
+    memcpy(rr->rr_rdata, rrsig, rr->rr_rdata_length);
+    rr->rr_status = VAL_AC_UNSET;
+    rr->rr_next = set->rrs_sig;
+    set->rrs_sig = rr;
+    ret = 0;
+
+  done:
+    if (mdctx)
+        EVP_MD_CTX_free(mdctx);
+    FREE(data);
+    return ret;
+}
+
+static struct rrset_rec *
+make_set(u_int16_t type_h, const u_char * name_n)
+{
+    struct rrset_rec *set;
+    size_t          len = wire_name_length(name_n);
+
+    if ((set = (struct rrset_rec *) MALLOC(sizeof(struct rrset_rec))) ==
+        NULL)
+        return NULL;
+    memset(set, 0, sizeof(struct rrset_rec));
+    if ((set->rrs_name_n = (u_char *) MALLOC(len)) == NULL) {
+        FREE(set);
+        return NULL;
+    }
+    memcpy(set->rrs_name_n, name_n, len);
+    set->rrs_type_h = type_h;
+    set->rrs_class_h = ns_c_in;
+    set->rrs_ttl_h = VERIFY_TEST_TTL;
+    set->rrs_section = VAL_FROM_ANSWER;
+    return set;
+}
+
+static int
+rdata_cmp(const void *a, const void *b)
+{
+    const u_char   *ra = *(const u_char * const *) a;
+    const u_char   *rb = *(const u_char * const *) b;
+    int             ret = memcmp(ra + 1, rb + 1, ra[0] < rb[0] ? ra[0] : rb[0]);
+
+    return ret ? ret : ra[0] - rb[0];
+}
+
+/*
+ * A TXT RRset of single strings, in canonical order
+ */
+static int
+fill_set(struct rrset_rec *set, int records)
+{
+    u_char        **txt;
+    u_char          buf[256];
+    int             i, j, len;
+
+    if ((txt = (u_char **) MALLOC(records * sizeof(u_char *))) == NULL)
+        return -1;
+    for (i = 0; i < records; i++) {
+        len = 16 + random() % 200;
+        if ((txt[i] = (u_char *) MALLOC(len + 1)) == NULL)
+            return -1;
+        txt[i][0] = (u_char) len;
+        for (j = 1; j <= len; j++)
+            txt[i][j] = "abcdefghijklmnopqrstuvwxyz0123456789"[random() % 36];
+    }
+    qsort(txt, records, sizeof(u_char *), rdata_cmp);
+    for (i = 0; i < records; i++) {
+        memcpy(buf, txt[i], txt[i][0] + 1);
+        if (add_to_set(set, txt[i][0] + 1, buf) != VAL_NO_ERROR)
+            return -1;
+        FREE(txt[i]);
+    }
+    FREE(txt);
+    return 0;
+}
+
+static void
+reset_status(struct val_digested_auth_chain *as,
+             struct val_digested_auth_chain *keys)
+{
+    struct rrset_rr *rr;
+
+    as->val_ac_status = VAL_AC_INIT;
+    for (rr = as->val_ac_rrset.ac_data->rrs_sig; rr; rr = rr->rr_next)
+        rr->rr_status = VAL_AC_UNSET;
+    for (rr = keys->val_ac_rrset.ac_data->rrs_data; rr; rr = rr->rr_next)
+        rr->rr_status = VAL_AC_UNSET;
+}
+
+/*
+ * Validate the set once and check that every RRSIG got the expected
+ * status
+ */
+static int
+validate(struct val_digested_auth_chain *as,
+         struct val_digested_auth_chain *keys, val_astatus_t expect)
+{
+    struct rrset_rr *rr;
+    int             ok = 1;
+
+    reset_status(as, keys);
+    verify_next_assertion(NULL, as, keys,
+                          VAL_QUERY_CHECK_ALL_RRSIGS);
+    for (rr = as->val_ac_rrset.ac_data->rrs_sig; rr; rr = rr->rr_next)
+        if (rr->rr_status != expect)
+            ok = 0;
+    return ok;
+}
+
+static void
+check(const char *what, int ok)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static double
+elapsed_ns(const struct timeval *start, int count)
+{
+    struct timeval  end;
+
+    gettimeofday(&end, NULL);
+    return ((end.tv_sec - start->tv_sec) * 1e9 +
+            (end.tv_usec - start->tv_usec) * 1e3) / (count ? count : 1);
+}
+
+#ifdef HAVE_GETOPT_LONG
+static struct option prog_options[] = {
+    {"iterations", 1, 0, 'n'},
+    {"records", 1, 0, 'r'},
+    {"keys", 1, 0, 'k'},
+    {"algorithm", 1, 0, 'a'},
+    {"collide", 0, 0, 'c'},
+    {"seed", 1, 0, 's'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+};
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    int             iterations = 200, records = 64, nkeys = 2;
+    unsigned int    seed = (unsigned int) time(NULL);
+    struct test_key keys[VERIFY_TEST_MAXKEYS];
+    struct rrset_rec *plain, *wild, *keyset;
+    struct val_digested_auth_chain plain_as, wild_as, key_as;
+    struct rrset_rr *rr;
+    size_t          signed_len = 0;
+    val_stats_t     before, after;
+    struct timeval  start;
+    double          ns;
+    int             c, i;
+
+    while (1) {
+#ifdef HAVE_GETOPT_LONG
+        int             opt_index = 0;
+        c = getopt_long(argc, argv, "hn:r:k:a:cs:", prog_options,
+                        &opt_index);
+#else
+        c = getopt(argc, argv, "hn:r:k:a:cs:");
+#endif
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'r':
+            records = atoi(optarg);
+            break;
+        case 'k':
+            nkeys = atoi(optarg);
+            break;
+        case 'a':
+            algorithm = atoi(optarg);
+            break;
+        case 'c':
+            decoys = 1;
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (records < 1 || nkeys < 1 || nkeys > VERIFY_TEST_MAXKEYS) {
+        usage(argv[0]);
+        return 1;
+    }
+    srandom(seed);
+
+    if ((plain = make_set(ns_t_txt, owner_n)) == NULL ||
+        (wild = make_set(ns_t_txt, owner_n)) == NULL ||
+        (keyset = make_set(ns_t_dnskey, signer_n)) == NULL ||
+        fill_set(plain, records) != 0) {
+        fprintf(stderr, "could not build the RRset\n");
+        return 1;
+    }
+    for (rr = plain->rrs_data; rr; rr = rr->rr_next)
+        add_to_set(wild, rr->rr_rdata_length, rr->rr_rdata);
+
+    for (i = 0; i < nkeys; i++) {
+        struct test_key decoy;
+
+        if (make_key(&keys[i]) != 0 ||
+            (decoys && (make_decoy(&decoy, &keys[i]) != 0 ||
+                        add_to_set(keyset, decoy.rdata_len,
+                                   decoy.rdata) != VAL_NO_ERROR)) ||
+            add_to_set(keyset, keys[i].rdata_len,
+                       keys[i].rdata) != VAL_NO_ERROR ||
+            sign_set(plain, &keys[i], owner_n, &signed_len) != 0 ||
+            sign_set(wild, &keys[i], wcard_n, &signed_len) != 0) {
+            fprintf(stderr, "could not sign the RRset\n");
+            return 1;
+        }
+    }
+
+    memset(&plain_as, 0, sizeof(plain_as));
+    memset(&wild_as, 0, sizeof(wild_as));
+    memset(&key_as, 0, sizeof(key_as));
+    plain_as.val_ac_rrset.ac_data = plain;
+    wild_as.val_ac_rrset.ac_data = wild;
+    key_as.val_ac_rrset.ac_data = keyset;
+
+    printf("algorithm %d, %d RRs, %d keys%s, %lu bytes signed per RRSIG "
+           "(seed %u)\n", algorithm, records, nkeys,
+           decoys ? " with decoys" : "", (unsigned long) signed_len, seed);
+
+    check("answer verifies",
+          validate(&plain_as, &key_as, VAL_AC_RRSIG_VERIFIED));
+    check("wildcard expansion verifies",
+          validate(&wild_as, &key_as, VAL_AC_WCARD_VERIFIED));
+    check("answer verifies again",
+          validate(&plain_as, &key_as, VAL_AC_RRSIG_VERIFIED));
+
+    /*
+     * A changed RR must be noticed, even though the set has been
+     * verified before
+     */
+    rr = plain->rrs_data;
+    rr->rr_rdata[1] ^= 0x01;
+    free_rrset_canon(plain);
+    check("damaged RR is rejected",
+          validate(&plain_as, &key_as, VAL_AC_RRSIG_VERIFY_FAILED));
+    rr->rr_rdata[1] ^= 0x01;
+    free_rrset_canon(plain);
+    check("repaired RR verifies",
+          validate(&plain_as, &key_as, VAL_AC_RRSIG_VERIFIED));
+
+    /*
+     * Every round starts from a freshly built set, as every answer
+     * the validator receives does
+     */
+    val_get_stats(&before, sizeof(before));
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++) {
+        free_rrset_canon(plain);
+        validate(&plain_as, &key_as, VAL_AC_RRSIG_VERIFIED);
+    }
+    ns = elapsed_ns(&start, iterations);
+    val_get_stats(&after, sizeof(after));
+
+    printf("%12.0f ns per validated answer, %.0f ns per RRSIG "
+           "(%.0f RRSIGs/s)\n", ns, ns / nkeys, ns > 0 ? 1e9 * nkeys / ns : 0);
+    if (iterations > 0) {
+        printf("%12.0f bytes of signed data built per validated answer "
+               "(%lu with a buffer per RRSIG)\n",
+               (double) (after.vs_sig_bytes - before.vs_sig_bytes) /
+               iterations, (unsigned long) (signed_len * nkeys));
+        printf("%12.0f bytes hashed per validated answer (%lu hashing "
+               "for every key tried), %.1f hashes used again\n",
+               (double) (after.vs_sig_hash_bytes -
+                         before.vs_sig_hash_bytes) / iterations,
+               (unsigned long) (signed_len * nkeys * (decoys ? 2 : 1)),
+               (double) (after.vs_sig_hash_reused -
+                         before.vs_sig_hash_reused) / iterations);
+        printf("%12.1f parsed keys used again per validated answer\n",
+               (double) (after.vs_key_cache_hits -
+                         before.vs_key_cache_hits) / iterations);
+    }
+
+    /*
+     * Checking the same set again finds its canonical form and hashes
+     * already made
+     */
+    gettimeofday(&start, NULL);
+    for (i = 0; i < iterations; i++)
+        validate(&plain_as, &key_as, VAL_AC_RRSIG_VERIFIED);
+    ns = elapsed_ns(&start, iterations);
+    printf("%12.0f ns per repeated check of the same answer\n", ns);
+
+    for (i = 0; i < nkeys; i++)
+        EVP_PKEY_free(keys[i].pkey);
+    res_sq_free_rrset_recs(&plain);
+    res_sq_free_rrset_recs(&wild);
+    res_sq_free_rrset_recs(&keyset);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all signatures verified as expected\n");
+    return 0;
+}
@@ -0,0 +1,414 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Batch lookups for dt-getrrset, dt-getaddr and dt-gethost.
+ *
+ * Names are read from a file or stdin, one per line:
+ *
+ *      <name> [<class>] [<type>]
+ *
+ * and submitted with val_async_submit(), keeping up to a fixed number
+ * of queries in flight.  The input is read only as fast as queries
+ * complete, so lists of any length can be streamed through.  Every
+ * answer is written to stdout as soon as it arrives, as one JSON
+ * object per line:
+ *
+ *      {"name":"www.example.com","class":"IN","type":"A",
+ *       "status":"VAL_SUCCESS","validated":true,"trusted":true,
+ *       "ms":0.412,"rrs":1,"data":["192.0.2.1"]}
+ *
+ * ("data" only for A and AAAA answers), and the throughput, status
+ * counts and cache statistics of the run are written to stderr at the
+ * end.  Blank lines and lines starting with '#' or ';' are ignored.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+#include "lookup_batch.h"
+
+#ifndef VAL_NO_ASYNC
+
+#define BATCH_MAX_TYPES 8
+
+typedef struct batch_query_st {
+    char                name[NS_MAXDNAME];
+    int                 qc;
+    int                 qt;
+    int                 slot;
+    int                 done;
+    struct timeval      start;
+    val_async_status   *as;
+    struct batch_run_st *run;
+} batch_query;
+
+typedef struct batch_run_st {
+    FILE               *fp;
+    const char         *file;
+    int                 lineno;
+    int                 eof;
+
+    /* the line being submitted, one query per type */
+    char                name[NS_MAXDNAME];
+    int                 qc;
+    int                 types[BATCH_MAX_TYPES];
+    int                 ntypes;
+    int                 next_type;
+
+    const int          *default_types;
+    int                 default_ntypes;
+    u_int32_t           flags;
+
+    batch_query        *queries;
+    int                *free_slots;
+    int                 nfree;
+    int                 in_flight;
+
+    unsigned long       submitted;
+    unsigned long       answered;
+    unsigned long       errors;
+    unsigned long       status_count[256];
+    double              total_ms;
+    double              max_ms;
+} batch_run;
+
+static double
+batch_msec(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 +
+        (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+static void
+batch_print_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            printf("\\u%04x", (unsigned char) *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+/*
+ * Read input lines until one names something to look up.  Returns 1
+ * when a line is ready and 0 at the end of the input.  Lines that
+ * cannot be parsed are reported, counted as errors and skipped.
+ */
+static int
+batch_next_line(batch_run *run)
+{
+    char            line[NS_MAXDNAME + 64];
+
+    while (fgets(line, sizeof(line), run->fp)) {
+        char           *tok, *save = NULL, *name = NULL;
+        int             qc = ns_c_in, qt = -1, success, v;
+
+        ++run->lineno;
+        for (tok = strtok_r(line, " \t\r\n", &save); tok;
+             tok = strtok_r(NULL, " \t\r\n", &save)) {
+            if (NULL == name) {
+                if (*tok == '#' || *tok == ';')
+                    break;
+                name = tok;
+                continue;
+            }
+            v = res_nametoclass(tok, &success);
+            if (success) {
+                qc = v;
+                continue;
+            }
+            v = res_nametotype(tok, &success);
+            if (success) {
+                qt = v;
+                continue;
+            }
+            fprintf(stderr, "%s:%d: unknown class or type %s\n", run->file,
+                    run->lineno, tok);
+            ++run->errors;
+            name = NULL;
+            break;
+        }
+        if (NULL == name)
+            continue;
+        if (strlen(name) >= sizeof(run->name)) {
+            fprintf(stderr, "%s:%d: name too long\n", run->file,
+                    run->lineno);
+            ++run->errors;
+            continue;
+        }
+
+        strcpy(run->name, name);
+        run->qc = qc;
+        if (qt >= 0) {
+            run->types[0] = qt;
+            run->ntypes = 1;
+        } else {
+            memcpy(run->types, run->default_types,
+                   run->default_ntypes * sizeof(int));
+            run->ntypes = run->default_ntypes;
+        }
+        run->next_type = 0;
+        return 1;
+    }
+    return 0;
+}
+
+static void
+batch_print_result(batch_query *q, struct val_result_chain *results,
+                   double ms)
+{
+    struct val_result_chain *res;
+    struct val_rrset_rec *answer = NULL;
+    struct val_rr_rec *rr;
+    val_status_t    status;
+    int             count = 0;
+
+    /* report the result that holds the requested type, if any */
+    for (res = results; res; res = res->val_rc_next) {
+        if (res->val_rc_rrset && res->val_rc_rrset->val_rrset_type == q->qt) {
+            answer = res->val_rc_rrset;
+            break;
+        }
+    }
+    if (answer == NULL)
+        res = results;
+    status = res ? res->val_rc_status : VAL_DONT_KNOW;
+    ++q->run->status_count[status];
+
+    printf("{\"name\":");
+    batch_print_string(q->name);
+    printf(",\"class\":\"%s\",\"type\":\"%s\",\"status\":\"%s\","
+           "\"validated\":%s,\"trusted\":%s,\"ms\":%.3f",
+           p_class(q->qc), p_sres_type(q->qt), p_val_status(status),
+           val_isvalidated(status) ? "true" : "false",
+           val_istrusted(status) ? "true" : "false", ms);
+
+    if (answer)
+        for (rr = answer->val_rrset_data; rr; rr = rr->rr_next)
+            count++;
+    printf(",\"rrs\":%d", count);
+
+    if (count && (q->qt == ns_t_a || q->qt == ns_t_aaaa)) {
+        char            buf[INET6_ADDRSTRLEN];
+        const char     *sep = "";
+
+        printf(",\"data\":[");
+        for (rr = answer->val_rrset_data; rr; rr = rr->rr_next) {
+            int             af = (q->qt == ns_t_a) ? AF_INET : AF_INET6;
+
+            if (rr->rr_rdata_length != ((af == AF_INET) ? 4 : 16) ||
+                inet_ntop(af, rr->rr_rdata, buf, sizeof(buf)) == NULL)
+                continue;
+            printf("%s\"%s\"", sep, buf);
+            sep = ",";
+        }
+        printf("]");
+    }
+    printf("}\n");
+}
+
+static int
+batch_callback(val_async_status *as, int event, val_context_t *ctx,
+               void *cb_data, val_cb_params_t *cbp)
+{
+    batch_query    *q = (batch_query *) cb_data;
+    batch_run      *run;
+    struct timeval  end;
+    double          ms;
+
+    if ((NULL == q) || (NULL == q->run))
+        return VAL_BAD_ARGUMENT;
+    run = q->run;
+
+    gettimeofday(&end, NULL);
+    ms = batch_msec(&q->start, &end);
+
+    if (event != VAL_AS_EVENT_COMPLETED || NULL == cbp ||
+        cbp->retval != VAL_NO_ERROR) {
+        printf("{\"name\":");
+        batch_print_string(q->name);
+        printf(",\"class\":\"%s\",\"type\":\"%s\",\"error\":\"%s\","
+               "\"ms\":%.3f}\n", p_class(q->qc), p_sres_type(q->qt),
+               (event != VAL_AS_EVENT_COMPLETED || NULL == cbp) ?
+               "canceled" : p_val_err(cbp->retval), ms);
+        ++run->errors;
+    } else {
+        batch_print_result(q, cbp->results, ms);
+        ++run->answered;
+        run->total_ms += ms;
+        if (ms > run->max_ms)
+            run->max_ms = ms;
+    }
+    if (cbp) {
+        val_free_result_chain(cbp->results);
+        cbp->results = NULL;
+    }
+
+    q->as = NULL;
+    q->done = 1;
+    run->free_slots[run->nfree++] = q->slot;
+    --run->in_flight;
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ * submit queries from the input until the window is full
+ */
+static void
+batch_fill_window(val_context_t *context, batch_run *run)
+{
+    int             rc;
+
+    while (run->nfree > 0 && !run->eof) {
+        batch_query    *q;
+
+        if (run->next_type >= run->ntypes && !batch_next_line(run)) {
+            run->eof = 1;
+            break;
+        }
+
+        q = &run->queries[run->free_slots[--run->nfree]];
+        strcpy(q->name, run->name);
+        q->qc = run->qc;
+        q->qt = run->types[run->next_type++];
+        q->run = run;
+        q->done = 0;
+        ++run->in_flight;
+        ++run->submitted;
+        gettimeofday(&q->start, NULL);
+        rc = val_async_submit(context, q->name, q->qc, q->qt, run->flags,
+                              &batch_callback, q, &q->as);
+        if (rc != VAL_NO_ERROR && !q->done) {
+            printf("{\"name\":");
+            batch_print_string(q->name);
+            printf(",\"class\":\"%s\",\"type\":\"%s\",\"error\":\"%s\","
+                   "\"ms\":0.000}\n", p_class(q->qc), p_sres_type(q->qt),
+                   p_val_err(rc));
+            ++run->errors;
+            run->free_slots[run->nfree++] = q->slot;
+            --run->in_flight;
+        }
+    }
+}
+
+int
+lookup_batch(const char *file, const int *types, int ntypes,
+             u_int32_t flags, int window)
+{
+    val_context_t  *context = NULL;
+    batch_run       run;
+    val_stats_t     before, after;
+    struct timeval  start, end, tv;
+    double          elapsed;
+    unsigned long   lookups;
+    int             i, ret = 0;
+
+    if (window < 1 || ntypes < 1 || ntypes > BATCH_MAX_TYPES)
+        return -1;
+
+    memset(&run, 0, sizeof(run));
+    run.file = file;
+    run.default_types = types;
+    run.default_ntypes = ntypes;
+    run.flags = flags;
+    if (!strcmp(file, "-"))
+        run.fp = stdin;
+    else if ((run.fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    run.queries = (batch_query *) MALLOC(window * sizeof(batch_query));
+    run.free_slots = (int *) MALLOC(window * sizeof(int));
+    if (run.queries == NULL || run.free_slots == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        ret = -1;
+        goto done;
+    }
+    memset(run.queries, 0, window * sizeof(batch_query));
+    for (i = 0; i < window; i++) {
+        run.queries[i].slot = i;
+        run.free_slots[run.nfree++] = window - 1 - i;
+    }
+
+    if (val_create_context(NULL, &context) != VAL_NO_ERROR) {
+        fprintf(stderr, "Cannot create validator context\n");
+        ret = -1;
+        goto done;
+    }
+
+    val_get_stats(&before, sizeof(before));
+    gettimeofday(&start, NULL);
+
+    while (1) {
+        batch_fill_window(context, &run);
+        if (run.in_flight == 0 && run.eof)
+            break;
+
+        /** libval selects on its own sockets; answers may also come from the cache */
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        val_async_check_wait(context, NULL, NULL, &tv, 0);
+        fflush(stdout);
+    }
+    if (run.in_flight)
+        val_async_cancel_all(context, VAL_AS_CANCEL_NO_CALLBACKS);
+    fflush(stdout);
+
+    gettimeofday(&end, NULL);
+    val_get_stats(&after, sizeof(after));
+    elapsed = batch_msec(&start, &end) / 1000.0;
+
+    fprintf(stderr, "%lu queries (%lu answered, %lu errors) in %.3f sec, "
+            "%.1f queries/sec\n", run.submitted, run.answered, run.errors,
+            elapsed, elapsed > 0 ? run.submitted / elapsed : 0.0);
+    if (run.answered)
+        fprintf(stderr, "  latency ms mean %.3f max %.3f\n",
+                run.total_ms / run.answered, run.max_ms);
+    lookups = (after.vs_cache_hits - before.vs_cache_hits) +
+        (after.vs_cache_misses - before.vs_cache_misses);
+    fprintf(stderr, "  cache hits %lu of %lu lookups (%.1f%%), "
+            "%lu network queries, %lu validated\n",
+            after.vs_cache_hits - before.vs_cache_hits, lookups, lookups ?
+            100.0 * (after.vs_cache_hits - before.vs_cache_hits) / lookups :
+            0.0,
+            after.vs_net_queries - before.vs_net_queries,
+            after.vs_validated - before.vs_validated);
+    for (i = 0; i < 256; i++)
+        if (run.status_count[i])
+            fprintf(stderr, "  %-30s %lu\n", p_val_status(i),
+                    run.status_count[i]);
+
+    if (ret == 0)
+        ret = (int) run.errors;
+
+  done:
+    if (context)
+        val_free_context(context);
+    if (run.queries)
+        FREE(run.queries);
+    if (run.free_slots)
+        FREE(run.free_slots);
+    if (run.fp != stdin)
+        fclose(run.fp);
+    return ret;
+}
+
+#else /* VAL_NO_ASYNC */
+
+int
+lookup_batch(const char *file, const int *types, int ntypes,
+             u_int32_t flags, int window)
+{
+    fprintf(stderr, "async support not available\n");
+    return -1;
+}
+
+#endif /* VAL_NO_ASYNC */
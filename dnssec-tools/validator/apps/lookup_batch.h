@@ -0,0 +1,22 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Batch lookups for dt-getrrset, dt-getaddr and dt-gethost.
+ */
+#ifndef LOOKUP_BATCH_H
+#define LOOKUP_BATCH_H
+
+#define LOOKUP_BATCH_WINDOW 100
+
+/*
+ * Look up every name listed in file ("-" for stdin), with up to window
+ * queries in flight, and write one JSON object per answer to stdout.
+ * Each name is looked up for every type in types, unless its line
+ * names a type.  A summary goes to stderr.  Returns the number of
+ * queries that failed, or -1 if the batch could not be run.
+ */
+int lookup_batch(const char *file, const int *types, int ntypes,
+                 u_int32_t flags, int window);
+
+#endif /* LOOKUP_BATCH_H */
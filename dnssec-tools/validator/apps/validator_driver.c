@@ -57,6 +57,10 @@ static struct option prog_options[] = {
     {"root-hints", 1, 0, 'i'},
     {"wait", 1, 0, 'w'},
     {"inflight", 1, 0, 'I'},
+    {"replay", 1, 0, 'R'},
+    {"event-loop", 0, 0, 'E'},
+    {"workers", 1, 0, 'W'},
+    {"perf-report", 1, 0, 'P'},
     {"Version", 1, 0, 'V'},
     {0, 0, 0, 0}
 };
@@ -283,7 +287,20 @@ usage(char *progname)
     printf("        -r, --resolv-conf=<file> Specifies a resolv.conf to search for nameservers\n");
     printf("        -i, --root-hints=<file> Specifies a root.hints to search for root nameservers\n");
     printf("        -I, --inflight=<number> Maximum number of simultaneous queries\n");
-    printf("        -m, --multi-thread=<number> Maximum number of simultaneous threads\n");
+    printf("        -m, --multi-thread=<number>[-<number>]\n");
+    printf("                               Maximum number of simultaneous threads; with\n");
+    printf("                               -R, replay in each thread count of the range,\n");
+    printf("                               doubling, and report how throughput scales\n");
+    printf("        -P, --perf-report=<format>[:<file>]\n");
+    printf("                               Report latency, throughput and cache\n");
+    printf("                               statistics for self tests; <format> is\n");
+    printf("                               one of text, json, csv (default stdout)\n");
+    printf("        -R, --replay=<file>    Replay the queries in <file> and report\n");
+    printf("                               throughput, latency and heap usage\n");
+    printf("        -E, --event-loop       Drive replayed queries with poll() and the\n");
+    printf("                               event loop API instead of select()\n");
+    printf("        -W, --workers=<number> Let <number> libval worker threads drive\n");
+    printf("                               the replayed queries\n");
     printf("        -w, --wait=<secs> Run tests in a loop, sleeping for specifed seconds between runs\n");
     printf("        -l, --label=<label-string> Specifies the policy to use during validation\n");
     printf("        -o, --output=<debug-level>:<dest-type>[:<dest-options>]\n");
@@ -709,14 +726,17 @@ main(int argc, char *argv[])
     // Parse the command line for a query and resolve+validate it
     int             c;
     char           *domain_name = NULL;
-    const char     *args = "c:dF:hi:I:l:m:nw:o:pr:S:st:T:v:V";
+    const char     *args = "c:dEF:hi:I:l:m:nw:W:o:pP:r:R:S:st:T:v:V";
     int            class_h = ns_c_in;
     int            type_h = ns_t_a;
     int             success = 0;
     int             doprint = 0;
     int             selftest = 0;
     int             num_threads = 0;
+    int             min_threads = 0;
     int             max_in_flight = 1;
+    int             event_loop = 0;
+    int             workers = 0;
     int             daemon = 0;
     //u_int32_t       flags = VAL_QUERY_AC_DETAIL|VAL_QUERY_NO_EDNS0_FALLBACK;
     u_int32_t       flags = VAL_QUERY_AC_DETAIL, nodnssec_flag = 0;
@@ -725,6 +745,8 @@ main(int argc, char *argv[])
     int             wait = 0;
     char           *label_str = NULL, *nextarg = NULL;
     char           *suite = NULL, *testcase_config = NULL;
+    char           *replay_file = NULL;
+    FILE           *report_fp = NULL;
     val_log_t      *logp;
     int             rc;
 
@@ -827,6 +849,10 @@ main(int argc, char *argv[])
 
         case 'm':
             num_threads = atoi(optarg);
+            if (NULL != (nextarg = strchr(optarg, '-'))) {
+                min_threads = num_threads;
+                num_threads = atoi(nextarg + 1);
+            }
             break;
 
         case 'v':
@@ -841,6 +867,58 @@ main(int argc, char *argv[])
             resolv_conf_set(optarg);
             break;
 
+        case 'R':
+            replay_file = optarg;
+            break;
+
+        case 'W':
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+            workers = atoi(optarg);
+#else
+            fprintf(stderr, "libval was built without thread support\n");
+            fprintf(stderr, "ignoring -W parameter\n");
+#endif
+            break;
+
+        case 'E':
+#ifndef VAL_NO_ASYNC
+            event_loop = 1;
+#else
+            fprintf(stderr, "libval was built without asynchronous support\n");
+            fprintf(stderr, "ignoring -E parameter\n");
+#endif /* ndef VAL_NO_ASYNC */
+            break;
+
+        case 'P':
+            {
+                int   format = SELFTEST_REPORT_NONE;
+                char *file = strchr(optarg, ':');
+
+                if (file)
+                    *file++ = '\0';
+                if (!strcasecmp(optarg, "text"))
+                    format = SELFTEST_REPORT_TEXT;
+                else if (!strcasecmp(optarg, "json"))
+                    format = SELFTEST_REPORT_JSON;
+                else if (!strcasecmp(optarg, "csv"))
+                    format = SELFTEST_REPORT_CSV;
+                else {
+                    fprintf(stderr, "Unknown report format %s\n", optarg);
+                    usage(argv[0]);
+                    return -1;
+                }
+                if (report_fp && report_fp != stdout)
+                    fclose(report_fp);
+                report_fp = file ? fopen(file, "w") : stdout;
+                if (NULL == report_fp) {
+                    fprintf(stderr, "Cannot open %s: %s\n", file,
+                            strerror(errno));
+                    return -1;
+                }
+                selftest_set_report(format, report_fp);
+            }
+            break;
+
         case 'w':
             wait = strtol(optarg, &nextarg, 10);
             break; 
@@ -905,6 +983,19 @@ main(int argc, char *argv[])
                               VAL_QUERY_DONT_VALIDATE);
     }
 
+    if (replay_file && num_threads > 0) {
+        rc = replay_scaling(context, replay_file, flags,
+                            (min_threads > 0) ? min_threads : num_threads,
+                            num_threads);
+        goto done;
+    }
+
+    if (replay_file) {
+        rc = replay_queries(context, replay_file, flags, max_in_flight,
+                            event_loop, workers, doprint);
+        goto done;
+    }
+
     // optind is a global variable.  See man page for getopt_long(3)
     if (optind >= argc) {
         if (!selftest && (tcs == -1)) {
@@ -962,6 +1053,8 @@ main(int argc, char *argv[])
 #endif /* VAL_NO_THREADS */
 
 done:
+    if (report_fp && report_fp != stdout)
+        fclose(report_fp);
     if (context)
         val_free_context(context);
     val_free_validator_state();
@@ -22,5 +22,39 @@ int check_results(val_context_t * context, const char *desc, char * name,
                   const int *result_ar, struct val_result_chain *results,
                   int trusted_only, struct timeval *start);
 
+/*
+ * latency samples, in milliseconds
+ */
+typedef struct latency_stats_st {
+    double             *samples;
+    int                 count;
+    int                 alloc;
+    int                 sorted;
+} latency_stats;
+
+double tv_diff_msec(const struct timeval *start, const struct timeval *end);
+int latency_add(latency_stats *ls, double msec);
+double latency_percentile(latency_stats *ls, double pct);
+double latency_mean(const latency_stats *ls);
+void latency_free(latency_stats *ls);
+
+#define LATENCY_HISTOGRAM_BUCKETS 16
+void latency_histogram(const latency_stats *ls, int *buckets, int nbuckets);
+
+/*
+ * self test performance report formats
+ */
+#define SELFTEST_REPORT_NONE 0
+#define SELFTEST_REPORT_TEXT 1
+#define SELFTEST_REPORT_JSON 2
+#define SELFTEST_REPORT_CSV  3
+
+void selftest_set_report(int format, FILE *fp);
+
+int replay_queries(val_context_t *context, const char *file,
+                   u_int32_t flags, int max_in_flight, int event_loop,
+                   int workers, int doprint);
+int replay_scaling(val_context_t *context, const char *file,
+                   u_int32_t flags, int min_threads, int max_threads);
 
 #endif /* VALIDATOR_DRIVER_H */
@@ -0,0 +1,856 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ *
+ * Query replay for dt-validate.
+ *
+ * A recorded query stream is fed through libval, either one query at a
+ * time or asynchronously with a bounded number of queries in flight,
+ * and the throughput, latency distribution, validation results and
+ * heap usage of the run are reported.  Together with dt-authserv this
+ * allows repeatable, offline measurements of the validator.
+ *
+ * The query file contains one query per line:
+ *
+ *      <name> [<class>] [<type>]
+ *
+ * Class defaults to IN and type to A.  Blank lines and lines starting
+ * with '#' or ';' are ignored.
+ */
+
+#include "validator/validator-config.h"
+#include <validator/validator.h>
+#include <validator/resolver.h>
+#include "validator_driver.h"
+
+#if !defined(VAL_NO_ASYNC) && !defined(WIN32)
+#include <poll.h>
+#define REPLAY_HAVE_POLL 1
+#endif
+
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+#include <pthread.h>
+#define REPLAY_HAVE_THREADS 1
+#ifndef VAL_NO_ASYNC
+#define REPLAY_HAVE_ENGINE 1
+#endif
+#endif
+
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+#include <malloc.h>
+#define REPLAY_HAVE_MALLINFO2 1
+#endif
+
+typedef struct replay_query_st {
+    char               *name;
+    int                 qc;
+    int                 qt;
+    struct timeval      start;
+#ifndef VAL_NO_ASYNC
+    val_async_status   *as;
+    struct replay_run_st *run;
+#endif
+} replay_query;
+
+typedef struct replay_run_st {
+    replay_query       *queries;
+    int                 count;
+    int                 in_flight;
+    int                 remaining;
+    int                 errors;
+    int                 doprint;
+    int                 status_count[256];
+    latency_stats       latency;
+#ifdef REPLAY_HAVE_ENGINE
+    /* callbacks come from libval's worker threads */
+    pthread_mutex_t    *lock;
+    pthread_cond_t     *done;
+#endif
+} replay_run;
+
+/*============================================================================
+ *
+ * LATENCY SAMPLES
+ *
+ *===========================================================================*/
+
+double
+tv_diff_msec(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000.0 +
+        (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+int
+latency_add(latency_stats *ls, double msec)
+{
+    if (ls->count == ls->alloc) {
+        int     n = ls->alloc ? ls->alloc * 2 : 1024;
+        double *s = (double *) realloc(ls->samples, n * sizeof(double));
+        if (s == NULL)
+            return -1;
+        ls->samples = s;
+        ls->alloc = n;
+    }
+    ls->samples[ls->count++] = msec;
+    ls->sorted = 0;
+    return 0;
+}
+
+static int
+latency_cmp(const void *a, const void *b)
+{
+    double  da = *(const double *) a;
+    double  db = *(const double *) b;
+
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+/*
+ * Return the given percentile (0-100) of the collected samples, using
+ * the nearest-rank method.
+ */
+double
+latency_percentile(latency_stats *ls, double pct)
+{
+    int     rank;
+
+    if (ls->count == 0)
+        return 0.0;
+    if (!ls->sorted) {
+        qsort(ls->samples, ls->count, sizeof(double), latency_cmp);
+        ls->sorted = 1;
+    }
+    rank = (int) ((pct / 100.0) * ls->count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > ls->count)
+        rank = ls->count;
+    return ls->samples[rank - 1];
+}
+
+double
+latency_mean(const latency_stats *ls)
+{
+    double  sum = 0.0;
+    int     i;
+
+    if (ls->count == 0)
+        return 0.0;
+    for (i = 0; i < ls->count; i++)
+        sum += ls->samples[i];
+    return sum / ls->count;
+}
+
+/*
+ * Count the samples in power-of-two buckets: bucket 0 holds samples
+ * below 1ms, bucket i those in [2^(i-1), 2^i) ms, and the last bucket
+ * everything larger.
+ */
+void
+latency_histogram(const latency_stats *ls, int *buckets, int nbuckets)
+{
+    int     i, b;
+
+    memset(buckets, 0, nbuckets * sizeof(int));
+    for (i = 0; i < ls->count; i++) {
+        double  limit = 1.0;
+
+        for (b = 0; b < nbuckets - 1 && ls->samples[i] >= limit; b++)
+            limit *= 2.0;
+        ++buckets[b];
+    }
+}
+
+void
+latency_free(latency_stats *ls)
+{
+    free(ls->samples);
+    memset(ls, 0, sizeof(*ls));
+}
+
+/*============================================================================
+ *
+ * QUERY FILE
+ *
+ *===========================================================================*/
+
+static void
+replay_free_queries(replay_query *queries, int count)
+{
+    int i;
+
+    if (queries == NULL)
+        return;
+    for (i = 0; i < count; i++)
+        FREE(queries[i].name);
+    FREE(queries);
+}
+
+static int
+replay_read_queries(const char *file, replay_query **queries, int *count)
+{
+    FILE           *fp;
+    char            line[1024];
+    int             lineno = 0, alloc = 0;
+    replay_query   *q = NULL;
+
+    *queries = NULL;
+    *count = 0;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Cannot open query file %s: %s\n", file,
+                strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char           *tok, *save = NULL, *name = NULL;
+        int             qc = ns_c_in, qt = ns_t_a, success, v;
+
+        ++lineno;
+        for (tok = strtok_r(line, " \t\r\n", &save); tok;
+             tok = strtok_r(NULL, " \t\r\n", &save)) {
+            if (NULL == name) {
+                if (*tok == '#' || *tok == ';')
+                    break;
+                name = tok;
+                continue;
+            }
+            v = res_nametoclass(tok, &success);
+            if (success) {
+                qc = v;
+                continue;
+            }
+            v = res_nametotype(tok, &success);
+            if (success) {
+                qt = v;
+                continue;
+            }
+            fprintf(stderr, "%s:%d: unknown class or type %s\n", file,
+                    lineno, tok);
+            goto err;
+        }
+        if (NULL == name)
+            continue;
+
+        if (*count == alloc) {
+            replay_query *tmp;
+
+            alloc = alloc ? alloc * 2 : 256;
+            tmp = (replay_query *) MALLOC(alloc * sizeof(replay_query));
+            if (NULL == tmp)
+                goto err;
+            if (*count)
+                memcpy(tmp, q, *count * sizeof(replay_query));
+            FREE(q);
+            q = tmp;
+        }
+        memset(&q[*count], 0, sizeof(replay_query));
+        q[*count].name = STRDUP(name);
+        q[*count].qc = qc;
+        q[*count].qt = qt;
+        if (NULL == q[*count].name)
+            goto err;
+        ++(*count);
+    }
+    fclose(fp);
+    *queries = q;
+    return 0;
+
+  err:
+    fclose(fp);
+    replay_free_queries(q, *count);
+    *count = 0;
+    return -1;
+}
+
+/*============================================================================
+ *
+ * REPLAY
+ *
+ *===========================================================================*/
+
+static void
+replay_result(replay_run *run, replay_query *q,
+              struct val_result_chain *results)
+{
+    struct timeval  end;
+    val_status_t    status;
+
+    gettimeofday(&end, NULL);
+    latency_add(&run->latency, tv_diff_msec(&q->start, &end));
+
+    status = results ? results->val_rc_status : VAL_DONT_KNOW;
+    ++run->status_count[status];
+    if (run->doprint)
+        fprintf(stderr, "%s %s %s: %s\n", q->name, p_class(q->qc),
+                p_sres_type(q->qt), p_val_status(status));
+}
+
+static void
+replay_sync(val_context_t *context, replay_run *run, u_int32_t flags)
+{
+    int             i, rc;
+
+    for (i = 0; i < run->count; i++) {
+        replay_query   *q = &run->queries[i];
+        struct val_result_chain *results = NULL;
+
+        gettimeofday(&q->start, NULL);
+        rc = val_resolve_and_check(context, q->name, q->qc, q->qt, flags,
+                                   &results);
+        if (rc != VAL_NO_ERROR) {
+            fprintf(stderr, "%s: error during resolution: %s\n", q->name,
+                    p_val_err(rc));
+            ++run->errors;
+        } else
+            replay_result(run, q, results);
+        val_free_result_chain(results);
+    }
+}
+
+#ifndef VAL_NO_ASYNC
+static int
+replay_async_callback(val_async_status *as, int event,
+                      val_context_t *ctx, void *cb_data,
+                      val_cb_params_t *cbp)
+{
+    replay_query   *q = (replay_query *) cb_data;
+    replay_run     *run;
+
+    if ((NULL == q) || (NULL == q->run) || (NULL == cbp))
+        return VAL_BAD_ARGUMENT;
+    run = q->run;
+
+#ifdef REPLAY_HAVE_ENGINE
+    if (run->lock)
+        pthread_mutex_lock(run->lock);
+#endif
+    --run->in_flight;
+    --run->remaining;
+
+    if (cbp->retval == VAL_NO_ERROR)
+        replay_result(run, q, cbp->results);
+    else {
+        fprintf(stderr, "%s: error during async resolution: %s\n",
+                q->name, p_val_err(cbp->retval));
+        ++run->errors;
+    }
+    val_free_result_chain(cbp->results);
+    cbp->results = NULL;
+    q->as = NULL;
+#ifdef REPLAY_HAVE_ENGINE
+    if (run->lock) {
+        pthread_cond_signal(run->done);
+        pthread_mutex_unlock(run->lock);
+    }
+#endif
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ * submit queries until max_in_flight are outstanding
+ */
+static void
+replay_fill_window(val_context_t *context, replay_run *run, u_int32_t flags,
+                   int max_in_flight, int *next)
+{
+    int             rc;
+
+    while (run->in_flight < max_in_flight && *next < run->count) {
+        replay_query   *q = &run->queries[(*next)++];
+
+        q->run = run;
+        gettimeofday(&q->start, NULL);
+        rc = val_async_submit(context, q->name, q->qc, q->qt, flags,
+                              &replay_async_callback, q, &q->as);
+        if ((rc != VAL_NO_ERROR) || (NULL == q->as)) {
+            fprintf(stderr, "%s: error submitting query: %s\n",
+                    q->name, p_val_err(rc));
+            ++run->errors;
+            --run->remaining;
+            continue;
+        }
+        ++run->in_flight;
+    }
+}
+
+static void
+replay_async(val_context_t *context, replay_run *run, u_int32_t flags,
+             int max_in_flight)
+{
+    int             next = 0, nfds, ready;
+    fd_set          activefds;
+    struct timeval  timeout;
+
+    run->remaining = run->count;
+    while (run->remaining) {
+        /** keep the window full */
+        replay_fill_window(context, run, flags, max_in_flight, &next);
+        if (0 == run->remaining)
+            break;
+
+        FD_ZERO(&activefds);
+        nfds = 0;
+        timeout.tv_sec = 60;
+        timeout.tv_usec = 0;
+        val_async_select_info(context, &activefds, &nfds, &timeout);
+        if (0 == nfds) {
+            /*
+             * answers may be available from the cache without any
+             * network activity
+             */
+            int prev = run->remaining;
+
+            val_async_check(context, &activefds, &nfds, 0);
+            if (run->remaining == prev && next == run->count) {
+                val_async_select_info(context, &activefds, &nfds,
+                                      &timeout);
+                if (0 == nfds) {
+                    fprintf(stderr, "replay stalled with %d in flight\n",
+                            run->in_flight);
+                    run->errors += run->in_flight;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        ready = select(nfds, &activefds, NULL, NULL, &timeout);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        val_async_check(context, &activefds, &nfds, 0);
+    }
+}
+
+#ifdef REPLAY_HAVE_POLL
+/*
+ * The sockets libval is waiting on, maintained from its socket
+ * callback rather than rebuilt for every select().
+ */
+typedef struct replay_pollset_st {
+    struct pollfd      *fds;
+    int                 count;
+    int                 alloc;
+} replay_pollset;
+
+static void
+replay_sock_callback(val_context_t *ctx, int sock, int event, void *cb_data)
+{
+    replay_pollset *ps = (replay_pollset *) cb_data;
+    int             i;
+
+    if (VAL_AS_SOCK_ADD == event) {
+        if (ps->count == ps->alloc) {
+            int     n = ps->alloc ? ps->alloc * 2 : 64;
+            struct pollfd *fds =
+                (struct pollfd *) realloc(ps->fds, n * sizeof(*fds));
+            if (fds == NULL) {
+                fprintf(stderr, "out of memory tracking socket %d\n", sock);
+                return;
+            }
+            ps->fds = fds;
+            ps->alloc = n;
+        }
+        ps->fds[ps->count].fd = sock;
+        ps->fds[ps->count].events = POLLIN;
+        ps->fds[ps->count].revents = 0;
+        ++ps->count;
+        return;
+    }
+
+    for (i = 0; i < ps->count; i++) {
+        if (ps->fds[i].fd == sock) {
+            ps->fds[i] = ps->fds[--ps->count];
+            break;
+        }
+    }
+}
+
+/*
+ * Like replay_async, but driven by poll() through the event loop API:
+ * libval reports its sockets as they come and go, says how long we may
+ * wait, and is handed only the sockets that are ready.
+ */
+static void
+replay_events(val_context_t *context, replay_run *run, u_int32_t flags,
+              int max_in_flight)
+{
+    replay_pollset  ps;
+    struct timeval  timeout;
+    int            *ready = NULL;
+    int             ready_alloc = 0;
+    int             next = 0, pending, nready, wait_ms, i, rc;
+
+    memset(&ps, 0, sizeof(ps));
+    if (val_async_set_sock_cb(context, &replay_sock_callback, &ps) !=
+        VAL_NO_ERROR) {
+        fprintf(stderr, "could not register socket callback\n");
+        run->errors += run->count;
+        return;
+    }
+
+    run->remaining = run->count;
+    while (run->remaining) {
+        replay_fill_window(context, run, flags, max_in_flight, &next);
+        if (0 == run->remaining)
+            break;
+
+        pending = val_async_next_timeout(context, &timeout);
+        if (pending <= 0) {
+            fprintf(stderr, "replay stalled with %d in flight\n",
+                    run->in_flight);
+            run->errors += run->in_flight;
+            break;
+        }
+        if (timeout.tv_sec >= 60)
+            wait_ms = 60000;
+        else
+            wait_ms = timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000;
+
+        rc = poll(ps.fds, ps.count, wait_ms);
+        if (rc < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        /*
+         * copy out the ready sockets; the set may change while libval
+         * processes them
+         */
+        if (ready_alloc < ps.count) {
+            int *r = (int *) realloc(ready, ps.alloc * sizeof(int));
+            if (r == NULL)
+                break;
+            ready = r;
+            ready_alloc = ps.alloc;
+        }
+        for (i = 0, nready = 0; rc > 0 && i < ps.count; i++) {
+            if (ps.fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+                ready[nready++] = ps.fds[i].fd;
+        }
+        val_async_process_events(context, ready, nready, 0);
+    }
+
+    val_async_set_sock_cb(context, NULL, NULL);
+    free(ready);
+    free(ps.fds);
+}
+#endif /* REPLAY_HAVE_POLL */
+
+#ifdef REPLAY_HAVE_ENGINE
+/*
+ * Let libval's worker threads drive the queries; this thread only
+ * keeps the window full.
+ */
+static void
+replay_engine(val_context_t *context, replay_run *run, u_int32_t flags,
+              int max_in_flight, int workers)
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t  done = PTHREAD_COND_INITIALIZER;
+    int             next = 0, rc;
+
+    rc = val_async_engine_start(context, workers, 0);
+    if (rc != VAL_NO_ERROR) {
+        fprintf(stderr, "could not start %d worker threads: %s\n", workers,
+                p_val_err(rc));
+        run->errors += run->count;
+        return;
+    }
+
+    run->lock = &lock;
+    run->done = &done;
+    run->remaining = run->count;
+
+    pthread_mutex_lock(&lock);
+    while (run->remaining) {
+        if (run->in_flight < max_in_flight && next < run->count) {
+            /* submitting may call back from a worker, so let go */
+            int batch = max_in_flight - run->in_flight;
+            int stop = next + batch < run->count ? next + batch : run->count;
+
+            run->in_flight += stop - next;
+            pthread_mutex_unlock(&lock);
+            while (next < stop) {
+                replay_query   *q = &run->queries[next++];
+
+                q->run = run;
+                gettimeofday(&q->start, NULL);
+                rc = val_async_submit(context, q->name, q->qc, q->qt, flags,
+                                      &replay_async_callback, q, &q->as);
+                if (rc != VAL_NO_ERROR) {
+                    fprintf(stderr, "%s: error submitting query: %s\n",
+                            q->name, p_val_err(rc));
+                    pthread_mutex_lock(&lock);
+                    ++run->errors;
+                    --run->remaining;
+                    --run->in_flight;
+                    pthread_mutex_unlock(&lock);
+                }
+            }
+            pthread_mutex_lock(&lock);
+            continue;
+        }
+        pthread_cond_wait(&done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    val_async_engine_stop(context, 0);
+    run->lock = NULL;
+    run->done = NULL;
+}
+#endif /* REPLAY_HAVE_ENGINE */
+#endif /* ndef VAL_NO_ASYNC */
+
+static size_t
+replay_heap_in_use(void)
+{
+#ifdef REPLAY_HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+int
+replay_queries(val_context_t *context, const char *file, u_int32_t flags,
+               int max_in_flight, int event_loop, int workers, int doprint)
+{
+    replay_run      run;
+    struct timeval  start, end;
+    double          elapsed;
+    size_t          heap_start, heap_end;
+    int             i;
+
+    memset(&run, 0, sizeof(run));
+    run.doprint = doprint;
+    if (replay_read_queries(file, &run.queries, &run.count) < 0)
+        return -1;
+    if (0 == run.count) {
+        fprintf(stderr, "No queries found in %s\n", file);
+        return -1;
+    }
+
+    heap_start = replay_heap_in_use();
+    gettimeofday(&start, NULL);
+
+#ifdef REPLAY_HAVE_ENGINE
+    if (workers > 0)
+        replay_engine(context, &run, flags,
+                      (max_in_flight > 1) ? max_in_flight : 1, workers);
+    else
+#endif
+#ifdef REPLAY_HAVE_POLL
+    if (event_loop)
+        replay_events(context, &run, flags,
+                      (max_in_flight > 1) ? max_in_flight : 1);
+    else
+#endif
+#ifndef VAL_NO_ASYNC
+    if (max_in_flight > 1)
+        replay_async(context, &run, flags, max_in_flight);
+    else
+#endif
+        replay_sync(context, &run, flags);
+
+    gettimeofday(&end, NULL);
+    heap_end = replay_heap_in_use();
+    elapsed = tv_diff_msec(&start, &end) / 1000.0;
+
+    fprintf(stdout, "replayed %d queries from %s (%d in flight%s)\n",
+            run.count, file, (max_in_flight > 1) ? max_in_flight : 1,
+            (workers > 0) ? ", worker threads" :
+            event_loop ? ", event loop" : "");
+    fprintf(stdout, "  elapsed    %.3f sec, %.1f queries/sec, %d errors\n",
+            elapsed, elapsed > 0 ? run.latency.count / elapsed : 0.0,
+            run.errors);
+    fprintf(stdout,
+            "  latency ms min %.3f mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+            latency_percentile(&run.latency, 0),
+            latency_mean(&run.latency),
+            latency_percentile(&run.latency, 50),
+            latency_percentile(&run.latency, 90),
+            latency_percentile(&run.latency, 99),
+            latency_percentile(&run.latency, 100));
+    for (i = 0; i < 256; i++)
+        if (run.status_count[i])
+            fprintf(stdout, "  %-30s %d\n", p_val_status(i),
+                    run.status_count[i]);
+#ifdef REPLAY_HAVE_MALLINFO2
+    fprintf(stdout,
+            "  heap       %lu bytes in use before, %lu after (%+ld, %.1f per query)\n",
+            (unsigned long) heap_start, (unsigned long) heap_end,
+            (long) (heap_end - heap_start),
+            (double) ((long) (heap_end - heap_start)) / run.count);
+#endif
+
+    latency_free(&run.latency);
+    replay_free_queries(run.queries, run.count);
+
+    return run.errors;
+}
+
+/*============================================================================
+ *
+ * THREAD SCALING
+ *
+ *===========================================================================*/
+
+#ifdef REPLAY_HAVE_THREADS
+typedef struct replay_thread_st {
+    val_context_t      *context;
+    u_int32_t           flags;
+    replay_run          run;
+} replay_thread;
+
+static void *
+replay_thread_main(void *arg)
+{
+    replay_thread  *t = (replay_thread *) arg;
+
+    replay_sync(t->context, &t->run, t->flags);
+    return NULL;
+}
+
+/*
+ * Replay the queries in nthreads threads at once, each thread running
+ * through the whole file with the shared context.  The latency samples
+ * of all threads are collected in *all.
+ */
+static int
+replay_threads(val_context_t *context, replay_query *queries, int count,
+               u_int32_t flags, int nthreads, latency_stats *all)
+{
+    replay_thread  *threads;
+    pthread_t      *tids;
+    int             i, j, started, errors = 0;
+
+    threads = (replay_thread *) MALLOC(nthreads * sizeof(replay_thread));
+    tids = (pthread_t *) MALLOC(nthreads * sizeof(pthread_t));
+    if (NULL == threads || NULL == tids) {
+        if (threads)
+            FREE(threads);
+        if (tids)
+            FREE(tids);
+        return -1;
+    }
+    memset(threads, 0, nthreads * sizeof(replay_thread));
+
+    for (started = 0; started < nthreads; started++) {
+        replay_thread  *t = &threads[started];
+
+        t->context = context;
+        t->flags = flags;
+        t->run.count = count;
+        /* each thread records its own start times */
+        t->run.queries = (replay_query *) MALLOC(count * sizeof(replay_query));
+        if (NULL == t->run.queries)
+            break;
+        memcpy(t->run.queries, queries, count * sizeof(replay_query));
+        if (0 != pthread_create(&tids[started], NULL, replay_thread_main, t)) {
+            FREE(t->run.queries);
+            break;
+        }
+    }
+
+    for (i = 0; i < started; i++) {
+        replay_thread  *t = &threads[i];
+
+        pthread_join(tids[i], NULL);
+        errors += t->run.errors;
+        for (j = 0; j < t->run.latency.count; j++)
+            latency_add(all, t->run.latency.samples[j]);
+        latency_free(&t->run.latency);
+        FREE(t->run.queries);
+    }
+
+    FREE(threads);
+    FREE(tids);
+    return (started < nthreads) ? -1 : errors;
+}
+#endif /* REPLAY_HAVE_THREADS */
+
+/*
+ * Measure how throughput scales with the number of threads sharing a
+ * context.  After one unmeasured pass to fill the caches, the queries
+ * are replayed by min_threads threads, then twice as many, and so on up
+ * to max_threads, every thread replaying the whole file.
+ */
+int
+replay_scaling(val_context_t *context, const char *file, u_int32_t flags,
+               int min_threads, int max_threads)
+{
+#ifdef REPLAY_HAVE_THREADS
+    replay_run      warm;
+    struct timeval  start, end;
+    latency_stats   all;
+    val_stats_t     before, after;
+    double          elapsed, qps, base_qps = 0;
+    int             n, rc, errors = 0;
+
+    if (min_threads < 1)
+        min_threads = 1;
+    if (max_threads < min_threads)
+        max_threads = min_threads;
+
+    memset(&warm, 0, sizeof(warm));
+    if (replay_read_queries(file, &warm.queries, &warm.count) < 0)
+        return -1;
+    if (0 == warm.count) {
+        fprintf(stderr, "No queries found in %s\n", file);
+        return -1;
+    }
+    replay_sync(context, &warm, flags);
+    latency_free(&warm.latency);
+
+    fprintf(stdout, "scaling %d queries from %s, %d to %d threads\n",
+            warm.count, file, min_threads, max_threads);
+    fprintf(stdout, "%8s %10s %10s %12s %8s %9s %9s %9s\n", "threads",
+            "queries", "seconds", "queries/sec", "speedup", "p50 ms",
+            "p99 ms", "snapshot");
+
+    for (n = min_threads; n > 0;
+         n = (n >= max_threads) ? 0 :
+             (n * 2 > max_threads) ? max_threads : n * 2) {
+        memset(&all, 0, sizeof(all));
+        val_get_stats(&before, sizeof(before));
+        gettimeofday(&start, NULL);
+        rc = replay_threads(context, warm.queries, warm.count, flags, n,
+                            &all);
+        gettimeofday(&end, NULL);
+        val_get_stats(&after, sizeof(after));
+        if (rc < 0) {
+            fprintf(stderr, "Could not start %d threads\n", n);
+            latency_free(&all);
+            errors = -1;
+            break;
+        }
+        errors += rc;
+
+        elapsed = tv_diff_msec(&start, &end) / 1000.0;
+        qps = elapsed > 0 ? all.count / elapsed : 0.0;
+        if (n == min_threads)
+            base_qps = qps;
+        fprintf(stdout, "%8d %10d %10.3f %12.1f %8.2f %9.3f %9.3f %8.1f%%\n",
+                n, all.count, elapsed, qps,
+                base_qps > 0 ? qps / base_qps : 0.0,
+                latency_percentile(&all, 50), latency_percentile(&all, 99),
+                (after.vs_queries > before.vs_queries) ?
+                100.0 * (after.vs_snapshot_hits - before.vs_snapshot_hits) /
+                (after.vs_queries - before.vs_queries) : 0.0);
+        fflush(stdout);
+        latency_free(&all);
+    }
+
+    replay_free_queries(warm.queries, warm.count);
+    return errors;
+#else
+    fprintf(stderr, "Thread support not available\n");
+    return -1;
+#endif
+}
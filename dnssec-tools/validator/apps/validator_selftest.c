@@ -23,6 +23,8 @@ typedef struct testcase_st {
     int                 qt; /* type */
     int                 qr[MAX_TEST_RESULTS]; /* expected rc */
     struct timeval      start;
+    struct timeval      end;
+    int                 failed;
 #ifndef VAL_NO_ASYNC
     val_async_status   *as;
 #endif
@@ -42,6 +44,29 @@ typedef struct testsuite_stats_st {
     int                 failed;
 } testsuite_stats;
 
+/*
+ * performance report for one self_test() run
+ */
+#define REPORT_INTERVAL 1       /* seconds per queries/sec sample */
+
+typedef struct selftest_report_st {
+    struct timeval      start;
+    val_stats_t         vstats;
+    latency_stats       latency;
+    int                 run;
+    int                 failed;
+    int                *completions; /* per REPORT_INTERVAL */
+    int                 intervals;
+    int                 suites;
+    FILE               *fp; /* private buffer, copied to report_fp at end */
+} selftest_report;
+
+static int   report_format = SELFTEST_REPORT_NONE;
+static FILE *report_fp = NULL;
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 #ifndef VAL_NO_ASYNC
 typedef struct async_cbd_st {
     val_context_t      *ctx;
@@ -502,9 +527,12 @@ run_suite(val_context_t *context, testcase *curr_test, int tcs, int tce,
 
         ++run;
         fprintf(stderr, "%d: ", ++i);
+        gettimeofday(&curr_test->start, NULL);
         rc = sendquery(context, curr_test->desc,
                        curr_test->qn, curr_test->qc,
                        curr_test->qt, flags, curr_test->qr, 0, &resp);
+        gettimeofday(&curr_test->end, NULL);
+        curr_test->failed = rc ? 1 : 0;
         if (doprint) {
             fprintf(stderr, "%s: ****RESPONSE**** \n", curr_test->desc);
             print_val_response(&resp);
@@ -548,6 +576,8 @@ suite_async_callback(val_async_status *as, int event,
     --acbd->ss->in_flight;
     --acbd->ss->remaining;
     tc = acbd->tc;
+    gettimeofday(&tc->end, NULL);
+    tc->failed = 1;
 
     val_log(ctx, LOG_INFO,
             "as 0x%x %s query completed; %d in flight, %d remaining",
@@ -576,7 +606,8 @@ suite_async_callback(val_async_status *as, int event,
                                     tc->qr, cbp->results, 0, &tc->start);
             if (0 != ret_val) {
                 ++acbd->ss->failed;
-            }
+            } else
+                tc->failed = 0;
         }
 
         val_free_result_chain(cbp->results);
@@ -630,11 +661,14 @@ run_suite_async(val_context_t *context, testsuite *suite, testcase *start_test,
             val_log(context, LOG_DEBUG, "starting test %i (max %d) %s", i, tce,
                     curr_test->desc);
             memset(&curr_test->resp, 0, sizeof(curr_test->resp));
+            timerclear(&curr_test->end);
+            curr_test->failed = 1;
             acbd = (async_cbd*) MALLOC(sizeof(async_cbd));
             acbd->ss = sstats;
             acbd->tc = curr_test;
             acbd->ctx = context;
             acbd->doprint = doprint;
+            gettimeofday(&curr_test->start, NULL);
             rc = val_async_submit(context, curr_test->qn, curr_test->qc,
                                   curr_test->qt, flags, &suite_async_callback,
                                   acbd, &curr_test->as);
@@ -645,7 +679,6 @@ run_suite_async(val_context_t *context, testsuite *suite, testcase *start_test,
                 --sstats->remaining;
                 continue;
             }
-            gettimeofday(&curr_test->start, NULL);
             ++run;
             ++sstats->in_flight;
         }
@@ -754,13 +787,408 @@ run_suite_async(val_context_t *context, testsuite *suite, testcase *start_test,
 }
 #endif /* ndef VAL_NO_ASYNC */
 
+/*============================================================================
+ *
+ * PERFORMANCE REPORT
+ *
+ *===========================================================================*/
+
+void
+selftest_set_report(int format, FILE *fp)
+{
+    report_format = format;
+    report_fp = fp;
+}
+
+static void
+report_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; str && *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(fp, "\\%c", *str);
+        else if ((unsigned char) *str < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char) *str);
+        else
+            fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+static void
+report_csv_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; str && *str; str++) {
+        if (*str == '"')
+            fputc('"', fp);
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+static double
+report_ratio(unsigned long num, unsigned long den)
+{
+    return den ? (double) num / den : 0.0;
+}
+
+/*
+ * The libval counters in the reports.  The name is the JSON key and
+ * the CSV column; the text report has a line for each counter that
+ * has one and is not zero.
+ */
+#define REPORT_COUNTER(field, name, text) \
+    {name, offsetof(val_stats_t, field), text}
+
+static const struct report_counter {
+    const char *name;
+    size_t      offset;
+    const char *text;
+} report_counters[] = {
+    REPORT_COUNTER(vs_queries, "submitted", NULL),
+    REPORT_COUNTER(vs_answers, "answers", NULL),
+    REPORT_COUNTER(vs_validated, "validated", NULL),
+    REPORT_COUNTER(vs_cache_hits, "cache_hits", NULL),
+    REPORT_COUNTER(vs_cache_misses, "cache_misses", NULL),
+    REPORT_COUNTER(vs_net_queries, "net_queries", NULL),
+    REPORT_COUNTER(vs_snapshot_hits, "snapshot_hits",
+                   "queries answered from published results"),
+    REPORT_COUNTER(vs_sig_checks, "sig_checks", "signature checks"),
+    REPORT_COUNTER(vs_sig_bytes, "sig_bytes",
+                   "bytes of signed data built"),
+    REPORT_COUNTER(vs_sig_hash_bytes, "sig_hash_bytes",
+                   "bytes of signed data hashed"),
+    REPORT_COUNTER(vs_sig_hash_reused, "sig_hash_reused",
+                   "signature hashes used again"),
+    REPORT_COUNTER(vs_key_cache_hits, "key_cache_hits",
+                   "parsed keys used again"),
+    REPORT_COUNTER(vs_dane_cache_hits, "dane_cache_hits",
+                   "certificates matched from the DANE cache"),
+    REPORT_COUNTER(vs_prefetches, "prefetches",
+                   "answers refreshed before they expired"),
+    REPORT_COUNTER(vs_prefetch_dropped, "prefetch_dropped",
+                   "refreshes dropped"),
+    REPORT_COUNTER(vs_stale_answers, "stale_answers",
+                   "stale answers served"),
+    REPORT_COUNTER(vs_coalesced_queries, "coalesced_queries",
+                   "queries joined identical ones in flight"),
+    REPORT_COUNTER(vs_mirror_answers, "mirror_answers",
+                   "queries answered from zone mirrors"),
+    REPORT_COUNTER(vs_trust_cache_hits, "trust_cache_hits",
+                   "authentication chains ended at a key set already trusted"),
+    REPORT_COUNTER(vs_insecure_walks, "insecure_walks",
+                   "delegations shown to be provably insecure"),
+    REPORT_COUNTER(vs_insecure_cache_hits, "insecure_cache_hits",
+                   "insecure walks avoided by delegations already known"),
+    REPORT_COUNTER(vs_pin_failures, "pin_failures",
+                   "pinned chains of trust that could not be resolved"),
+};
+#define REPORT_NUM_COUNTERS \
+    (sizeof(report_counters) / sizeof(report_counters[0]))
+
+static unsigned long
+report_counter_value(const val_stats_t *vs, size_t i)
+{
+    return *(const unsigned long *) ((const char *) vs +
+                                     report_counters[i].offset);
+}
+
+/*
+ * The counter columns of a CSV record; empty for records that have no
+ * statistics of their own.
+ */
+static void
+report_csv_counters(FILE *fp, const val_stats_t *vs)
+{
+    size_t i;
+
+    for (i = 0; i < REPORT_NUM_COUNTERS; i++) {
+        if (vs)
+            fprintf(fp, ",%lu", report_counter_value(vs, i));
+        else
+            fputc(',', fp);
+    }
+    fputc('\n', fp);
+}
+
+/*
+ * Write the summary of a set of queries: a suite, or the whole run.
+ * vs holds the libval statistics accumulated while it ran.
+ */
+static void
+report_summary(FILE *fp, const char *suite, int run, int failed,
+               double secs, latency_stats *ls, const val_stats_t *vs)
+{
+    double qps = secs > 0 ? ls->count / secs : 0.0;
+    double hit = report_ratio(vs->vs_cache_hits,
+                              vs->vs_cache_hits + vs->vs_cache_misses);
+    double npv = report_ratio(vs->vs_net_queries, vs->vs_validated);
+    int    hist[LATENCY_HISTOGRAM_BUCKETS], i;
+    size_t c;
+
+    switch (report_format) {
+    case SELFTEST_REPORT_JSON:
+        fprintf(fp, "{\"queries\":%d,\"failed\":%d,\"seconds\":%.6f,"
+                "\"qps\":%.3f,\"latency_ms\":{\"mean\":%.3f,\"p50\":%.3f,"
+                "\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},",
+                run, failed, secs, qps, latency_mean(ls),
+                latency_percentile(ls, 50), latency_percentile(ls, 90),
+                latency_percentile(ls, 99), latency_percentile(ls, 100));
+        latency_histogram(ls, hist, LATENCY_HISTOGRAM_BUCKETS);
+        fprintf(fp, "\"histogram_ms_log2\":[");
+        for (i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+            fprintf(fp, "%s%d", i ? "," : "", hist[i]);
+        fprintf(fp, "],\"cache_hit_ratio\":%.4f,"
+                "\"net_queries_per_validated\":%.4f,"
+                "\"sig_bytes_per_validated\":%.1f", hit, npv,
+                report_ratio(vs->vs_sig_bytes, vs->vs_validated));
+        for (c = 0; c < REPORT_NUM_COUNTERS; c++)
+            fprintf(fp, ",\"%s\":%lu", report_counters[c].name,
+                    report_counter_value(vs, c));
+        fprintf(fp, "}");
+        break;
+
+    case SELFTEST_REPORT_CSV:
+        fprintf(fp, "%s,", suite ? "suite" : "total");
+        report_csv_string(fp, suite ? suite : "");
+        fprintf(fp, ",,%d,%d,%.6f,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f,%.4f",
+                run, failed, secs, qps, latency_percentile(ls, 50),
+                latency_percentile(ls, 90), latency_percentile(ls, 99),
+                latency_percentile(ls, 100), hit, npv);
+        report_csv_counters(fp, vs);
+        break;
+
+    default:
+        fprintf(fp, "%s %s: %d queries, %d failed, %.3f sec, %.1f queries/sec\n",
+                suite ? "Suite" : "Total", suite ? suite : "", run, failed,
+                secs, qps);
+        fprintf(fp, "   latency ms: mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+                latency_mean(ls), latency_percentile(ls, 50),
+                latency_percentile(ls, 90), latency_percentile(ls, 99),
+                latency_percentile(ls, 100));
+        latency_histogram(ls, hist, LATENCY_HISTOGRAM_BUCKETS);
+        fprintf(fp, "   histogram:");
+        for (i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+            if (hist[i])
+                fprintf(fp, " <%dms:%d", 1 << i, hist[i]);
+        fprintf(fp, "\n   cache hit ratio %.4f (%lu/%lu), "
+                "%.4f network queries per validated answer (%lu/%lu)\n",
+                hit, vs->vs_cache_hits,
+                vs->vs_cache_hits + vs->vs_cache_misses, npv,
+                vs->vs_net_queries, vs->vs_validated);
+        for (c = 0; c < REPORT_NUM_COUNTERS; c++)
+            if (report_counters[c].text && report_counter_value(vs, c))
+                fprintf(fp, "   %lu %s\n", report_counter_value(vs, c),
+                        report_counters[c].text);
+        break;
+    }
+}
+
+static void
+report_stats_delta(const val_stats_t *before, val_stats_t *delta)
+{
+    val_stats_t now;
+    size_t      i;
+
+    val_get_stats(&now, sizeof(now));
+    for (i = 0; i < REPORT_NUM_COUNTERS; i++)
+        *(unsigned long *) ((char *) delta + report_counters[i].offset) =
+            report_counter_value(&now, i) - report_counter_value(before, i);
+}
+
+/*
+ * Record the results of one suite in the run report and write the
+ * per-test and per-suite sections.
+ */
+static void
+report_suite(selftest_report *report, testsuite *suite, testcase *start_test,
+             int count, int failed, const struct timeval *start,
+             const val_stats_t *vstats)
+{
+    FILE          *fp = report->fp;
+    testcase      *tc;
+    latency_stats  ls;
+    val_stats_t    delta;
+    struct timeval now;
+    int            i, n;
+
+    gettimeofday(&now, NULL);
+    report_stats_delta(vstats, &delta);
+    memset(&ls, 0, sizeof(ls));
+
+    if (report_format == SELFTEST_REPORT_JSON) {
+        fprintf(fp, "%s{\"name\":", report->suites ? "," : "");
+        report_json_string(fp, suite->name);
+        fprintf(fp, ",\"tests\":[");
+    }
+
+    for (i = 0, n = 0, tc = start_test; tc && i < count; tc = tc->next, i++) {
+        double ms;
+
+        if (!timerisset(&tc->end))
+            continue; /* never completed */
+        ms = tv_diff_msec(&tc->start, &tc->end);
+        latency_add(&ls, ms);
+        latency_add(&report->latency, ms);
+
+        n = (int) (tv_diff_msec(&report->start, &tc->end) /
+                   (REPORT_INTERVAL * 1000.0));
+        if (n >= report->intervals) {
+            int *tmp = (int *) realloc(report->completions,
+                                       (n + 1) * sizeof(int));
+            if (tmp) {
+                memset(tmp + report->intervals, 0,
+                       (n + 1 - report->intervals) * sizeof(int));
+                report->completions = tmp;
+                report->intervals = n + 1;
+            }
+        }
+        if (n < report->intervals)
+            ++report->completions[n];
+
+        switch (report_format) {
+        case SELFTEST_REPORT_JSON:
+            fprintf(fp, "%s{\"desc\":", ls.count > 1 ? "," : "");
+            report_json_string(fp, tc->desc);
+            fprintf(fp, ",\"name\":");
+            report_json_string(fp, tc->qn);
+            fprintf(fp, ",\"class\":\"%s\",\"type\":\"%s\","
+                    "\"latency_ms\":%.3f,\"passed\":%s}",
+                    p_class(tc->qc), p_sres_type(tc->qt), ms,
+                    tc->failed ? "false" : "true");
+            break;
+        case SELFTEST_REPORT_CSV:
+            fprintf(fp, "test,");
+            report_csv_string(fp, suite->name);
+            fprintf(fp, ",");
+            report_csv_string(fp, tc->desc);
+            fprintf(fp, ",1,%d,%.6f,,%.3f,%.3f,%.3f,%.3f,,",
+                    tc->failed, ms / 1000.0, ms, ms, ms, ms);
+            report_csv_counters(fp, NULL);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (report_format == SELFTEST_REPORT_JSON)
+        fprintf(fp, "],\"summary\":");
+    report_summary(fp, suite->name, count, failed,
+                   tv_diff_msec(start, &now) / 1000.0, &ls, &delta);
+    if (report_format == SELFTEST_REPORT_JSON)
+        fprintf(fp, "}");
+
+    report->run += count;
+    report->failed += failed;
+    ++report->suites;
+    latency_free(&ls);
+}
+
+static void
+report_start(selftest_report *report)
+{
+    memset(report, 0, sizeof(*report));
+    gettimeofday(&report->start, NULL);
+    val_get_stats(&report->vstats, sizeof(report->vstats));
+
+    /*
+     * Each run writes into its own temporary file, so that reports
+     * from concurrent threads (-m) don't get interleaved.
+     */
+    report->fp = tmpfile();
+    if (NULL == report->fp)
+        report->fp = report_fp;
+
+    if (report_format == SELFTEST_REPORT_JSON)
+        fprintf(report->fp, "{\"suites\":[");
+    else if (report_format == SELFTEST_REPORT_CSV) {
+        size_t i;
+
+        fprintf(report->fp, "record,suite,test,queries,failed,seconds,qps,"
+                "p50_ms,p90_ms,p99_ms,max_ms,cache_hit_ratio,"
+                "net_queries_per_validated");
+        for (i = 0; i < REPORT_NUM_COUNTERS; i++)
+            fprintf(report->fp, ",%s", report_counters[i].name);
+        fputc('\n', report->fp);
+    }
+}
+
+static void
+report_end(selftest_report *report)
+{
+    FILE          *fp = report->fp;
+    struct timeval now;
+    val_stats_t    delta;
+    char           buf[4096];
+    size_t         n;
+    int            i;
+
+    gettimeofday(&now, NULL);
+    report_stats_delta(&report->vstats, &delta);
+
+    switch (report_format) {
+    case SELFTEST_REPORT_JSON:
+        fprintf(fp, "],\"interval_sec\":%d,\"qps_over_time\":[",
+                REPORT_INTERVAL);
+        for (i = 0; i < report->intervals; i++)
+            fprintf(fp, "%s%.1f", i ? "," : "",
+                    (double) report->completions[i] / REPORT_INTERVAL);
+        fprintf(fp, "],\"total\":");
+        break;
+    case SELFTEST_REPORT_CSV:
+        for (i = 0; i < report->intervals; i++) {
+            fprintf(fp, "interval,,%d,%d,,%d,%.1f,,,,,,", i,
+                    report->completions[i], REPORT_INTERVAL,
+                    (double) report->completions[i] / REPORT_INTERVAL);
+            report_csv_counters(fp, NULL);
+        }
+        break;
+    default:
+        fprintf(fp, "Queries/sec over time (%d sec intervals):",
+                REPORT_INTERVAL);
+        for (i = 0; i < report->intervals; i++)
+            fprintf(fp, " %.1f",
+                    (double) report->completions[i] / REPORT_INTERVAL);
+        fprintf(fp, "\n");
+        break;
+    }
+
+    report_summary(fp, NULL, report->run, report->failed,
+                   tv_diff_msec(&report->start, &now) / 1000.0,
+                   &report->latency, &delta);
+    if (report_format == SELFTEST_REPORT_JSON)
+        fprintf(fp, "}\n");
+
+    if (fp != report_fp) {
+        rewind(fp);
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+        pthread_mutex_lock(&report_lock);
+#endif
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            fwrite(buf, 1, n, report_fp);
+#if defined(HAVE_PTHREAD_H) && !defined(VAL_NO_THREADS)
+        pthread_mutex_unlock(&report_lock);
+#endif
+        fclose(fp);
+    }
+    fflush(report_fp);
+
+    latency_free(&report->latency);
+    free(report->completions);
+    report->completions = NULL;
+    report->intervals = 0;
+}
+
 int
 run_test_suite(val_context_t *context, int tcs, int tce, u_int32_t flags,
-               testsuite *suite, int doprint, int max_in_flight)
+               testsuite *suite, int doprint, int max_in_flight,
+               selftest_report *report)
 {
     int             failed = 0, run_cnt = 0, i, tc_count, s, us;
     testcase        *curr_test, *start_test = NULL;
     struct timeval     now, start;
+    val_stats_t        vstats;
 
     if (NULL == suite)
         return 1;
@@ -790,6 +1218,8 @@ run_test_suite(val_context_t *context, int tcs, int tce, u_int32_t flags,
 
     fprintf(stderr, "Suite '%s': Running %d tests\n", suite->name, tc_count);
 
+    if (report)
+        val_get_stats(&vstats, sizeof(vstats));
     gettimeofday(&start, NULL);
 #ifndef VAL_NO_ASYNC
     if (max_in_flight > 1)
@@ -814,6 +1244,10 @@ run_test_suite(val_context_t *context, int tcs, int tce, u_int32_t flags,
             suite->name, run_cnt - failed, run_cnt, failed);
     fprintf(stderr, "   runtime was %d.%d seconds\n", s, us);
 
+    if (report)
+        report_suite(report, suite, start_test, tc_count, failed, &start,
+                     &vstats);
+
     return 0;
 }
 
@@ -823,6 +1257,7 @@ self_test(val_context_t *context, int tcs, int tce, u_int32_t flags,
           int max_in_flight)
 {
     testsuite *suite, *head;
+    selftest_report report, *rp = NULL;
     int rc;
 
     if (NULL == tests_file)
@@ -831,11 +1266,16 @@ self_test(val_context_t *context, int tcs, int tce, u_int32_t flags,
 
     suite = head;
 
+    if (report_format != SELFTEST_REPORT_NONE && report_fp) {
+        rp = &report;
+        report_start(rp);
+    }
+
     if (NULL == suites) {
 
         while(NULL != suite) {
             rc = run_test_suite(context, tcs, tce, flags, suite, doprint,
-                                max_in_flight);
+                                max_in_flight, rp);
             if (rc)
                 fprintf(stderr, "bad rc %d from run_test_suite\n", rc);
             /** does rc mean anything? */
@@ -857,7 +1297,7 @@ self_test(val_context_t *context, int tcs, int tce, u_int32_t flags,
                 fprintf(stderr, "unknown suite %s\n", name);
             else {
                 rc = run_test_suite(context, tcs, tce, flags, suite, doprint,
-                                    max_in_flight);
+                                    max_in_flight, rp);
                 if (rc)
                     fprintf(stderr, "bad rc %d from run_test_suite %s\n",
                             rc, name);
@@ -869,6 +1309,9 @@ self_test(val_context_t *context, int tcs, int tce, u_int32_t flags,
         free(name_save);
     }
 
+    if (rp)
+        report_end(rp);
+
     selftest_cleanup(head);
 
     return 0;
@@ -31,6 +31,7 @@ extern          "C" {
 #define QUERY_BAD_CACHE_TTL 60
 #define MAX_ALIAS_CHAIN_LENGTH 10       /* max length of cname/dname chain */
 #define MAX_GLUE_FETCH_DEPTH 10         /* max length of glue dependency chain */
+#define MAX_MIRROR_REFERRALS 8          /* max referrals followed in zone mirrors */
 #define IPADDR_STRING_MAX 128
 
 #ifndef LOG_EMERG
@@ -109,6 +110,8 @@ extern          "C" {
 
 #define SIGNBY              18
 #define ENVELOPE            10
+/* room left before the canonical RRs of a set for the RRSIG part */
+#define CANON_ROOM          (SIGNBY + NS_MAXCDNAME)
 #define RRSIGLABEL           3
 #define TTL                  4
 #define VAL_CTX_IDLEN       20
@@ -161,6 +164,8 @@ extern          "C" {
 #define ALG_RSASHA512 10 
 #define ALG_ECDSAP256SHA256 13
 #define ALG_ECDSAP384SHA384 14
+#define ALG_ED25519 15
+#define ALG_ED448   16
 
 #define IS_KNOWN_DNSSEC_ALG_BASIC(x) \
     (x == ALG_RSAMD5 || \
@@ -194,12 +199,22 @@ extern          "C" {
 #define IS_KNOWN_DNSSEC_ALG_ECDSA(x)\
     (0) /* false */
 #endif
+
+#ifdef HAVE_EDDSA
+#define IS_KNOWN_DNSSEC_ALG_EDDSA(x) \
+     (x == ALG_ED25519 ||\
+     x == ALG_ED448)
+#else
+#define IS_KNOWN_DNSSEC_ALG_EDDSA(x)\
+    (0) /* false */
+#endif
      
 #define IS_KNOWN_DNSSEC_ALG(x) \
     (IS_KNOWN_DNSSEC_ALG_BASIC(x) ||\
      IS_KNOWN_DNSSEC_ALG_NSEC3(x) ||\
      IS_KNOWN_DNSSEC_ALG_SHA2(x) ||\
-     IS_KNOWN_DNSSEC_ALG_ECDSA(x))
+     IS_KNOWN_DNSSEC_ALG_ECDSA(x) ||\
+     IS_KNOWN_DNSSEC_ALG_EDDSA(x))
 
 /* query types for which edns0 is required */
 #ifdef LIBVAL_DLV
@@ -258,7 +273,11 @@ extern          "C" {
         struct name_server *qc_respondent_server;
         unsigned long qc_respondent_server_options;
         int    qc_trans_id;             //  synchronous queries only
+        struct val_inflight *qc_inflight; // shared with identical queries
         long   qc_last_sent;            //  last time the query was sent
+        u_int32_t qc_hits;              //  answers served from this query
+        long   qc_hit_start;            //  when the answer became available
+        int    qc_prefetched;           //  a refresh has been requested
         struct expected_arrival *qc_ea; // asynchronous queries only
 
         struct val_digested_auth_chain *qc_ans;
@@ -403,9 +422,32 @@ extern          "C" {
         /* Query cache */
         struct val_query_chain *q_list;
 
+        /* validated results, readable without locks; see val_rcache.c */
+        struct val_rcache *rcache;
+
+        /* key sets already shown to be trusted; see val_tcache.c */
+        struct val_tcache *tcache;
+
+        /* refreshes of popular answers; see val_prefetch.c */
+        struct val_prefetch *prefetch;
+
+        /* local copies of whole zones; see val_mirror.c */
+        struct val_mirror *mirrors;
+
 #ifndef VAL_NO_ASYNC
         /* in flight async queries */
         val_async_status       *as_list;
+
+        /* event loop integration, see val_async_set_sock_cb() */
+        val_async_sock_cb       as_sock_cb;
+        void                   *as_sock_cb_data;
+        struct expected_arrival **as_sock_map; /* indexed by socket */
+        int                     as_sock_map_len;
+        int                     as_event_fd; /* epoll fd, or -1 */
+#ifndef VAL_NO_THREADS
+        /* worker threads, see val_async_engine_start() */
+        struct val_async_engine *as_engine;
+#endif
 #endif
 
         /* default flags that the context applies automatically */
@@ -468,6 +510,25 @@ extern          "C" {
         struct rrset_rr  *rr_next;
     };
 
+    /*
+     * The RDATA of an rrset_rr is normally allocated in the same block
+     * as the record itself, immediately following it.
+     */
+#define RR_INLINE_RDATA(rr) ((u_char *)((rr) + 1))
+
+    /*
+     * Hash of the data covered by one RRSIG over a set, kept so that
+     * it is not computed again for every key with a matching tag.
+     */
+    struct rrset_digest {
+        const void *rd_md;             /* EVP_MD used */
+        u_char      rd_prefix[SIGNBY + NS_MAXCDNAME]; /* RRSIG RDATA up */
+        size_t      rd_prefix_len;     /* to the signature */
+        u_char      rd_hash[64];
+        u_int       rd_hash_len;
+        struct rrset_digest *rd_next;
+    };
+
     struct rrset_rec {
         int       rrs_rcode;
         u_char   *rrs_name_n;       /* Owner */
@@ -483,6 +544,12 @@ extern          "C" {
         u_char *rrs_zonecut_n;
         u_char rrs_cred;       /* SR_CRED_... */
         u_char rrs_ans_kind;   /* SR_ANS_... */
+        u_char   *rrs_canon;        /* CANON_ROOM bytes, then the */
+        size_t    rrs_canon_len;    /* canonical RRs covered by RRSIGs */
+        u_int32_t rrs_canon_ttl_n;  /* original TTL and wildcard labels */
+        int       rrs_canon_wcard;  /* rrs_canon was built for */
+        struct rrset_digest *rrs_digests;
+        struct rrset_rec **rrs_index_ref; /* index entry pointing here */
         struct rrset_rec *rrs_next;
     };
 
@@ -166,6 +166,16 @@ struct name_server {
 #define SR_QUERY_DEFAULT                (SR_QUERY_RECURSE) 
 
 
+/*
+ * socket events reported to a res_io_sock_cb
+ */
+#define RES_IO_SOCK_OPEN      1
+#define RES_IO_SOCK_CLOSE     2
+
+struct expected_arrival;
+typedef void (*res_io_sock_cb)(struct expected_arrival *ea, SOCKET sock,
+                               int event, void *cb_data);
+
 struct expected_arrival {
     SOCKET          ea_socket;
 #ifdef EA_EXTRA_DEBUG
@@ -184,6 +194,10 @@ struct expected_arrival {
     struct timeval  ea_next_try;
     struct timeval  ea_cancel_time;
     struct expected_arrival *ea_next;
+    /* fields added since libsres 15 go below, to keep the layout above */
+    int             ea_ready;   /* data waiting, see res_async_ea_set_ready */
+    res_io_sock_cb  ea_sock_cb;
+    void           *ea_sock_cb_data;
 };
 
 /*
@@ -251,6 +265,50 @@ int             labelcmp(const u_char * name1, const u_char * name2,
                         size_t label_cnt);
 int             namecmp(const u_char * name1, const u_char * name2);
 
+/*
+ * A domain name prepared once for repeated comparisons: the lower case
+ * wire format name, its length, the offset of each label (the last one
+ * being the root label) and a hash of the lower case name.
+ */
+struct canon_name {
+    unsigned char   cn_name[NS_MAXCDNAME];
+    size_t          cn_len;
+    size_t          cn_labels;
+    unsigned char   cn_offsets[NS_MAXCDNAME / 2 + 1];
+    unsigned int    cn_hash;
+};
+
+int             canon_name_init(struct canon_name *cn,
+                                const u_char * name_n);
+int             canon_namecmp(const struct canon_name *cn1,
+                              const struct canon_name *cn2);
+int             canon_namecmp_wire(const struct canon_name *cn,
+                                   const u_char * name_n);
+int             canon_name_equal(const struct canon_name *cn,
+                                 const u_char * name_n);
+int             canon_name_tail(const struct canon_name *cn,
+                                const u_char * tail_n);
+
+/*
+ * Vector implementations of the byte-at-a-time name and encoding
+ * primitives, selected at run time from what the CPU supports.
+ */
+#define RES_SIMD_SCALAR     0
+#define RES_SIMD_SSE2       1
+#define RES_SIMD_AVX2       2
+
+int             res_simd_level(void);
+int             res_simd_set_level(int level);
+void            res_lower_bytes(u_char * buf, size_t len);
+size_t          res_ntop_span(const u_char * src, size_t len);
+size_t          res_pton_span(const char *src, size_t len);
+size_t          res_b32hex_encode_blocks(const u_char * in, size_t inlen,
+                                         u_char * out);
+size_t          res_b64_encode_blocks(const u_char * src, size_t srclen,
+                                      char *dst);
+size_t          res_b64_decode_blocks(const char *src, size_t srclen,
+                                      u_char * dst, size_t dstlen);
+
     int             res_map_srio_to_sr(int val);
 
 unsigned short       res_nametoclass(const char *buf, int *successp);
@@ -320,6 +378,21 @@ res_async_ea_is_using_stream(struct expected_arrival *ea);
 int
 res_async_ea_isset(struct expected_arrival *ea, fd_set *fds);
 
+/*
+ * event loop support: get told about socket changes instead of
+ * building an fd_set, and mark sockets ready instead of passing one
+ * to res_async_query_handle().
+ */
+void
+res_async_query_set_sock_cb(struct expected_arrival *ea, res_io_sock_cb cb,
+                            void *cb_data);
+
+void
+res_async_ea_set_ready(struct expected_arrival *ea);
+
+int
+res_async_ea_isready(struct expected_arrival *ea);
+
 void res_switch_all_to_tcp_tid(int trans_id);
 
 /*
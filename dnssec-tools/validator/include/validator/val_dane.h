@@ -94,6 +94,8 @@ struct val_ssl_data {
     val_context_t *context;
     char *qname;
     struct val_danestatus *danestatus;
+    unsigned char tlsa_id[SHA256_DIGEST_LENGTH]; /* digest of the TLSA RRset */
+    long tlsa_expiry;           /* matches are remembered until then */
 };
 
 typedef int (*val_dane_callback)(void *callback_data, 
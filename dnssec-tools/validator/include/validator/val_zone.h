@@ -0,0 +1,92 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_ZONE_H
+#define VAL_ZONE_H
+
+/*
+ * Signed zone files held in memory, and authoritative answers built
+ * from them.  libval uses these to answer from local mirrors of zones,
+ * and dt-authserv to serve zones to the validator in tests.  Names are
+ * in uncompressed wire format throughout.  Include validator.h first.
+ */
+
+#ifdef __cplusplus
+extern          "C" {
+#endif
+
+#define VZ_T_NSEC3          50
+#define VZ_T_NSEC3PARAM     51
+#define VZ_T_ZONEMD         63
+#define VZ_T_DLV            32769
+
+/*
+ * A single resource record as read from a zone file.  Owner names and
+ * names inside the rdata are kept in uncompressed wire format.
+ */
+struct vz_rr {
+    u_char          owner[NS_MAXCDNAME];
+    u_int16_t       type_h;
+    u_int16_t       class_h;
+    u_int32_t       ttl;
+    u_int16_t       covered;    /* type covered, RRSIGs only */
+    u_int16_t       rdlen;
+    u_char         *rdata;
+};
+
+/*
+ * An RRset and the signatures that cover it
+ */
+struct vz_rrset {
+    u_int16_t       type_h;
+    int             nrr;
+    struct vz_rr  **rr;
+    int             nsig;
+    struct vz_rr  **sig;
+};
+
+/*
+ * All the RRsets that exist at a single owner name
+ */
+struct vz_node {
+    u_char         *name;
+    int             nsets;
+    struct vz_rrset *sets;
+};
+
+struct val_zone {
+    char           *file;
+    u_char          apex[NS_MAXCDNAME];
+    int             apex_labels;
+    int             nrrs;
+    struct vz_rr  **rrs;        /* canonically sorted */
+    int             nnodes;
+    struct vz_node *nodes;      /* canonically sorted */
+    int             nnsec3;
+    struct vz_node **nsec3;     /* nodes that own an NSEC3 RRset */
+    int             has_nsec;
+    u_int8_t        n3_alg;
+    u_int16_t       n3_iter;
+    u_int8_t        n3_saltlen;
+    u_char          n3_salt[255];
+    int             bogus;
+    struct val_zone *next;
+};
+
+int             val_zone_load(const char *file, struct val_zone **zp);
+void            val_zone_free(struct val_zone *z);
+int             val_zone_text2name(const char *text, const char *origin,
+                                   u_char *name);
+struct vz_rrset *val_zone_find_rrset(const struct val_zone *z,
+                                     const u_char *name, u_int16_t type_h);
+int             val_zone_respond(struct val_zone *zones,
+                                 const u_char *q, size_t qlen,
+                                 u_char *resp, size_t resplen,
+                                 int is_tcp, size_t udp_limit);
+
+#ifdef __cplusplus
+}                               /* extern "C" */
+#endif
+
+#endif /* VAL_ZONE_H */
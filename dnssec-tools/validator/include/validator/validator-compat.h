@@ -954,6 +954,10 @@ const char     *p_sres_type(int type);
 #undef p_type
 #define p_type(type) p_sres_type(type)
 
+const char     *p_sres_rcode(int rcode);
+#undef p_rcode
+#define p_rcode(rcode) p_sres_rcode(rcode)
+
 
 #ifndef NS_MAXDNAME
 #define NS_MAXDNAME 1025        /* maximum domain name */
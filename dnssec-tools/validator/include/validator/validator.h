@@ -129,8 +129,74 @@ typedef struct val_global_opt {
     int rec_fallback;
     long max_refresh;
     int proto;
+    int prefetch;
+    int prefetch_hits;
+    int serve_stale;
+    int stale_timeout;
+    char *cache_file;
+    int cache_save_interval;
+    char *zone_mirror;
+    char *pinned_zones;
 } val_global_opt_t;
 
+/*
+ * process-wide query statistics, see val_get_stats().  Only unsigned
+ * long counters, and new ones only ever go at the end: callers pass
+ * the size of the structure they were built with.
+ */
+typedef struct val_stats {
+    unsigned long vs_queries;       /* queries submitted by applications */
+    unsigned long vs_answers;       /* results returned to applications */
+    unsigned long vs_validated;     /* ... of which were validated */
+    unsigned long vs_cache_hits;    /* internal queries answered from cache */
+    unsigned long vs_cache_misses;  /* internal queries that needed the network */
+    unsigned long vs_net_queries;   /* queries sent to name servers */
+    unsigned long vs_snapshot_hits; /* queries answered from published results */
+    unsigned long vs_sig_checks;    /* RRSIG/DNSKEY pairs checked */
+    unsigned long vs_sig_bytes;     /* bytes copied to build signed data */
+    unsigned long vs_sig_hash_bytes; /* bytes hashed for signature checks */
+    unsigned long vs_sig_hash_reused; /* signature hashes used again */
+    unsigned long vs_key_cache_hits; /* DNSKEYs found already parsed */
+    unsigned long vs_dane_cache_hits; /* certificates matched from the DANE cache */
+    unsigned long vs_prefetches;    /* answers refreshed before they expired */
+    unsigned long vs_prefetch_dropped; /* refreshes due but not sent */
+    unsigned long vs_stale_answers; /* expired answers served in an outage */
+    unsigned long vs_coalesced_queries; /* queries that joined one in flight */
+    unsigned long vs_mirror_answers; /* queries answered from zone mirrors */
+    unsigned long vs_trust_cache_hits; /* chains ended at a known key set */
+    unsigned long vs_insecure_walks; /* delegations shown to have no DS */
+    unsigned long vs_insecure_cache_hits; /* ... walks avoided by knowing one */
+    unsigned long vs_pin_failures;  /* pinned chains not resolved */
+} val_stats_t;
+
+/*
+ * one name to look up in val_cache_warm()
+ */
+typedef struct val_warm_query {
+    const char     *vw_name;
+    int             vw_class_h;
+    int             vw_type_h;
+    val_status_t    vw_status;  /* set by val_cache_warm() */
+    int             vw_retval;  /* ... and the VAL_* error, if any */
+} val_warm_query_t;
+
+/*
+ * state of a val_cache_warm() run, passed to its progress callback
+ */
+typedef struct val_warm_progress {
+    int             vwp_total;      /* queries in the list */
+    int             vwp_done;       /* ... finished, duplicates included */
+    int             vwp_failed;     /* ... that could not be resolved */
+    int             vwp_duplicates; /* ... answered by an identical one */
+    int             vwp_groups;     /* distinct parent domains */
+    int             vwp_in_flight;  /* requests outstanding */
+    double          vwp_elapsed;    /* seconds since the start */
+} val_warm_progress_t;
+
+typedef void    (*val_warm_progress_cb) (val_context_t *context,
+                                         const val_warm_progress_t *progress,
+                                         void *cb_data);
+
 /*
  * Dynamic policy can be configured with the following flags
  * in vc_polflags
@@ -170,6 +236,14 @@ typedef struct val_context_opt {
 #define GOPT_REC_FALLBACK "rec-fallback"
 #define GOPT_MAX_REFRESH_STR "max-refresh"
 #define GOPT_PROTO "proto"
+#define GOPT_PREFETCH_STR "prefetch"
+#define GOPT_PREFETCH_HITS_STR "prefetch-min-hits"
+#define GOPT_SERVE_STALE_STR "serve-stale"
+#define GOPT_STALE_TIMEOUT_STR "stale-answer-timeout"
+#define GOPT_CACHE_FILE_STR "cache-file"
+#define GOPT_CACHE_SAVE_INTERVAL_STR "cache-save-interval"
+#define GOPT_ZONE_MIRROR_STR "zone-mirror"
+#define GOPT_PINNED_ZONES_STR "pinned-zones"
 /* 
  * The following policies are deprecated. 
  * They are defined here for backwards compatibility
@@ -194,6 +268,14 @@ typedef struct val_context_opt {
 
 #define VAL_POL_GOPT_MAXREFRESH 60
 
+#define VAL_POL_GOPT_PREFETCH 10
+#define VAL_POL_GOPT_PREFETCH_HITS 2
+
+#define VAL_POL_GOPT_SERVE_STALE 0      /* seconds; 0 disables serve-stale */
+#define VAL_POL_GOPT_STALE_TIMEOUT 1800 /* milliseconds */
+
+#define VAL_POL_GOPT_CACHE_SAVE_INTERVAL 0 /* seconds; 0 saves only at exit */
+
 #define VAL_POL_GOPT_PROTO_ANY 0 
 #define VAL_POL_GOPT_PROTO_IPV4 1 
 #define VAL_POL_GOPT_PROTO_IPV6 2 
@@ -425,6 +507,37 @@ typedef struct val_context_opt {
                                     int *num_fds,
                                     struct timeval *timeout);
 
+    /*
+     * event loop integration: instead of an fd_set, applications can be
+     * told when sockets come and go (or watch a single epoll descriptor)
+     * and hand libval just the sockets that are ready.
+     */
+#define VAL_AS_SOCK_ADD                    0x01
+#define VAL_AS_SOCK_DEL                    0x02
+
+    typedef void (*val_async_sock_cb)(val_context_t *ctx, int sock,
+                                      int event, void *cb_data);
+
+    int             val_async_set_sock_cb(val_context_t *context,
+                                          val_async_sock_cb callback,
+                                          void *cb_data);
+    int             val_async_event_fd(val_context_t *context);
+    int             val_async_next_timeout(val_context_t *context,
+                                           struct timeval *timeout);
+    int             val_async_process_events(val_context_t *context,
+                                             const int *ready, int nready,
+                                             unsigned int flags);
+
+    /*
+     * worker threads that watch the sockets of async requests and call
+     * their callbacks on behalf of the application; validation is still
+     * done by one thread at a time
+     */
+    int             val_async_engine_start(val_context_t *context,
+                                           int nthreads, unsigned int flags);
+    int             val_async_engine_stop(val_context_t *context,
+                                          unsigned int flags);
+
     /*
      * cancellation flags
      */
@@ -491,6 +604,27 @@ typedef struct val_context_opt {
                                           unsigned char action,
                                           unsigned int flags);
 
+    /*
+     * from val_stats.c
+     */
+    int             val_get_stats(val_stats_t *stats, size_t size);
+    void            val_reset_stats(void);
+
+    /*
+     * from val_cache_file.c
+     */
+    int             val_cache_save(const char *file);
+    int             val_cache_load(const char *file);
+
+    /*
+     * from val_warm.c
+     */
+    int             val_cache_warm(val_context_t *context,
+                                   val_warm_query_t *queries, int count,
+                                   int concurrency, unsigned int flags,
+                                   val_warm_progress_cb progress,
+                                   void *cb_data);
+
     /*
      * from val_policy.h 
      */
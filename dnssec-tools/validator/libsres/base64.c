@@ -120,6 +120,17 @@ b64_ntop(u_char const *src, size_t srclength, char *target,
     u_char          output[4];
     size_t          i;
 
+    /*
+     * Encode whole blocks with vector instructions when the complete
+     * output is known to fit. 
+     */
+    if (targsize > (srclength + 2) / 3 * 4) {
+        i = res_b64_encode_blocks(src, srclength, target);
+        src += i;
+        srclength -= i;
+        datalength = i / 3 * 4;
+    }
+
     while (2U < srclength) {
         input[0] = *src++;
         input[1] = *src++;
@@ -188,12 +199,27 @@ int
 b64_pton(const char *src, u_char *target, size_t targsize)
 {
     int             tarindex, state, ch;
-    const char      *pos;
+    const char      *pos, *srcend;
+    size_t          n;
 
     state = 0;
     tarindex = 0;
+    srcend = src + strlen(src);
+
+    for (;;) {
+        /*
+         * Decode whole blocks with vector instructions until one of
+         * them holds white space or padding. 
+         */
+        if (state == 0 && target && (size_t) tarindex < targsize) {
+            n = res_b64_decode_blocks(src, srcend - src, target + tarindex,
+                                      targsize - tarindex);
+            src += n;
+            tarindex += n / 4 * 3;
+        }
+        if ((ch = *src++) == '\0')
+            break;
 
-    while ((ch = *src++) != '\0') {
         if (isspace(ch))        /* Skip whitespace anywhere. */
             continue;
 
@@ -78,6 +78,7 @@ ns_name_ntop(const u_char * src, char *dst, size_t dstsiz)
     u_char          c;
     u_int           n;
     int             l;
+    size_t          span;
 
     cp = src;
     dn = dst;
@@ -123,6 +124,15 @@ ns_name_ntop(const u_char * src, char *dst, size_t dstsiz)
             dn += m;
             continue;
         }
+        /*
+         * Copy the leading characters that need no escaping in one go;
+         * there is room for them since there is room for the label. 
+         */
+        span = res_ntop_span(cp, l);
+        memcpy(dn, cp, span);
+        dn += span;
+        cp += span;
+        l -= span;
         for ((void) NULL; l > 0; l--) {
             c = *cp++;
             if (special(c)) {
@@ -181,12 +191,14 @@ ns_name_pton(const char *src, u_char * dst, size_t dstsiz)
 {
     u_char         *label, *bp, *eom;
     int             c, n, escaped, e = 0;
-    const char     *cp;
+    const char     *cp, *srcend;
+    size_t          span;
 
     escaped = 0;
     bp = dst;
     eom = dst + dstsiz;
     label = bp++;
+    srcend = src + strlen(src);
 
     while ((c = *src++) != 0) {
         if (escaped) {
@@ -275,6 +287,16 @@ ns_name_pton(const char *src, u_char * dst, size_t dstsiz)
             return (-1);
         }
         *bp++ = (u_char) c;
+        /*
+         * Copy the rest of a run of plain characters in one go, leaving
+         * it to the checks above if it does not fit. 
+         */
+        span = res_pton_span(src, srcend - src);
+        if (span > 0 && bp + span <= eom) {
+            memcpy(bp, src, span);
+            bp += span;
+            src += span;
+        }
     }
     c = (bp - label - 1);
     if ((c & NS_CMPRSFLGS) != 0) {      /* Label too big. */
@@ -138,14 +138,6 @@ typedef enum __ns_cert_types {
 } ns_cert_types;
 #endif
 
-/*
- * some system prototypes are missing
- */
-#if defined HAVE_DECL_P_RCODE && !HAVE_DECL_P_RCODE
-const char     *p_rcode(int);
-#endif
-
-
 extern const char *_res_sectioncodes[];
 
 #define ERRBUFLEN 80
@@ -637,10 +629,12 @@ p_time(u_int32_t value)
 }
 
 /*
- * Return a string for the rcode.
+ * Return a string for the rcode.  Named apart from p_rcode(), which
+ * the system's resolver headers may map to a deprecated function; the
+ * compat header maps p_rcode() to this one instead.
  */
 const char     *
-p_rcode(int rcode)
+p_sres_rcode(int rcode)
 {
     return (sym_ntos
             ((const struct RES_SYM_TYPE *) __p_rcode_syms, rcode, (int *) 0));
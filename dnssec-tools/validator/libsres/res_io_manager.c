@@ -196,6 +196,25 @@ res_get_timeout(struct name_server *ns)
 void            res_print_ea(struct expected_arrival *ea);
 int             res_quecmp(u_char * query, u_char * response);
 
+/*
+ * Close the socket of an expected arrival, telling the owner of the
+ * arrival first if it asked to be told about socket changes.
+ */
+static void
+res_io_close_socket(struct expected_arrival *ea)
+{
+    if (ea->ea_socket == INVALID_SOCKET)
+        return;
+
+    if (ea->ea_sock_cb)
+        (*ea->ea_sock_cb)(ea, ea->ea_socket, RES_IO_SOCK_CLOSE,
+                          ea->ea_sock_cb_data);
+    CLOSESOCK(ea->ea_socket);
+    --_open_sockets;
+    ea->ea_socket = INVALID_SOCKET;
+    ea->ea_ready = 0;
+}
+
 void
 res_sq_free_expected_arrival(struct expected_arrival **ea)
 {
@@ -214,10 +233,7 @@ res_sq_free_expected_arrival(struct expected_arrival **ea)
     if ((*ea)->name != NULL)
         free((*ea)->name);
 #endif
-    if ((*ea)->ea_socket != INVALID_SOCKET) {
-        CLOSESOCK((*ea)->ea_socket);
-        --_open_sockets;
-    }
+    res_io_close_socket(*ea);
     if ((*ea)->ea_signed)
         FREE((*ea)->ea_signed);
     if ((*ea)->ea_response)
@@ -306,11 +322,7 @@ res_io_retry_source(struct expected_arrival *ea)
     res_print_ea(ea);
 
     /* close socket */
-    if (ea->ea_socket != INVALID_SOCKET) {
-        CLOSESOCK(ea->ea_socket);
-        --_open_sockets;
-        ea->ea_socket = INVALID_SOCKET;
-    }
+    res_io_close_socket(ea);
 
     /* bump retry time to current time */
     gettimeofday(&ea->ea_next_try, NULL);
@@ -327,11 +339,7 @@ res_io_reset_source(struct expected_arrival *ea)
     res_print_ea(ea);
 
     /* close socket */
-    if (ea->ea_socket != INVALID_SOCKET) {
-        CLOSESOCK(ea->ea_socket);
-        --_open_sockets;
-        ea->ea_socket = INVALID_SOCKET;
-    }
+    res_io_close_socket(ea);
 
     /* bump cancel time to current time */
     gettimeofday(&ea->ea_cancel_time, NULL);
@@ -348,11 +356,7 @@ res_io_cancel_source(struct expected_arrival *ea)
     res_print_ea(ea);
 
     /* close socket */
-    if (ea->ea_socket != INVALID_SOCKET) {
-        CLOSESOCK(ea->ea_socket);
-        --_open_sockets;
-        ea->ea_socket = INVALID_SOCKET;
-    }
+    res_io_close_socket(ea);
 
     /* bump cancel time to current time */
     gettimeofday(&ea->ea_cancel_time, NULL);
@@ -437,6 +441,9 @@ res_io_send(struct expected_arrival *shipit)
             return SR_IO_SOCKET_ERROR;
         }
         ++_open_sockets;
+        if (shipit->ea_sock_cb)
+            (*shipit->ea_sock_cb)(shipit, shipit->ea_socket, RES_IO_SOCK_OPEN,
+                                  shipit->ea_sock_cb_data);
 
         /* Set the source port */
         if (0 != bind_to_random_source(af, shipit->ea_socket)) {
@@ -690,10 +697,7 @@ res_nsfallback_ea(struct expected_arrival *ea, struct timeval *closest_event,
     }
 
     /** close socket so retry uses different port */
-    if (temp->ea_socket != INVALID_SOCKET) {
-        CLOSESOCK(temp->ea_socket);
-        --_open_sockets;
-    }
+    res_io_close_socket(temp);
     temp->ea_socket = INVALID_SOCKET;
 
     res_log(NULL, LOG_INFO, "libsres: "
@@ -715,11 +719,7 @@ res_io_next_address(struct expected_arrival *ea,
         /*
          * Start over with new address 
          */
-        if (ea->ea_socket != INVALID_SOCKET) {
-            CLOSESOCK (ea->ea_socket);
-            --_open_sockets;
-            ea->ea_socket = INVALID_SOCKET;
-        }
+        res_io_close_socket(ea);
         ea->ea_which_address++;
         ea->ea_remaining_attempts = ea->ea_ns->ns_retry+1;
         set_alarms(ea, 0, res_get_timeout(ea->ea_ns));
@@ -1291,11 +1291,7 @@ res_io_get_a_response(struct expected_arrival *ea_list, u_char ** answer,
             res_log(NULL, LOG_DEBUG, "libsres: "
                     "*** dropped response for ea %p rc %d", ea_list, retval);
             /** close socket so retry uses different port */
-            if (ea_list->ea_socket != INVALID_SOCKET) {
-                CLOSESOCK (ea_list->ea_socket);
-                --_open_sockets;
-                ea_list->ea_socket = INVALID_SOCKET;
-            }
+            res_io_close_socket(ea_list);
             res_print_ea(ea_list);
             _clone_respondent(ea_list, respondent);
             set_alarms(ea_list, 0, res_get_timeout(ea_list->ea_ns));
@@ -1530,11 +1526,7 @@ res_switch_to_tcp(struct expected_arrival *ea)
      * Use the same "ea_which_address," since it already got a rise. 
      */
     ea->ea_using_stream = TRUE;
-    if (ea->ea_socket != INVALID_SOCKET) {
-        CLOSESOCK(ea->ea_socket);
-        --_open_sockets;
-        ea->ea_socket = INVALID_SOCKET;
-    }
+    res_io_close_socket(ea);
     ea->ea_remaining_attempts = ea->ea_ns->ns_retry+1;
     set_alarms(ea, 0, res_get_timeout(ea->ea_ns));
 }
@@ -1560,11 +1552,7 @@ res_switch_all_to_tcp(struct expected_arrival *ea)
         ea->ea_response_length = 0;
 
         ea->ea_using_stream = TRUE;
-        if (ea->ea_socket != INVALID_SOCKET) {
-            CLOSESOCK(ea->ea_socket);
-            --_open_sockets;
-            ea->ea_socket = INVALID_SOCKET;
-        }
+        res_io_close_socket(ea);
     }
 }
 
@@ -1594,16 +1582,21 @@ res_io_read(fd_set * read_descriptors, struct expected_arrival *ea_list)
          * skip canceled/expired attempts, or sockets without data
          */
         if ((ea_list->ea_remaining_attempts == -1) ||
-            (ea_list->ea_socket == INVALID_SOCKET) ||
-            ! FD_ISSET(ea_list->ea_socket, read_descriptors))
+            (ea_list->ea_socket == INVALID_SOCKET))
+            continue;
+        if (read_descriptors) {
+            if (! FD_ISSET(ea_list->ea_socket, read_descriptors))
+                continue;
+            FD_CLR(ea_list->ea_socket, read_descriptors);
+        } else if (! ea_list->ea_ready)
             continue;
+        ea_list->ea_ready = 0;
 
         { /* dummy block to preserve indentation; remove later */
 
             res_log(NULL, LOG_DEBUG, "libsres: ""ACTIVITY on %d",
                     ea_list->ea_socket);
             ++handled;
-            FD_CLR(ea_list->ea_socket, read_descriptors);
 
             arrival = ea_list;
             res_print_ea(arrival);
@@ -2039,12 +2032,16 @@ res_async_query_select_info(struct expected_arrival *ea, int *nfds,
     res_io_select_info(ea, nfds, fds, timeout);
 }
 
+/*
+ * fds may be NULL, in which case the sockets marked ready with
+ * res_async_ea_set_ready() are read instead.
+ */
 int
 res_async_query_handle(struct expected_arrival *ea, int *handled, fd_set *fds)
 {
     int ret_val = SR_NO_ANSWER;
 
-    if (!ea || !handled || !fds)
+    if (!ea || !handled)
         return SR_INTERNAL_ERROR;
 
     /*
@@ -2102,6 +2099,44 @@ res_async_ea_isset(struct expected_arrival *ea, fd_set *fds)
     return 0;
 }
 
+/*
+ * Ask to be told whenever a socket for one of the arrivals in the list
+ * is opened or closed, e.g. to keep an epoll/kqueue set up to date.
+ */
+void
+res_async_query_set_sock_cb(struct expected_arrival *ea, res_io_sock_cb cb,
+                            void *cb_data)
+{
+    for (; ea; ea = ea->ea_next) {
+        ea->ea_sock_cb = cb;
+        ea->ea_sock_cb_data = cb_data;
+    }
+}
+
+/*
+ * Mark an arrival as having data waiting on its socket, for use
+ * with a NULL fd_set in res_async_query_handle().
+ */
+void
+res_async_ea_set_ready(struct expected_arrival *ea)
+{
+    if (NULL == ea || ea->ea_socket == INVALID_SOCKET)
+        return;
+
+    ea->ea_ready = 1;
+}
+
+int
+res_async_ea_isready(struct expected_arrival *ea)
+{
+    for (; ea; ea = ea->ea_next) {
+        if (ea->ea_socket != INVALID_SOCKET && ea->ea_ready)
+            return 1;
+    }
+
+    return 0;
+}
+
 int
 res_async_tid_isset(int tid, fd_set *fds)
 {
@@ -0,0 +1,593 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+
+/*
+ * SSE2 and AVX2 versions of the byte-at-a-time primitives used on
+ * domain names and encoded key material: ASCII case folding, finding
+ * the run of characters in a label that need no escaping (or
+ * unescaping), base32hex encoding of NSEC3 hashes and base64 encoding
+ * and decoding.
+ *
+ * The implementation is picked at run time from the features the CPU
+ * reports; every function has a scalar fallback, which is also used
+ * when the compiler cannot generate the vector code or when RES_NO_SIMD
+ * is defined.  The vector code only ever handles whole blocks, and
+ * leaves the remainder of the input to the callers' existing loops so
+ * that the results are identical to the scalar code.
+ */
+#include "validator-internal.h"
+
+#if !defined(RES_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && \
+     (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define RES_X86_SIMD 1
+#include <immintrin.h>
+#define RES_TARGET_SSE2 __attribute__((target("sse2")))
+#define RES_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/*
+ * Both values are only ever set to the same result by any thread, so
+ * no locking is needed around them.
+ */
+static int      res_simd_detected = -1;
+static int      res_simd_active = -1;
+
+#define RES_SIMD_ACTIVE() \
+    (res_simd_active >= 0 ? res_simd_active : res_simd_level())
+
+static int
+res_simd_detect(void)
+{
+#ifdef RES_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return RES_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return RES_SIMD_SSE2;
+#endif
+    return RES_SIMD_SCALAR;
+}
+
+/*
+ * Returns the vector instruction set in use (RES_SIMD_*).
+ */
+int
+res_simd_level(void)
+{
+    if (res_simd_detected < 0)
+        res_simd_detected = res_simd_detect();
+    if (res_simd_active < 0)
+        res_simd_active = res_simd_detected;
+    return res_simd_active;
+}
+
+/*
+ * Restrict the vector instruction set used, mainly for testing and
+ * benchmarking against the scalar code.  A level above what the CPU
+ * supports (or below zero) selects the best supported level.  Returns
+ * the level now in use.
+ */
+int
+res_simd_set_level(int level)
+{
+    if (res_simd_detected < 0)
+        res_simd_detected = res_simd_detect();
+    if (level < 0 || level > res_simd_detected)
+        level = res_simd_detected;
+    res_simd_active = level;
+    return level;
+}
+
+/*
+ * ASCII case folding
+ */
+
+static void
+lower_scalar(u_char * buf, size_t len)
+{
+    size_t          i;
+
+    for (i = 0; i < len; i++) {
+        if ((u_char) (buf[i] - 'A') < 26)
+            buf[i] += 'a' - 'A';
+    }
+}
+
+#ifdef RES_X86_SIMD
+/*
+ * Bytes are biased so that 'A'..'Z' become the 26 smallest signed
+ * values, which a single signed compare picks out.  Folding is
+ * idempotent, so the last block may overlap the one before it.
+ */
+static RES_TARGET_SSE2 __m128i
+lower_block_sse2(__m128i v)
+{
+    __m128i         biased = _mm_add_epi8(v, _mm_set1_epi8(0x80 - 'A'));
+    __m128i         upper = _mm_cmplt_epi8(biased,
+                                           _mm_set1_epi8(-128 + 26));
+
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static RES_TARGET_SSE2 void
+lower_sse2(u_char * buf, size_t len)
+{
+    size_t          i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i         v = _mm_loadu_si128((const __m128i *) (buf + i));
+        _mm_storeu_si128((__m128i *) (buf + i), lower_block_sse2(v));
+    }
+    if (i < len) {
+        __m128i         v =
+            _mm_loadu_si128((const __m128i *) (buf + len - 16));
+        _mm_storeu_si128((__m128i *) (buf + len - 16),
+                         lower_block_sse2(v));
+    }
+}
+
+static RES_TARGET_AVX2 __m256i
+lower_block_avx2(__m256i v)
+{
+    __m256i         biased =
+        _mm256_add_epi8(v, _mm256_set1_epi8(0x80 - 'A'));
+    __m256i         upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26),
+                                              biased);
+
+    return _mm256_or_si256(v,
+                           _mm256_and_si256(upper,
+                                            _mm256_set1_epi8(0x20)));
+}
+
+static RES_TARGET_AVX2 void
+lower_avx2(u_char * buf, size_t len)
+{
+    size_t          i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i         v =
+            _mm256_loadu_si256((const __m256i *) (buf + i));
+        _mm256_storeu_si256((__m256i *) (buf + i), lower_block_avx2(v));
+    }
+    if (i < len) {
+        __m256i         v =
+            _mm256_loadu_si256((const __m256i *) (buf + len - 32));
+        _mm256_storeu_si256((__m256i *) (buf + len - 32),
+                            lower_block_avx2(v));
+    }
+}
+#endif
+
+/*
+ * Convert the upper case ASCII letters in buf to lower case.
+ */
+void
+res_lower_bytes(u_char * buf, size_t len)
+{
+    if (buf == NULL)
+        return;
+#ifdef RES_X86_SIMD
+    if (len >= 16) {
+        int             level = RES_SIMD_ACTIVE();
+
+        if (level >= RES_SIMD_AVX2 && len >= 32) {
+            lower_avx2(buf, len);
+            return;
+        }
+        if (level >= RES_SIMD_SSE2) {
+            lower_sse2(buf, len);
+            return;
+        }
+    }
+#endif
+    lower_scalar(buf, len);
+}
+
+/*
+ * Label scanning for ns_name_ntop() and ns_name_pton()
+ */
+
+/*
+ * Characters that ns_name_ntop() copies without escaping: printable
+ * ASCII other than the zone file specials " $ ( ) . ; @ and \
+ */
+static int
+ntop_plain(u_char c)
+{
+    switch (c) {
+    case '"':
+    case '$':
+    case '(':
+    case ')':
+    case '.':
+    case ';':
+    case '@':
+    case '\\':
+        return 0;
+    default:
+        return (c > 0x20 && c < 0x7f);
+    }
+}
+
+#ifdef RES_X86_SIMD
+static RES_TARGET_SSE2 unsigned int
+ntop_mask_sse2(const u_char * p)
+{
+    __m128i         v = _mm_loadu_si128((const __m128i *) p);
+    __m128i         ok = _mm_and_si128(_mm_cmpgt_epi8(v,
+                                                      _mm_set1_epi8(0x20)),
+                                       _mm_cmplt_epi8(v,
+                                                      _mm_set1_epi8(0x7f)));
+    __m128i         sp = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('$'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(';'))));
+
+    sp = _mm_or_si128(sp, _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('@')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        /* '(' and ')' differ only in the lowest bit */
+        _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(1)),
+                       _mm_set1_epi8(')'))));
+    return (unsigned int) _mm_movemask_epi8(_mm_andnot_si128(sp, ok));
+}
+
+static RES_TARGET_AVX2 unsigned int
+ntop_mask_avx2(const u_char * p)
+{
+    __m256i         v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i         ok = _mm256_andnot_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x7e)),
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x20)));
+    __m256i         sp = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';'))));
+
+    sp = _mm256_or_si256(sp, _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('@')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(1)),
+                          _mm256_set1_epi8(')'))));
+    return (unsigned int) _mm256_movemask_epi8(_mm256_andnot_si256(sp, ok));
+}
+
+static RES_TARGET_SSE2 unsigned int
+pton_mask_sse2(const char *p)
+{
+    __m128i         v = _mm_loadu_si128((const __m128i *) p);
+    __m128i         stop =
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')),
+                                  _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+
+    return (unsigned int) (~_mm_movemask_epi8(stop) & 0xffff);
+}
+
+static RES_TARGET_AVX2 unsigned int
+pton_mask_avx2(const char *p)
+{
+    __m256i         v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i         stop =
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v,
+                                                          _mm256_set1_epi8
+                                                          ('\\')),
+                                        _mm256_cmpeq_epi8(v,
+                                                          _mm256_setzero_si256
+                                                          ())));
+
+    return ~(unsigned int) _mm256_movemask_epi8(stop);
+}
+
+/*
+ * Length of the leading run of bytes whose bits are set in the masks
+ * returned for each block.  The last block is allowed to overlap the
+ * one before it, ignoring the bits already looked at.
+ */
+#define RES_SPAN(mask_fn, width, full, p, len) do {                     \
+        size_t          i_, s_;                                         \
+        unsigned int    m_;                                             \
+        for (i_ = 0; i_ + (width) <= (len); i_ += (width)) {            \
+            m_ = mask_fn((p) + i_);                                     \
+            if (m_ != (full))                                           \
+                return i_ + __builtin_ctz(~m_);                         \
+        }                                                               \
+        if (i_ == (len))                                                \
+            return i_;                                                  \
+        s_ = i_ + (width) - (len);                                      \
+        m_ = mask_fn((p) + (len) - (width)) >> s_;                      \
+        if (m_ == ((full) >> s_))                                       \
+            return (len);                                               \
+        return i_ + __builtin_ctz(~m_);                                 \
+    } while (0)
+
+static RES_TARGET_SSE2 size_t
+ntop_span_sse2(const u_char * src, size_t len)
+{
+    RES_SPAN(ntop_mask_sse2, 16, 0xffffU, src, len);
+}
+
+static RES_TARGET_AVX2 size_t
+ntop_span_avx2(const u_char * src, size_t len)
+{
+    RES_SPAN(ntop_mask_avx2, 32, 0xffffffffU, src, len);
+}
+
+static RES_TARGET_SSE2 size_t
+pton_span_sse2(const char *src, size_t len)
+{
+    RES_SPAN(pton_mask_sse2, 16, 0xffffU, src, len);
+}
+
+static RES_TARGET_AVX2 size_t
+pton_span_avx2(const char *src, size_t len)
+{
+    RES_SPAN(pton_mask_avx2, 32, 0xffffffffU, src, len);
+}
+#endif
+
+/*
+ * Returns the number of leading bytes in the len bytes at src that
+ * ns_name_ntop() can copy without escaping them.
+ */
+size_t
+res_ntop_span(const u_char * src, size_t len)
+{
+    size_t          i;
+
+#ifdef RES_X86_SIMD
+    if (len >= 16) {
+        int             level = RES_SIMD_ACTIVE();
+
+        if (level >= RES_SIMD_AVX2 && len >= 32)
+            return ntop_span_avx2(src, len);
+        if (level >= RES_SIMD_SSE2)
+            return ntop_span_sse2(src, len);
+    }
+#endif
+    for (i = 0; i < len && ntop_plain(src[i]); i++);
+    return i;
+}
+
+/*
+ * Returns the number of leading characters in the len characters at
+ * src that ns_name_pton() copies unchanged into a label, that is, up
+ * to the first '.', '\' or NUL.
+ */
+size_t
+res_pton_span(const char *src, size_t len)
+{
+    size_t          i;
+
+#ifdef RES_X86_SIMD
+    if (len >= 16) {
+        int             level = RES_SIMD_ACTIVE();
+
+        if (level >= RES_SIMD_AVX2 && len >= 32)
+            return pton_span_avx2(src, len);
+        if (level >= RES_SIMD_SSE2)
+            return pton_span_sse2(src, len);
+    }
+#endif
+    for (i = 0; i < len && src[i] != '.' && src[i] != '\\' &&
+         src[i] != '\0'; i++);
+    return i;
+}
+
+/*
+ * base32hex
+ */
+
+#ifdef RES_X86_SIMD
+/*
+ * Encode 20 bytes (four 40 bit groups, the size of a SHA-1 NSEC3 hash)
+ * into 32 lower case characters.  Each output character is the top
+ * five bits of a big endian 16 bit window into its group, shifted into
+ * place with a multiply since AVX2 has no variable 16 bit shift.  The
+ * lanes hold groups 0-1 and 2-3 respectively, and packing the two
+ * halves of every group back together leaves the characters in order.
+ */
+static RES_TARGET_AVX2 void
+b32hex_block_avx2(const u_char * in, u_char * out)
+{
+    const __m256i   shuf_first = _mm256_setr_epi8(
+        1, 0, 1, 0, 2, 1, 2, 1, 3, 2, 4, 3, 4, 3, -128, 4,
+        7, 6, 7, 6, 8, 7, 8, 7, 9, 8, 10, 9, 10, 9, -128, 10);
+    const __m256i   shuf_second = _mm256_setr_epi8(
+        6, 5, 6, 5, 7, 6, 7, 6, 8, 7, 9, 8, 9, 8, -128, 9,
+        12, 11, 12, 11, 13, 12, 13, 12, 14, 13, 15, 14, 15, 14, -128, 15);
+    const __m256i   shift = _mm256_setr_epi16(
+        32, 1024, 128, 4096, 512, 64, 2048, 256,
+        32, 1024, 128, 4096, 512, 64, 2048, 256);
+    const __m256i   five = _mm256_set1_epi16(0x1f);
+    __m256i         v, w1, w2, c;
+
+    v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                                    _mm_loadu_si128((const __m128i *) in)),
+                                _mm_loadu_si128((const __m128i *) (in + 4)),
+                                1);
+    w1 = _mm256_and_si256(_mm256_mulhi_epu16(
+                              _mm256_shuffle_epi8(v, shuf_first), shift),
+                          five);
+    w2 = _mm256_and_si256(_mm256_mulhi_epu16(
+                              _mm256_shuffle_epi8(v, shuf_second), shift),
+                          five);
+    c = _mm256_packus_epi16(w1, w2);
+    /* '0'..'9' for 0-9 and 'a'..'v' for 10-31 */
+    c = _mm256_add_epi8(c, _mm256_add_epi8(
+                            _mm256_set1_epi8('0'),
+                            _mm256_and_si256(
+                                _mm256_cmpgt_epi8(c, _mm256_set1_epi8(9)),
+                                _mm256_set1_epi8('a' - '0' - 10))));
+    _mm256_storeu_si256((__m256i *) out, c);
+}
+#endif
+
+/*
+ * Encode whole 20 byte blocks of in as lower case base32hex.  Returns
+ * the number of input bytes consumed (the output is 8/5 as long);
+ * the caller encodes whatever is left.
+ */
+size_t
+res_b32hex_encode_blocks(const u_char * in, size_t inlen, u_char * out)
+{
+    size_t          done = 0;
+
+#ifdef RES_X86_SIMD
+    if (inlen >= 20 && RES_SIMD_ACTIVE() >= RES_SIMD_AVX2) {
+        for (; done + 20 <= inlen; done += 20)
+            b32hex_block_avx2(in + done, out + done / 5 * 8);
+    }
+#endif
+    return done;
+}
+
+/*
+ * base64, after the vector algorithms of Wojciech Mula and Daniel
+ * Lemire.  They rely on byte shuffles, so there is no SSE2 version.
+ */
+
+#ifdef RES_X86_SIMD
+/*
+ * Encode 24 bytes into 32 characters.  in must have 28 readable bytes.
+ */
+static RES_TARGET_AVX2 void
+b64_encode_block_avx2(const u_char * in, char *out)
+{
+    const __m256i   shuf = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    /* offsets to add to each 6 bit value, indexed by its range */
+    const __m256i   offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    __m256i         v, t0, t1, idx, range;
+
+    v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                                    _mm_loadu_si128((const __m128i *) in)),
+                                _mm_loadu_si128((const __m128i *) (in + 12)),
+                                1);
+    v = _mm256_shuffle_epi8(v, shuf);
+    /* split every 3 bytes into four 6 bit values, one per byte */
+    t0 = _mm256_mulhi_epu16(_mm256_and_si256(v,
+                                             _mm256_set1_epi32(0x0fc0fc00)),
+                            _mm256_set1_epi32(0x04000040));
+    t1 = _mm256_mullo_epi16(_mm256_and_si256(v,
+                                             _mm256_set1_epi32(0x003f03f0)),
+                            _mm256_set1_epi32(0x01000010));
+    idx = _mm256_or_si256(t0, t1);
+
+    /* 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12 */
+    range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx),
+                                _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i *) out,
+                        _mm256_add_epi8(idx,
+                                        _mm256_shuffle_epi8(offsets,
+                                                            range)));
+}
+
+/*
+ * Decode 32 characters into 24 bytes, writing 32.  Returns 0 if any of
+ * the characters is not in the base64 alphabet.
+ */
+static RES_TARGET_AVX2 int
+b64_decode_block_avx2(const char *in, u_char * out)
+{
+    const __m256i   lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i   lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i   lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i   mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i   pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    __m256i         v, hi, lo, roll;
+
+    v = _mm256_loadu_si256((const __m256i *) in);
+    hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+    lo = _mm256_and_si256(v, mask_2f);
+    if (!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, lo),
+                            _mm256_shuffle_epi8(lut_hi, hi)))
+        return 0;
+
+    /* map the characters to their 6 bit values */
+    roll = _mm256_shuffle_epi8(lut_roll,
+                               _mm256_add_epi8(_mm256_cmpeq_epi8(v, mask_2f),
+                                               hi));
+    v = _mm256_add_epi8(v, roll);
+
+    /* and merge four of them into every three bytes */
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(v, pack);
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+                                                         7, 7));
+    _mm256_storeu_si256((__m256i *) out, v);
+    return 1;
+}
+#endif
+
+/*
+ * Encode whole 24 byte blocks of src as base64 into dst, which must
+ * have room for all of the output.  Returns the number of input bytes
+ * consumed (the output is 4/3 as long); the caller encodes the rest.
+ */
+size_t
+res_b64_encode_blocks(const u_char * src, size_t srclen, char *dst)
+{
+    size_t          done = 0;
+
+#ifdef RES_X86_SIMD
+    if (srclen >= 28 && RES_SIMD_ACTIVE() >= RES_SIMD_AVX2) {
+        for (; done + 28 <= srclen; done += 24)
+            b64_encode_block_avx2(src + done, dst + done / 3 * 4);
+    }
+#endif
+    return done;
+}
+
+/*
+ * Decode whole 32 character blocks of base64 at src into dst, stopping
+ * at the first block containing anything outside the base64 alphabet
+ * (white space or padding included).  Returns the number of characters
+ * consumed (the output is 3/4 as long); the caller decodes the rest.
+ */
+size_t
+res_b64_decode_blocks(const char *src, size_t srclen, u_char * dst,
+                      size_t dstlen)
+{
+    size_t          done = 0;
+
+#ifdef RES_X86_SIMD
+    if (srclen >= 32 && dstlen >= 32 &&
+        RES_SIMD_ACTIVE() >= RES_SIMD_AVX2) {
+        for (; done + 32 <= srclen && done / 4 * 3 + 32 <= dstlen;
+             done += 32) {
+            if (!b64_decode_block_avx2(src + done, dst + done / 4 * 3))
+                break;
+        }
+    }
+#endif
+    return done;
+}
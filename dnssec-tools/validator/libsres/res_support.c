@@ -434,12 +434,34 @@ u_int16_t libsres_random(void)
     return rnd;
 }
 
-int
-label_bytes_cmp(const u_char * field1, size_t length1, 
-                const u_char * field2, size_t length2)
+/*
+ * ASCII case folding; bytes outside 'A'-'Z' (including label lengths,
+ * which never exceed 63) are left alone.
+ */
+static const u_char res_lower[256] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+    0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+    0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+    0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+    0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+    0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+    0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+    0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+    0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+    0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+#define RES_TOLOWER(c) (res_lower[(u_char) (c)])
+
+static int
+label_fold_cmp(const u_char * field1, size_t length1,
+               const u_char * field2, size_t length2)
 {
-    u_char        buffer1[NS_MAXCDNAME];
-    u_char        buffer2[NS_MAXCDNAME];
     size_t        i;
     size_t        min_len;
     int           ret_val;
@@ -454,28 +476,14 @@ label_bytes_cmp(const u_char * field1, size_t length1,
     min_len = (length1 < length2) ? length1 : length2;
 
     /*
-     * Compare this label's first min_len bytes 
-     */
-    /*
-     * Convert to lower case first 
+     * Compare this label's first min_len bytes, ignoring case 
      */
-    memcpy(buffer1, field1, min_len);
-    for (i = 0; i < min_len; i++)
-        if (isupper(buffer1[i]))
-            buffer1[i] = tolower(buffer1[i]);
-
-    memcpy(buffer2, field2, min_len);
-    for (i = 0; i < min_len; i++)
-        if (isupper(buffer2[i]))
-            buffer2[i] = tolower(buffer2[i]);
-
-    ret_val = memcmp(buffer1, buffer2, min_len);
+    for (i = 0; i < min_len; i++) {
+        ret_val = RES_TOLOWER(field1[i]) - RES_TOLOWER(field2[i]);
+        if (ret_val != 0)
+            return ret_val;
+    }
 
-    /*
-     * If they differ, propgate that 
-     */
-    if (ret_val != 0)
-        return ret_val;
     /*
      * If the first n bytes are the same, then the length determines
      * the difference - if any 
@@ -483,6 +491,34 @@ label_bytes_cmp(const u_char * field1, size_t length1,
     return length1 - length2;
 }
 
+int
+label_bytes_cmp(const u_char * field1, size_t length1,
+                const u_char * field2, size_t length2)
+{
+    return label_fold_cmp(field1, length1, field2, length2);
+}
+
+/*
+ * Record the offset of each label in a wire format name.  Returns the
+ * number of labels, counting the root label, or 0 if the name is
+ * malformed.
+ */
+static size_t
+label_offsets(const u_char * name, u_char * offsets)
+{
+    size_t          i = 0;
+    size_t          n = 0;
+
+    while (name[i]) {
+        if ((name[i] & 0xc0) || i + name[i] + 1 >= NS_MAXCDNAME)
+            return 0;
+        offsets[n++] = (u_char) i;
+        i += name[i] + 1;
+    }
+    offsets[n++] = (u_char) i;
+    return n;
+}
+
 int
 labelcmp(const u_char * name1, const u_char * name2, size_t label_cnt)
 {
@@ -525,7 +561,7 @@ labelcmp(const u_char * name1, const u_char * name2, size_t label_cnt)
         if (length1 == 0 || length2 == 0) {
             retval = length1 - length2;
         } else {
-            retval = label_bytes_cmp(&ptr1[label_cnt-1][1], 
+            retval = label_fold_cmp(&ptr1[label_cnt-1][1], 
                                      length1,
                                      &ptr2[label_cnt-1][1],
                                      length2);
@@ -552,13 +588,11 @@ labelcmp(const u_char * name1, const u_char * name2, size_t label_cnt)
 int
 namecmp(const u_char * name1, const u_char * name2)
 {
-    size_t             labels1 = 1;
-    size_t             labels2 = 1;
-    size_t             index1 = 0;
-    size_t             index2 = 0;
-    size_t             i;
-    size_t             label_cnt;
-    size_t             ldiff;
+    u_char          offsets1[NS_MAXCDNAME / 2 + 1];
+    u_char          offsets2[NS_MAXCDNAME / 2 + 1];
+    size_t          labels1;
+    size_t          labels2;
+    size_t          i1, i2;
     int             ret_val;
 
     /*
@@ -575,45 +609,176 @@ namecmp(const u_char * name1, const u_char * name2)
     }
 
     /*
-     * count labels 
+     * find the label boundaries in a single pass over each name
      */
-    for (; name1[index1]; index1 += (int) name1[index1] + 1)
-        labels1++;
-    for (; name2[index2]; index2 += (int) name2[index2] + 1)
-        labels2++;
-
-    index1 = 0;
-    index2 = 0;
+    labels1 = label_offsets(name1, offsets1);
+    labels2 = label_offsets(name2, offsets2);
+    if (labels1 == 0 || labels2 == 0)
+        return (int) labels1 - (int) labels2;
 
     /*
-     * find index in longer name where the number of labels is equal 
+     * compare the labels right to left, skipping the root 
      */
-    if (labels1 > labels2) {
-        label_cnt = labels2;
-        ldiff = labels1 - labels2;
-        for (i = 0; i < ldiff; i++)
-            index1 += name1[index1] + 1;
-    }
-    else {
-        label_cnt = labels1;
-        ldiff = labels2 - labels1;
-        for (i = 0; i < ldiff; i++)
-            index2 += name2[index2] + 1;
+    for (i1 = labels1 - 1, i2 = labels2 - 1; i1 > 0 && i2 > 0;) {
+        const u_char   *l1 = &name1[offsets1[--i1]];
+        const u_char   *l2 = &name2[offsets2[--i2]];
+
+        ret_val = label_fold_cmp(l1 + 1, l1[0], l2 + 1, l2[0]);
+        if (ret_val != 0)
+            return ret_val;
     }
 
     /*
-     * compare last N labels 
+     * If one dname is a "proper suffix" of the other,
+     * the shorter comes first 
      */
-    ret_val = labelcmp(&name1[index1], &name2[index2], label_cnt);
+    return (int) labels1 - (int) labels2;
+}
 
-    if (ret_val != 0)
-        return ret_val;
+/*
+ * Prepare a canonical (lower case) copy of a wire format name, together
+ * with its length, label offsets and hash, so that it can be compared
+ * against many other names without rescanning it each time.
+ *
+ * Returns 0 on success, -1 if the name is malformed.
+ */
+int
+canon_name_init(struct canon_name *cn, const u_char * name_n)
+{
+    unsigned int    h = 2166136261U;
+    size_t          i;
+
+    if (cn == NULL || name_n == NULL)
+        return -1;
+
+    cn->cn_labels = label_offsets(name_n, cn->cn_offsets);
+    if (cn->cn_labels == 0)
+        return -1;
+    cn->cn_len = cn->cn_offsets[cn->cn_labels - 1] + 1;
+
+    for (i = 0; i < cn->cn_len; i++) {
+        cn->cn_name[i] = RES_TOLOWER(name_n[i]);
+        h = (h ^ cn->cn_name[i]) * 16777619U;
+    }
+    cn->cn_hash = h;
+
+    return 0;
+}
+
+/*
+ * Same ordering as namecmp(), for two canonical names.
+ */
+int
+canon_namecmp(const struct canon_name *cn1, const struct canon_name *cn2)
+{
+    size_t          i1, i2, len1, len2;
+    int             ret_val;
+
+    if (cn1->cn_hash == cn2->cn_hash && cn1->cn_len == cn2->cn_len &&
+        !memcmp(cn1->cn_name, cn2->cn_name, cn1->cn_len))
+        return 0;
+
+    for (i1 = cn1->cn_labels - 1, i2 = cn2->cn_labels - 1;
+         i1 > 0 && i2 > 0;) {
+        const u_char   *l1 = &cn1->cn_name[cn1->cn_offsets[--i1]];
+        const u_char   *l2 = &cn2->cn_name[cn2->cn_offsets[--i2]];
+
+        len1 = l1[0];
+        len2 = l2[0];
+        ret_val = memcmp(l1 + 1, l2 + 1, len1 < len2 ? len1 : len2);
+        if (ret_val == 0)
+            ret_val = (int) len1 - (int) len2;
+        if (ret_val != 0)
+            return ret_val;
+    }
+
+    return (int) cn1->cn_labels - (int) cn2->cn_labels;
+}
+
+/*
+ * Same ordering as namecmp(), for a canonical name and a wire format
+ * name.
+ */
+int
+canon_namecmp_wire(const struct canon_name *cn, const u_char * name_n)
+{
+    u_char          offsets[NS_MAXCDNAME / 2 + 1];
+    size_t          labels;
+    size_t          i1, i2;
+    int             ret_val;
+
+    if (name_n == NULL)
+        return 1;
+    labels = label_offsets(name_n, offsets);
+    if (labels == 0)
+        return 1;
+
+    for (i1 = cn->cn_labels - 1, i2 = labels - 1; i1 > 0 && i2 > 0;) {
+        const u_char   *l1 = &cn->cn_name[cn->cn_offsets[--i1]];
+        const u_char   *l2 = &name_n[offsets[--i2]];
+
+        ret_val = label_fold_cmp(l1 + 1, l1[0], l2 + 1, l2[0]);
+        if (ret_val != 0)
+            return ret_val;
+    }
+
+    return (int) cn->cn_labels - (int) labels;
+}
+
+/*
+ * Returns 1 if the wire format name is the same as the canonical name,
+ * ignoring case, and 0 otherwise.  Stops at the first differing byte.
+ */
+int
+canon_name_equal(const struct canon_name *cn, const u_char * name_n)
+{
+    size_t          i;
+
+    if (name_n == NULL)
+        return 0;
 
     /*
-     * If one dname is a "proper suffix" of the other,
-     * the shorter comes first 
+     * The canonical name ends in the root label, so a match on every
+     * byte also means that the other name ends in the same place.
      */
-    return labels1 - labels2;
+    for (i = 0; i < cn->cn_len; i++) {
+        if (RES_TOLOWER(name_n[i]) != cn->cn_name[i])
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Check if tail_n is the canonical name itself or one of its ancestors.
+ * Returns the offset of tail_n within the name, or -1 if it is not.
+ */
+int
+canon_name_tail(const struct canon_name *cn, const u_char * tail_n)
+{
+    size_t          i = 0;
+    size_t          labels = 1;
+    size_t          off;
+
+    if (tail_n == NULL)
+        return -1;
+
+    while (tail_n[i]) {
+        if ((tail_n[i] & 0xc0) || i + tail_n[i] + 1 >= NS_MAXCDNAME)
+            return -1;
+        i += tail_n[i] + 1;
+        labels++;
+    }
+    if (labels > cn->cn_labels)
+        return -1;
+
+    off = cn->cn_offsets[cn->cn_labels - labels];
+    if (cn->cn_len - off != i + 1)
+        return -1;
+    for (i = 0; i < cn->cn_len - off; i++) {
+        if (RES_TOLOWER(tail_n[i]) != cn->cn_name[off + i])
+            return -1;
+    }
+    return (int) off;
 }
 
 int
@@ -13,6 +13,12 @@
 #include "val_context.h"
 #include "val_assertion.h"
 #include "val_parse.h"
+#include "val_stats.h"
+#include "val_async_engine.h"
+#include "val_rcache.h"
+#include "val_tcache.h"
+#include "val_prefetch.h"
+#include "val_cache_file.h"
 
 extern void res_print_ea(struct expected_arrival *ea);
 extern const char *p_query_status(int err);
@@ -291,12 +297,16 @@ init_query_chain_node(struct val_query_chain *q)
     q->qc_state = Q_INIT;
     q->qc_ttl_x = 0; 
     q->qc_bad = 0;
+    q->qc_hits = 0;
+    q->qc_hit_start = 0;
+    q->qc_prefetched = 0;
     q->qc_zonecut_n = NULL;
     q->qc_referral = NULL;
     q->qc_ns_list = NULL;
     q->qc_respondent_server = NULL;
     q->qc_respondent_server_options = 0;
     q->qc_trans_id = -1;
+    q->qc_inflight = NULL;
     q->qc_ea = NULL;
     q->qc_ans = NULL;
     q->qc_proof = NULL;
@@ -501,6 +511,10 @@ add_to_query_chain(val_context_t *context, u_char * name_n,
                         temp->qc_type_h, temp->qc_state, temp->qc_flags,
                         temp->qc_ttl_x - tv.tv_sec);
                 /* return this cached record */
+                if (temp->qc_state >= Q_ANSWERED) {
+                    VAL_STATS_INC(vs_cache_hits);
+                    val_prefetch_query_hit(context, temp, tv.tv_sec);
+                }
                 *added_q = temp;
                 return VAL_NO_ERROR;
             }
@@ -883,7 +897,7 @@ get_zse(val_context_t * ctx, u_char * name_n, u_int32_t flags,
 {
     policy_entry_t *zse_pol, *zse_cur;
     size_t          name_len;
-    u_char         *p;
+    struct canon_name cname;
     int             retval;
 
     /*
@@ -905,7 +919,7 @@ get_zse(val_context_t * ctx, u_char * name_n, u_int32_t flags,
      */
     
     RETRIEVE_POLICY(ctx, P_ZONE_SECURITY_EXPECTATION, zse_pol);
-    if (zse_pol != NULL) {
+    if (zse_pol != NULL && canon_name_init(&cname, name_n) == 0) {
         for (zse_cur = zse_pol;
              zse_cur && (wire_name_length(zse_cur->zone_n) > name_len);
              zse_cur = zse_cur->next);
@@ -917,27 +931,14 @@ get_zse(val_context_t * ctx, u_char * name_n, u_int32_t flags,
          * Because of the ordering, the longest match is found first 
          */
         for (; zse_cur; zse_cur = zse_cur->next) {
-            int             root_zone = 0;
-            if (!namecmp(zse_cur->zone_n, (const u_char *) ""))
-                root_zone = 1;
-            else {
-                /*
-                 * Find the last occurrence of zse_cur->zone_n in name_n 
-                 */
-                p = name_n;
-                while (p && (*p != '\0')) {
-                    if (!namecmp(p, zse_cur->zone_n))
-                        break;
-                    p = p + *p + 1;
-                }
-            }
+            int             off = canon_name_tail(&cname, zse_cur->zone_n);
 
-            if ((root_zone || (!namecmp(p, zse_cur->zone_n))) && zse_cur->pol) {
+            if (off >= 0 && zse_cur->pol) {
                 struct zone_se_policy *pol = 
                     (struct zone_se_policy *)(zse_cur->pol);
     
                 if (match_ptr) {
-                    *match_ptr = namename(name_n, zse_cur->zone_n);
+                    *match_ptr = name_n + off;
                 }
 
                 if (zse_cur->exp_ttl > 0)
@@ -971,10 +972,9 @@ find_trust_point(val_context_t * ctx, u_char * zone_n,
                  u_char ** matched_zone, u_int32_t *ttl_x)
 {
 
-    policy_entry_t *ta_pol, *ta_cur, *ta_tmphead;
-    size_t       name_len;
-    u_char       *zp = zone_n;
-    u_char       *ep;
+    policy_entry_t *ta_pol, *ta_cur;
+    struct canon_name cname;
+    int          off;
 
     /*
      * This function should never be called with a NULL zone_n, but still... 
@@ -985,12 +985,9 @@ find_trust_point(val_context_t * ctx, u_char * zone_n,
     *matched_zone = NULL;
     *ttl_x = 0;
 
-    name_len = wire_name_length(zp);
-    ep = zp + name_len;
-    
     RETRIEVE_POLICY(ctx, P_TRUST_ANCHOR, ta_pol);
     
-    if (ta_pol == NULL) {
+    if (ta_pol == NULL || canon_name_init(&cname, zone_n) != 0) {
         return VAL_NO_ERROR;
     }
 
@@ -998,44 +995,34 @@ find_trust_point(val_context_t * ctx, u_char * zone_n,
      * skip longer names 
      */
     for (ta_cur = ta_pol;
-         ta_cur && (wire_name_length(ta_cur->zone_n) > name_len);
+         ta_cur && (wire_name_length(ta_cur->zone_n) > cname.cn_len);
          ta_cur = ta_cur->next);
 
     /*
-     * for the remaining nodes, see if there is any hope 
+     * The list is ordered by decreasing name length, so the first
+     * trust anchor at or above zone_n is the closest one
      */
-    ta_tmphead = ta_cur;
-    while (zp < ep) {
-        for (ta_cur = ta_tmphead; ta_cur; ta_cur = ta_cur->next) {
-            if (wire_name_length(zp) < wire_name_length(ta_cur->zone_n))
-                /** next time look from this point */
-                ta_tmphead = ta_cur->next;
-
-            if (namecmp(ta_cur->zone_n, zp) == 0) {
-                size_t len;
-                len = wire_name_length(zp);
-                /** We have hope */
-                *matched_zone =
-                   (u_char *) MALLOC( len * sizeof(u_char));
-                if (*matched_zone == NULL) {
-                    return VAL_OUT_OF_MEMORY;
-                }
-                memcpy(*matched_zone, zp, len);
-                if (ta_cur->exp_ttl > 0)
-                    *ttl_x = ta_cur->exp_ttl;
-                return VAL_NO_ERROR;
+    for (; ta_cur; ta_cur = ta_cur->next) {
+        if ((off = canon_name_tail(&cname, ta_cur->zone_n)) >= 0) {
+            size_t len;
+            len = cname.cn_len - off;
+            /** We have hope */
+            *matched_zone =
+               (u_char *) MALLOC( len * sizeof(u_char));
+            if (*matched_zone == NULL) {
+                return VAL_OUT_OF_MEMORY;
             }
+            memcpy(*matched_zone, zone_n + off, len);
+            if (ta_cur->exp_ttl > 0)
+                *ttl_x = ta_cur->exp_ttl;
+            return VAL_NO_ERROR;
         }
-        /*
-         * trim the top label from our candidate zone 
-         */
-        zp += (int) zp[0] + 1;
     }
 
     return VAL_NO_ERROR;
 }
 
-static int
+int
 is_trusted_key(val_context_t * ctx, u_char * zone_n, struct rrset_rr *key, 
                val_astatus_t * status, u_int32_t flags, u_int32_t *ttl_x)
 {
@@ -1655,6 +1642,25 @@ build_pending_query(val_context_t *context,
      */
     if (as->val_ac_rrset.ac_data->rrs_type_h == ns_t_dnskey) {
 
+        /*
+         * No need to go further if another chain has already shown
+         * this key set to be trusted
+         */
+        if (val_tcache_keyset_trusted(context, as->val_ac_rrset.ac_data,
+                                      flags, &ttl_x)) {
+            char name_p[NS_MAXDNAME];
+            if (-1 == ns_name_ntop(as->val_ac_rrset.ac_data->rrs_name_n,
+                                   name_p, sizeof(name_p)))
+                snprintf(name_p, sizeof(name_p), "unknown/error");
+            val_log(context, LOG_INFO,
+                    "build_pending_query(): DNSKEY set for %s is already trusted",
+                    name_p);
+            SET_MIN_TTL(as->val_ac_rrset.ac_data->rrs_ttl_x, ttl_x);
+            SET_MIN_TTL(as->val_ac_query->qc_ttl_x, ttl_x);
+            as->val_ac_status = VAL_AC_TRUST;
+            return VAL_NO_ERROR;
+        }
+
         /*
          * Create a query for missing data 
          */
@@ -2335,6 +2341,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
     u_char   wc_n[NS_MAXCDNAME];
     u_char *soa_name_n;
     u_char *ce = NULL;
+    struct canon_name qname, wcname;
 
     if (ctx == NULL || nlist == NULL || qname_n == NULL || 
         span_proof == NULL || wcard_proof == NULL || notype == NULL) {
@@ -2345,6 +2352,9 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
     *wcard_proof = NULL;
     *notype = 0;
 
+    if (canon_name_init(&qname, qname_n) != 0)
+        return;
+
     for (n = nlist; n; n=n->next) {
         u_char *q1, *q2, *q;
         u_char  *nxtname;
@@ -2353,7 +2363,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
         soa_name_n = &(n->the_set->rrs_sig->rr_rdata[SIGNBY]);
         nxtname = n->the_set->rrs_data->rr_rdata;
 
-        cmp = namecmp(qname_n, n->the_set->rrs_name_n);
+        cmp = canon_namecmp_wire(&qname, n->the_set->rrs_name_n);
         if (cmp ==0) {
             int  nsec_bit_field;
             int  offset;
@@ -2422,7 +2432,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
              * check if query name comes before the next name 
              * or if the next name wraps around 
              */
-            if (namecmp(qname_n, nxtname) <= 0 ||
+            if (canon_namecmp_wire(&qname, nxtname) <= 0 ||
                 !namecmp(nxtname, soa_name_n)) {
 
                 *span_proof = n;
@@ -2431,11 +2441,11 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
 
         /* find the closest enclosure */
         q1 = n->the_set->rrs_name_n;
-        while (*q1 != '\0' && namename(qname_n, q1) == NULL) {
+        while (*q1 != '\0' && canon_name_tail(&qname, q1) < 0) {
             STRIP_LABEL(q1,q1);
         }
         q2 = nxtname;
-        while (*q2 != '\0' && namename(qname_n, q2) == NULL) {
+        while (*q2 != '\0' && canon_name_tail(&qname, q2) < 0) {
             STRIP_LABEL(q2,q2);
         }
         q = (wire_name_length(q1) > wire_name_length(q2))? q1 : q2;
@@ -2471,6 +2481,8 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
     wc_n[0] = 0x01;
     wc_n[1] = 0x2a;             /* for the '*' character */
     memcpy(&wc_n[2], ce, wire_name_length(ce));
+    if (canon_name_init(&wcname, wc_n) != 0)
+        return;
 
     for (n = nlist; n; n=n->next) {
         u_char  *nxtname;
@@ -2478,7 +2490,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
 
         soa_name_n = &(n->the_set->rrs_sig->rr_rdata[SIGNBY]);
         nxtname = n->the_set->rrs_data->rr_rdata;
-        cmp = namecmp(wc_n, n->the_set->rrs_name_n);
+        cmp = canon_namecmp_wire(&wcname, n->the_set->rrs_name_n);
 
         if (cmp == 0) {
             /* wildcard proves non-existence of the type, we've already proved that the type is not set */
@@ -2490,7 +2502,7 @@ prove_nsec_span(val_context_t *ctx, struct nsecprooflist *nlist,
              * check if query name comes before the next name 
              * or if the next name wraps around 
              */
-            if (namecmp(wc_n, nxtname) <= 0 ||
+            if (canon_namecmp_wire(&wcname, nxtname) <= 0 ||
                 !namecmp(nxtname, soa_name_n)) {
                 *wcard_proof = n;
                 return;
@@ -2641,7 +2653,7 @@ compute_nsec3_hash(val_context_t * ctx, u_char * qname_n,
 {
     int             name_len;
     policy_entry_t *pol, *cur;
-    u_char         *p;
+    struct canon_name cname;
     char            name_p[NS_MAXDNAME];
     size_t          hashlen;
     u_char         *hash;
@@ -2655,7 +2667,7 @@ compute_nsec3_hash(val_context_t * ctx, u_char * qname_n,
         name_len = wire_name_length(soa_name_n);
         RETRIEVE_POLICY(ctx, P_NSEC3_MAX_ITER, pol);
 
-        if (pol != NULL) {
+        if (pol != NULL && canon_name_init(&cname, soa_name_n) == 0) {
             /*
              * go past longer names 
              */
@@ -2670,22 +2682,7 @@ compute_nsec3_hash(val_context_t * ctx, u_char * qname_n,
              * Because of the ordering, the longest match is found first 
              */
             for (; cur; cur = cur->next) {
-                int             root_zone = 0;
-                if (!namecmp(cur->zone_n, (const u_char *) ""))
-                    root_zone = 1;
-                else {
-                    /*
-                     * Find the last occurrence of cur->zone_n in soa_name_n 
-                     */
-                    p = soa_name_n;
-                    while (p && (*p != '\0')) {
-                        if (!namecmp(p, cur->zone_n))
-                            break;
-                        p = p + *p + 1;
-                    }
-                }
-    
-                if (root_zone || !namecmp(p, cur->zone_n)) {
+                if (canon_name_tail(&cname, cur->zone_n) >= 0) {
                     if (-1 == ns_name_ntop(soa_name_n, name_p, sizeof(name_p)))
                         snprintf(name_p, sizeof(name_p), "unknown/error");
     
@@ -3843,6 +3840,8 @@ verify_provably_insecure(val_context_t * context,
     u_char *known_zonecut_n;
     u_char *q_name_n;
     u_int16_t q_type_h;
+    u_int32_t pi_ttl_x = 0;
+    long pi_ttl;
 
     if ((queries == NULL) || (next_as == NULL) || (done == NULL) || (is_pinsecure == NULL)) {
         return VAL_BAD_ARGUMENT;
@@ -3984,6 +3983,21 @@ verify_provably_insecure(val_context_t * context,
         }
     } 
 
+    /*
+     * No need to walk down from the trust point if the name is below
+     * a delegation that has already been shown to have no DS
+     */
+    if (val_tcache_insecure(context, q_labels, curzone_n, ns_c_in,
+                            flags, &pi_ttl_x)) {
+        val_log(context, LOG_INFO,
+                "verify_provably_insecure(): %s is below a zone cut already known to be provably insecure",
+                name_p);
+        *is_pinsecure = 1;
+        if (ttl_x)
+            SET_MIN_TTL(*ttl_x, pi_ttl_x);
+        goto donefornow;
+    }
+
     /* remove common labels in q_labels */
     *q = '\0';
 
@@ -4189,7 +4203,18 @@ verify_provably_insecure(val_context_t * context,
                 }
             } else
 #endif
+            {
+                /* remember the cut for as long as its proof is valid */
+                VAL_STATS_INC(vs_insecure_walks);
+                if ((pi_ttl = val_rcache_results_ttl(results, 0)) > 0) {
+                    pi_ttl_x = (u_int32_t) (time(NULL) + pi_ttl);
+                    if (ttl_x)
+                        SET_MIN_TTL(pi_ttl_x, *ttl_x);
+                    val_tcache_add_insecure(context, zonecut_n, ns_c_in,
+                                            flags, pi_ttl_x);
+                }
                 goto donefornow;
+            }
         }
 
         /* look for next (more specific) zonecut */ 
@@ -4235,12 +4260,12 @@ static int
 is_pu_trusted(val_context_t *ctx, u_char *name_n, u_int32_t *ttl_x)
 {
     policy_entry_t *pu_pol, *pu_cur;
-    u_char       *p;
+    struct canon_name cname;
     char         name_p[NS_MAXDNAME];
     size_t       name_len;
 
     RETRIEVE_POLICY(ctx, P_PROV_INSECURE, pu_pol);
-    if (pu_pol) {
+    if (pu_pol && canon_name_init(&cname, name_n) == 0) {
 
         name_len = wire_name_length(name_n);
         
@@ -4255,22 +4280,9 @@ is_pu_trusted(val_context_t *ctx, u_char *name_n, u_int32_t *ttl_x)
          * Because of the ordering, the longest match is found first 
          */
         for (; pu_cur; pu_cur = pu_cur->next) {
-            int             root_zone = 0;
-            if (!namecmp(pu_cur->zone_n, (const u_char *) ""))
-                root_zone = 1;
-            else {
-                /*
-                 * Find the last occurrence of zse_cur->zone_n in name_n 
-                 */
-                p = name_n;
-                while (p && (*p != '\0')) {
-                    if (!namecmp(p, pu_cur->zone_n))
-                        break;
-                    p = p + *p + 1;
-                }
-            }
+            int             off = canon_name_tail(&cname, pu_cur->zone_n);
 
-            if ((root_zone || (!namecmp(p, pu_cur->zone_n))) && pu_cur->pol) {
+            if (off >= 0 && pu_cur->pol) {
                 struct prov_insecure_policy *pol =
                     (struct prov_insecure_policy *)(pu_cur->pol);
                 if (-1 == ns_name_ntop(name_n, name_p, sizeof(name_p)))
@@ -4801,6 +4813,45 @@ int switch_to_root(val_context_t * context,
 
 }
 
+
+#define MAX_REMEMBERED_CHAIN 32
+
+/*
+ * The authentication chain from as up to top has ended at a trust
+ * point.  Remember the DNSKEY RRsets on it as trusted for as long as
+ * the part of the chain above each of them remains valid.
+ */
+static void
+remember_trusted_keys(val_context_t * context,
+                      struct queries_for_query **queries,
+                      struct val_digested_auth_chain *as,
+                      struct val_digested_auth_chain *top,
+                      u_int32_t flags)
+{
+    struct val_digested_auth_chain *chain[MAX_REMEMBERED_CHAIN];
+    struct rrset_rec *the_set;
+    u_int32_t ttl_x;
+    int n = 0;
+
+    while (as && as != top && n < MAX_REMEMBERED_CHAIN) {
+        chain[n++] = as;
+        as = get_ac_trust(context, as, queries, flags, 0);
+    }
+    if (as != top || top->val_ac_rrset.ac_data == NULL)
+        return;
+
+    ttl_x = top->val_ac_rrset.ac_data->rrs_ttl_x;
+    while (n-- > 0) {
+        the_set = chain[n]->val_ac_rrset.ac_data;
+        if (the_set == NULL)
+            return;
+        if (the_set->rrs_type_h == ns_t_dnskey &&
+            chain[n]->val_ac_status == VAL_AC_VERIFIED)
+            val_tcache_add_keyset(context, the_set, flags, ttl_x);
+        SET_MIN_TTL(ttl_x, the_set->rrs_ttl_x);
+    }
+}
+
 /*
  * Try and verify each assertion. Update results as and when they are available.
  * Do not try and validate assertions that have already been validated.
@@ -5073,6 +5124,8 @@ restart_query:
                                 p_type(next_as->val_ac_rrset.ac_data->rrs_type_h),
                                 next_as->val_ac_rrset.ac_data->rrs_type_h);
                         SET_CHAIN_COMPLETE(res->val_rc_status);
+                        remember_trusted_keys(context, queries, as_more,
+                                              next_as, flags);
                     } else if (next_as->val_ac_status ==
                                VAL_AC_UNTRUSTED_ZONE) {
                         val_log(context, LOG_INFO, 
@@ -5424,6 +5477,7 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
         return retval;
 
     if (!response) {
+        VAL_STATS_INC(vs_cache_misses);
         if (next_q->qfq_query->qc_state > Q_SENT)
             *data_received = 1;
 
@@ -5435,6 +5489,8 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
         return VAL_NO_ERROR;
     }
 
+    VAL_STATS_INC(vs_cache_hits);
+
     if (next_q->qfq_query->qc_state == Q_ANSWERED) {
 
         val_log(context, LOG_INFO,
@@ -5534,6 +5590,70 @@ _ask_cache_one(val_context_t * context, struct queries_for_query **queries,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Take in an answer that was received for next_q
+ */
+static int
+_resolver_assimilate(val_context_t * context,
+                     struct queries_for_query **queries,
+                     struct queries_for_query *next_q,
+                     struct domain_info *response)
+{
+    char                      name_p[NS_MAXDNAME];
+
+    if (-1 == ns_name_ntop(next_q->qfq_query->qc_name_n, name_p,
+                           sizeof(name_p)))
+        snprintf(name_p, sizeof(name_p), "unknown/error");
+    val_log(context, LOG_INFO,
+            "_resolver_rcv_one(): found matching ack/nack response for {%s %s(%d) %s(%d)}, flags=%x",
+            name_p, p_class(next_q->qfq_query->qc_class_h),
+            next_q->qfq_query->qc_class_h,
+            p_type(next_q->qfq_query->qc_type_h),
+            next_q->qfq_query->qc_type_h, next_q->qfq_query->qc_flags);
+    return assimilate_answers(context, queries, response, next_q);
+}
+
+/*
+ * Let a local copy of the zone answer the query, if there is one, and
+ * follow any referrals it gives to the copies of zones further down.
+ * Whatever is left in Q_INIT goes to the network.
+ */
+static int
+_resolver_ask_mirror(val_context_t * context,
+                     struct queries_for_query **queries,
+                     struct queries_for_query *query)
+{
+    struct domain_info *response;
+    int                 answered, i;
+    int                 retval = VAL_NO_ERROR;
+
+    for (i = 0; i < MAX_MIRROR_REFERRALS &&
+                query->qfq_query->qc_state == Q_INIT; i++) {
+
+        if (i > 0 && VAL_NO_ERROR !=
+            (retval = find_nslist_for_query(context, query, queries)))
+            break;
+        if (query->qfq_query->qc_state != Q_INIT)
+            break;
+
+        retval = val_resquery_mirror(context, query, &response, queries,
+                                     &answered);
+        if (VAL_NO_ERROR != retval || !answered)
+            break;
+
+        if (query->qfq_query->qc_state == Q_ANSWERED && response != NULL)
+            retval = _resolver_assimilate(context, queries, query, response);
+        if (response != NULL) {
+            free_domain_info_ptrs(response);
+            FREE(response);
+        }
+        if (VAL_NO_ERROR != retval)
+            break;
+    }
+
+    return retval;
+}
+
 static int
 _resolver_submit_one(val_context_t * context, struct queries_for_query **queries,
                      struct queries_for_query *query)
@@ -5573,6 +5693,15 @@ _resolver_submit_one(val_context_t * context, struct queries_for_query **queries
     if (VAL_NO_ERROR != retval)
         return retval;
 
+#ifndef VAL_NO_ASYNC
+    if (!(query->qfq_query->qc_flags & VAL_QUERY_ASYNC))
+#endif
+    {
+        retval = _resolver_ask_mirror(context, queries, query);
+        if (VAL_NO_ERROR != retval)
+            return retval;
+    }
+
     /* find_nslist_for_query() could have modified the state */
     if (query->qfq_query->qc_state == Q_INIT) {
 #ifndef VAL_NO_ASYNC
@@ -5628,6 +5757,9 @@ _resolver_submit(val_context_t * context, struct queries_for_query **queries,
             break;
         if (next_q->qfq_query->qc_state == Q_SENT)
             ++(*sent);
+        else if (next_q->qfq_query->qc_state >= Q_ANSWERED)
+            /* answered locally, or failed before anything was sent */
+            *data_received = 1;
     }
 
     /* if no data needed, tell caller no data is missing */
@@ -5665,18 +5797,9 @@ _resolver_rcv_one(val_context_t * context, struct queries_for_query **queries,
         return retval;
 
     if ((next_q->qfq_query->qc_state == Q_ANSWERED) && (response != NULL)) {
-        if (-1 == ns_name_ntop(next_q->qfq_query->qc_name_n, name_p,
-                               sizeof(name_p)))
-            snprintf(name_p, sizeof(name_p), "unknown/error");
-        val_log(context, LOG_INFO,
-                "_resolver_rcv_one(): found matching ack/nack response for {%s %s(%d) %s(%d)}, flags=%x",
-                name_p, p_class(next_q->qfq_query->qc_class_h),
-                next_q->qfq_query->qc_class_h,
-                p_type(next_q->qfq_query->qc_type_h),
-                next_q->qfq_query->qc_type_h, next_q->qfq_query->qc_flags);
         if (VAL_NO_ERROR !=
-            (retval = assimilate_answers(context, queries, response,
-                                         next_q))) {
+            (retval = _resolver_assimilate(context, queries, next_q,
+                                           response))) {
             free_domain_info_ptrs(response);
             FREE(response);
             return retval;
@@ -6371,6 +6494,24 @@ int try_chase_query(val_context_t * context,
     return retval;
 }
 
+/*
+ * Did resolution fail to produce an answer, rather than produce one
+ * that says the data does not exist or could not be validated?
+ */
+static int
+_resolution_failed(struct val_result_chain *results)
+{
+    struct val_result_chain *res;
+
+    if (results == NULL)
+        return 1;
+    for (res = results; res; res = res->val_rc_next) {
+        if (res->val_rc_status == VAL_DNS_ERROR)
+            return 1;
+    }
+    return 0;
+}
+
 /*
  * Look inside the cache, ask the resolver for missing data.
  * Then try and validate what ever is possible.
@@ -6394,9 +6535,14 @@ val_resolve_and_check(val_context_t * ctx,
     int done = 0;
     int data_received;
     int data_missing;
+    int prefetch = 0;
+    struct val_result_chain *stale = NULL;
+    struct timeval stale_deadline;
+    int stale_recent = 0;
     val_context_t  *context = NULL;
     u_char domain_name_n[NS_MAXCDNAME];
     u_int16_t q_class, q_type;
+    u_int32_t q_flags;
     
     if ((results == NULL) || (domain_name == NULL))
         return VAL_BAD_ARGUMENT;
@@ -6426,13 +6572,63 @@ val_resolve_and_check(val_context_t * ctx,
     context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
     if (context == NULL)
         return VAL_INTERNAL_ERROR;
+
+    VAL_STATS_INC(vs_queries);
+
+    q_flags = (flags | context->def_cflags | context->def_uflags) &
+                VAL_QFLAGS_USERMASK;
+
+    /*
+     * Let refreshes that nobody else drives land first, so that they
+     * can replace a snapshot that is about to expire.
+     */
+    val_prefetch_poll(context);
+    val_cache_file_poll();
+
+    /*
+     * A trusted answer for this query may already have been published;
+     * this does not need the query cache lock.
+     */
+    if (!(q_flags & VAL_QUERY_SKIP_CACHE) &&
+        val_rcache_lookup(context, domain_name_n, q_class, q_type, q_flags,
+                          results, &prefetch)) {
+        VAL_STATS_INC(vs_snapshot_hits);
+        val_log_authentication_chain(context, LOG_NOTICE, 
+            domain_name, class_h, type_h, *results);
+        val_stats_count_results(*results);
+        if (prefetch)
+            val_prefetch_note(context, domain_name_n, q_class, q_type,
+                              q_flags & ~VAL_QUERY_ASYNC);
+        CTX_UNLOCK_POL(context);
+        val_prefetch_submit(context);
+        return VAL_NO_ERROR;
+    }
+
+    /*
+     * With serve-stale, keep an expired answer at hand in case the
+     * name servers do not answer in time.
+     */
+    if (!(q_flags & VAL_QUERY_SKIP_CACHE) &&
+        context->g_opt && context->g_opt->serve_stale > 0 &&
+        val_rcache_lookup_stale(context, domain_name_n, q_class, q_type,
+                                q_flags, &stale, &stale_recent)) {
+        gettimeofday(&stale_deadline, NULL);
+        if (!stale_recent) {
+            stale_deadline.tv_sec += context->g_opt->stale_timeout / 1000;
+            stale_deadline.tv_usec +=
+                (context->g_opt->stale_timeout % 1000) * 1000;
+            if (stale_deadline.tv_usec >= 1000000) {
+                stale_deadline.tv_sec++;
+                stale_deadline.tv_usec -= 1000000;
+            }
+        }
+    }
   
     CTX_LOCK_ACACHE(context);
    
     if (VAL_NO_ERROR != (retval =
                 add_to_qfq_chain(context, &queries, domain_name_n, q_type, q_class, 
-                    (flags | context->def_cflags | context->def_uflags) & VAL_QFLAGS_USERMASK, 
-                    &added_q))) {
+                    q_flags, &added_q))) {
         goto err;
     }
     top_q = added_q;
@@ -6510,6 +6706,18 @@ val_resolve_and_check(val_context_t * ctx,
         /* We are either done or we are waiting for some data */
         if (!done) {
 
+            /* Don't keep the client waiting if we have a stale answer */
+            if (stale) {
+                struct timeval now_tv;
+
+                gettimeofday(&now_tv, NULL);
+                if (!timercmp(&now_tv, &stale_deadline, <))
+                    break;
+                if (!timerisset(&closest_event) ||
+                    timercmp(&stale_deadline, &closest_event, <))
+                    closest_event = stale_deadline;
+            }
+
             /* Release the lock, let some other thread get some time slice to run */
 #if 0
 #ifndef VAL_NO_THREADS
@@ -6544,9 +6752,32 @@ val_resolve_and_check(val_context_t * ctx,
 
     retval = VAL_NO_ERROR;
 
-    if (*results) {
+    if (stale && (!done || _resolution_failed(*results))) {
+        /*
+         * Answer from the expired snapshot and refresh it in the
+         * background, instead of waiting out the resolver's retries
+         */
+        val_log(context, LOG_NOTICE,
+                "val_resolve_and_check(): Serving stale answer for {%s %s %s}",
+                domain_name, p_class(q_class), p_type(q_type));
+        VAL_STATS_INC(vs_stale_answers);
+        if (*results)
+            val_free_result_chain(*results);
+        *results = stale;
+        stale = NULL;
+        if (!stale_recent) {
+            val_rcache_stale_served(context, domain_name_n, q_class, q_type,
+                                    q_flags);
+            val_prefetch_note(context, domain_name_n, q_class, q_type,
+                              q_flags & ~VAL_QUERY_ASYNC);
+        }
+        val_stats_count_results(*results);
+    } else if (*results) {
         val_log_authentication_chain(context, LOG_NOTICE, 
             domain_name, class_h, type_h, *results);
+        val_stats_count_results(*results);
+        val_rcache_publish(context, domain_name_n, q_class, q_type, q_flags,
+                           *results);
     }
 
   err:
@@ -6557,6 +6788,10 @@ val_resolve_and_check(val_context_t * ctx,
     w_results = NULL;
     free_qfq_chain(context, queries);
 
+    if (stale)
+        val_free_result_chain(stale);
+    val_prefetch_submit(context);
+
     return retval;
 }
 
@@ -6783,6 +7018,22 @@ _call_callbacks(int event, val_async_status *as)
     return callit;
 }
 
+#ifndef VAL_NO_THREADS
+/*
+ * May thread self drive the request?  A request belongs to the thread
+ * that submitted it, unless the worker engine runs; the library's own
+ * refreshes belong to every thread, so that they complete even if the
+ * thread whose lookup noted them never comes back.
+ */
+int
+val_async_owned(val_async_status *as, pthread_t self)
+{
+    return ((as->val_as_ctx->ctx_flags & CTX_PROCESS_ALL_THREADS) ||
+            pthread_equal(self, as->val_as_tid) ||
+            val_prefetch_request(as));
+}
+#endif
+
 static void
 _handle_completed(val_context_t *context)
 
@@ -6804,8 +7055,7 @@ _handle_completed(val_context_t *context)
 
         if (! (as->val_as_flags & VAL_AS_DONE)
 #ifndef VAL_NO_THREADS
-            || (! (context->ctx_flags & CTX_PROCESS_ALL_THREADS) &&
-                (! pthread_equal(self, as->val_as_tid)))
+            || ! val_async_owned(as, self)
 #endif
             ) {
             last = as;
@@ -6826,19 +7076,34 @@ _handle_completed(val_context_t *context)
 
     CTX_UNLOCK_ACACHE(context);
 
+    /** let the engine's workers call the callbacks, if there is one */
+    if (completed && val_async_engine_enqueue(context, completed))
+        return;
+
     /*
      * call callback for completed queries
      */
     while (completed) {
         as = completed;
         completed = completed->val_as_next;
-        _call_callbacks(VAL_AS_EVENT_COMPLETED, as);
-        as->val_as_ctx = NULL; /* we've already removed ourselves */
-        _async_status_free(&as); /* no ctx, so no lock needed */
-        CTX_UNLOCK_POL(context);
+        val_async_complete(context, as);
     }
 }
 
+/*
+ * Call the callback for a request that has been removed from the
+ * context's list of async requests, then release it.
+ */
+void
+val_async_complete(val_context_t *context, val_async_status *as)
+{
+    val_stats_count_results(as->val_as_results);
+    _call_callbacks(VAL_AS_EVENT_COMPLETED, as);
+    as->val_as_ctx = NULL; /* we've already removed ourselves */
+    _async_status_free(&as); /* no ctx, so no lock needed */
+    CTX_UNLOCK_POL(context);
+}
+
 /*
  * Look inside the cache, ask the resolver for missing data.
  */
@@ -6909,6 +7174,7 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
     }
 
     as->val_as_ctx = context;
+    VAL_STATS_INC(vs_queries);
 
     tflags = VAL_QFLAGS_USERMASK & (flags | VAL_QUERY_ASYNC | 
                 context->def_cflags | context->def_uflags);
@@ -7003,6 +7269,10 @@ val_async_submit(val_context_t * ctx,  const char * domain_name, int class_h,
 
     *async_status = as;
 
+    /** answers may already be available; make sure someone looks */
+    if (VAL_NO_ERROR == retval)
+        val_async_engine_wakeup(context);
+
     return retval;
 }
 
@@ -7024,15 +7294,17 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
     pthread_t                   self = pthread_self();
 #endif
 
-    if ((NULL == as) || (as->val_as_ctx == NULL) ||
-        (pending_desc == NULL) || (NULL == nfds) || (NULL == remaining))
+    /*
+     * pending_desc and nfds may be NULL when the caller has marked
+     * ready sockets with val_async_mark_ready() instead.
+     */
+    if ((NULL == as) || (as->val_as_ctx == NULL) || (NULL == remaining))
         return VAL_BAD_ARGUMENT;
 
     context = as->val_as_ctx;
 
 #ifndef VAL_NO_THREADS
-    if (! (context->ctx_flags & CTX_PROCESS_ALL_THREADS) &&
-        ! pthread_equal(self, as->val_as_tid)) {
+    if (! val_async_owned(as, self)) {
         val_log(context,LOG_DEBUG, "as %p tid %d _async_check_one skiping tid",
                 as, as->val_as_tid);
         return VAL_NO_ERROR;
@@ -7077,7 +7349,9 @@ _async_check_one(val_async_status *as, fd_set *pending_desc,
 
         ++checked;
         ea = qfq->qfq_query->qc_ea; /* save ptr for loging */
-        if (res_async_ea_isset(qfq->qfq_query->qc_ea, pending_desc))
+        if (pending_desc ?
+            res_async_ea_isset(qfq->qfq_query->qc_ea, pending_desc) :
+            res_async_ea_isready(qfq->qfq_query->qc_ea))
             retval = _resolver_rcv_one(as->val_as_ctx, &as->val_as_queries, qfq,
                                        pending_desc, &closest_event,
                                        &data_received);
@@ -7319,8 +7593,7 @@ val_async_check_wait(val_context_t *ctx, fd_set *pending_desc,
     for (as = context->as_list; as; as = as->val_as_next) {
 
 #ifndef VAL_NO_THREADS
-        if (! (as->val_as_ctx->ctx_flags & CTX_PROCESS_ALL_THREADS) &&
-            (! pthread_equal(self, as->val_as_tid)))
+        if (! val_async_owned(as, self))
             continue;
 #endif
 
@@ -7343,6 +7616,91 @@ val_async_check_wait(val_context_t *ctx, fd_set *pending_desc,
 
 done:
     CTX_UNLOCK_POL(context);
+    val_prefetch_submit(context);
+    return retval;
+}
+
+/*
+ * Function: val_async_process_events
+ *
+ * Purpose:
+ * Event loop counterpart of val_async_check_wait: read responses from
+ * the given ready sockets only, handle timeouts and retries, and
+ * validate whatever is possible.  Never blocks.
+ *
+ * Note that this can result in callbacks being called.
+ *
+ * Parameters: context  -- context for pending async requests
+ *             ready -- sockets (as reported to the val_async_sock_cb)
+ *                      with data waiting. May be NULL, in which case
+ *                      the ready sockets are collected from the
+ *                      descriptor returned by val_async_event_fd(), if
+ *                      any; otherwise only timeouts are handled.
+ *             nready -- number of entries in ready
+ *             flags -- flags affecting operation of this function.
+ *                      None defined yet.
+ *
+ * Returns:  < 0  : VAL_* error
+ *             0  : no pending requests found
+ *           > 0  : number of requests still pending
+ */
+int
+val_async_process_events(val_context_t *ctx, const int *ready, int nready,
+                         unsigned int flags)
+{
+#ifndef VAL_NO_THREADS
+    pthread_t                   self = pthread_self();
+#endif
+    val_async_status           *as;
+    int                         count = 0, completed = 0, marked;
+    val_context_t *context;
+    int retval = VAL_NO_ERROR;
+
+    if ((nready < 0) || ((NULL == ready) && (nready > 0)))
+        return VAL_BAD_ARGUMENT;
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+
+    /** handle any completed requests */
+    _handle_completed(context);
+
+    if (NULL == context->as_list)
+        goto done;
+
+    CTX_LOCK_ACACHE(context);
+
+    marked = val_async_mark_ready(context, ready, nready);
+    val_log(context, LOG_DEBUG, "val_async_process_events: %d ready", marked);
+
+    for (as = context->as_list; as; as = as->val_as_next) {
+
+#ifndef VAL_NO_THREADS
+        if (! val_async_owned(as, self))
+            continue;
+#endif
+
+        if (as->val_as_flags & VAL_AS_DONE)
+            ++completed;
+        else {
+            /* ignore errors, keep trying other requests */
+            _async_check_one(as, NULL, NULL, &count, flags);
+            if (as->val_as_flags & VAL_AS_DONE)
+                ++completed;
+        }
+    }
+
+    CTX_UNLOCK_ACACHE(context);
+
+    if (completed)
+        _handle_completed(context);
+
+    retval = count;
+
+done:
+    CTX_UNLOCK_POL(context);
+    val_prefetch_submit(context);
     return retval;
 }
 
@@ -7367,7 +7725,7 @@ _async_cancel_one(val_context_t *context, val_async_status *as, u_int flags)
     if (NULL == context || NULL == as)
         return ;
 
-    if (flags & VAL_AS_CANCEL_NO_CALLBACKS)
+    if ((flags & VAL_AS_CANCEL_NO_CALLBACKS) && !val_prefetch_request(as))
         as->val_as_flags |= VAL_AS_CALLBACK_CALLED;
 
     /** call callback if done */
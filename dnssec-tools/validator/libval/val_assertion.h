@@ -35,6 +35,9 @@ int             get_zse(val_context_t * ctx, u_char * name_n,
                         u_int32_t flags, u_int16_t *status, u_char ** match_ptr, u_int32_t *ttl_x);
 int             find_trust_point(val_context_t * ctx, u_char * zone_n, 
                                  u_char ** matched_zone, u_int32_t *ttl_x);
+int             is_trusted_key(val_context_t * ctx, u_char * zone_n,
+                               struct rrset_rr *key, val_astatus_t * status,
+                               u_int32_t flags, u_int32_t *ttl_x);
 #ifdef LIBVAL_DLV
 int             check_anc_proof(val_context_t *context,
                                 struct val_query_chain *q, 
@@ -53,6 +56,9 @@ int             try_chase_query(val_context_t * context,
 
 #ifndef VAL_NO_ASYNC
 int             val_async_status_free(val_async_status *as);
+#ifndef VAL_NO_THREADS
+int             val_async_owned(val_async_status *as, pthread_t self);
+#endif
 #endif
 
 #endif
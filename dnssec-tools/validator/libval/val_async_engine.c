@@ -0,0 +1,498 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Worker threads that drive all of a context's asynchronous requests,
+ * so that applications only submit requests and receive callbacks.
+ *
+ * The workers follow a leader/followers scheme.  At any time one worker
+ * is the poller: it waits for socket activity or the next timeout and
+ * lets libval read responses and validate answers.  Requests that
+ * complete are put on a completion queue; the poller then goes back to
+ * waiting and idle workers take requests off the queue and call their
+ * callbacks.  A worker that finds the queue empty and nobody polling
+ * becomes the next poller, so a slow callback never holds up network
+ * I/O for the other requests.
+ *
+ * Only the callbacks run in parallel.  val_async_process_events() reads
+ * and validates under the context's ACACHE lock, since validation walks
+ * and updates the shared query list, so the poller does all of it.
+ * Validation workers that take (and steal) each other's validation
+ * work are not implemented: the queries and assertions of the query
+ * list are shared between requests, and synchronous lookups in other
+ * threads validate under the same lock, so that needs locking per
+ * query first.
+ */
+#include "validator-internal.h"
+
+#include "val_context.h"
+#include "val_async_engine.h"
+
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+
+#include <poll.h>
+#include <fcntl.h>
+
+#define VAL_AS_ENGINE_MAX_THREADS  64
+
+struct val_async_engine {
+    val_context_t      *context;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    pthread_t          *workers;
+    int                 nworkers;
+    int                 running;
+    int                 polling;    /* a worker is waiting for I/O */
+
+    /* completed requests waiting for their callbacks */
+    val_async_status   *cq_head;
+    val_async_status   *cq_tail;
+
+    /* sockets to watch, kept up to date by the socket callback */
+    int                *socks;
+    int                 nsocks;
+    int                 socks_alloc;
+    unsigned long       socks_gen;
+
+    /* poller state; only used by the worker that is polling */
+    struct pollfd      *pfds;
+    int                *ready;
+    int                 pfds_alloc;
+    int                 npfds;
+    unsigned long       pfds_gen;
+
+    int                 wake[2];    /* self pipe to interrupt poll() */
+};
+
+static void
+_engine_wake(struct val_async_engine *eng)
+{
+    char c = 0;
+
+    /* a full pipe already means a wakeup is pending */
+    if (write(eng->wake[1], &c, 1) < 0 && errno != EAGAIN)
+        val_log(eng->context, LOG_WARNING,
+                "val_async_engine: wakeup failed: %s", strerror(errno));
+}
+
+/*
+ * socket callback, called with the context's ACACHE lock held
+ */
+static void
+_engine_sock_cb(val_context_t *ctx, int sock, int event, void *cb_data)
+{
+    struct val_async_engine *eng = (struct val_async_engine *) cb_data;
+    int i;
+
+    pthread_mutex_lock(&eng->lock);
+    if (VAL_AS_SOCK_ADD == event) {
+        if (eng->nsocks == eng->socks_alloc) {
+            int  n = eng->socks_alloc ? eng->socks_alloc * 2 : 64;
+            int *socks = (int *) MALLOC(n * sizeof(int));
+
+            if (NULL == socks) {
+                pthread_mutex_unlock(&eng->lock);
+                val_log(ctx, LOG_ERR,
+                        "val_async_engine: could not track socket %d", sock);
+                return;
+            }
+            if (eng->socks) {
+                memcpy(socks, eng->socks, eng->nsocks * sizeof(int));
+                FREE(eng->socks);
+            }
+            eng->socks = socks;
+            eng->socks_alloc = n;
+        }
+        eng->socks[eng->nsocks++] = sock;
+    } else {
+        for (i = 0; i < eng->nsocks; ++i) {
+            if (eng->socks[i] == sock) {
+                eng->socks[i] = eng->socks[--eng->nsocks];
+                break;
+            }
+        }
+    }
+    ++eng->socks_gen;
+    pthread_mutex_unlock(&eng->lock);
+
+    /** the poller must start watching the new socket */
+    if (VAL_AS_SOCK_ADD == event)
+        _engine_wake(eng);
+}
+
+/*
+ * Refresh the poller's descriptor set from the socket list.
+ * Called with the engine lock held.
+ */
+static int
+_engine_build_pollset(struct val_async_engine *eng)
+{
+    int i;
+
+    if ((eng->npfds > 0) && (eng->pfds_gen == eng->socks_gen))
+        return 0;
+
+    if (eng->pfds_alloc < eng->nsocks + 1) {
+        int            n = eng->socks_alloc + 1;
+        struct pollfd *pfds = (struct pollfd *) MALLOC(n * sizeof(*pfds));
+        int           *ready = (int *) MALLOC(n * sizeof(int));
+
+        if ((NULL == pfds) || (NULL == ready)) {
+            if (pfds)
+                FREE(pfds);
+            if (ready)
+                FREE(ready);
+            return -1;
+        }
+        if (eng->pfds)
+            FREE(eng->pfds);
+        if (eng->ready)
+            FREE(eng->ready);
+        eng->pfds = pfds;
+        eng->ready = ready;
+        eng->pfds_alloc = n;
+    }
+
+    eng->pfds[0].fd = eng->wake[0];
+    eng->pfds[0].events = POLLIN;
+    for (i = 0; i < eng->nsocks; ++i) {
+        eng->pfds[i + 1].fd = eng->socks[i];
+        eng->pfds[i + 1].events = POLLIN;
+    }
+    eng->npfds = eng->nsocks + 1;
+    eng->pfds_gen = eng->socks_gen;
+
+    return 0;
+}
+
+/*
+ * Wait for socket activity or the next timeout, then let libval
+ * process whatever is ready.
+ */
+static void
+_engine_poll(struct val_async_engine *eng)
+{
+    struct timeval tv;
+    int            pending, wait_ms, rc, i, nready = 0;
+    char           buf[64];
+
+    pending = val_async_next_timeout(eng->context, &tv);
+    if (pending < 0)
+        wait_ms = 1000;
+    else if (pending == 0)
+        wait_ms = -1; /* nothing to do until a request is submitted */
+    else if (tv.tv_sec > 3600)
+        wait_ms = 3600 * 1000;
+    else
+        wait_ms = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+
+    pthread_mutex_lock(&eng->lock);
+    rc = _engine_build_pollset(eng);
+    pthread_mutex_unlock(&eng->lock);
+    if (rc < 0) {
+        val_log(eng->context, LOG_ERR,
+                "val_async_engine: out of memory building poll set");
+        return;
+    }
+
+    rc = poll(eng->pfds, eng->npfds, wait_ms);
+    if (rc < 0) {
+        if (errno != EINTR)
+            val_log(eng->context, LOG_WARNING,
+                    "val_async_engine: poll: %s", strerror(errno));
+        return;
+    }
+
+    if (eng->pfds[0].revents & POLLIN)
+        while (read(eng->wake[0], buf, sizeof(buf)) > 0)
+            ;
+    for (i = 1; rc > 0 && i < eng->npfds; ++i) {
+        if (eng->pfds[i].revents & (POLLIN | POLLERR | POLLHUP))
+            eng->ready[nready++] = eng->pfds[i].fd;
+    }
+
+    val_async_process_events(eng->context, eng->ready, nready, 0);
+}
+
+static void *
+_engine_worker(void *arg)
+{
+    struct val_async_engine *eng = (struct val_async_engine *) arg;
+    val_async_status        *as;
+
+    pthread_mutex_lock(&eng->lock);
+    while (eng->running) {
+
+        /** callbacks first, so answers reach the application quickly */
+        if (eng->cq_head) {
+            as = eng->cq_head;
+            eng->cq_head = as->val_as_next;
+            if (NULL == eng->cq_head)
+                eng->cq_tail = NULL;
+            pthread_mutex_unlock(&eng->lock);
+
+            val_async_complete(eng->context, as);
+
+            pthread_mutex_lock(&eng->lock);
+            continue;
+        }
+
+        /** nobody is waiting for I/O, so take a turn */
+        if (! eng->polling) {
+            eng->polling = 1;
+            pthread_mutex_unlock(&eng->lock);
+
+            _engine_poll(eng);
+
+            pthread_mutex_lock(&eng->lock);
+            eng->polling = 0;
+            pthread_cond_broadcast(&eng->cond);
+            continue;
+        }
+
+        pthread_cond_wait(&eng->cond, &eng->lock);
+    }
+    pthread_mutex_unlock(&eng->lock);
+
+    return NULL;
+}
+
+/*
+ * Hand a list of completed requests (linked through val_as_next) to the
+ * workers.  Returns 1 if the engine took them, 0 if the caller must call
+ * the callbacks itself.
+ */
+int
+val_async_engine_enqueue(val_context_t *context, val_async_status *completed)
+{
+    struct val_async_engine *eng;
+    val_async_status        *last;
+    int                      taken = 0;
+
+    if ((NULL == context) || (NULL == completed))
+        return 0;
+
+    CTX_LOCK_ACACHE(context);
+    eng = context->as_engine;
+    if (eng) {
+        pthread_mutex_lock(&eng->lock);
+        if (eng->running) {
+            for (last = completed; last->val_as_next; last = last->val_as_next)
+                ;
+            if (eng->cq_tail)
+                eng->cq_tail->val_as_next = completed;
+            else
+                eng->cq_head = completed;
+            eng->cq_tail = last;
+            pthread_cond_broadcast(&eng->cond);
+            taken = 1;
+        }
+        pthread_mutex_unlock(&eng->lock);
+    }
+    CTX_UNLOCK_ACACHE(context);
+
+    return taken;
+}
+
+/*
+ * Interrupt the poller, e.g. because a new request was submitted.
+ */
+void
+val_async_engine_wakeup(val_context_t *context)
+{
+    if (NULL == context)
+        return;
+
+    CTX_LOCK_ACACHE(context);
+    if (context->as_engine)
+        _engine_wake(context->as_engine);
+    CTX_UNLOCK_ACACHE(context);
+}
+
+static void
+_engine_free(struct val_async_engine *eng)
+{
+    if (eng->wake[0] != -1)
+        close(eng->wake[0]);
+    if (eng->wake[1] != -1)
+        close(eng->wake[1]);
+    if (eng->socks)
+        FREE(eng->socks);
+    if (eng->pfds)
+        FREE(eng->pfds);
+    if (eng->ready)
+        FREE(eng->ready);
+    if (eng->workers)
+        FREE(eng->workers);
+    pthread_cond_destroy(&eng->cond);
+    pthread_mutex_destroy(&eng->lock);
+    FREE(eng);
+}
+
+/*
+ * Function: val_async_engine_start
+ *
+ * Purpose:  start worker threads that process all of the context's
+ *           async requests, whichever thread submitted them, and call
+ *           their callbacks.  While the engine runs, callbacks are
+ *           called from the worker threads and the application does not
+ *           need to call val_async_check_wait() or
+ *           val_async_process_events().  The engine uses the context's
+ *           socket callback (see val_async_set_sock_cb()).
+ *
+ * Parameters: context -- context for async requests
+ *             nthreads -- number of worker threads, 1 to 64
+ *             flags -- none defined yet
+ *
+ * Returns:  VAL_NO_ERROR or a VAL_* error
+ */
+int
+val_async_engine_start(val_context_t *ctx, int nthreads, unsigned int flags)
+{
+    struct val_async_engine *eng;
+    val_context_t           *context;
+    int                      i, retval;
+
+    if ((nthreads < 1) || (nthreads > VAL_AS_ENGINE_MAX_THREADS))
+        return VAL_BAD_ARGUMENT;
+
+    eng = (struct val_async_engine *) MALLOC(sizeof(*eng));
+    if (NULL == eng)
+        return VAL_OUT_OF_MEMORY;
+    memset(eng, 0, sizeof(*eng));
+    eng->wake[0] = eng->wake[1] = -1;
+    pthread_mutex_init(&eng->lock, NULL);
+    pthread_cond_init(&eng->cond, NULL);
+
+    eng->workers = (pthread_t *) MALLOC(nthreads * sizeof(pthread_t));
+    if ((NULL == eng->workers) || (pipe(eng->wake) < 0)) {
+        _engine_free(eng);
+        return VAL_RESOURCE_UNAVAILABLE;
+    }
+    for (i = 0; i < 2; ++i) {
+        fcntl(eng->wake[i], F_SETFL, fcntl(eng->wake[i], F_GETFL) | O_NONBLOCK);
+        fcntl(eng->wake[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context) {
+        _engine_free(eng);
+        return VAL_INTERNAL_ERROR;
+    }
+    eng->context = context;
+
+    CTX_LOCK_ACACHE(context);
+    if (context->as_engine) {
+        CTX_UNLOCK_ACACHE(context);
+        CTX_UNLOCK_POL(context);
+        _engine_free(eng);
+        return VAL_BAD_ARGUMENT;
+    }
+    context->as_engine = eng;
+    context->ctx_flags |= CTX_PROCESS_ALL_THREADS;
+    eng->running = 1;
+    CTX_UNLOCK_ACACHE(context);
+    CTX_UNLOCK_POL(context);
+
+    retval = val_async_set_sock_cb(context, _engine_sock_cb, eng);
+    if (VAL_NO_ERROR != retval) {
+        val_async_engine_stop(context, 0);
+        return retval;
+    }
+
+    for (i = 0; i < nthreads; ++i) {
+        if (0 != pthread_create(&eng->workers[i], NULL, _engine_worker, eng)) {
+            val_log(context, LOG_ERR,
+                    "val_async_engine_start: could only start %d of %d threads",
+                    i, nthreads);
+            break;
+        }
+        ++eng->nworkers;
+    }
+    if (0 == eng->nworkers) {
+        val_async_engine_stop(context, 0);
+        return VAL_RESOURCE_UNAVAILABLE;
+    }
+
+    val_log(context, LOG_INFO, "val_async_engine_start: %d worker threads",
+            eng->nworkers);
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Function: val_async_engine_stop
+ *
+ * Purpose:  stop the context's worker threads.  Callbacks for requests
+ *           that have already completed are called before returning;
+ *           requests still in progress stay pending and must be
+ *           processed or cancelled by the application.
+ *
+ * Parameters: context -- context for async requests
+ *             flags -- none defined yet
+ *
+ * Returns:  VAL_NO_ERROR or a VAL_* error
+ */
+int
+val_async_engine_stop(val_context_t *ctx, unsigned int flags)
+{
+    struct val_async_engine *eng;
+    val_context_t           *context;
+    val_async_status        *as;
+    int                      i;
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+
+    CTX_LOCK_ACACHE(context);
+    eng = context->as_engine;
+    CTX_UNLOCK_ACACHE(context);
+    CTX_UNLOCK_POL(context);
+    if (NULL == eng)
+        return VAL_BAD_ARGUMENT;
+
+    pthread_mutex_lock(&eng->lock);
+    eng->running = 0;
+    pthread_cond_broadcast(&eng->cond);
+    pthread_mutex_unlock(&eng->lock);
+    _engine_wake(eng);
+
+    for (i = 0; i < eng->nworkers; ++i)
+        pthread_join(eng->workers[i], NULL);
+
+    val_async_set_sock_cb(context, NULL, NULL);
+
+    CTX_LOCK_ACACHE(context);
+    context->as_engine = NULL;
+    context->ctx_flags &= ~CTX_PROCESS_ALL_THREADS;
+    CTX_UNLOCK_ACACHE(context);
+
+    /** nobody else can see the queue now */
+    while (NULL != (as = eng->cq_head)) {
+        eng->cq_head = as->val_as_next;
+        val_async_complete(context, as);
+    }
+
+    _engine_free(eng);
+
+    return VAL_NO_ERROR;
+}
+
+#else /* VAL_NO_ASYNC || VAL_NO_THREADS */
+
+int
+val_async_engine_start(val_context_t *ctx, int nthreads, unsigned int flags)
+{
+    return VAL_NOT_IMPLEMENTED;
+}
+
+int
+val_async_engine_stop(val_context_t *ctx, unsigned int flags)
+{
+    return VAL_NOT_IMPLEMENTED;
+}
+
+#endif /* VAL_NO_ASYNC || VAL_NO_THREADS */
@@ -0,0 +1,24 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_ASYNC_ENGINE_H
+#define VAL_ASYNC_ENGINE_H
+
+#ifndef VAL_NO_ASYNC
+
+void            val_async_complete(val_context_t *context,
+                                   val_async_status *as);
+
+#ifndef VAL_NO_THREADS
+int             val_async_engine_enqueue(val_context_t *context,
+                                         val_async_status *completed);
+void            val_async_engine_wakeup(val_context_t *context);
+#else
+#define val_async_engine_enqueue(context, completed) 0
+#define val_async_engine_wakeup(context)
+#endif
+
+#endif /* VAL_NO_ASYNC */
+
+#endif /* VAL_ASYNC_ENGINE_H */
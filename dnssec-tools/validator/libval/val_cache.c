@@ -29,13 +29,34 @@
 #include "val_support.h"
 #include "val_resquery.h"
 #include "val_cache.h"
+#include "val_crypto.h"
 
-struct zone_ns_map_t {
-    u_char        zone_n[NS_MAXCDNAME];
-    struct name_server *nslist;
-    struct zone_ns_map_t *next;
+/*
+ * Zone cuts are kept in trees of reversed labels, so that the deepest
+ * cut known for a name is found in one pass over its labels.  The
+ * children of all nodes of a tree share one hash table, keyed on the
+ * parent node and the lower case label.
+ */
+struct deleg_node {
+    struct deleg_node *dn_parent;
+    struct deleg_node *dn_hnext;    /* hash chain */
+    unsigned int    dn_hash;
+    u_char          dn_label[64];   /* length and lower case label */
+    struct name_server *dn_nslist;  /* forwarders for the zone */
+    struct rrset_rec *dn_ns;        /* NS RRset in the hints cache; */
+                                    /* cleared when the set is freed */
+    u_int32_t       dn_ttl_x;       /* expiry of dn_ns, 0 for never */
+};
+
+struct deleg_tree {
+    struct deleg_node dt_root;
+    struct deleg_node **dt_buckets;
+    size_t          dt_nbuckets;
+    size_t          dt_count;
 };
 
+#define DELEG_TREE_MIN_BUCKETS 64
+
 /*
  * we have caches for DNSKEY, DS, NS/glue, answers, and proofs
  * XXX negative cache functionality is currently unimplemented
@@ -44,9 +65,12 @@ static struct rrset_rec *unchecked_hints = NULL;
 static struct rrset_rec *unchecked_answers = NULL;
 
 /*
- * Also maintain mapping between zone and name server, 
+ * Also maintain mapping between zone and name server (zone_ns_tree,
+ * under map_rwlock), and index the NS RRsets of the hints cache by
+ * owner (hints_ns_tree, under ns_rwlock)
  */
-static struct zone_ns_map_t *zone_ns_map = NULL;
+static struct deleg_tree zone_ns_tree;
+static struct deleg_tree hints_ns_tree;
 
 #ifndef VAL_NO_THREADS
 
@@ -96,6 +120,164 @@ static int map_rwlock_init = -1;
      (q->qc_zonecut_n? (NULL != namename(name, q->qc_zonecut_n)) :\
       (NULL != namename(q->qc_name_n, name))))
 
+static unsigned int
+deleg_hash(const struct deleg_node *parent, const u_char *label)
+{
+    unsigned int    h = 2166136261U;
+    size_t          i;
+
+    h = (h ^ (unsigned int) ((unsigned long) parent >> 4)) * 16777619U;
+    for (i = 0; i <= label[0]; i++)
+        h = (h ^ label[i]) * 16777619U;
+    return h;
+}
+
+/*
+ * Double the hash table of the tree once it holds twice as many nodes
+ * as buckets.  Failing to grow only makes the chains longer.
+ */
+static void
+deleg_tree_grow(struct deleg_tree *tree)
+{
+    struct deleg_node **buckets;
+    struct deleg_node *node, *next;
+    size_t          nbuckets, i;
+
+    nbuckets = tree->dt_nbuckets ?
+        tree->dt_nbuckets * 2 : DELEG_TREE_MIN_BUCKETS;
+    buckets = (struct deleg_node **)
+        MALLOC(nbuckets * sizeof(struct deleg_node *));
+    if (buckets == NULL)
+        return;
+    memset(buckets, 0, nbuckets * sizeof(struct deleg_node *));
+
+    for (i = 0; i < tree->dt_nbuckets; i++) {
+        for (node = tree->dt_buckets[i]; node; node = next) {
+            next = node->dn_hnext;
+            node->dn_hnext = buckets[node->dn_hash & (nbuckets - 1)];
+            buckets[node->dn_hash & (nbuckets - 1)] = node;
+        }
+    }
+    if (tree->dt_buckets)
+        FREE(tree->dt_buckets);
+    tree->dt_buckets = buckets;
+    tree->dt_nbuckets = nbuckets;
+}
+
+/*
+ * Find the child of parent for the given lower case label, adding it
+ * if create is set.
+ */
+static struct deleg_node *
+deleg_child(struct deleg_tree *tree, struct deleg_node *parent,
+            const u_char *label, int create)
+{
+    struct deleg_node *node;
+    unsigned int    h;
+
+    if (label[0] >= sizeof(node->dn_label))
+        return NULL;
+
+    h = deleg_hash(parent, label);
+    if (tree->dt_nbuckets) {
+        for (node = tree->dt_buckets[h & (tree->dt_nbuckets - 1)]; node;
+             node = node->dn_hnext) {
+            if (node->dn_hash == h && node->dn_parent == parent &&
+                !memcmp(node->dn_label, label, label[0] + 1))
+                return node;
+        }
+    }
+    if (!create)
+        return NULL;
+
+    if (tree->dt_count >= 2 * tree->dt_nbuckets)
+        deleg_tree_grow(tree);
+    if (tree->dt_nbuckets == 0)
+        return NULL;
+
+    node = (struct deleg_node *) MALLOC(sizeof(struct deleg_node));
+    if (node == NULL)
+        return NULL;
+    memset(node, 0, sizeof(struct deleg_node));
+    node->dn_parent = parent;
+    node->dn_hash = h;
+    memcpy(node->dn_label, label, label[0] + 1);
+    node->dn_hnext = tree->dt_buckets[h & (tree->dt_nbuckets - 1)];
+    tree->dt_buckets[h & (tree->dt_nbuckets - 1)] = node;
+    tree->dt_count++;
+    return node;
+}
+
+/*
+ * Return the node for zone_n, adding it and its ancestors as needed
+ */
+static struct deleg_node *
+deleg_tree_insert(struct deleg_tree *tree, const u_char *zone_n)
+{
+    struct canon_name zone;
+    struct deleg_node *node;
+    size_t          i;
+
+    if (canon_name_init(&zone, zone_n) != 0)
+        return NULL;
+
+    node = &tree->dt_root;
+    for (i = zone.cn_labels - 1; node && i > 0; i--)
+        node = deleg_child(tree, node,
+                           &zone.cn_name[zone.cn_offsets[i - 1]], 1);
+    return node;
+}
+
+static void
+deleg_tree_free(struct deleg_tree *tree)
+{
+    struct deleg_node *node, *next;
+    size_t          i;
+
+    for (i = 0; i < tree->dt_nbuckets; i++) {
+        for (node = tree->dt_buckets[i]; node; node = next) {
+            next = node->dn_hnext;
+            if (node->dn_nslist)
+                free_name_servers(&node->dn_nslist);
+            if (node->dn_ns)
+                node->dn_ns->rrs_index_ref = NULL;
+            FREE(node);
+        }
+    }
+    if (tree->dt_root.dn_nslist)
+        free_name_servers(&tree->dt_root.dn_nslist);
+    if (tree->dt_root.dn_ns)
+        tree->dt_root.dn_ns->rrs_index_ref = NULL;
+    if (tree->dt_buckets)
+        FREE(tree->dt_buckets);
+    memset(tree, 0, sizeof(struct deleg_tree));
+}
+
+/*
+ * Point the hints cache index at a stored NS RRset.  The set keeps a
+ * reference to the entry, which res_sq_free_rrset_recs() clears, so
+ * the index never points at a set that has been freed, whichever way
+ * it leaves the cache.
+ * NOTE: This assumes a write lock on the hints cache is held.
+ */
+static void
+index_hints_ns(struct rrset_rec *ns_rr)
+{
+    struct deleg_node *node;
+
+    node = deleg_tree_insert(&hints_ns_tree, ns_rr->rrs_name_n);
+    if (node == NULL) {
+        val_log(NULL, LOG_WARNING,
+                "index_hints_ns(): Could not index zone cut; out of memory");
+        return;
+    }
+    if (node->dn_ns && node->dn_ns != ns_rr)
+        node->dn_ns->rrs_index_ref = NULL;
+    node->dn_ns = ns_rr;
+    node->dn_ttl_x = ns_rr->rrs_ttl_x;
+    ns_rr->rrs_index_ref = &node->dn_ns;
+}
+
 /*
  * Common routine to store data to a specific cache
  * NOTE: This assumes a read lock is alread held by the caller.
@@ -150,14 +332,21 @@ stow_info(struct rrset_rec **unchecked_info, struct rrset_rec **new_info, struct
                     struct rrset_rr  *rr_exchange;
 
                     old->rrs_cred = new_rr->rrs_cred;
+                    old->rrs_ttl_h = new_rr->rrs_ttl_h;
+                    old->rrs_ttl_x = new_rr->rrs_ttl_x;
                     old->rrs_section = new_rr->rrs_section;
                     old->rrs_ans_kind = new_rr->rrs_ans_kind;
                     rr_exchange = old->rrs_data;
                     old->rrs_data = new_rr->rrs_data;
                     new_rr->rrs_data = rr_exchange;
+                    free_rrset_canon(old);
+                    free_rrset_canon(new_rr);
                     rr_exchange = old->rrs_sig;
                     old->rrs_sig = new_rr->rrs_sig;
                     new_rr->rrs_sig = rr_exchange;
+                    if (unchecked_info == &unchecked_hints &&
+                        old->rrs_type_h == ns_t_ns)
+                        index_hints_ns(old);
                 }
 
                 delete_newrr = 1;
@@ -190,6 +379,9 @@ stow_info(struct rrset_rec **unchecked_info, struct rrset_rec **new_info, struct
             } else {
                 *unchecked_info = new_rr;
             }
+            if (unchecked_info == &unchecked_hints &&
+                new_rr->rrs_type_h == ns_t_ns)
+                index_hints_ns(new_rr);
         }
     }
     return VAL_NO_ERROR;
@@ -207,12 +399,16 @@ lookup_store(u_char *name_n, u_int16_t class_h, u_int16_t type_h,
 
     struct rrset_rec *next_answer;
     struct timeval  tv;
+    struct canon_name qname;
 
     if (NULL == new_answer)
         return VAL_BAD_ARGUMENT;
 
     *new_answer = NULL;
 
+    if (canon_name_init(&qname, name_n) != 0)
+        return VAL_NO_ERROR;
+
     gettimeofday(&tv, NULL);
 
     next_answer = answer_head;
@@ -226,14 +422,13 @@ lookup_store(u_char *name_n, u_int16_t class_h, u_int16_t type_h,
                 (next_answer->rrs_type_h == ns_t_cname &&
                 ALIAS_MATCH_TYPE(type_h))) &&
                 /* and name is an exact match */
-                (namecmp(next_answer->rrs_name_n, name_n) == 0)) ||
+                canon_name_equal(&qname, next_answer->rrs_name_n)) ||
                 /* OR */
                 /* DNAME indirection */
                 ((next_answer->rrs_type_h == ns_t_dname &&
                 ALIAS_MATCH_TYPE(type_h)) &&
                 /* and name applies */
-                (NULL != (u_char *) namename(name_n, 
-                                    next_answer->rrs_name_n)))) {
+                (canon_name_tail(&qname, next_answer->rrs_name_n) >= 0))) {
 
                 if (next_answer->rrs_data != NULL) {
                     *new_answer = copy_rrset_rec(next_answer);
@@ -428,14 +623,57 @@ stow_answers(struct rrset_rec **new_info, struct val_query_chain *matched_q)
     return rc;
 }
 
+static int
+same_address(const struct sockaddr_storage *a,
+             const struct sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family)
+        return 0;
+    if (a->ss_family == AF_INET)
+        return ((const struct sockaddr_in *) a)->sin_port ==
+            ((const struct sockaddr_in *) b)->sin_port &&
+            !memcmp(&((const struct sockaddr_in *) a)->sin_addr,
+                    &((const struct sockaddr_in *) b)->sin_addr,
+                    sizeof(struct in_addr));
+#ifdef VAL_IPV6
+    if (a->ss_family == AF_INET6)
+        return ((const struct sockaddr_in6 *) a)->sin6_port ==
+            ((const struct sockaddr_in6 *) b)->sin6_port &&
+            !memcmp(&((const struct sockaddr_in6 *) a)->sin6_addr,
+                    &((const struct sockaddr_in6 *) b)->sin6_addr,
+                    sizeof(struct in6_addr));
+#endif
+    return !memcmp(a, b, sizeof(struct sockaddr_storage));
+}
+
+/*
+ * Two name server entries are the same if they have the same name and
+ * the same addresses
+ */
+static int
+same_name_server(const struct name_server *a, const struct name_server *b)
+{
+    int             i;
+
+    if (namecmp(a->ns_name_n, b->ns_name_n) ||
+        a->ns_number_of_addresses != b->ns_number_of_addresses)
+        return 0;
+    for (i = 0; i < a->ns_number_of_addresses; i++) {
+        if (!same_address(a->ns_address[i], b->ns_address[i]))
+            return 0;
+    }
+    return 1;
+}
+
 /*
  * Maintain a mapping between the zone and the name server that answered 
- * data for it 
+ * data for it.  Servers already listed for the zone are not added again.
  */
 int
 store_ns_for_zone(u_char * zonecut_n, struct name_server *resp_server)
 {
-    struct zone_ns_map_t *map_e;
+    struct deleg_node *node;
+    struct name_server *ns, *cur, *tail;
 
     if (!zonecut_n || !resp_server)
         return VAL_NO_ERROR;
@@ -443,35 +681,30 @@ store_ns_for_zone(u_char * zonecut_n, struct name_server *resp_server)
     VAL_CACHE_LOCK_INIT(&map_rwlock, map_rwlock_init);
     VAL_CACHE_LOCK_EX(&map_rwlock);
 
-    for (map_e = zone_ns_map; map_e; map_e = map_e->next) {
+    node = deleg_tree_insert(&zone_ns_tree, zonecut_n);
+    if (node == NULL) {
+        VAL_CACHE_UNLOCK(&map_rwlock);
+        return VAL_OUT_OF_MEMORY;
+    }
 
-        if (!namecmp(map_e->zone_n, zonecut_n)) {
-            struct name_server *nslist = NULL;
-            /*
-             * add blindly to the list 
-             */
-            clone_ns_list(&nslist, resp_server);
-            nslist->ns_next = map_e->nslist;
-            map_e->nslist = nslist;
-            break;
+    for (ns = resp_server; ns; ns = ns->ns_next) {
+        tail = NULL;
+        for (cur = node->dn_nslist; cur; cur = cur->ns_next) {
+            if (same_name_server(cur, ns))
+                break;
+            tail = cur;
         }
-    }
+        if (cur)
+            continue;
 
-    if (!map_e) {
-        map_e =
-            (struct zone_ns_map_t *) MALLOC(sizeof(struct zone_ns_map_t));
-        if (map_e == NULL) {
+        if (SR_UNSET != clone_ns(&cur, ns)) {
             VAL_CACHE_UNLOCK(&map_rwlock);
             return VAL_OUT_OF_MEMORY;
         }
-
-        clone_ns_list(&map_e->nslist, resp_server);
-        memcpy(map_e->zone_n, zonecut_n, wire_name_length(zonecut_n));
-        map_e->next = NULL;
-
-        if (zone_ns_map != NULL)
-            map_e->next = zone_ns_map;
-        zone_ns_map = map_e;
+        if (tail)
+            tail->ns_next = cur;
+        else
+            node->dn_nslist = cur;
     }
 
     VAL_CACHE_UNLOCK(&map_rwlock);
@@ -482,18 +715,9 @@ store_ns_for_zone(u_char * zonecut_n, struct name_server *resp_server)
 static int
 free_zone_nslist(void)
 {
-    struct zone_ns_map_t *map_e;
-
     VAL_CACHE_LOCK_INIT(&map_rwlock, map_rwlock_init);
     VAL_CACHE_LOCK_EX(&map_rwlock);
-    while (zone_ns_map) {
-        map_e = zone_ns_map;
-        zone_ns_map = zone_ns_map->next;
-
-        if (map_e->nslist)
-            free_name_servers(&map_e->nslist);
-        FREE(map_e);
-    }
+    deleg_tree_free(&zone_ns_tree);
     VAL_CACHE_UNLOCK(&map_rwlock);
 
     return VAL_NO_ERROR;
@@ -514,15 +738,14 @@ get_nslist_from_cache(val_context_t *ctx,
     /*
      * find closest matching name zone_n 
      */
-    struct rrset_rec *nsrrset;
     u_char       *name_n = NULL;
-    u_char       *tname_n = NULL;
-    u_char       *p;
     u_int16_t     qtype;
     u_char       *qname_n;
-    struct zone_ns_map_t *map_e, *saved_map;
+    struct deleg_node *node, *best;
     u_char       *tmp_zonecut_n = NULL;
     struct timeval  tv;
+    struct canon_name qname;
+    size_t        i, best_off;
 
     if (matched_qfq == NULL || queries == NULL || ref_ns_list == NULL || ns_cred == NULL)
         return VAL_BAD_ARGUMENT;
@@ -533,6 +756,8 @@ get_nslist_from_cache(val_context_t *ctx,
     /* matched_qfq->qfq_query cannot be NULL */
     qname_n = matched_qfq->qfq_query->qc_name_n;
     qtype = matched_qfq->qfq_query->qc_type_h;
+    if (canon_name_init(&qname, qname_n) != 0)
+        return VAL_BAD_ARGUMENT;
 
     *zonecut_n = NULL;
     gettimeofday(&tv, NULL);
@@ -542,30 +767,33 @@ get_nslist_from_cache(val_context_t *ctx,
 
     /*
      * Check mapping table between zone and nameserver to see if 
-     * NS information is available here 
+     * NS information is available here; walk down the labels of the
+     * query name and keep the deepest zone that has servers
      */
-    saved_map = NULL;
-    for (map_e = zone_ns_map; map_e; map_e = map_e->next) {
-
-        /*
-         * check if zone is within query 
-         */
-        if (NULL != (p = namename(qname_n, map_e->zone_n))) {
-            if (!saved_map || (namecmp(p, saved_map->zone_n) > 0)) {
-                saved_map = map_e;
-            }
+    best = NULL;
+    best_off = 0;
+    node = &zone_ns_tree.dt_root;
+    for (i = qname.cn_labels - 1; node; i--) {
+        if (node->dn_nslist) {
+            best = node;
+            best_off = qname.cn_offsets[i];
         }
+        if (i == 0)
+            break;
+        node = deleg_child(&zone_ns_tree, node,
+                           &qname.cn_name[qname.cn_offsets[i - 1]], 0);
     }
 
-    if (saved_map) {
-        *zonecut_n = (u_char *) MALLOC (wire_name_length(saved_map->zone_n) *
+    if (best) {
+        *zonecut_n = (u_char *) MALLOC (wire_name_length(qname_n + best_off) *
                 sizeof (u_char));
         if (*zonecut_n == NULL) {
             VAL_CACHE_UNLOCK(&map_rwlock);
             return VAL_OUT_OF_MEMORY;
         } 
-        clone_ns_list(ref_ns_list, saved_map->nslist);
-        memcpy(*zonecut_n, saved_map->zone_n, wire_name_length(saved_map->zone_n));
+        clone_ns_list(ref_ns_list, best->dn_nslist);
+        memcpy(*zonecut_n, qname_n + best_off,
+               wire_name_length(qname_n + best_off));
         VAL_CACHE_UNLOCK(&map_rwlock);
         return VAL_NO_ERROR;
     }
@@ -580,42 +808,33 @@ get_nslist_from_cache(val_context_t *ctx,
     VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init);
     VAL_CACHE_LOCK_SH(&ns_rwlock);
 
-    nsrrset = unchecked_hints;
-    while (nsrrset) {
-
-        if (tv.tv_sec < nsrrset->rrs_ttl_x &&
-            nsrrset->rrs_type_h == ns_t_ns) {
-
-            tname_n = nsrrset->rrs_name_n;
-
-            /*
-             * Find the closest name with the best credibility
-             */
-            if ((*ns_cred == SR_CRED_UNSET || nsrrset->rrs_cred <= *ns_cred) &&
-                    NULL != (p = namename(qname_n, tname_n))) {
-
-                if (!name_n ||
-                    nsrrset->rrs_cred < *ns_cred ||
-                    (wire_name_length(tname_n) > wire_name_length(name_n))) {
-
-                    /*
-                     * If type is DS, you don't want an exact match
-                     * since that will lead you to the child zone
-                     */
-                    if ((qtype != ns_t_ds) || (p != qname_n)) {
-                        /*
-                         * New name is longer than old name 
-                         */
-                        name_n = tname_n;
-                        *ns_cred = nsrrset->rrs_cred;
-                        tmp_zonecut_n = nsrrset->rrs_name_n;
-                    }
-                }
-            }
-        }
-        nsrrset = nsrrset->rrs_next;
+    /*
+     * Find the closest name with the best credibility among the
+     * unexpired NS RRsets owned by the query name and its ancestors
+     */
+    best = NULL;
+    node = &hints_ns_tree.dt_root;
+    for (i = qname.cn_labels - 1; node; i--) {
+        /*
+         * If type is DS, you don't want an exact match
+         * since that will lead you to the child zone
+         */
+        if (node->dn_ns && tv.tv_sec < node->dn_ttl_x &&
+            (qtype != ns_t_ds || i != 0) &&
+            (best == NULL ||
+             node->dn_ns->rrs_cred <= best->dn_ns->rrs_cred))
+            best = node;
+        if (i == 0)
+            break;
+        node = deleg_child(&hints_ns_tree, node,
+                           &qname.cn_name[qname.cn_offsets[i - 1]], 0);
     }
 
+    if (best) {
+        name_n = best->dn_ns->rrs_name_n;
+        *ns_cred = best->dn_ns->rrs_cred;
+        tmp_zonecut_n = best->dn_ns->rrs_name_n;
+    }
 
     if (name_n) {
         bootstrap_referral(ctx, name_n, unchecked_hints, matched_qfq, queries,
@@ -639,6 +858,211 @@ get_nslist_from_cache(val_context_t *ctx,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Call fn for every RRset held in the answer and hints caches, with
+ * a read lock on the cache held.  Stops at the first non-zero value
+ * returned by fn and returns it.
+ */
+int
+walk_validator_cache(int (*fn)(void *arg, int which, struct rrset_rec *rr),
+                     void *arg)
+{
+    struct rrset_rec *rr;
+    int             retval = 0;
+
+    if (fn == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    VAL_CACHE_LOCK_INIT(&ans_rwlock, ans_rwlock_init);
+    VAL_CACHE_LOCK_SH(&ans_rwlock);
+    for (rr = unchecked_answers; rr && !retval; rr = rr->rrs_next)
+        retval = fn(arg, VAL_CACHE_ANSWERS, rr);
+    VAL_CACHE_UNLOCK(&ans_rwlock);
+    if (retval)
+        return retval;
+
+    VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init);
+    VAL_CACHE_LOCK_SH(&ns_rwlock);
+    for (rr = unchecked_hints; rr && !retval; rr = rr->rrs_next)
+        retval = fn(arg, VAL_CACHE_HINTS, rr);
+    VAL_CACHE_UNLOCK(&ns_rwlock);
+
+    return retval;
+}
+
+/*
+ * A temporary index of RRsets by owner, class and type, hashed like
+ * the zone cut trees, so that restoring a saved cache into a full one
+ * does not compare every saved RRset with every cached one
+ */
+struct rrset_index_entry {
+    struct rrset_rec *re_rr;
+    unsigned int    re_hash;
+    struct rrset_index_entry *re_next;
+};
+
+struct rrset_index {
+    struct rrset_index_entry **ri_buckets;
+    struct rrset_index_entry *ri_entries;
+    size_t          ri_nbuckets;
+    size_t          ri_count;
+    size_t          ri_max;
+};
+
+static unsigned int
+rrset_index_hash(const struct rrset_rec *rr)
+{
+    unsigned int    h = 2166136261U;
+    size_t          i, len = wire_name_length(rr->rrs_name_n);
+
+    /* label lengths are below 'A', so they are left alone */
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned int) tolower(rr->rrs_name_n[i])) * 16777619U;
+    h = (h ^ rr->rrs_class_h) * 16777619U;
+    h = (h ^ rr->rrs_type_h) * 16777619U;
+    return h;
+}
+
+/*
+ * Set up an index for up to max RRsets
+ */
+static int
+rrset_index_init(struct rrset_index *idx, size_t max)
+{
+    memset(idx, 0, sizeof(struct rrset_index));
+    for (idx->ri_nbuckets = DELEG_TREE_MIN_BUCKETS; idx->ri_nbuckets < max;
+         idx->ri_nbuckets *= 2);
+    idx->ri_buckets = (struct rrset_index_entry **)
+        MALLOC(idx->ri_nbuckets * sizeof(struct rrset_index_entry *));
+    idx->ri_entries = (struct rrset_index_entry *)
+        MALLOC((max ? max : 1) * sizeof(struct rrset_index_entry));
+    if (idx->ri_buckets == NULL || idx->ri_entries == NULL) {
+        if (idx->ri_buckets)
+            FREE(idx->ri_buckets);
+        if (idx->ri_entries)
+            FREE(idx->ri_entries);
+        memset(idx, 0, sizeof(struct rrset_index));
+        return VAL_OUT_OF_MEMORY;
+    }
+    memset(idx->ri_buckets, 0,
+           idx->ri_nbuckets * sizeof(struct rrset_index_entry *));
+    idx->ri_max = max;
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Add rr to the index, unless an RRset with the same owner, class and
+ * type is there already; returns 1 in that case
+ */
+static int
+rrset_index_add(struct rrset_index *idx, struct rrset_rec *rr)
+{
+    struct rrset_index_entry *e;
+    unsigned int    h = rrset_index_hash(rr);
+
+    for (e = idx->ri_buckets[h & (idx->ri_nbuckets - 1)]; e;
+         e = e->re_next) {
+        if (e->re_hash == h && e->re_rr->rrs_type_h == rr->rrs_type_h &&
+            e->re_rr->rrs_class_h == rr->rrs_class_h &&
+            namecmp(e->re_rr->rrs_name_n, rr->rrs_name_n) == 0)
+            return 1;
+    }
+    if (idx->ri_count < idx->ri_max) {
+        e = &idx->ri_entries[idx->ri_count++];
+        e->re_rr = rr;
+        e->re_hash = h;
+        e->re_next = idx->ri_buckets[h & (idx->ri_nbuckets - 1)];
+        idx->ri_buckets[h & (idx->ri_nbuckets - 1)] = e;
+    }
+    return 0;
+}
+
+static void
+rrset_index_free(struct rrset_index *idx)
+{
+    if (idx->ri_buckets)
+        FREE(idx->ri_buckets);
+    if (idx->ri_entries)
+        FREE(idx->ri_entries);
+    memset(idx, 0, sizeof(struct rrset_index));
+}
+
+/*
+ * Add RRsets saved earlier to the answer or hints cache.  RRsets that
+ * the cache already holds, or that come twice in the list, are kept
+ * once and the later copies dropped, since they cannot be more
+ * recent.  The list is consumed.
+ */
+int
+restore_cached_rrsets(int which, struct rrset_rec **new_info)
+{
+    struct rrset_rec **head, *tail, *rr, *new_rr;
+    struct rrset_index idx;
+#ifndef VAL_NO_THREADS
+    pthread_rwlock_t *lk;
+#endif
+    size_t          count = 0;
+
+    if (new_info == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    if (which == VAL_CACHE_HINTS) {
+        VAL_CACHE_LOCK_INIT(&ns_rwlock, ns_rwlock_init);
+        head = &unchecked_hints;
+#ifndef VAL_NO_THREADS
+        lk = &ns_rwlock;
+#endif
+    } else {
+        VAL_CACHE_LOCK_INIT(&ans_rwlock, ans_rwlock_init);
+        head = &unchecked_answers;
+#ifndef VAL_NO_THREADS
+        lk = &ans_rwlock;
+#endif
+    }
+
+    for (rr = *new_info; rr; rr = rr->rrs_next)
+        count++;
+
+    VAL_CACHE_LOCK_EX(lk);
+
+    tail = NULL;
+    for (rr = *head; rr; rr = rr->rrs_next) {
+        tail = rr;
+        count++;
+    }
+    if (rrset_index_init(&idx, count) != VAL_NO_ERROR) {
+        VAL_CACHE_UNLOCK(lk);
+        res_sq_free_rrset_recs(new_info);
+        return VAL_OUT_OF_MEMORY;
+    }
+    for (rr = *head; rr; rr = rr->rrs_next)
+        rrset_index_add(&idx, rr);
+
+    while (*new_info) {
+        new_rr = *new_info;
+        *new_info = new_rr->rrs_next;
+        new_rr->rrs_next = NULL;
+
+        if (rrset_index_add(&idx, new_rr)) {
+            res_sq_free_rrset_recs(&new_rr);
+            continue;
+        }
+
+        if (tail)
+            tail->rrs_next = new_rr;
+        else
+            *head = new_rr;
+        tail = new_rr;
+        if (which == VAL_CACHE_HINTS && new_rr->rrs_type_h == ns_t_ns)
+            index_hints_ns(new_rr);
+    }
+
+    VAL_CACHE_UNLOCK(lk);
+    rrset_index_free(&idx);
+
+    return VAL_NO_ERROR;
+}
+
 int
 free_validator_cache(void)
 {
@@ -646,6 +1070,7 @@ free_validator_cache(void)
     VAL_CACHE_LOCK_EX(&ns_rwlock);
     res_sq_free_rrset_recs(&unchecked_hints);
     unchecked_hints = NULL;
+    deleg_tree_free(&hints_ns_tree);
     VAL_CACHE_UNLOCK(&ns_rwlock);
     
     VAL_CACHE_LOCK_INIT(&ans_rwlock, ans_rwlock_init);
@@ -655,6 +1080,7 @@ free_validator_cache(void)
     VAL_CACHE_UNLOCK(&ans_rwlock);
     
     free_zone_nslist();
+    val_crypto_free_keys();
 
     return VAL_NO_ERROR;
 }
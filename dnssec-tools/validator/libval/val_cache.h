@@ -5,6 +5,8 @@
 #ifndef VAL_CACHE_H
 #define VAL_CACHE_H
 
+#define VAL_CACHE_ANSWERS   0
+#define VAL_CACHE_HINTS     1
 
 int             stow_zone_info(struct rrset_rec **new_info, struct val_query_chain *matched_q);
 int             stow_key_info(struct rrset_rec **new_info, struct val_query_chain *matched_q);
@@ -12,6 +14,11 @@ int             stow_ds_info(struct rrset_rec **new_info, struct val_query_chain
 int             stow_answers(struct rrset_rec **new_info, struct val_query_chain *matched_q);
 int             get_cached_rrset(struct val_query_chain *matched_q, struct domain_info **response);
 int             free_validator_cache(void);
+int             walk_validator_cache(int (*fn)(void *arg, int which,
+                                               struct rrset_rec *rr),
+                                     void *arg);
+int             restore_cached_rrsets(int which,
+                                      struct rrset_rec **new_info);
 int             store_ns_for_zone(u_char * zonecut_n,
                                   struct name_server *resp_server);
 int             get_nslist_from_cache(val_context_t *ctx,
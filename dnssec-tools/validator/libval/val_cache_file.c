@@ -0,0 +1,658 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Save the rrset caches to a file and load them back, so that a
+ * restarted validator does not have to fetch every DNSKEY, DS and
+ * referral again.
+ *
+ * The file is a fixed header followed by one record per RRset, each
+ * record aligned to 8 bytes and holding only lengths and offsets, so
+ * that the file can be mapped and walked in place.  The header carries
+ * a version, a byte order mark and CRC-32 checksums of itself and of
+ * the records; files that fail any check are ignored as a whole.
+ * Every RRset is saved with its absolute expiry time, and RRsets that
+ * have expired by the time the file is loaded are skipped.
+ *
+ * Only the data is restored, never a verdict: the per-RR verification
+ * marks are not saved, so restored RRsets are checked against the
+ * trust anchors again when they are used, like anything else found in
+ * the caches.  A damaged or planted file cannot make data secure; it
+ * only saves the network round trips.
+ *
+ * The file named by the cache-file global option is loaded when the
+ * first context using it is created, saved every cache-save-interval
+ * seconds by val_resolve_and_check(), and saved again by
+ * val_free_validator_state().
+ */
+#include "validator-internal.h"
+
+#include "val_cache.h"
+#include "val_support.h"
+#include "val_cache_file.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#define CF_MAGIC        "VALCACHE"
+#define CF_VERSION      1
+#define CF_BYTE_ORDER   0x01020304
+#define CF_ALIGN(n)     (((n) + 7) & ~((size_t) 7))
+#define CF_MAX_SIZE     (256 * 1024 * 1024)
+
+struct cf_header {
+    char            ch_magic[8];
+    u_int32_t       ch_version;
+    u_int32_t       ch_byte_order;
+    u_int32_t       ch_header_len;
+    u_int32_t       ch_count;       /* number of RRsets */
+    u_int32_t       ch_created;     /* time the file was written */
+    u_int32_t       ch_payload_crc; /* CRC-32 of the records */
+    u_int64_t       ch_payload_len;
+    u_int32_t       ch_header_crc;  /* CRC-32 of the header, this as 0 */
+    u_int32_t       ch_reserved;
+};
+
+/*
+ * One RRset; followed by the owner name, the zone cut, the respondent
+ * address and the RRs, each RR as a 16 bit length and the RDATA.
+ */
+struct cf_rrset {
+    u_int32_t       cr_len;         /* whole record, with padding */
+    u_int32_t       cr_ttl_x;       /* absolute expiry */
+    int32_t         cr_rcode;
+    u_int16_t       cr_class_h;
+    u_int16_t       cr_type_h;
+    u_int16_t       cr_name_len;
+    u_int16_t       cr_zonecut_len;
+    u_int16_t       cr_server_len;
+    u_int16_t       cr_ndata;
+    u_int16_t       cr_nsig;
+    u_char          cr_cache;       /* VAL_CACHE_ANSWERS or _HINTS */
+    u_char          cr_section;
+    u_char          cr_cred;
+    u_char          cr_ans_kind;
+    u_int16_t       cr_reserved;
+    u_int64_t       cr_ns_options;
+};
+
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t cf_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CF_LOCK()       pthread_mutex_lock(&cf_lock)
+#define CF_TRYLOCK()    (0 == pthread_mutex_trylock(&cf_lock))
+#define CF_UNLOCK()     pthread_mutex_unlock(&cf_lock)
+#else
+#define CF_LOCK()
+#define CF_TRYLOCK()    1
+#define CF_UNLOCK()
+#endif
+
+/* the file saved periodically and at shutdown, under cf_lock */
+static char    *cf_path = NULL;
+static long     cf_interval = 0;
+static long     cf_next_save = 0;
+
+static u_int32_t
+cf_crc32(u_int32_t crc, const u_char *buf, size_t len)
+{
+    size_t          i;
+    int             k;
+
+    crc = ~crc;
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/*
+ * Records are built in a growing buffer while the caches are locked,
+ * and written out once the locks have been released
+ */
+struct cf_buf {
+    u_char         *cb_data;
+    size_t          cb_len;
+    size_t          cb_size;
+    u_int32_t       cb_count;
+    u_int32_t       cb_now;
+};
+
+static u_char *
+cf_reserve(struct cf_buf *b, size_t len)
+{
+    u_char         *p;
+    size_t          size;
+
+    if (b->cb_len + len > b->cb_size) {
+        size = b->cb_size ? b->cb_size : 65536;
+        while (size < b->cb_len + len)
+            size *= 2;
+        if (size > CF_MAX_SIZE)
+            return NULL;
+        p = (u_char *) MALLOC(size);
+        if (p == NULL)
+            return NULL;
+        if (b->cb_data) {
+            memcpy(p, b->cb_data, b->cb_len);
+            FREE(b->cb_data);
+        }
+        b->cb_data = p;
+        b->cb_size = size;
+    }
+    p = b->cb_data + b->cb_len;
+    memset(p, 0, len);
+    b->cb_len += len;
+    return p;
+}
+
+static size_t
+cf_server_len(const struct sockaddr *sa)
+{
+    if (sa == NULL)
+        return 0;
+    if (sa->sa_family == AF_INET)
+        return sizeof(struct sockaddr_in);
+#ifdef VAL_IPV6
+    if (sa->sa_family == AF_INET6)
+        return sizeof(struct sockaddr_in6);
+#endif
+    return 0;
+}
+
+static int
+cf_add_rrset(void *arg, int which, struct rrset_rec *rr)
+{
+    struct cf_buf  *b = (struct cf_buf *) arg;
+    struct cf_rrset *cr;
+    struct rrset_rr *r;
+    size_t          len, start, name_len, zonecut_len, server_len;
+    u_int16_t       ndata = 0, nsig = 0, rlen;
+    u_char         *p;
+
+    /* nothing worth keeping */
+    if (rr->rrs_name_n == NULL || rr->rrs_data == NULL ||
+        rr->rrs_ttl_x <= b->cb_now)
+        return 0;
+
+    name_len = wire_name_length(rr->rrs_name_n);
+    zonecut_len = rr->rrs_zonecut_n ?
+        wire_name_length(rr->rrs_zonecut_n) : 0;
+    server_len = cf_server_len(rr->rrs_server);
+    len = sizeof(struct cf_rrset) + name_len + zonecut_len + server_len;
+    for (r = rr->rrs_data; r; r = r->rr_next, ndata++)
+        len += sizeof(u_int16_t) + r->rr_rdata_length;
+    for (r = rr->rrs_sig; r; r = r->rr_next, nsig++)
+        len += sizeof(u_int16_t) + r->rr_rdata_length;
+    len = CF_ALIGN(len);
+
+    start = b->cb_len;
+    if (NULL == cf_reserve(b, len))
+        return VAL_OUT_OF_MEMORY;
+    cr = (struct cf_rrset *) (b->cb_data + start);
+    cr->cr_len = (u_int32_t) len;
+    cr->cr_ttl_x = rr->rrs_ttl_x;
+    cr->cr_rcode = rr->rrs_rcode;
+    cr->cr_class_h = rr->rrs_class_h;
+    cr->cr_type_h = rr->rrs_type_h;
+    cr->cr_name_len = (u_int16_t) name_len;
+    cr->cr_zonecut_len = (u_int16_t) zonecut_len;
+    cr->cr_server_len = (u_int16_t) server_len;
+    cr->cr_ndata = ndata;
+    cr->cr_nsig = nsig;
+    cr->cr_cache = (u_char) which;
+    cr->cr_section = rr->rrs_section;
+    cr->cr_cred = rr->rrs_cred;
+    cr->cr_ans_kind = rr->rrs_ans_kind;
+    cr->cr_ns_options = rr->rrs_ns_options;
+
+    p = (u_char *) (cr + 1);
+    memcpy(p, rr->rrs_name_n, name_len);
+    p += name_len;
+    if (zonecut_len) {
+        memcpy(p, rr->rrs_zonecut_n, zonecut_len);
+        p += zonecut_len;
+    }
+    if (server_len) {
+        memcpy(p, rr->rrs_server, server_len);
+        p += server_len;
+    }
+    for (r = rr->rrs_data; r; r = r->rr_next) {
+        rlen = (u_int16_t) r->rr_rdata_length;
+        memcpy(p, &rlen, sizeof(rlen));
+        memcpy(p + sizeof(rlen), r->rr_rdata, rlen);
+        p += sizeof(rlen) + rlen;
+    }
+    for (r = rr->rrs_sig; r; r = r->rr_next) {
+        rlen = (u_int16_t) r->rr_rdata_length;
+        memcpy(p, &rlen, sizeof(rlen));
+        memcpy(p + sizeof(rlen), r->rr_rdata, rlen);
+        p += sizeof(rlen) + rlen;
+    }
+
+    b->cb_count++;
+    return 0;
+}
+
+static int
+cf_write_all(int fd, const u_char *buf, size_t len)
+{
+    ssize_t         n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Write the contents of the rrset caches to file.  The file is
+ * written under a new, unique temporary name in the same directory
+ * and then renamed, so that readers never see a partial file.
+ */
+int
+val_cache_save(const char *file)
+{
+    struct cf_buf   b;
+    struct cf_header h;
+    struct timeval  now;
+    char            tmp[PATH_MAX];
+    int             fd, retval;
+
+    if (file == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    gettimeofday(&now, NULL);
+    memset(&b, 0, sizeof(b));
+    b.cb_now = (u_int32_t) now.tv_sec;
+
+    if (0 != (retval = walk_validator_cache(cf_add_rrset, &b))) {
+        if (b.cb_data)
+            FREE(b.cb_data);
+        return retval;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.ch_magic, CF_MAGIC, sizeof(h.ch_magic));
+    h.ch_version = CF_VERSION;
+    h.ch_byte_order = CF_BYTE_ORDER;
+    h.ch_header_len = sizeof(h);
+    h.ch_count = b.cb_count;
+    h.ch_created = b.cb_now;
+    h.ch_payload_len = b.cb_len;
+    h.ch_payload_crc = cf_crc32(0, b.cb_data, b.cb_len);
+    h.ch_header_crc = cf_crc32(0, (u_char *) &h, sizeof(h));
+
+    /*
+     * a fresh file of our own next to the target: an existing file or
+     * a link planted under the temporary name is never followed
+     */
+    fd = -1;
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) < (int) sizeof(tmp)) {
+#ifdef WIN32
+        if (_mktemp_s(tmp, strlen(tmp) + 1) == 0)
+            fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0600);
+#else
+        fd = mkstemp(tmp);
+#endif
+    } else
+        errno = ENAMETOOLONG;
+    if (fd < 0) {
+        val_log(NULL, LOG_WARNING,
+                "val_cache_save(): Cannot create %s: %s", tmp,
+                strerror(errno));
+        if (b.cb_data)
+            FREE(b.cb_data);
+        return VAL_CONF_NOT_FOUND;
+    }
+    retval = VAL_NO_ERROR;
+    if (cf_write_all(fd, (u_char *) &h, sizeof(h)) != 0 ||
+        (b.cb_len && cf_write_all(fd, b.cb_data, b.cb_len) != 0)) {
+        val_log(NULL, LOG_WARNING,
+                "val_cache_save(): Cannot write %s: %s", tmp,
+                strerror(errno));
+        retval = VAL_INTERNAL_ERROR;
+    }
+    if (close(fd) != 0)
+        retval = VAL_INTERNAL_ERROR;
+    if (b.cb_data)
+        FREE(b.cb_data);
+
+#ifdef WIN32
+    if (retval == VAL_NO_ERROR)
+        unlink(file);
+#endif
+    if (retval == VAL_NO_ERROR && rename(tmp, file) != 0) {
+        val_log(NULL, LOG_WARNING,
+                "val_cache_save(): Cannot rename %s to %s: %s", tmp, file,
+                strerror(errno));
+        retval = VAL_INTERNAL_ERROR;
+    }
+    if (retval != VAL_NO_ERROR) {
+        unlink(tmp);
+        return retval;
+    }
+
+    val_log(NULL, LOG_INFO, "val_cache_save(): Saved %u RRsets to %s",
+            h.ch_count, file);
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Length of the wire format name at p, which must end before end, or
+ * 0 if it does not
+ */
+static size_t
+cf_name_len(const u_char *p, const u_char *end)
+{
+    const u_char   *q = p;
+
+    while (q < end && *q != 0) {
+        if (*q > 63)
+            return 0;
+        q += *q + 1;
+    }
+    if (q >= end || q - p + 1 > NS_MAXCDNAME)
+        return 0;
+    return q - p + 1;
+}
+
+/*
+ * Rebuild one saved RRset, or return NULL if it has expired or does
+ * not make sense.  Lengths have been checked against the record size.
+ */
+static struct rrset_rec *
+cf_read_rrset(const struct cf_rrset *cr, u_int32_t now)
+{
+    struct rrset_rec *rr;
+    const u_char   *p, *end;
+    u_int16_t       rlen;
+    int             i;
+
+    if (cr->cr_ttl_x <= now)
+        return NULL;
+
+    rr = (struct rrset_rec *) MALLOC(sizeof(struct rrset_rec));
+    if (rr == NULL)
+        return NULL;
+    memset(rr, 0, sizeof(struct rrset_rec));
+
+    p = (const u_char *) (cr + 1);
+    end = (const u_char *) cr + cr->cr_len;
+
+    if (cr->cr_name_len == 0 || cf_name_len(p, end) != cr->cr_name_len ||
+        NULL == (rr->rrs_name_n = (u_char *) MALLOC(cr->cr_name_len)))
+        goto err;
+    memcpy(rr->rrs_name_n, p, cr->cr_name_len);
+    p += cr->cr_name_len;
+
+    if (cr->cr_zonecut_len) {
+        if (cf_name_len(p, end) != cr->cr_zonecut_len ||
+            NULL == (rr->rrs_zonecut_n =
+                     (u_char *) MALLOC(cr->cr_zonecut_len)))
+            goto err;
+        memcpy(rr->rrs_zonecut_n, p, cr->cr_zonecut_len);
+        p += cr->cr_zonecut_len;
+    }
+
+    if (cr->cr_server_len) {
+        if (cr->cr_server_len > sizeof(struct sockaddr_storage) ||
+            NULL == (rr->rrs_server = (struct sockaddr *)
+                     MALLOC(sizeof(struct sockaddr_storage))))
+            goto err;
+        memset(rr->rrs_server, 0, sizeof(struct sockaddr_storage));
+        memcpy(rr->rrs_server, p, cr->cr_server_len);
+        p += cr->cr_server_len;
+    }
+
+    for (i = 0; i < cr->cr_ndata + cr->cr_nsig; i++) {
+        if (p + sizeof(rlen) > end)
+            goto err;
+        memcpy(&rlen, p, sizeof(rlen));
+        p += sizeof(rlen);
+        if (rlen == 0 || p + rlen > end)
+            goto err;
+        if (VAL_NO_ERROR != (i < cr->cr_ndata ?
+                             add_to_set(rr, rlen, (u_char *) p) :
+                             add_as_sig(rr, rlen, (u_char *) p)))
+            goto err;
+        p += rlen;
+    }
+    if (rr->rrs_data == NULL)
+        goto err;
+
+    rr->rrs_rcode = cr->cr_rcode;
+    rr->rrs_class_h = cr->cr_class_h;
+    rr->rrs_type_h = cr->cr_type_h;
+    rr->rrs_ttl_x = cr->cr_ttl_x;
+    rr->rrs_ttl_h = cr->cr_ttl_x - now;
+    rr->rrs_section = cr->cr_section;
+    rr->rrs_cred = cr->cr_cred;
+    rr->rrs_ans_kind = cr->cr_ans_kind;
+    rr->rrs_ns_options = (unsigned long) cr->cr_ns_options;
+    return rr;
+
+  err:
+    res_sq_free_rrset_recs(&rr);
+    return NULL;
+}
+
+/*
+ * Check the header and records of a mapped file and add the RRsets
+ * that have not expired to the caches
+ */
+static int
+cf_load_image(const char *file, const u_char *image, size_t size)
+{
+    struct cf_header h;
+    const struct cf_rrset *cr;
+    const u_char   *payload;
+    struct rrset_rec *lists[2] = { NULL, NULL };
+    struct rrset_rec *tails[2] = { NULL, NULL };
+    struct rrset_rec *rr;
+    struct timeval  now;
+    size_t          off;
+    u_int32_t       crc, i, restored = 0;
+
+    if (size < sizeof(h))
+        goto bad;
+    memcpy(&h, image, sizeof(h));
+    if (memcmp(h.ch_magic, CF_MAGIC, sizeof(h.ch_magic)) ||
+        h.ch_byte_order != CF_BYTE_ORDER) {
+        val_log(NULL, LOG_WARNING,
+                "val_cache_load(): %s is not a cache file for this host",
+                file);
+        return VAL_CONF_PARSE_ERROR;
+    }
+    if (h.ch_version != CF_VERSION) {
+        val_log(NULL, LOG_NOTICE,
+                "val_cache_load(): Ignoring %s, written by version %u",
+                file, h.ch_version);
+        return VAL_CONF_PARSE_ERROR;
+    }
+    crc = h.ch_header_crc;
+    h.ch_header_crc = 0;
+    if (h.ch_header_len != sizeof(h) ||
+        crc != cf_crc32(0, (u_char *) &h, sizeof(h)) ||
+        h.ch_payload_len != size - sizeof(h))
+        goto bad;
+    payload = image + sizeof(h);
+    if (h.ch_payload_crc != cf_crc32(0, payload, h.ch_payload_len))
+        goto bad;
+
+    gettimeofday(&now, NULL);
+    off = 0;
+    for (i = 0; i < h.ch_count; i++) {
+        if (off + sizeof(struct cf_rrset) > h.ch_payload_len)
+            goto bad_records;
+        cr = (const struct cf_rrset *) (payload + off);
+        if (cr->cr_len < sizeof(struct cf_rrset) ||
+            cr->cr_len != CF_ALIGN(cr->cr_len) ||
+            off + cr->cr_len > h.ch_payload_len ||
+            cr->cr_cache > VAL_CACHE_HINTS ||
+            (size_t) cr->cr_name_len + cr->cr_zonecut_len +
+            cr->cr_server_len > cr->cr_len - sizeof(struct cf_rrset))
+            goto bad_records;
+        off += cr->cr_len;
+
+        if (NULL == (rr = cf_read_rrset(cr, (u_int32_t) now.tv_sec)))
+            continue;
+        if (tails[cr->cr_cache])
+            tails[cr->cr_cache]->rrs_next = rr;
+        else
+            lists[cr->cr_cache] = rr;
+        tails[cr->cr_cache] = rr;
+        restored++;
+    }
+
+    restore_cached_rrsets(VAL_CACHE_ANSWERS, &lists[VAL_CACHE_ANSWERS]);
+    restore_cached_rrsets(VAL_CACHE_HINTS, &lists[VAL_CACHE_HINTS]);
+    val_log(NULL, LOG_INFO,
+            "val_cache_load(): Restored %u of %u RRsets from %s",
+            restored, h.ch_count, file);
+    return VAL_NO_ERROR;
+
+  bad_records:
+    res_sq_free_rrset_recs(&lists[VAL_CACHE_ANSWERS]);
+    res_sq_free_rrset_recs(&lists[VAL_CACHE_HINTS]);
+  bad:
+    val_log(NULL, LOG_WARNING,
+            "val_cache_load(): Ignoring %s, the file is damaged", file);
+    return VAL_CONF_PARSE_ERROR;
+}
+
+/*
+ * Add the RRsets saved in file by val_cache_save() to the rrset
+ * caches, unless they have expired since.
+ */
+int
+val_cache_load(const char *file)
+{
+    struct stat     st;
+    u_char         *image;
+    int             fd, retval;
+
+    if (file == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return VAL_CONF_NOT_FOUND;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 ||
+        st.st_size > CF_MAX_SIZE) {
+        close(fd);
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+#ifndef WIN32
+    image = (u_char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == (u_char *) MAP_FAILED)
+        return VAL_INTERNAL_ERROR;
+    retval = cf_load_image(file, image, st.st_size);
+    munmap(image, st.st_size);
+#else
+    image = (u_char *) MALLOC(st.st_size);
+    if (image == NULL) {
+        close(fd);
+        return VAL_OUT_OF_MEMORY;
+    }
+    if (read(fd, image, st.st_size) != st.st_size)
+        retval = VAL_CONF_PARSE_ERROR;
+    else
+        retval = cf_load_image(file, image, st.st_size);
+    close(fd);
+    FREE(image);
+#endif
+
+    return retval;
+}
+
+/*
+ * Load the cache file configured for a new context, the first time a
+ * context names it, and remember it for later saves.
+ */
+void
+val_cache_file_init(val_context_t *context)
+{
+    const char     *file;
+    struct timeval  now;
+    int             load = 0;
+
+    if (context == NULL || context->g_opt == NULL ||
+        NULL == (file = context->g_opt->cache_file))
+        return;
+
+    CF_LOCK();
+    if (cf_path == NULL || strcmp(cf_path, file)) {
+        if (cf_path)
+            FREE(cf_path);
+        cf_path = (char *) MALLOC(strlen(file) + 1);
+        if (cf_path)
+            strcpy(cf_path, file);
+        load = (cf_path != NULL);
+    }
+    cf_interval = context->g_opt->cache_save_interval;
+    gettimeofday(&now, NULL);
+    cf_next_save = cf_interval > 0 ? now.tv_sec + cf_interval : 0;
+    CF_UNLOCK();
+
+    if (load && val_cache_load(file) == VAL_CONF_NOT_FOUND)
+        val_log(context, LOG_INFO,
+                "val_cache_file_init(): No cache file %s yet", file);
+}
+
+/*
+ * Save the configured cache file if it is due.  Only one thread saves
+ * at a time; others go on without waiting.
+ */
+void
+val_cache_file_poll(void)
+{
+    struct timeval  now;
+    char           *file;
+
+    if (cf_next_save == 0)
+        return;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < cf_next_save || !CF_TRYLOCK())
+        return;
+    if (cf_path == NULL || cf_next_save == 0 || now.tv_sec < cf_next_save) {
+        CF_UNLOCK();
+        return;
+    }
+    cf_next_save = now.tv_sec + cf_interval;
+    file = cf_path;
+    val_cache_save(file);
+    CF_UNLOCK();
+}
+
+/*
+ * Save the configured cache file one last time and forget it.  Called
+ * before the caches are freed.
+ */
+void
+val_cache_file_shutdown(void)
+{
+    CF_LOCK();
+    if (cf_path) {
+        val_cache_save(cf_path);
+        FREE(cf_path);
+        cf_path = NULL;
+    }
+    cf_next_save = 0;
+    CF_UNLOCK();
+}
@@ -0,0 +1,12 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_CACHE_FILE_H
+#define VAL_CACHE_FILE_H
+
+void            val_cache_file_init(val_context_t *context);
+void            val_cache_file_poll(void);
+void            val_cache_file_shutdown(void);
+
+#endif /* VAL_CACHE_FILE_H */
@@ -20,6 +20,11 @@
 #include "val_cache.h"
 #include "val_assertion.h"
 #include "val_context.h"
+#include "val_rcache.h"
+#include "val_tcache.h"
+#include "val_prefetch.h"
+#include "val_cache_file.h"
+#include "val_mirror.h"
 
 #define GET_LATEST_TIMESTAMP(ctx, file, cur_ts, new_ts) do { \
     memset(&new_ts, 0, sizeof(struct stat));\
@@ -171,6 +176,7 @@ val_refresh_resolver_policy(val_context_t * context)
         val_log(context, LOG_WARNING, 
                 "val_refresh_resolver_policy(): Resolver configuration could not be read; using older values");
     }
+    val_rcache_flush(context);
     return VAL_NO_ERROR; 
 }
 
@@ -210,6 +216,7 @@ val_refresh_root_hints(val_context_t * context)
         val_log(context, LOG_WARNING, 
                 "val_refresh_root_hints(): Root Hints could not be read; using older values");
     }
+    val_rcache_flush(context);
 
     return VAL_NO_ERROR;
 }
@@ -483,6 +490,9 @@ val_create_context_internal( const char *label,
         goto err;
     }
     memset(*newcontext, 0, sizeof(val_context_t));
+#ifndef VAL_NO_ASYNC
+    (*newcontext)->as_event_fd = -1;
+#endif
 #ifdef VAL_REFCOUNTS
     ++(*newcontext)->refcount; /* don't need lock, it's a new object */
 #endif
@@ -548,6 +558,24 @@ val_create_context_internal( const char *label,
     }
     memset(((*newcontext)->e_pol), 0,
            MAX_POL_TOKEN * sizeof(policy_entry_t *));
+
+    (*newcontext)->rcache = val_rcache_create();
+    if ((*newcontext)->rcache == NULL) {
+        retval = VAL_OUT_OF_MEMORY;
+        goto err;
+    }
+
+    (*newcontext)->tcache = val_tcache_create();
+    if ((*newcontext)->tcache == NULL) {
+        retval = VAL_OUT_OF_MEMORY;
+        goto err;
+    }
+
+    (*newcontext)->prefetch = val_prefetch_create();
+    if ((*newcontext)->prefetch == NULL) {
+        retval = VAL_OUT_OF_MEMORY;
+        goto err;
+    }
    
     (*newcontext)->val_log_targets = NULL;
     (*newcontext)->q_list = NULL;
@@ -583,6 +611,16 @@ val_create_context_internal( const char *label,
         (*newcontext)->def_cflags |= VAL_QUERY_AC_DETAIL;
     }
 
+    /*
+     * Warm the rrset caches from the cache file, if one is configured
+     */
+    val_cache_file_init(*newcontext);
+
+    /*
+     * Resolve the chains of trust of the pinned zones
+     */
+    val_prefetch_warm(*newcontext);
+
     val_log(*newcontext, LOG_DEBUG, 
             "val_create_context_with_conf(): Context created with %s %s %s", 
             (*newcontext)->base_dnsval_conf,
@@ -721,6 +759,16 @@ val_free_context(val_context_t * context)
 
     if (context == NULL)
         return;
+
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+    /** workers use the context, so they must go first */
+    if (context->as_engine)
+        val_async_engine_stop(context, 0);
+#endif
+#ifndef VAL_NO_ASYNC
+    /** our own refreshes hold the policy lock until they finish */
+    val_prefetch_cancel(context);
+#endif
     
     /*
      * never free context that has multiple users
@@ -799,9 +847,19 @@ val_free_context(val_context_t * context)
         free_query_chain_structure(q);
         q = NULL;
     }
+    val_rcache_destroy(context->rcache);
+    val_tcache_destroy(context->tcache);
+    val_prefetch_destroy(context->prefetch);
+    val_mirror_free(context->mirrors);
     if (context->base_dnsval_conf)
         FREE(context->base_dnsval_conf);
-    
+
+#ifndef VAL_NO_ASYNC
+    if (context->as_sock_map)
+        FREE(context->as_sock_map);
+    if (context->as_event_fd != -1)
+        CLOSESOCK(context->as_event_fd);
+#endif
 
     FREE(context);
 }
@@ -817,6 +875,7 @@ val_free_validator_state()
 {
     val_context_t * saved_ctx = NULL;
 
+    val_cache_file_shutdown();
     free_validator_cache();
 
     LOCK_DEFAULT_CONTEXT();
@@ -7,12 +7,13 @@
 
 /*
  * DESCRIPTION
- * This is the implementation for the DSA/SHA-1 algorithm signature
- * verification, the implementation for the RSA/MD5 algorithm signature
- * verification and the implementation for the RSA/SHA-1 algorithm signature
- * verification
+ * Signature verification for the DNSSEC algorithms (RSA/MD5, DSA,
+ * RSA/SHA-1, RSA/SHA-2, ECDSA and EdDSA) through OpenSSL's EVP
+ * interface, driven by a table of the supported algorithms, and the
+ * DS and NSEC3 hashes.
  *
- * See RFC 2537, RFC 3110, RFC 4034 Appendix B.1, RFC 2536
+ * See RFC 2536, RFC 3110, RFC 4034 Appendix B.1, RFC 5702, RFC 6605,
+ * RFC 8080
  */
 #include "validator-internal.h"
 
@@ -37,514 +38,781 @@
 #include <openssl/obj_mac.h>  /* for EC curves */
 #endif
 
+/*
+ * With OpenSSL 3 public keys are built from parameters; the older
+ * low-level key structures are only used with earlier versions.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#define VAL_PKEY_FROMDATA 1
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
 #include "val_crypto.h"
 #include "val_support.h"
+#include "val_stats.h"
 
+#define VAL_DIGEST_CACHE_MDS 4
 
 /*
- * Returns VAL_NO_ERROR on success, other values on failure 
+ * An initialized context for each digest in use, which is copied for
+ * every signature instead of setting up a new one each time, and a
+ * working context to copy into.
  */
-static int
-dsasha1_parse_public_key(const u_char *buf, size_t buflen, DSA * dsa)
-{
-    u_char        T;
-    int             index = 0;
-    BIGNUM         *bn_p, *bn_q, *bn_g, *bn_y;
-
-    if (!dsa || buflen == 0) {
-        return VAL_BAD_ARGUMENT;
-    }
-
-    T = (u_char) (buf[index]);
-    index++;
-    
-    if (index+20 > buflen)
-        return VAL_BAD_ARGUMENT;
-    bn_q = BN_bin2bn(buf + index, 20, NULL);
-    index += 20;
-
-    if (index+64 + (T * 8) > buflen)
-        return VAL_BAD_ARGUMENT;
-    bn_p = BN_bin2bn(buf + index, 64 + (T * 8), NULL);
-    index += (64 + (T * 8));
-
-    if (index+64 + (T * 8) > buflen)
-        return VAL_BAD_ARGUMENT;
-    bn_g = BN_bin2bn(buf + index, 64 + (T * 8), NULL);
-    index += (64 + (T * 8));
-
-    if (index+64 + (T * 8) > buflen)
-        return VAL_BAD_ARGUMENT;
-    bn_y = BN_bin2bn(buf + index, 64 + (T * 8), NULL);
-    index += (64 + (T * 8));
-
-    DSA_set0_pqg(dsa, bn_p, bn_q, bn_g);
-    DSA_set0_key(dsa, bn_y, NULL);
-
-    return VAL_NO_ERROR;        /* success */
-}
+struct val_digest_cache {
+    const EVP_MD   *dc_md[VAL_DIGEST_CACHE_MDS];
+    EVP_MD_CTX     *dc_template[VAL_DIGEST_CACHE_MDS];
+    EVP_MD_CTX     *dc_work;
+};
 
 void
-dsasha1_sigverify(val_context_t * ctx,
-                  const u_char *data,
-                  size_t data_len,
-                  const val_dnskey_rdata_t * dnskey,
-                  const val_rrsig_rdata_t * rrsig,
-                  val_astatus_t * key_status, val_astatus_t * sig_status)
+val_digest_cache_free(struct val_digest_cache *dc)
 {
-    char            buf[1028];
-    size_t          buflen = 1024;
-    DSA            *dsa = NULL;
-    u_char   sha1_hash[SHA_DIGEST_LENGTH];
-    u_char   sig_asn1[2+2*(3+SHA_DIGEST_LENGTH)];
+    int             i;
 
-    val_log(ctx, LOG_DEBUG,
-            "dsasha1_sigverify(): parsing the public key...");
-    if ((dsa = DSA_new()) == NULL) {
-        val_log(ctx, LOG_INFO,
-                "dsasha1_sigverify(): could not allocate dsa structure.");
-        *key_status = VAL_AC_INVALID_KEY;
+    if (dc == NULL)
         return;
-    };
+    for (i = 0; i < VAL_DIGEST_CACHE_MDS; i++)
+        if (dc->dc_template[i])
+            EVP_MD_CTX_free(dc->dc_template[i]);
+    if (dc->dc_work)
+        EVP_MD_CTX_free(dc->dc_work);
+    FREE(dc);
+}
 
-    if (dsasha1_parse_public_key
-        (dnskey->public_key, dnskey->public_key_len,
-         dsa) != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
-                "dsasha1_sigverify(): Error in parsing public key.");
-        DSA_free(dsa);
-        *key_status = VAL_AC_INVALID_KEY;
-        return;
+/*
+ * Set up mdctx for a new digest, from the cached template if there is
+ * one.
+ */
+static int
+digest_cache_init(struct val_digest_cache **dcp, const EVP_MD *md,
+                  EVP_MD_CTX **mdctx)
+{
+    struct val_digest_cache *dc;
+    int             i;
+
+    *mdctx = NULL;
+    if (dcp == NULL) {
+        if ((*mdctx = EVP_MD_CTX_new()) == NULL)
+            return 0;
+        return EVP_DigestInit_ex(*mdctx, md, NULL) == 1;
     }
 
-    memset(sha1_hash, 0, SHA_DIGEST_LENGTH);
-    SHA1(data, data_len, sha1_hash);
-    val_log(ctx, LOG_DEBUG, "dsasha1_sigverify(): SHA-1 hash = %s",
-            get_hex_string(sha1_hash, SHA_DIGEST_LENGTH, buf, buflen));
+    if (*dcp == NULL) {
+        *dcp = (struct val_digest_cache *)
+            MALLOC(sizeof(struct val_digest_cache));
+        if (*dcp == NULL)
+            return 0;
+        memset(*dcp, 0, sizeof(struct val_digest_cache));
+    }
+    dc = *dcp;
+    if (dc->dc_work == NULL && (dc->dc_work = EVP_MD_CTX_new()) == NULL)
+        return 0;
 
-    val_log(ctx, LOG_DEBUG,
-            "dsasha1_sigverify(): verifying DSA signature...");
+    for (i = 0; i < VAL_DIGEST_CACHE_MDS; i++) {
+        if (dc->dc_md[i] == md)
+            break;
+        if (dc->dc_md[i] == NULL) {
+            if ((dc->dc_template[i] = EVP_MD_CTX_new()) == NULL)
+                return 0;
+            if (EVP_DigestInit_ex(dc->dc_template[i], md, NULL) != 1) {
+                EVP_MD_CTX_free(dc->dc_template[i]);
+                dc->dc_template[i] = NULL;
+                return 0;
+            }
+            dc->dc_md[i] = md;
+            break;
+        }
+    }
+    *mdctx = dc->dc_work;
+    if (i == VAL_DIGEST_CACHE_MDS)
+        return EVP_DigestInit_ex(*mdctx, md, NULL) == 1;
+    return EVP_MD_CTX_copy_ex(*mdctx, dc->dc_template[i]) == 1;
+}
 
-    /*
-     * Fix: courtesy tom.fowler
-     * First convert the signature into its DER representation
-     *  0x30, 0x2E,       -  ASN1 sequence 
-     *   0x02, 0x15,      - ASN integer, length 21 bytes
-     *   0x00, <R bytes>  - 1 + 20 bytes per 2536 
-     *   0x02, 0x15,      - ASN integer 
-     *   0x00, <S bytes>  - 1 + 20 bytes per 2536
-     */
-    if (rrsig->signature_len < (1 + 2*SHA_DIGEST_LENGTH)) {
-        /* dont have enough data */
-        val_log(ctx, LOG_INFO,
-                "dsasha1_sigverify(): Error parsing DSA rrsig.");
-        DSA_free(dsa);
-        *sig_status = VAL_AC_INVALID_RRSIG;
-        return;
+/*
+ * Hash the data covered by a signature.  The two parts are fed to the
+ * digest in turn, so they never need to be copied into one buffer.  The
+ * RRset part follows the RRSIG part, so the hash cannot be shared
+ * between different RRSIGs; but the result is remembered on the set,
+ * and every other key tried for the same RRSIG, and any later check of
+ * the set, uses it without hashing the RRset again.
+ * Returns 1 on success, 0 on failure.
+ */
+static int
+sigfield_digest(const EVP_MD *md, const struct val_sigfield *sf,
+                u_char *hash)
+{
+    EVP_MD_CTX     *mdctx = NULL;
+    struct rrset_digest *rd;
+    u_int           hash_len = 0;
+    int             ok;
+
+    if (sf->sf_set != NULL) {
+        for (rd = sf->sf_set->rrs_digests; rd; rd = rd->rd_next) {
+            if (rd->rd_md == (const void *) md &&
+                rd->rd_prefix_len == sf->sf_prefix_len &&
+                !memcmp(rd->rd_prefix, sf->sf_prefix, sf->sf_prefix_len)) {
+                memcpy(hash, rd->rd_hash, rd->rd_hash_len);
+                VAL_STATS_INC(vs_sig_hash_reused);
+                return 1;
+            }
+        }
     }
-    memcpy(sig_asn1, "\x30\x2E\x02\x15\x00", 5);
-    memcpy(sig_asn1+5, rrsig->signature+1, SHA_DIGEST_LENGTH);
-    memcpy(sig_asn1+5+SHA_DIGEST_LENGTH, "\x02\x15\x00", 3);
-    memcpy(sig_asn1+5+SHA_DIGEST_LENGTH+3,
-           rrsig->signature+1+SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH);
-
-    if (DSA_verify
-        (NID_sha1, (u_char *) sha1_hash, SHA_DIGEST_LENGTH,
-         sig_asn1, sizeof(sig_asn1), dsa)  == 1) {
-        val_log(ctx, LOG_INFO, "dsasha1_sigverify(): returned SUCCESS");
-        DSA_free(dsa);
-        *sig_status = VAL_AC_RRSIG_VERIFIED;
-    } else {
-        val_log(ctx, LOG_INFO, "dsasha1_sigverify(): returned FAILURE");
-        DSA_free(dsa);
-        *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
+
+    ok = digest_cache_init(sf->sf_dcache, md, &mdctx) &&
+        EVP_DigestUpdate(mdctx, sf->sf_prefix, sf->sf_prefix_len) == 1 &&
+        EVP_DigestUpdate(mdctx, sf->sf_rrs, sf->sf_rrs_len) == 1 &&
+        EVP_DigestFinal_ex(mdctx, hash, &hash_len) == 1;
+    if (mdctx && sf->sf_dcache == NULL)
+        EVP_MD_CTX_free(mdctx);
+    if (!ok)
+        return 0;
+    val_stats_add(offsetof(val_stats_t, vs_sig_hash_bytes),
+                  sf->sf_prefix_len + sf->sf_rrs_len);
+
+    if (sf->sf_set != NULL && hash_len <= sizeof(rd->rd_hash) &&
+        sf->sf_prefix_len <= sizeof(rd->rd_prefix) &&
+        (rd = (struct rrset_digest *) MALLOC(sizeof(struct rrset_digest)))
+        != NULL) {
+        rd->rd_md = (const void *) md;
+        memcpy(rd->rd_prefix, sf->sf_prefix, sf->sf_prefix_len);
+        rd->rd_prefix_len = sf->sf_prefix_len;
+        memcpy(rd->rd_hash, hash, hash_len);
+        rd->rd_hash_len = hash_len;
+        rd->rd_next = sf->sf_set->rrs_digests;
+        sf->sf_set->rrs_digests = rd;
     }
-    return;
+    return 1;
 }
 
+#ifdef VAL_PKEY_FROMDATA
 /*
- * Returns VAL_NO_ERROR on success, other values on failure 
+ * Build a public key of the given type from a parameter list
  */
-static int
-rsamd5_parse_public_key(const u_char *buf, size_t buflen, RSA * rsa)
+static EVP_PKEY *
+pkey_fromdata(const char *type, OSSL_PARAM_BLD *bld)
 {
-    int             index = 0;
-    const u_char   *cp;
-    u_int16_t       exp_len = 0x0000;
-    BIGNUM         *bn_exp;
-    BIGNUM         *bn_mod;
+    EVP_PKEY_CTX   *pctx = NULL;
+    OSSL_PARAM     *params = NULL;
+    EVP_PKEY       *pkey = NULL;
 
-    if (!rsa || buflen == 0)
-        return VAL_BAD_ARGUMENT;
+    if (bld == NULL)
+        return NULL;
+    if ((params = OSSL_PARAM_BLD_to_param(bld)) != NULL &&
+        (pctx = EVP_PKEY_CTX_new_from_name(NULL, type, NULL)) != NULL &&
+        EVP_PKEY_fromdata_init(pctx) == 1 &&
+        EVP_PKEY_fromdata(pctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) != 1)
+        pkey = NULL;
+    if (pctx)
+        EVP_PKEY_CTX_free(pctx);
+    if (params)
+        OSSL_PARAM_free(params);
+    return pkey;
+}
+#endif
 
-    cp = buf;
+struct val_sigalg;
+
+/*
+ * RFC 3110, section 2
+ */
+static EVP_PKEY *
+rsa_parse_key(const struct val_sigalg *sa, const u_char *buf,
+              size_t buflen)
+{
+    size_t          index;
+    size_t          exp_len;
+    BIGNUM         *bn_exp = NULL;
+    BIGNUM         *bn_mod = NULL;
+    EVP_PKEY       *pkey = NULL;
 
-    if (buf[index] == 0) {
+    if (buflen == 0)
+        return NULL;
 
+    if (buf[0] == 0) {
         if (buflen < 3)
-            return VAL_BAD_ARGUMENT;
-
-        index += 1;
-        cp = (buf + index);
-        VAL_GET16(exp_len, cp);
-        index += 2;
+            return NULL;
+        exp_len = (buf[1] << 8) | buf[2];
+        index = 3;
     } else {
-        exp_len += buf[index];
-        index += 1;
+        exp_len = buf[0];
+        index = 1;
     }
+    if (index + exp_len >= buflen)
+        return NULL;
 
-    if (exp_len > buflen - index) {
-        return VAL_BAD_ARGUMENT;
-    }
-    
-    /*
-     * Extract the exponent 
-     */
     bn_exp = BN_bin2bn(buf + index, exp_len, NULL);
+    bn_mod = BN_bin2bn(buf + index + exp_len, buflen - index - exp_len,
+                       NULL);
+    if (bn_exp != NULL && bn_mod != NULL) {
+#ifdef VAL_PKEY_FROMDATA
+        OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+
+        if (bld != NULL &&
+            OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_N, bn_mod) &&
+            OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_RSA_E, bn_exp))
+            pkey = pkey_fromdata("RSA", bld);
+        OSSL_PARAM_BLD_free(bld);
+#else
+        RSA            *rsa = RSA_new();
+
+        if (rsa != NULL && RSA_set0_key(rsa, bn_mod, bn_exp, NULL) == 1) {
+            bn_mod = bn_exp = NULL;
+            if ((pkey = EVP_PKEY_new()) != NULL &&
+                EVP_PKEY_assign_RSA(pkey, rsa) == 1)
+                rsa = NULL;
+            else if (pkey != NULL) {
+                EVP_PKEY_free(pkey);
+                pkey = NULL;
+            }
+        }
+        if (rsa)
+            RSA_free(rsa);
+#endif
+    }
+    if (bn_exp)
+        BN_free(bn_exp);
+    if (bn_mod)
+        BN_free(bn_mod);
+    return pkey;
+}
 
-    index += exp_len;
+/*
+ * RFC 2536, section 2
+ */
+static EVP_PKEY *
+dsa_parse_key(const struct val_sigalg *sa, const u_char *buf,
+              size_t buflen)
+{
+    size_t          T, len;
+    BIGNUM         *bn_p = NULL, *bn_q = NULL, *bn_g = NULL, *bn_y = NULL;
+    EVP_PKEY       *pkey = NULL;
 
-    if (buflen <= index) {
-        return VAL_BAD_ARGUMENT;
+    if (buflen == 0)
+        return NULL;
+    T = buf[0];
+    len = 64 + T * 8;
+    if (1 + 20 + 3 * len > buflen)
+        return NULL;
+
+    bn_q = BN_bin2bn(buf + 1, 20, NULL);
+    bn_p = BN_bin2bn(buf + 1 + 20, len, NULL);
+    bn_g = BN_bin2bn(buf + 1 + 20 + len, len, NULL);
+    bn_y = BN_bin2bn(buf + 1 + 20 + 2 * len, len, NULL);
+    if (bn_p && bn_q && bn_g && bn_y) {
+#ifdef VAL_PKEY_FROMDATA
+        OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+
+        if (bld != NULL &&
+            OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_FFC_P, bn_p) &&
+            OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_FFC_Q, bn_q) &&
+            OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_FFC_G, bn_g) &&
+            OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_PUB_KEY, bn_y))
+            pkey = pkey_fromdata("DSA", bld);
+        OSSL_PARAM_BLD_free(bld);
+#else
+        DSA            *dsa = DSA_new();
+
+        if (dsa != NULL && DSA_set0_pqg(dsa, bn_p, bn_q, bn_g) == 1) {
+            bn_p = bn_q = bn_g = NULL;
+            if (DSA_set0_key(dsa, bn_y, NULL) == 1) {
+                bn_y = NULL;
+                if ((pkey = EVP_PKEY_new()) != NULL &&
+                    EVP_PKEY_assign_DSA(pkey, dsa) == 1)
+                    dsa = NULL;
+                else if (pkey != NULL) {
+                    EVP_PKEY_free(pkey);
+                    pkey = NULL;
+                }
+            }
+        }
+        if (dsa)
+            DSA_free(dsa);
+#endif
     }
+    if (bn_p)
+        BN_free(bn_p);
+    if (bn_q)
+        BN_free(bn_q);
+    if (bn_g)
+        BN_free(bn_g);
+    if (bn_y)
+        BN_free(bn_y);
+    return pkey;
+}
 
-    /*
-     * Extract the modulus 
-     */
-    bn_mod = BN_bin2bn(buf + index, buflen - index, NULL);
+/*
+ * Encode the two halves of an r | s signature as a DER SEQUENCE of two
+ * INTEGERs, the form OpenSSL verifies.  Each half is at most 48 octets,
+ * so all lengths fit in one octet.
+ */
+static size_t
+der_integer(const u_char *v, size_t len, u_char *out)
+{
+    size_t          pad;
 
-    RSA_set0_key(rsa, bn_mod, bn_exp, NULL);
+    while (len > 1 && *v == 0) {
+        v++;
+        len--;
+    }
+    pad = (*v & 0x80) ? 1 : 0;
+    out[0] = 0x02;
+    out[1] = (u_char) (len + pad);
+    out[2] = 0;
+    memcpy(out + 2 + pad, v, len);
+    return 2 + pad + len;
+}
+
+static size_t
+der_rs_sig(const u_char *r, const u_char *s, size_t half, u_char *out)
+{
+    size_t          len;
 
-    return VAL_NO_ERROR;        /* success */
+    len = der_integer(r, half, out + 2);
+    len += der_integer(s, half, out + 2 + len);
+    out[0] = 0x30;
+    out[1] = (u_char) len;
+    return 2 + len;
 }
 
 /*
- * See RFC 4034, Appendix B.1 :
- *
- * " For a DNSKEY RR with algorithm 1, the key tag is defined to be the most
- *   significant 16 bits of the least significant 24 bits in the public
- *   key modulus (in other words, the 4th to last and 3rd to last octets
- *   of the public key modulus)."
+ * RFC 2536, section 3: T | R | S
  */
-u_int16_t
-rsamd5_keytag(const u_char *pubkey, size_t pubkey_len)
+static int
+dsa_parse_sig(const struct val_sigalg *sa, const u_char *sig,
+              size_t siglen, u_char *out, size_t *outlen)
 {
-    RSA            *rsa = NULL;
-    BIGNUM         *modulus;
-    u_int16_t       keytag = 0x0000;
-    u_char  *modulus_bin;
-    int             modulus_len;
-
-    if ((rsa = RSA_new()) == NULL) {
-        return VAL_OUT_OF_MEMORY;
-    };
-
-    if (rsamd5_parse_public_key(pubkey, pubkey_len, rsa) != VAL_NO_ERROR) {
-        RSA_free(rsa);
-        return VAL_BAD_ARGUMENT;
-    }
+    if (siglen < 1 + 2 * SHA_DIGEST_LENGTH)
+        return 0;
+    *outlen = der_rs_sig(sig + 1, sig + 1 + SHA_DIGEST_LENGTH,
+                         SHA_DIGEST_LENGTH, out);
+    return 1;
+}
 
-    RSA_get0_key(rsa, (const BIGNUM **) &modulus, NULL, NULL);
-    modulus_len = BN_num_bytes(modulus);
-    modulus_bin =
-        (u_char *) MALLOC(modulus_len * sizeof(u_char));
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+/*
+ * RFC 6605, section 4: Q = x | y
+ */
+static EVP_PKEY *
+ecdsa_parse_key(const struct val_sigalg *sa, const u_char *buf,
+                size_t buflen);
 
-    BN_bn2bin(modulus, modulus_bin);
+/*
+ * RFC 6605, section 4: r | s
+ */
+static int
+ecdsa_parse_sig(const struct val_sigalg *sa, const u_char *sig,
+                size_t siglen, u_char *out, size_t *outlen);
+#endif
 
-    keytag = ((0x00ff & modulus_bin[modulus_len - 3]) << 8) |
-        (0x00ff & modulus_bin[modulus_len - 2]);
+#ifdef HAVE_EDDSA
+/*
+ * RFC 8080, section 3: the public key is used as is
+ */
+static EVP_PKEY *
+eddsa_parse_key(const struct val_sigalg *sa, const u_char *buf,
+                size_t buflen);
+#endif
 
-    FREE(modulus_bin);
-    RSA_free(rsa);
-    return keytag;
-}
+/*
+ * The signature algorithms, see RFC 8624.  sa_md is the digest the
+ * signed data is hashed with before it is handed to the public key
+ * algorithm, or NULL if the algorithm takes the data itself (EdDSA);
+ * sa_parse_sig, if set, converts the signature from its DNSSEC form.
+ */
+struct val_sigalg {
+    u_char          sa_alg;
+    const char     *sa_name;
+    const EVP_MD *(*sa_md) (void);
+    EVP_PKEY     *(*sa_parse_key) (const struct val_sigalg * sa,
+                                   const u_char *buf, size_t buflen);
+    int           (*sa_parse_sig) (const struct val_sigalg * sa,
+                                   const u_char *sig, size_t siglen,
+                                   u_char *out, size_t *outlen);
+    int             sa_param;   /* curve NID, or EVP_PKEY type */
+    size_t          sa_size;    /* size of a coordinate or key */
+};
+
+static const struct val_sigalg val_sigalgs[] = {
+    {ALG_RSAMD5, "RSAMD5", EVP_md5, rsa_parse_key, NULL, 0, 0},
+    {ALG_DSASHA1, "DSA", EVP_sha1, dsa_parse_key, dsa_parse_sig, 0, 0},
+    {ALG_RSASHA1, "RSASHA1", EVP_sha1, rsa_parse_key, NULL, 0, 0},
+#ifdef LIBVAL_NSEC3
+    {ALG_NSEC3_DSASHA1, "DSA-NSEC3-SHA1", EVP_sha1, dsa_parse_key,
+     dsa_parse_sig, 0, 0},
+    {ALG_NSEC3_RSASHA1, "RSASHA1-NSEC3-SHA1", EVP_sha1, rsa_parse_key,
+     NULL, 0, 0},
+#endif
+#ifdef HAVE_SHA_2
+    {ALG_RSASHA256, "RSASHA256", EVP_sha256, rsa_parse_key, NULL, 0, 0},
+    {ALG_RSASHA512, "RSASHA512", EVP_sha512, rsa_parse_key, NULL, 0, 0},
+#endif
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+    {ALG_ECDSAP256SHA256, "ECDSAP256SHA256", EVP_sha256, ecdsa_parse_key,
+     ecdsa_parse_sig, NID_X9_62_prime256v1, 32},
+    {ALG_ECDSAP384SHA384, "ECDSAP384SHA384", EVP_sha384, ecdsa_parse_key,
+     ecdsa_parse_sig, NID_secp384r1, 48},
+#endif
+#ifdef HAVE_EDDSA
+    {ALG_ED25519, "ED25519", NULL, eddsa_parse_key, NULL,
+     EVP_PKEY_ED25519, 32},
+    {ALG_ED448, "ED448", NULL, eddsa_parse_key, NULL, EVP_PKEY_ED448, 57},
+#endif
+};
 
-void
-rsamd5_sigverify(val_context_t * ctx,
-                 const u_char *data,
-                 size_t data_len,
-                 const val_dnskey_rdata_t * dnskey,
-                 const val_rrsig_rdata_t * rrsig,
-                 val_astatus_t * key_status, val_astatus_t * sig_status)
-{
-    char            buf[1028];
-    size_t          buflen = 1024;
-    RSA            *rsa = NULL;
-    u_char   md5_hash[MD5_DIGEST_LENGTH];
+#define VAL_SIGALGS (sizeof(val_sigalgs) / sizeof(val_sigalgs[0]))
 
-    val_log(ctx, LOG_DEBUG,
-            "rsamd5_sigverify(): parsing the public key...");
-    if ((rsa = RSA_new()) == NULL) {
-        val_log(ctx, LOG_INFO,
-                "rsamd5_sigverify(): could not allocate rsa structure.");
-        *key_status = VAL_AC_INVALID_KEY;
-        return;
-    };
+#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
+static EVP_PKEY *
+ecdsa_parse_key(const struct val_sigalg *sa, const u_char *buf,
+                size_t buflen)
+{
+    EVP_PKEY       *pkey = NULL;
+#ifdef VAL_PKEY_FROMDATA
+    OSSL_PARAM_BLD *bld;
+    u_char          point[1 + 2 * 48];
 
-    if (rsamd5_parse_public_key(dnskey->public_key, dnskey->public_key_len,
-                                rsa) != VAL_NO_ERROR) {
-        val_log(ctx, LOG_INFO,
-                "rsamd5_sigverify(): Error in parsing public key.");
-        RSA_free(rsa);
-        *key_status = VAL_AC_INVALID_KEY;
-        return;
+    if (buflen != 2 * sa->sa_size || buflen + 1 > sizeof(point))
+        return NULL;
+    /* uncompressed point */
+    point[0] = 0x04;
+    memcpy(point + 1, buf, buflen);
+    if ((bld = OSSL_PARAM_BLD_new()) == NULL)
+        return NULL;
+    if (OSSL_PARAM_BLD_push_utf8_string(bld, OSSL_PKEY_PARAM_GROUP_NAME,
+                                        OBJ_nid2sn(sa->sa_param), 0) &&
+        OSSL_PARAM_BLD_push_octet_string(bld, OSSL_PKEY_PARAM_PUB_KEY,
+                                         point, buflen + 1))
+        pkey = pkey_fromdata("EC", bld);
+    OSSL_PARAM_BLD_free(bld);
+#else
+    EC_KEY         *eckey;
+    BIGNUM         *bn_x, *bn_y;
+
+    if (buflen != 2 * sa->sa_size)
+        return NULL;
+    if ((eckey = EC_KEY_new_by_curve_name(sa->sa_param)) == NULL)
+        return NULL;
+    bn_x = BN_bin2bn(buf, sa->sa_size, NULL);
+    bn_y = BN_bin2bn(buf + sa->sa_size, sa->sa_size, NULL);
+    if (bn_x && bn_y &&
+        EC_KEY_set_public_key_affine_coordinates(eckey, bn_x, bn_y) == 1 &&
+        (pkey = EVP_PKEY_new()) != NULL) {
+        if (EVP_PKEY_assign_EC_KEY(pkey, eckey) == 1)
+            eckey = NULL;
+        else {
+            EVP_PKEY_free(pkey);
+            pkey = NULL;
+        }
     }
+    if (bn_x)
+        BN_free(bn_x);
+    if (bn_y)
+        BN_free(bn_y);
+    if (eckey)
+        EC_KEY_free(eckey);
+#endif
+    return pkey;
+}
 
-    memset(md5_hash, 0, MD5_DIGEST_LENGTH);
-    MD5(data, data_len, (u_char *) md5_hash);
-    val_log(ctx, LOG_DEBUG, "rsamd5_sigverify(): MD5 hash = %s",
-            get_hex_string(md5_hash, MD5_DIGEST_LENGTH, buf, buflen));
+static int
+ecdsa_parse_sig(const struct val_sigalg *sa, const u_char *sig,
+                size_t siglen, u_char *out, size_t *outlen)
+{
+    if (siglen != 2 * sa->sa_size)
+        return 0;
+    *outlen = der_rs_sig(sig, sig + sa->sa_size, sa->sa_size, out);
+    return 1;
+}
+#endif
 
-    val_log(ctx, LOG_DEBUG,
-            "rsamd5_sigverify(): verifying RSA signature...");
+#ifdef HAVE_EDDSA
+static EVP_PKEY *
+eddsa_parse_key(const struct val_sigalg *sa, const u_char *buf,
+                size_t buflen)
+{
+    if (buflen != sa->sa_size)
+        return NULL;
+    return EVP_PKEY_new_raw_public_key(sa->sa_param, NULL, buf, buflen);
+}
+#endif
 
-    if (RSA_verify(NID_md5, (u_char *) md5_hash, MD5_DIGEST_LENGTH,
-                   rrsig->signature, rrsig->signature_len, rsa) == 1) {
-        val_log(ctx, LOG_INFO, "rsamd5_sigverify(): returned SUCCESS");
-        RSA_free(rsa);
-        *sig_status = VAL_AC_RRSIG_VERIFIED;
-    } else {
-        val_log(ctx, LOG_INFO, "rsamd5_sigverify(): returned FAILURE");
-        RSA_free(rsa);
-        *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
-    }
-    return;
+static const struct val_sigalg *
+find_sigalg(u_char alg)
+{
+    size_t          i;
+
+    for (i = 0; i < VAL_SIGALGS; i++)
+        if (val_sigalgs[i].sa_alg == alg)
+            return &val_sigalgs[i];
+    return NULL;
 }
 
 /*
- * Returns VAL_NO_ERROR on success, other values on failure 
+ * Returns 1 if signatures made with the algorithm can be verified
  */
-static int
-rsa_parse_public_key(const u_char *buf, size_t buflen, RSA * rsa)
+int
+val_sigalg_supported(u_char alg)
 {
-    int             index = 0;
-    const u_char   *cp;
-    u_int16_t       exp_len = 0x0000;
-    BIGNUM         *bn_exp;
-    BIGNUM         *bn_mod;
+    return find_sigalg(alg) != NULL;
+}
 
-    if (!rsa || buflen == 0)
-        return VAL_BAD_ARGUMENT;
+/*
+ * Parsed DNSKEYs, shared by all contexts, so that the keys of a zone
+ * are turned into EVP_PKEY objects once rather than for every
+ * signature they are used to check.  The table is direct mapped on a
+ * hash of the public key rather than on the key tag, which anyone can
+ * make collide; an EVP_PKEY can be used by several threads at once.
+ */
+#define VAL_PKEY_CACHE_SIZE 128
+
+struct val_pkey_slot {
+    u_char          ps_alg;
+    u_char         *ps_key;
+    size_t          ps_key_len;
+    EVP_PKEY       *ps_pkey;
+};
+
+static struct val_pkey_slot pkey_cache[VAL_PKEY_CACHE_SIZE];
+
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t pkey_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PKEY_CACHE_LOCK()    pthread_mutex_lock(&pkey_cache_lock)
+#define PKEY_CACHE_UNLOCK()  pthread_mutex_unlock(&pkey_cache_lock)
+#else
+#define PKEY_CACHE_LOCK()
+#define PKEY_CACHE_UNLOCK()
+#endif
 
-    cp = buf;
+static struct val_pkey_slot *
+pkey_slot(u_char alg, const u_char *key, size_t key_len)
+{
+    u_int32_t       h = 2166136261U ^ alg;
+    size_t          i;
 
-    if (buf[index] == 0) {
-        if (buflen < 3)
-            return VAL_BAD_ARGUMENT;
-        index += 1;
-        cp = (buf + index);
-        VAL_GET16(exp_len, cp);
-        index += 2;
-    } else {
-        exp_len += buf[index];
-        index += 1;
-    }
+    for (i = 0; i < key_len; i++)
+        h = (h ^ key[i]) * 16777619U;
+    return &pkey_cache[h % VAL_PKEY_CACHE_SIZE];
+}
 
-    if (index + exp_len > buflen) {
-        return VAL_BAD_ARGUMENT;
+/*
+ * Return the EVP_PKEY for a DNSKEY, which the caller must release with
+ * EVP_PKEY_free(), or NULL if the key cannot be parsed.
+ */
+static EVP_PKEY *
+get_dnskey_pkey(const struct val_sigalg *sa, const val_dnskey_rdata_t *dnskey)
+{
+    struct val_pkey_slot *ps = pkey_slot(sa->sa_alg, dnskey->public_key,
+                                         dnskey->public_key_len);
+    EVP_PKEY       *pkey = NULL;
+    u_char         *key;
+
+    PKEY_CACHE_LOCK();
+    if (ps->ps_pkey != NULL && ps->ps_alg == sa->sa_alg &&
+        ps->ps_key_len == dnskey->public_key_len &&
+        !memcmp(ps->ps_key, dnskey->public_key, ps->ps_key_len) &&
+        EVP_PKEY_up_ref(ps->ps_pkey) == 1)
+        pkey = ps->ps_pkey;
+    PKEY_CACHE_UNLOCK();
+    if (pkey != NULL) {
+        VAL_STATS_INC(vs_key_cache_hits);
+        return pkey;
     }
-    
-    /*
-     * Extract the exponent 
-     */
-    bn_exp = BN_bin2bn(buf + index, exp_len, NULL);
-    index += exp_len;
 
-    if (buflen <= index) {
-        return VAL_BAD_ARGUMENT;
+    pkey = sa->sa_parse_key(sa, dnskey->public_key, dnskey->public_key_len);
+    if (pkey == NULL || dnskey->public_key_len == 0)
+        return pkey;
+    if ((key = (u_char *) MALLOC(dnskey->public_key_len)) == NULL)
+        return pkey;
+    memcpy(key, dnskey->public_key, dnskey->public_key_len);
+    if (EVP_PKEY_up_ref(pkey) != 1) {
+        FREE(key);
+        return pkey;
     }
 
-    /*
-     * Extract the modulus 
-     */
-    bn_mod = BN_bin2bn(buf + index, buflen - index, NULL);
-
-    RSA_set0_key(rsa, bn_mod, bn_exp, NULL);
+    PKEY_CACHE_LOCK();
+    if (ps->ps_pkey != NULL) {
+        EVP_PKEY_free(ps->ps_pkey);
+        FREE(ps->ps_key);
+    }
+    ps->ps_alg = sa->sa_alg;
+    ps->ps_key = key;
+    ps->ps_key_len = dnskey->public_key_len;
+    ps->ps_pkey = pkey;
+    PKEY_CACHE_UNLOCK();
+    return pkey;
+}
 
-    return VAL_NO_ERROR;        /* success */
+/*
+ * Release the parsed DNSKEYs
+ */
+void
+val_crypto_free_keys(void)
+{
+    int             i;
+
+    PKEY_CACHE_LOCK();
+    for (i = 0; i < VAL_PKEY_CACHE_SIZE; i++) {
+        if (pkey_cache[i].ps_pkey != NULL) {
+            EVP_PKEY_free(pkey_cache[i].ps_pkey);
+            FREE(pkey_cache[i].ps_key);
+        }
+        memset(&pkey_cache[i], 0, sizeof(pkey_cache[i]));
+    }
+    PKEY_CACHE_UNLOCK();
 }
 
+/*
+ * Verify an RRSIG over the data in sf with the given DNSKEY, through
+ * the entry for the RRSIG's algorithm in val_sigalgs.
+ */
 void
-rsasha_sigverify(val_context_t * ctx,
-                  const u_char *data,
-                  size_t data_len,
-                  const val_dnskey_rdata_t * dnskey,
-                  const val_rrsig_rdata_t * rrsig,
-                  val_astatus_t * key_status, val_astatus_t * sig_status)
+val_crypto_sigverify(val_context_t * ctx,
+                     const struct val_sigfield *sf,
+                     const val_dnskey_rdata_t * dnskey,
+                     const val_rrsig_rdata_t * rrsig,
+                     val_astatus_t * key_status, val_astatus_t * sig_status)
 {
     char            buf[1028];
     size_t          buflen = 1024;
-    RSA            *rsa = NULL;
-    u_char   sha_hash[MAX_DIGEST_LENGTH];
-    size_t   hashlen = 0;
-    int nid = 0;
-
-    val_log(ctx, LOG_DEBUG,
-            "rsasha_sigverify(): parsing the public key...");
-    if ((rsa = RSA_new()) == NULL) {
+    const struct val_sigalg *sa;
+    EVP_PKEY       *pkey;
+    const u_char   *sig = rrsig->signature;
+    size_t          siglen = rrsig->signature_len;
+    u_char          sig_der[128];
+    int             ok = 0;
+
+    if ((sa = find_sigalg(rrsig->algorithm)) == NULL) {
         val_log(ctx, LOG_INFO,
-                "rsasha_sigverify(): could not allocate rsa structure.");
-        *key_status = VAL_AC_INVALID_KEY;
+                "val_crypto_sigverify(): Unsupported algorithm %d.",
+                rrsig->algorithm);
+        *sig_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
+        *key_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
         return;
-    };
+    }
 
-    if (rsa_parse_public_key
-        (dnskey->public_key, (size_t)dnskey->public_key_len,
-         rsa) != VAL_NO_ERROR) {
+    val_log(ctx, LOG_DEBUG,
+            "val_crypto_sigverify(): parsing the %s public key...",
+            sa->sa_name);
+    if ((pkey = get_dnskey_pkey(sa, dnskey)) == NULL) {
         val_log(ctx, LOG_INFO,
-                "rsasha_sigverify(): Error in parsing public key.");
-        RSA_free(rsa);
+                "val_crypto_sigverify(): Error in parsing %s public key.",
+                sa->sa_name);
+        ERR_clear_error();
         *key_status = VAL_AC_INVALID_KEY;
         return;
     }
 
-    memset(sha_hash, 0, sizeof(sha_hash));
-    if (rrsig->algorithm == ALG_RSASHA1
-#ifdef LIBVAL_NSEC3
-        || rrsig->algorithm == ALG_NSEC3_RSASHA1
-#endif
-       ) {
-        SHA1(data, data_len, sha_hash);
-        hashlen = SHA_DIGEST_LENGTH; 
-        nid = NID_sha1; 
-    } else if (rrsig->algorithm == ALG_RSASHA256) {
-        SHA256(data, data_len, sha_hash);
-        hashlen = SHA256_DIGEST_LENGTH; 
-        nid = NID_sha256; 
-    } else if (rrsig->algorithm == ALG_RSASHA512) {
-        SHA512(data, data_len, sha_hash);
-        hashlen = SHA512_DIGEST_LENGTH; 
-        nid = NID_sha512; 
-    } else {
-        val_log(ctx, LOG_INFO,
-                "rsasha_sigverify(): Unkown algorithm.");
-        RSA_free(rsa);
-        *key_status = VAL_AC_INVALID_KEY;
-        return;
-    } 
+    if (sa->sa_parse_sig != NULL) {
+        if (!sa->sa_parse_sig(sa, sig, siglen, sig_der, &siglen)) {
+            val_log(ctx, LOG_INFO,
+                    "val_crypto_sigverify(): Error parsing %s rrsig.",
+                    sa->sa_name);
+            EVP_PKEY_free(pkey);
+            *sig_status = VAL_AC_INVALID_RRSIG;
+            return;
+        }
+        sig = sig_der;
+    }
 
-    val_log(ctx, LOG_DEBUG, "rsasha_sigverify(): SHA hash = %s",
-            get_hex_string(sha_hash, hashlen, buf, buflen));
     val_log(ctx, LOG_DEBUG,
-            "rsasha_sigverify(): verifying RSA signature...");
+            "val_crypto_sigverify(): verifying %s signature...",
+            sa->sa_name);
+
+    if (sa->sa_md != NULL) {
+        const EVP_MD   *md = sa->sa_md();
+        u_char          hash[EVP_MAX_MD_SIZE];
+        size_t          hashlen = EVP_MD_size(md);
+        EVP_PKEY_CTX   *pctx;
+
+        memset(hash, 0, sizeof(hash));
+        if (!sigfield_digest(md, sf, hash)) {
+            val_log(ctx, LOG_INFO,
+                    "val_crypto_sigverify(): Error computing %s hash.",
+                    EVP_MD_name(md));
+            ERR_clear_error();
+            EVP_PKEY_free(pkey);
+            *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
+            return;
+        }
+        val_log(ctx, LOG_DEBUG, "val_crypto_sigverify(): %s hash = %s",
+                EVP_MD_name(md),
+                get_hex_string(hash, hashlen, buf, buflen));
+
+        if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) != NULL) {
+            ok = EVP_PKEY_verify_init(pctx) == 1 &&
+                EVP_PKEY_CTX_set_signature_md(pctx, md) == 1 &&
+                EVP_PKEY_verify(pctx, sig, siglen, hash, hashlen) == 1;
+            EVP_PKEY_CTX_free(pctx);
+        }
+    } else {
+        /*
+         * The algorithm hashes the data itself and takes it in one
+         * piece only, so put the prefix in the room left for it right
+         * before the RRs instead of copying the RRs behind the prefix
+         */
+        size_t          len = sf->sf_prefix_len + sf->sf_rrs_len;
+        u_char         *data;
+        EVP_MD_CTX     *mdctx;
+
+        if (sf->sf_room == NULL || sf->sf_prefix_len > CANON_ROOM) {
+            val_log(ctx, LOG_INFO,
+                    "val_crypto_sigverify(): No room for the %s signed data.",
+                    sa->sa_name);
+        } else if ((mdctx = EVP_MD_CTX_new()) != NULL) {
+            data = sf->sf_room + CANON_ROOM - sf->sf_prefix_len;
+            memcpy(data, sf->sf_prefix, sf->sf_prefix_len);
+            ok = EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) == 1 &&
+                EVP_DigestVerify(mdctx, sig, siglen, data, len) == 1;
+            EVP_MD_CTX_free(mdctx);
+        }
+    }
+    EVP_PKEY_free(pkey);
 
-    if (RSA_verify
-        (nid, sha_hash, hashlen,
-         rrsig->signature, rrsig->signature_len, rsa) == 1) {
-        val_log(ctx, LOG_INFO, "rsasha_sigverify(): returned SUCCESS");
-        RSA_free(rsa);
+    if (ok) {
+        val_log(ctx, LOG_INFO, "val_crypto_sigverify(): %s returned SUCCESS",
+                sa->sa_name);
         *sig_status = VAL_AC_RRSIG_VERIFIED;
     } else {
-        val_log(ctx, LOG_INFO, "rsasha_sigverify(): returned FAILURE");
-        RSA_free(rsa);
+        val_log(ctx, LOG_INFO, "val_crypto_sigverify(): %s returned FAILURE",
+                sa->sa_name);
+        ERR_clear_error();
         *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
     }
-    return;
 }
 
-#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
-void
-ecdsa_sigverify(val_context_t * ctx,
-                const u_char *data,
-                size_t data_len,
-                const val_dnskey_rdata_t * dnskey,
-                const val_rrsig_rdata_t * rrsig,
-                val_astatus_t * key_status, val_astatus_t * sig_status)
+/*
+ * See RFC 4034, Appendix B.1 :
+ *
+ * " For a DNSKEY RR with algorithm 1, the key tag is defined to be the most
+ *   significant 16 bits of the least significant 24 bits in the public
+ *   key modulus (in other words, the 4th to last and 3rd to last octets
+ *   of the public key modulus)."
+ */
+u_int16_t
+rsamd5_keytag(const u_char *pubkey, size_t pubkey_len)
 {
-    char            buf[1028];
-    size_t          buflen = 1024;
-    u_char   sha_hash[MAX_DIGEST_LENGTH];
-    EC_KEY   *eckey = NULL;
-    BIGNUM *bn_x = NULL;
-    BIGNUM *bn_y = NULL;
-    ECDSA_SIG *ecdsa_sig;
-    size_t   hashlen = 0;
-
-    ecdsa_sig = ECDSA_SIG_new();
-    memset(sha_hash, 0, sizeof(sha_hash));
-
-    val_log(ctx, LOG_DEBUG,
-            "ecdsa_sigverify(): parsing the public key...");
-
-    if (rrsig->algorithm == ALG_ECDSAP256SHA256) {
-        hashlen = SHA256_DIGEST_LENGTH; 
-        SHA256(data, data_len, sha_hash);
-        eckey = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1); /* P-256 */
-    } else if (rrsig->algorithm == ALG_ECDSAP384SHA384) {
-        hashlen = SHA384_DIGEST_LENGTH; 
-        SHA384(data, data_len, sha_hash);
-        eckey = EC_KEY_new_by_curve_name(NID_secp384r1); /* P-384 */
-    } 
-
-    if (eckey == NULL) {
-        val_log(ctx, LOG_INFO,
-                "ecdsa_sigverify(): could not create key for ECDSA group.");
-        *key_status = VAL_AC_INVALID_KEY;
-        goto err;
-    };
+    size_t          index;
+    size_t          exp_len;
 
-    /* 
-     * contruct an EC_POINT from the "Q" field in the 
-     * dnskey->public_key, dnskey->public_key_len
-     */
-    if (dnskey->public_key_len != 2*hashlen) {
-        val_log(ctx, LOG_INFO,
-                "ecdsa_sigverify(): dnskey length does not match expected size.");
-        *key_status = VAL_AC_INVALID_KEY;
-        goto err;
-    }
-    bn_x = BN_bin2bn(dnskey->public_key, hashlen, NULL);
-    bn_y = BN_bin2bn(&dnskey->public_key[hashlen], hashlen, NULL);
-    if (1 != EC_KEY_set_public_key_affine_coordinates(eckey, bn_x, bn_y)) {
-        val_log(ctx, LOG_INFO,
-                "ecdsa_sigverify(): Error associating ECSA structure with key.");
-        *key_status = VAL_AC_INVALID_KEY;
-        goto err;
-    }
-
-
-    val_log(ctx, LOG_DEBUG, "ecdsa_sigverify(): SHA hash = %s",
-            get_hex_string(sha_hash, hashlen, buf, buflen));
-    val_log(ctx, LOG_DEBUG,
-            "ecdsa_sigverify(): verifying ECDSA signature...");
-
-    /* 
-     * contruct ECDSA signature from the "r" and "s" fileds in 
-     * rrsig->signature, rrsig->signature_len
-     */
-    if (rrsig->signature_len != 2*hashlen) {
-        val_log(ctx, LOG_INFO,
-                "ecdsa_sigverify(): Signature length does not match expected size.");
-        *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
-        goto err;
-    }
-
-    ECDSA_SIG_set0(ecdsa_sig, BN_bin2bn(rrsig->signature, hashlen, NULL),
-                   BN_bin2bn(&rrsig->signature[hashlen], hashlen, NULL));
-
-    if (ECDSA_do_verify(sha_hash, hashlen, ecdsa_sig, eckey) == 1) {
-        val_log(ctx, LOG_INFO, "ecdsa_sigverify(): returned SUCCESS");
-        *sig_status = VAL_AC_RRSIG_VERIFIED;
+    if (pubkey == NULL || pubkey_len == 0)
+        return VAL_BAD_ARGUMENT;
+    if (pubkey[0] == 0) {
+        if (pubkey_len < 3)
+            return VAL_BAD_ARGUMENT;
+        exp_len = (pubkey[1] << 8) | pubkey[2];
+        index = 3;
     } else {
-        val_log(ctx, LOG_INFO, "ecdsa_sigverify(): returned FAILURE");
-        *sig_status = VAL_AC_RRSIG_VERIFY_FAILED;
+        exp_len = pubkey[0];
+        index = 1;
     }
+    /* the modulus follows the exponent and takes up the rest */
+    if (index + exp_len + 3 > pubkey_len)
+        return VAL_BAD_ARGUMENT;
 
-    /* Free all structures allocated */
-err:
-    if (ecdsa_sig)
-        ECDSA_SIG_free(ecdsa_sig);
-    if (bn_x)
-        BN_free(bn_x);
-    if (bn_y)
-        BN_free(bn_y);
-    if (eckey)
-        EC_KEY_free(eckey);
-
-    return;
-
+    return (pubkey[pubkey_len - 3] << 8) | pubkey[pubkey_len - 2];
 }
-#endif
 
 int
 ds_sha_hash_is_equal(u_char * name_n,
@@ -9,42 +9,45 @@
 #ifndef VAL_CRYPTO_H
 #define VAL_CRYPTO_H
 
+/*
+ * Digest contexts shared by the signature checks of one assertion
+ */
+struct val_digest_cache;
 
-void            dsasha1_sigverify(val_context_t * ctx,
-                                  const u_char *data,
-                                  size_t data_len,
-                                  const val_dnskey_rdata_t * dnskey,
-                                  const val_rrsig_rdata_t * rrsig,
-                                  val_astatus_t * key_status,
-                                  val_astatus_t * sig_status);
-
-void            rsamd5_sigverify(val_context_t * ctx,
-                                 const u_char *data,
-                                 size_t data_len,
-                                 const val_dnskey_rdata_t * dnskey,
-                                 const val_rrsig_rdata_t * rrsig,
-                                 val_astatus_t * key_status,
-                                 val_astatus_t * sig_status);
+void            val_digest_cache_free(struct val_digest_cache *dc);
 
-u_int16_t       rsamd5_keytag(const u_char *pubkey, size_t pubkey_len);
+/*
+ * The data covered by an RRSIG: the RRSIG RDATA up to the signature,
+ * followed by the RRset in canonical form.  The two parts are kept
+ * apart so that the RRset part can be shared by all RRSIGs over a set.
+ * Hashes are remembered in sf_set->rrs_digests; sf_dcache, if given,
+ * holds the digest contexts, created as they are needed.  sf_room, if
+ * set, is the start of CANON_ROOM writable bytes that end where sf_rrs
+ * begins, where the prefix can be put to get the data in one piece.
+ */
+struct val_sigfield {
+    const u_char   *sf_prefix;
+    size_t          sf_prefix_len;
+    u_char         *sf_room;
+    const u_char   *sf_rrs;
+    size_t          sf_rrs_len;
+    struct rrset_rec *sf_set;
+    struct val_digest_cache **sf_dcache;
+};
 
-void            rsasha_sigverify(val_context_t * ctx,
-                                  const u_char *data,
-                                  size_t data_len,
-                                  const val_dnskey_rdata_t * dnskey,
-                                  const val_rrsig_rdata_t * rrsig,
-                                  val_astatus_t * key_status,
-                                  val_astatus_t * sig_status);
 
-#ifdef HAVE_SHA_2
-void            ecdsa_sigverify(val_context_t * ctx,
-                                const u_char *data,
-                                size_t data_len,
-                                const val_dnskey_rdata_t * dnskey,
-                                const val_rrsig_rdata_t * rrsig,
-                                val_astatus_t * key_status,
-                                val_astatus_t * sig_status);
-#endif
+void            val_crypto_sigverify(val_context_t * ctx,
+                                     const struct val_sigfield *sf,
+                                     const val_dnskey_rdata_t * dnskey,
+                                     const val_rrsig_rdata_t * rrsig,
+                                     val_astatus_t * key_status,
+                                     val_astatus_t * sig_status);
+
+int             val_sigalg_supported(u_char alg);
+
+void            val_crypto_free_keys(void);
+
+u_int16_t       rsamd5_keytag(const u_char *pubkey, size_t pubkey_len);
 
 int             ds_sha_hash_is_equal(u_char * name_n,
                                      u_char * rrdata,
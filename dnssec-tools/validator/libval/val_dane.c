@@ -13,6 +13,7 @@
 
 #include "validator-internal.h"
 #include "val_context.h"
+#include "val_stats.h"
 #include "validator/val_dane.h"
 
 /*
@@ -641,24 +642,123 @@ val_dane_cert_namechk(val_context_t *context,
 }
 
 /*
- * Matches a DANE record against the correct part of a key, either in
- * raw or a calculated hash of the part.
+ * A certificate being checked against a TLSA RRset, with the parts
+ * and digests that the TLSA records may ask for.  Each is computed the
+ * first time a record needs it, so a certificate's key is extracted
+ * and hashed at most once per handshake however many records there
+ * are.
  */
-static int 
-val_dane_match_internal(val_context_t *context,
-                           struct val_danestatus *dane_cur, 
-                           const unsigned char *data,
-                           int len,
-                           X509 *cert)
+struct dane_cert {
+    X509           *cert;
+    const u_char   *der;
+    int             der_len;
+    u_char         *der_buf;    /* der, if we had to encode it */
+    u_char         *spki;
+    int             spki_len;
+    int             spki_tried;
+    u_char          sha256[2][SHA256_DIGEST_LENGTH];
+    u_char          sha512[2][SHA512_DIGEST_LENGTH];
+    int             have_digest; /* bit per selector and matching type */
+    u_int32_t       match_mask;  /* TLSA records that match, by index */
+    int             have_mask;
+};
+
+#define DANE_MASK_MAX 32
+
+static int
+dane_cert_init(struct dane_cert *dc, X509 *cert,
+               const u_char *der, int der_len)
 {
-    val_context_t *ctx;
+    u_char *c;
 
-    if (cert == NULL || data == NULL || len <= 0 || dane_cur == NULL)
-        return VAL_DANE_CHECK_FAILED;
+    memset(dc, 0, sizeof(*dc));
+    dc->cert = cert;
+    if (der != NULL) {
+        dc->der = der;
+        dc->der_len = der_len;
+        return 0;
+    }
+    if ((der_len = i2d_X509(cert, NULL)) <= 0 ||
+        (dc->der_buf = OPENSSL_malloc(der_len)) == NULL)
+        return -1;
+    c = dc->der_buf;
+    if ((der_len = i2d_X509(cert, &c)) <= 0)
+        return -1;
+    dc->der = dc->der_buf;
+    dc->der_len = der_len;
+    return 0;
+}
 
-    ctx = val_create_or_refresh_context(context);/* does CTX_LOCK_POL_SH */
-    if (ctx == NULL)
-        return VAL_DANE_INTERNAL_ERROR;
+static void
+dane_cert_free(struct dane_cert *dc)
+{
+    if (dc->der_buf)
+        OPENSSL_free(dc->der_buf);
+    if (dc->spki)
+        FREE(dc->spki);
+    memset(dc, 0, sizeof(*dc));
+}
+
+/*
+ * The part of the certificate a TLSA selector refers to
+ */
+static int
+dane_cert_part(struct dane_cert *dc, int selector,
+               const u_char **buf, int *len)
+{
+    if (selector == DANE_SEL_FULLCERT) {
+        *buf = dc->der;
+        *len = dc->der_len;
+        return dc->der ? 0 : -1;
+    }
+    if (!dc->spki_tried) {
+        dc->spki_tried = 1;
+        if (0 != get_pkeybuf(dc->cert, &dc->spki_len, &dc->spki)) {
+            if (dc->spki)
+                FREE(dc->spki);
+            dc->spki = NULL;
+        }
+    }
+    *buf = dc->spki;
+    *len = dc->spki_len;
+    return dc->spki ? 0 : -1;
+}
+
+/*
+ * The SHA-256 or SHA-512 digest of the part of the certificate a TLSA
+ * selector refers to
+ */
+static const u_char *
+dane_cert_digest(struct dane_cert *dc, int selector, int type)
+{
+    int bit = 1 << (selector * 2 + (type == DANE_MATCH_SHA512));
+    const u_char *buf;
+    int len;
+
+    if (!(dc->have_digest & bit)) {
+        if (0 != dane_cert_part(dc, selector, &buf, &len))
+            return NULL;
+        if (type == DANE_MATCH_SHA256)
+            SHA256(buf, len, dc->sha256[selector]);
+        else
+            SHA512(buf, len, dc->sha512[selector]);
+        dc->have_digest |= bit;
+    }
+    return type == DANE_MATCH_SHA256 ?
+        dc->sha256[selector] : dc->sha512[selector];
+}
+
+/*
+ * Matches a DANE record against the correct part of a certificate,
+ * either in raw or a calculated hash of the part.
+ */
+static int
+dane_match_cert(val_context_t *ctx,
+                struct val_danestatus *dane_cur,
+                struct dane_cert *dc)
+{
+    const u_char *buf;
+    int len;
 
     val_log(ctx, LOG_DEBUG,
             "val_dane_match(): checking for DANE cert match - sel:%d type:%d", 
@@ -669,159 +769,60 @@ val_dane_match_internal(val_context_t *context,
         val_log(ctx, LOG_NOTICE,
             "val_dane_match(): Unknown DANE selector:%d",
             dane_cur->selector);
-        CTX_UNLOCK_POL(ctx);
         return VAL_DANE_CHECK_FAILED;
     }
 
     if (dane_cur->type == DANE_MATCH_EXACT) {
-#if 0
-    {
-        char buf1[1028];
-        char buf2[1028];
-        size_t buflen1 = 1024;
-        size_t buflen2 = 1024;
-        fprintf(stderr,
-            "val_dane_match(): checking for exact DANE cert match %s \n\n %s", 
-            get_hex_string(data, len, buf1, buflen1),
-            get_hex_string(dane_cur->data, dane_cur->datalen, buf2, buflen2));
-    }
-#endif
 
-        if (dane_cur->selector == DANE_SEL_FULLCERT) {
-            if (len == dane_cur->datalen &&
-                    !memcmp(data, dane_cur->data, len)) {
-
-                val_log(ctx, LOG_INFO, "val_dane_match(): DANE_SEL_FULLCERT/DANE_MATCH_EXACT success");
-                CTX_UNLOCK_POL(ctx);
-                return VAL_DANE_NOERROR;
-            }
-
-            val_log(ctx, LOG_NOTICE, "val_dane_match(): DANE_SEL_FULLCERT/DANE_MATCH_EXACT failed");
-            CTX_UNLOCK_POL(ctx);
-            return VAL_DANE_CHECK_FAILED;
-
-        } else {
-            int pkeyLen = 0;
-            unsigned char *pkeybuf = NULL;
-
-            if (0 != get_pkeybuf(cert, &pkeyLen, &pkeybuf)) {
-                CTX_UNLOCK_POL(ctx);
-                return VAL_DANE_CHECK_FAILED;
-            }
-
-            if (pkeyLen == dane_cur->datalen &&
-                0 == memcmp(pkeybuf, dane_cur->data, pkeyLen)) {
-
-                val_log(ctx, LOG_INFO, "val_dane_match(): DANE_SEL_PUBKEY/DANE_MATCH_EXACT success");
-                FREE(pkeybuf);
-                CTX_UNLOCK_POL(ctx);
-                return VAL_DANE_NOERROR;
-            }
-            val_log(ctx, LOG_NOTICE, "val_dane_match(): DANE_SEL_PUBKEY/DANE_MATCH_EXACT failed");
-            FREE(pkeybuf);
-            CTX_UNLOCK_POL(ctx);
+        if (0 != dane_cert_part(dc, dane_cur->selector, &buf, &len))
             return VAL_DANE_CHECK_FAILED;
 
+        if (len == dane_cur->datalen &&
+            0 == memcmp(buf, dane_cur->data, len)) {
+            val_log(ctx, LOG_INFO, "val_dane_match(): %s/DANE_MATCH_EXACT success",
+                    dane_cur->selector == DANE_SEL_FULLCERT ?
+                    "DANE_SEL_FULLCERT" : "DANE_SEL_PUBKEY");
+            return VAL_DANE_NOERROR;
         }
+        val_log(ctx, LOG_NOTICE, "val_dane_match(): %s/DANE_MATCH_EXACT failed",
+                dane_cur->selector == DANE_SEL_FULLCERT ?
+                "DANE_SEL_FULLCERT" : "DANE_SEL_PUBKEY");
+        return VAL_DANE_CHECK_FAILED;
 
     } else if (dane_cur->type == DANE_MATCH_SHA256) {
 
-        unsigned char cert_sha[SHA256_DIGEST_LENGTH];
-        memset(cert_sha, 0, SHA256_DIGEST_LENGTH);
-
-        if (dane_cur->selector == DANE_SEL_FULLCERT) {
-            SHA256(data, len, cert_sha);
-        } else {
-            int pkeyLen = 0;
-            unsigned char *pkeybuf = NULL;
-            if (0 != get_pkeybuf(cert, &pkeyLen, &pkeybuf)) {
-                CTX_UNLOCK_POL(ctx);
-                return VAL_DANE_CHECK_FAILED;
-            }
-#if 0
-            {
-                char buf1[1028];
-                size_t buflen1 = 1024;
-                fprintf(stderr, "pkeylen = %d, pkeybuf = %s\n",
-                        pkeyLen, 
-                        get_hex_string(pkeybuf, pkeyLen, buf1, buflen1));
-            }
-#endif
-            SHA256(pkeybuf, pkeyLen, cert_sha);
-            FREE(pkeybuf);
-        }
-
-#if 0
-        {
-        char buf1[1028];
-        char buf2[1028];
-        size_t buflen1 = 1024;
-        size_t buflen2 = 1024;
-        fprintf(stderr,
-            "val_dane_match(): checking for DANE SHA256 match %s with %s", 
-            get_hex_string(cert_sha, SHA256_DIGEST_LENGTH, buf1, buflen1),
-            get_hex_string(dane_cur->data, dane_cur->datalen, buf2, buflen2));
-        }
-#endif
+        if (NULL == (buf = dane_cert_digest(dc, dane_cur->selector,
+                                            DANE_MATCH_SHA256)))
+            return VAL_DANE_CHECK_FAILED;
 
         if (dane_cur->datalen == SHA256_DIGEST_LENGTH && 
-            0 == memcmp(cert_sha, dane_cur->data, SHA256_DIGEST_LENGTH)) {
+            0 == memcmp(buf, dane_cur->data, SHA256_DIGEST_LENGTH)) {
             val_log(ctx, LOG_INFO, "val_dane_match(): DANE_MATCH_SHA256 success");
-            CTX_UNLOCK_POL(ctx);
             return VAL_DANE_NOERROR;
         }
         val_log(ctx, LOG_NOTICE, 
                 "val_dane_match(): DANE SHA256 does NOT match (len = %d)", 
                 dane_cur->datalen);
-        CTX_UNLOCK_POL(ctx);
         return VAL_DANE_CHECK_FAILED;
 
     } else if (dane_cur->type == DANE_MATCH_SHA512) {
 
-        unsigned char cert_sha[SHA512_DIGEST_LENGTH];
-        memset(cert_sha, 0, SHA512_DIGEST_LENGTH);
-
-        if (dane_cur->selector  == DANE_SEL_FULLCERT) {
-            SHA512(data, len, cert_sha);
-        } else {
-            int pkeyLen = 0;
-            unsigned char *pkeybuf = NULL;
-            if (0 != get_pkeybuf(cert, &pkeyLen, &pkeybuf)) {
-                CTX_UNLOCK_POL(ctx);
-                return VAL_DANE_CHECK_FAILED;
-            }
-            SHA512(pkeybuf, pkeyLen, cert_sha);
-            FREE(pkeybuf);
-        }
-
-#if 0
-        {
-        char buf1[1028];
-        char buf2[1028];
-        size_t buflen1 = 1024;
-        size_t buflen2 = 1024;
-        fprintf(stderr,
-            "val_dane_match(): checking for DANE SHA512 match %s with %s", 
-            get_hex_string(cert_sha, SHA512_DIGEST_LENGTH, buf1, buflen1),
-            get_hex_string(dane_cur->data, dane_cur->datalen, buf2, buflen2));
-        }
-#endif
+        if (NULL == (buf = dane_cert_digest(dc, dane_cur->selector,
+                                            DANE_MATCH_SHA512)))
+            return VAL_DANE_CHECK_FAILED;
 
         if (dane_cur->datalen == SHA512_DIGEST_LENGTH &&
-            0 == memcmp(cert_sha, dane_cur->data, SHA512_DIGEST_LENGTH)) {
+            0 == memcmp(buf, dane_cur->data, SHA512_DIGEST_LENGTH)) {
             val_log(ctx, LOG_INFO, "val_dane_match(): DANE_MATCH_SHA512 success");
-            CTX_UNLOCK_POL(ctx);
             return VAL_DANE_NOERROR;
         }
         val_log(ctx, LOG_NOTICE, "val_dane_match(): DANE_MATCH_SHA512 failed");
-        CTX_UNLOCK_POL(ctx);
         return VAL_DANE_CHECK_FAILED;
 
     } 
 
     val_log(ctx, LOG_NOTICE,
             "val_dane_match(): Error - Unknown DANE type:%d", dane_cur->type);
-    CTX_UNLOCK_POL(ctx);
     return VAL_DANE_CHECK_FAILED;
 }
 
@@ -833,26 +834,189 @@ int val_dane_match(val_context_t *context,
                    const unsigned char *data, 
                    int len) 
 {
+    val_context_t *ctx;
+    struct dane_cert dc;
     X509 *cert;
     const unsigned char *tmp = data;
     int ret;
 
-    if (data == NULL)
-        return 0;
+    if (data == NULL || len <= 0 || dane_cur == NULL)
+        return VAL_DANE_CHECK_FAILED;
 
     cert = d2i_X509(NULL, &tmp, len);
     if (cert == NULL)
-        return 0;
+        return VAL_DANE_CHECK_FAILED;
 
-    ret = val_dane_match_internal(context, dane_cur, 
-                                  data, len, cert);
+    ctx = val_create_or_refresh_context(context);/* does CTX_LOCK_POL_SH */
+    if (ctx == NULL) {
+        X509_free(cert);
+        return VAL_DANE_INTERNAL_ERROR;
+    }
 
+    dane_cert_init(&dc, cert, data, len);
+    ret = dane_match_cert(ctx, dane_cur, &dc);
+    dane_cert_free(&dc);
 
+    CTX_UNLOCK_POL(ctx);
     X509_free(cert);
 
     return ret;
 }
 
+/*
+ * Which TLSA records match a certificate, shared by all handshakes in
+ * the process.  An entry is keyed on the digest of the TLSA RRset and
+ * the SHA-256 digest of the certificate, holds a bit for each record
+ * that matched, and is good until the TTL of the TLSA RRset runs out.
+ * The table is direct mapped and simply overwritten on collision.
+ */
+#define VAL_DANE_CACHE_SIZE 256
+
+struct dane_match_slot {
+    u_char          dm_tlsa[SHA256_DIGEST_LENGTH];
+    u_char          dm_cert[SHA256_DIGEST_LENGTH];
+    u_int32_t       dm_mask;
+    long            dm_expiry;
+};
+
+static struct dane_match_slot dane_cache[VAL_DANE_CACHE_SIZE];
+
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t dane_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define DANE_CACHE_LOCK()    pthread_mutex_lock(&dane_cache_lock)
+#define DANE_CACHE_UNLOCK()  pthread_mutex_unlock(&dane_cache_lock)
+#else
+#define DANE_CACHE_LOCK()
+#define DANE_CACHE_UNLOCK()
+#endif
+
+/*
+ * Identify a TLSA RRset by a digest of its records, and work out how
+ * long matches against it may be remembered
+ */
+static void
+dane_tlsa_id(struct val_danestatus *danestatus,
+             unsigned char *id, long *expiry)
+{
+    EVP_MD_CTX *mdctx;
+    struct val_danestatus *dane_cur;
+    struct timeval now;
+    u_char hdr[7];
+    long ttl = -1;
+    int count = 0;
+    unsigned int len = SHA256_DIGEST_LENGTH;
+
+    *expiry = 0;
+    memset(id, 0, SHA256_DIGEST_LENGTH);
+    if ((mdctx = EVP_MD_CTX_new()) == NULL)
+        return;
+    if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1)
+        goto done;
+    for (dane_cur = danestatus; dane_cur; dane_cur = dane_cur->next) {
+        hdr[0] = (u_char) dane_cur->usage;
+        hdr[1] = (u_char) dane_cur->selector;
+        hdr[2] = (u_char) dane_cur->type;
+        hdr[3] = (u_char) (dane_cur->datalen >> 24);
+        hdr[4] = (u_char) (dane_cur->datalen >> 16);
+        hdr[5] = (u_char) (dane_cur->datalen >> 8);
+        hdr[6] = (u_char) dane_cur->datalen;
+        EVP_DigestUpdate(mdctx, hdr, sizeof(hdr));
+        EVP_DigestUpdate(mdctx, dane_cur->data, dane_cur->datalen);
+        if (ttl < 0 || dane_cur->ttl < ttl)
+            ttl = dane_cur->ttl;
+        count++;
+    }
+    if (EVP_DigestFinal_ex(mdctx, id, &len) != 1)
+        goto done;
+
+    if (count <= DANE_MASK_MAX && ttl > 0) {
+        gettimeofday(&now, NULL);
+        *expiry = now.tv_sec + ttl;
+    }
+
+  done:
+    EVP_MD_CTX_free(mdctx);
+}
+
+/*
+ * Work out which of the TLSA records match the certificate, from the
+ * cache if we can.  Returns 0 if the records have to be checked one at
+ * a time instead.
+ */
+static int
+dane_cert_mask(val_context_t *context,
+               struct val_ssl_data *ssl_dane_data,
+               struct dane_cert *dc)
+{
+    struct dane_match_slot *ds;
+    struct val_danestatus *dane_cur;
+    const u_char *cert_id;
+    struct timeval now;
+    u_int32_t mask;
+    int i;
+
+    if (dc->have_mask)
+        return 1;
+    if (ssl_dane_data->tlsa_expiry == 0)
+        return 0;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec >= ssl_dane_data->tlsa_expiry)
+        return 0;
+    if ((cert_id = dane_cert_digest(dc, DANE_SEL_FULLCERT,
+                                    DANE_MATCH_SHA256)) == NULL)
+        return 0;
+
+    ds = &dane_cache[((cert_id[0] | (cert_id[1] << 8)) ^
+                      (ssl_dane_data->tlsa_id[0] |
+                       (ssl_dane_data->tlsa_id[1] << 8))) %
+                     VAL_DANE_CACHE_SIZE];
+    DANE_CACHE_LOCK();
+    if (ds->dm_expiry > now.tv_sec &&
+        !memcmp(ds->dm_cert, cert_id, SHA256_DIGEST_LENGTH) &&
+        !memcmp(ds->dm_tlsa, ssl_dane_data->tlsa_id,
+                SHA256_DIGEST_LENGTH)) {
+        dc->match_mask = ds->dm_mask;
+        dc->have_mask = 1;
+    }
+    DANE_CACHE_UNLOCK();
+    if (dc->have_mask) {
+        VAL_STATS_INC(vs_dane_cache_hits);
+        return 1;
+    }
+
+    mask = 0;
+    for (i = 0, dane_cur = ssl_dane_data->danestatus; dane_cur;
+         i++, dane_cur = dane_cur->next) {
+        if (dane_match_cert(context, dane_cur, dc) == VAL_DANE_NOERROR)
+            mask |= (u_int32_t) 1 << i;
+    }
+    dc->match_mask = mask;
+    dc->have_mask = 1;
+
+    DANE_CACHE_LOCK();
+    memcpy(ds->dm_tlsa, ssl_dane_data->tlsa_id, SHA256_DIGEST_LENGTH);
+    memcpy(ds->dm_cert, cert_id, SHA256_DIGEST_LENGTH);
+    ds->dm_mask = mask;
+    ds->dm_expiry = ssl_dane_data->tlsa_expiry;
+    DANE_CACHE_UNLOCK();
+    return 1;
+}
+
+/*
+ * Does TLSA record number idx match the certificate?
+ */
+static int
+dane_cert_matches(val_context_t *context,
+                  struct val_ssl_data *ssl_dane_data,
+                  struct dane_cert *dc,
+                  struct val_danestatus *dane_cur, int idx)
+{
+    if (idx < DANE_MASK_MAX &&
+        dane_cert_mask(context, ssl_dane_data, dc))
+        return (dc->match_mask >> idx) & 1;
+    return dane_match_cert(context, dane_cur, dc) == VAL_DANE_NOERROR;
+}
+
 static int 
 val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
 {
@@ -867,16 +1031,26 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
     STACK_OF(X509) *certList = NULL;
     int pkix_succeeded = 0;
     int rv = VAL_DANE_CHECK_FAILED;
-    int cert_datalen = 0;
-    unsigned char *cert_data = NULL;
-    unsigned char *c = NULL;
+    struct dane_cert ee;
+    struct dane_cert *chain = NULL;
+    int idx;
 
     ssl_dane_data = (struct val_ssl_data *) arg;
     if (x509ctx == NULL || ssl_dane_data == NULL)
         return 0;
 
     
+    /*
+     * The peer certificate; the current cert is only set once
+     * verification has started
+     */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    cert = X509_STORE_CTX_get0_cert(x509ctx);
+#else
     cert = X509_STORE_CTX_get_current_cert(x509ctx);
+#endif
+    if (cert == NULL)
+        return 0;
     context = ssl_dane_data->context;
 
     /* 
@@ -975,15 +1149,12 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
 
 
     dane_cur = ssl_dane_data->danestatus;
+    idx = 0;
 
-    if (((cert_datalen = i2d_X509(cert, NULL)) <= 0) ||
-         ((cert_data = OPENSSL_malloc(cert_datalen)) == NULL) ||
-         (((c = cert_data)) && (cert_datalen = i2d_X509(cert, &c)) <= 0)) {
-
-        if (cert_data)
-            OPENSSL_free(cert_data);
+    if (0 != dane_cert_init(&ee, cert, NULL, 0)) {
+        dane_cert_free(&ee);
         return 0;
-    } 
+    }
 
     /*
      * Keep looking for a good TLSA match
@@ -1005,8 +1176,8 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                 }
                 /* fall through */
             case DANE_USE_DOMAIN_ISSUED: /*3*/
-                if (val_dane_match_internal(context,
-                        dane_cur, cert_data, cert_datalen, cert) == 0) {
+                if (dane_cert_matches(context, ssl_dane_data, &ee,
+                                      dane_cur, idx)) {
                     val_log(context, LOG_INFO, 
                             "DANE: passed EE certificate checks = %s", buf);
                     rv = VAL_DANE_NOERROR;
@@ -1027,10 +1198,23 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                  * Check that the TLSA cert matches one of the certs
                  * in the chain
                  */
+                if (chain == NULL && depth >= 0) {
+                    chain = (struct dane_cert *)
+                        MALLOC((depth + 1) * sizeof(struct dane_cert));
+                    if (chain == NULL)
+                        goto done;
+                    for (i = 0; i <= depth; i++)
+                        memset(&chain[i], 0, sizeof(struct dane_cert));
+                }
                 for (i = 0; i <= depth; i++) {
-                    cert = sk_X509_value(certList, i);
-                    if (val_dane_match_internal(context,
-                            dane_cur, cert_data, cert_datalen, cert) == 0) {
+                    if (chain[i].cert == NULL &&
+                        (sk_X509_value(certList, i) == NULL ||
+                         0 != dane_cert_init(&chain[i],
+                                             sk_X509_value(certList, i),
+                                             NULL, 0)))
+                        continue;
+                    if (dane_cert_matches(context, ssl_dane_data,
+                                          &chain[i], dane_cur, idx)) {
                         /* reset err status */
                         val_log(context, 
                                 LOG_INFO, "DANE: skipping TA PKIX validation = %s", buf);
@@ -1048,12 +1232,17 @@ val_X509_peer_cert_verify_cb(X509_STORE_CTX *x509ctx, void *arg)
                 "DANE: check for usage %d failed", dane_cur->usage);
 
         dane_cur = dane_cur->next;
+        idx++;
     }
 
 done:
 
-    if (cert_data)
-        OPENSSL_free(cert_data);
+    dane_cert_free(&ee);
+    if (chain) {
+        for (i = 0; i <= depth; i++)
+            dane_cert_free(&chain[i]);
+        FREE(chain);
+    }
 
     if (rv == VAL_DANE_NOERROR) {
         val_log(context, LOG_NOTICE, "DANE check successful");
@@ -1109,6 +1298,8 @@ val_enable_dane_ssl(val_context_t *ctx,
 
     (*ssl_dane_data)->danestatus = danestatus_p;
     (*ssl_dane_data)->context = context;
+    dane_tlsa_id(danestatus_p, (*ssl_dane_data)->tlsa_id,
+                 &(*ssl_dane_data)->tlsa_expiry);
 
     /*
      * Callback from EE cert validation
@@ -0,0 +1,487 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Process-wide table of upstream queries in flight.
+ *
+ * The query list of a context only merges identical queries made through
+ * that context.  Queries sent by val_resquery_send() are also entered in
+ * a table shared by all contexts, keyed on the question, the query flags
+ * and the list of name servers it goes to (addresses and options).  A
+ * query that matches one already in flight does not send anything: it
+ * joins the existing entry and shares its libsres transaction.
+ *
+ * Every member of an entry drives the shared transaction, so it does not
+ * matter which of them keeps waiting.  The member that ends up with a
+ * good answer publishes a copy of it in the entry; the others pick the
+ * copy up, digest it as if they had received it themselves and leave.
+ * Since the first member to read the response is not necessarily the
+ * one that wakes up, members also wait on a pipe that is written to when
+ * the entry completes.  The pipe is created along with the entry, so the
+ * member that sent the query waits on it from the start.  Where there is
+ * no pipe, members look at the entry every IF_POLL_USEC instead.
+ */
+#include "validator-internal.h"
+
+#include "val_resquery.h"
+#include "val_stats.h"
+#include "val_inflight.h"
+
+#include <ctype.h>
+
+#define IF_BUCKETS      256     /* must be a power of two */
+
+#ifndef VAL_NO_THREADS
+#define IF_LOCK()           pthread_mutex_lock(&if_table_lock)
+#define IF_UNLOCK()         pthread_mutex_unlock(&if_table_lock)
+#define IF_ENTRY_LOCK(e)    pthread_mutex_lock(&(e)->lock)
+#define IF_ENTRY_UNLOCK(e)  pthread_mutex_unlock(&(e)->lock)
+#ifndef WIN32
+#define IF_WAKEUP_PIPE 1
+#include <fcntl.h>
+#endif
+#else
+#define IF_LOCK()
+#define IF_UNLOCK()
+#define IF_ENTRY_LOCK(e)
+#define IF_ENTRY_UNLOCK(e)
+#endif
+
+/* how often members look at an entry if they cannot be woken up */
+#define IF_POLL_USEC    100000
+
+struct val_inflight {
+    struct val_inflight *next;          /* bucket chain */
+    u_int32_t           hash;
+    u_char             *key;
+    size_t              key_len;
+    int                 linked;         /* still in the table */
+    int                 refs;           /* queries sharing the entry */
+#ifndef VAL_NO_THREADS
+    pthread_mutex_t     lock;           /* protects the fields below */
+#endif
+    int                 trans_id;       /* shared libsres transaction */
+    int                 done;
+    int                 failed;
+    u_char             *response;       /* copy of the good answer */
+    size_t              response_len;
+    struct name_server *server;         /* ... and who sent it */
+    int                 wake[2];        /* written to once done */
+};
+
+static struct val_inflight *if_table[IF_BUCKETS];
+#ifndef VAL_NO_THREADS
+static pthread_mutex_t if_table_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Serialize everything a query sends on the wire, and where to: the
+ * question, the query flags and every server address and option.
+ * Returns the length of the key, or 0 if the query should not be
+ * merged with others.
+ */
+static size_t
+_if_make_key(struct val_query_chain *q, struct name_server *nslist,
+             u_char *key, size_t size)
+{
+    struct name_server *ns;
+    size_t          len, n;
+    int             i;
+
+#define IF_PUT(p, l) do { \
+        if (len + (l) > size) \
+            return 0; \
+        memcpy(key + len, (p), (l)); \
+        len += (l); \
+    } while (0)
+
+    len = 0;
+    n = wire_name_length(q->qc_name_n);
+    IF_PUT(q->qc_name_n, n);
+    for (i = 0; i < (int) n; i++)
+        key[i] = tolower(key[i]);
+    IF_PUT(&q->qc_type_h, sizeof(q->qc_type_h));
+    IF_PUT(&q->qc_class_h, sizeof(q->qc_class_h));
+    IF_PUT(&q->qc_flags, sizeof(q->qc_flags));
+
+    for (ns = nslist; ns; ns = ns->ns_next) {
+        /* signed queries are not shared */
+        if (ns->ns_tsig)
+            return 0;
+        IF_PUT(&ns->ns_options, sizeof(ns->ns_options));
+        IF_PUT(&ns->ns_security_options, sizeof(ns->ns_security_options));
+        IF_PUT(&ns->ns_edns0_size, sizeof(ns->ns_edns0_size));
+        IF_PUT(&ns->ns_retrans, sizeof(ns->ns_retrans));
+        IF_PUT(&ns->ns_retry, sizeof(ns->ns_retry));
+        IF_PUT(&ns->ns_number_of_addresses,
+               sizeof(ns->ns_number_of_addresses));
+        for (i = 0; i < ns->ns_number_of_addresses; i++) {
+            struct sockaddr *sa = (struct sockaddr *) ns->ns_address[i];
+            if (sa->sa_family == AF_INET)
+                IF_PUT(sa, sizeof(struct sockaddr_in));
+#ifdef VAL_IPV6
+            else if (sa->sa_family == AF_INET6)
+                IF_PUT(sa, sizeof(struct sockaddr_in6));
+#endif
+            else
+                return 0;
+        }
+    }
+#undef IF_PUT
+
+    return len;
+}
+
+static u_int32_t
+_if_hash(const u_char *key, size_t len)
+{
+    u_int32_t       h = 2166136261U;
+    size_t          i;
+
+    for (i = 0; i < len; i++) {
+        h ^= key[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void
+_if_unlink(struct val_inflight *e)
+{
+    struct val_inflight **pp;
+
+    if (!e->linked)
+        return;
+    for (pp = &if_table[e->hash & (IF_BUCKETS - 1)]; *pp; pp = &(*pp)->next) {
+        if (*pp == e) {
+            *pp = e->next;
+            break;
+        }
+    }
+    e->linked = 0;
+}
+
+static void
+_if_free(struct val_inflight *e)
+{
+    res_cancel(&e->trans_id);
+    if (e->response)
+        FREE(e->response);
+    if (e->server)
+        free_name_server(&e->server);
+#ifdef IF_WAKEUP_PIPE
+    if (e->wake[0] != -1)
+        close(e->wake[0]);
+    if (e->wake[1] != -1)
+        close(e->wake[1]);
+#endif
+#ifndef VAL_NO_THREADS
+    pthread_mutex_destroy(&e->lock);
+#endif
+    FREE(e->key);
+    FREE(e);
+}
+
+#ifdef IF_WAKEUP_PIPE
+/*
+ * Create the pipe that members of an entry wait on.  If that fails, or
+ * the descriptors do not fit in an fd_set, members poll the entry
+ * instead.
+ */
+static void
+_if_wake_init(struct val_inflight *e)
+{
+    int             i;
+
+    if (pipe(e->wake) != 0) {
+        e->wake[0] = e->wake[1] = -1;
+        return;
+    }
+    if (e->wake[0] >= FD_SETSIZE) {
+        close(e->wake[0]);
+        close(e->wake[1]);
+        e->wake[0] = e->wake[1] = -1;
+        return;
+    }
+    for (i = 0; i < 2; ++i) {
+        fcntl(e->wake[i], F_SETFL, fcntl(e->wake[i], F_GETFL) | O_NONBLOCK);
+        fcntl(e->wake[i], F_SETFD, FD_CLOEXEC);
+    }
+}
+#endif
+
+/*
+ * Mark an entry as complete and wake up everyone waiting for it.  New
+ * queries no longer join it.  Called with the entry lock held.
+ */
+static void
+_if_complete(struct val_inflight *e, int failed)
+{
+    e->done = 1;
+    e->failed = failed;
+    res_cancel(&e->trans_id);
+
+    IF_LOCK();
+    _if_unlink(e);
+    IF_UNLOCK();
+
+#ifdef IF_WAKEUP_PIPE
+    if (e->wake[1] != -1) {
+        char            c = 0;
+        if (write(e->wake[1], &c, 1) < 0 && errno != EAGAIN)
+            val_log(NULL, LOG_INFO, "_if_complete(): Cannot wake waiters");
+    }
+#endif
+}
+
+/*============================================================================
+ *
+ * INTERFACE
+ *
+ *===========================================================================*/
+
+/*
+ * Send query q to nslist, unless an identical query is already in flight,
+ * in which case q joins it and *joined is set.  Returns the libsres
+ * status of the send.
+ */
+int
+val_inflight_send(struct val_query_chain *q, struct name_server *nslist,
+                  const char *name_p, int *joined)
+{
+    struct val_inflight *e;
+    u_char          key[NS_MAXCDNAME + 1024];
+    size_t          key_len;
+    u_int32_t       hash;
+    int             ret_val;
+
+    if (NULL == q || NULL == joined)
+        return SR_INTERNAL_ERROR;
+
+    *joined = 0;
+    val_inflight_release(q);
+
+    key_len = _if_make_key(q, nslist, key, sizeof(key));
+    if (0 == key_len)
+        return query_send(name_p, q->qc_type_h, q->qc_class_h, nslist,
+                          &q->qc_trans_id);
+    hash = _if_hash(key, key_len);
+
+    IF_LOCK();
+    for (e = if_table[hash & (IF_BUCKETS - 1)]; e; e = e->next) {
+        if (e->hash == hash && e->key_len == key_len &&
+            !memcmp(e->key, key, key_len))
+            break;
+    }
+    if (e) {
+        e->refs++;
+        q->qc_inflight = e;
+        *joined = 1;
+        IF_UNLOCK();
+
+        VAL_STATS_INC(vs_coalesced_queries);
+        val_log(NULL, LOG_DEBUG,
+                "val_inflight_send(): Query for {%s %s %s} already in flight",
+                name_p, p_class(q->qc_class_h), p_type(q->qc_type_h));
+        return SR_UNSET;
+    }
+
+    /*
+     * Send the query while holding the table lock, so that identical
+     * queries find the transaction in place
+     */
+    e = (struct val_inflight *) MALLOC(sizeof(struct val_inflight));
+    if (NULL == e) {
+        IF_UNLOCK();
+        return query_send(name_p, q->qc_type_h, q->qc_class_h, nslist,
+                          &q->qc_trans_id);
+    }
+    memset(e, 0, sizeof(struct val_inflight));
+    e->trans_id = -1;
+    e->wake[0] = e->wake[1] = -1;
+    e->key = (u_char *) MALLOC(key_len);
+    if (NULL == e->key) {
+        FREE(e);
+        IF_UNLOCK();
+        return query_send(name_p, q->qc_type_h, q->qc_class_h, nslist,
+                          &q->qc_trans_id);
+    }
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->hash = hash;
+#ifndef VAL_NO_THREADS
+    pthread_mutex_init(&e->lock, NULL);
+#endif
+#ifdef IF_WAKEUP_PIPE
+    /*
+     * The pipe must exist before anyone can join, so that the member
+     * that sent the query already waits on it
+     */
+    _if_wake_init(e);
+#endif
+
+    ret_val = query_send(name_p, q->qc_type_h, q->qc_class_h, nslist,
+                         &e->trans_id);
+    if (SR_UNSET != ret_val) {
+        IF_UNLOCK();
+        _if_free(e);
+        return ret_val;
+    }
+
+    e->refs = 1;
+    e->linked = 1;
+    e->next = if_table[hash & (IF_BUCKETS - 1)];
+    if_table[hash & (IF_BUCKETS - 1)] = e;
+    q->qc_inflight = e;
+    IF_UNLOCK();
+
+    return SR_UNSET;
+}
+
+/*
+ * Check for the answer to a shared query, in the same way as
+ * response_recv().  If another member has already completed the query,
+ * hand out a copy of its answer.
+ */
+int
+val_inflight_recv(struct val_query_chain *q, fd_set *pending_desc,
+                  struct timeval *closest_event,
+                  struct name_server **respondent,
+                  u_char **answer, size_t *answer_length)
+{
+    struct val_inflight *e;
+    int             ret_val;
+
+    if (NULL == q || NULL == (e = q->qc_inflight) || NULL == respondent ||
+        NULL == answer || NULL == answer_length)
+        return SR_INTERNAL_ERROR;
+
+    *respondent = NULL;
+    *answer = NULL;
+    *answer_length = 0;
+
+    IF_ENTRY_LOCK(e);
+    if (e->done) {
+        ret_val = SR_NO_ANSWER;
+        if (!e->failed &&
+            NULL != (*answer = (u_char *) MALLOC(e->response_len))) {
+            memcpy(*answer, e->response, e->response_len);
+            *answer_length = e->response_len;
+            if (SR_UNSET == clone_ns(respondent, e->server))
+                ret_val = SR_UNSET;
+            else {
+                *respondent = NULL;
+                FREE(*answer);
+                *answer = NULL;
+                *answer_length = 0;
+            }
+        }
+        IF_ENTRY_UNLOCK(e);
+        return ret_val;
+    }
+
+    ret_val = response_recv(&e->trans_id, pending_desc, closest_event,
+                            respondent, answer, answer_length);
+    if (SR_NO_ANSWER_YET == ret_val) {
+#ifdef IF_WAKEUP_PIPE
+        if (e->wake[0] != -1)
+            FD_SET(e->wake[0], pending_desc);
+        else
+#endif
+        if (e->refs > 1) {
+            struct timeval  poll_tv;
+
+            gettimeofday(&poll_tv, NULL);
+            poll_tv.tv_usec += IF_POLL_USEC;
+            if (poll_tv.tv_usec >= 1000000) {
+                poll_tv.tv_sec++;
+                poll_tv.tv_usec -= 1000000;
+            }
+            if (!timerisset(closest_event) ||
+                timercmp(&poll_tv, closest_event, <))
+                *closest_event = poll_tv;
+        }
+    }
+    IF_ENTRY_UNLOCK(e);
+
+    return ret_val;
+}
+
+/*
+ * Move a shared query on to its next server or to a smaller EDNS0 size,
+ * as res_nsfallback() does.  Fails once the query is complete.
+ */
+int
+val_inflight_fallback(struct val_query_chain *q,
+                      struct timeval *closest_event,
+                      struct name_server *server, const char *name_p)
+{
+    struct val_inflight *e;
+    int             ret_val = -1;
+
+    if (NULL == q || NULL == (e = q->qc_inflight))
+        return -1;
+
+    IF_ENTRY_LOCK(e);
+    if (!e->done)
+        ret_val = res_nsfallback(e->trans_id, closest_event, server, name_p,
+                                 q->qc_class_h, q->qc_type_h);
+    IF_ENTRY_UNLOCK(e);
+
+    return ret_val;
+}
+
+/*
+ * Publish the good answer that a member received for its shared query,
+ * or, if answer is NULL, record that the query failed for everyone.
+ */
+void
+val_inflight_done(struct val_query_chain *q, struct name_server *server,
+                  const u_char *answer, size_t answer_length)
+{
+    struct val_inflight *e;
+
+    if (NULL == q || NULL == (e = q->qc_inflight))
+        return;
+
+    IF_ENTRY_LOCK(e);
+    if (!e->done) {
+        if (answer && answer_length > 0 && server &&
+            NULL != (e->response = (u_char *) MALLOC(answer_length)) &&
+            SR_UNSET == clone_ns(&e->server, server)) {
+            memcpy(e->response, answer, answer_length);
+            e->response_len = answer_length;
+            _if_complete(e, 0);
+        } else {
+            e->server = NULL;
+            _if_complete(e, 1);
+        }
+    }
+    IF_ENTRY_UNLOCK(e);
+}
+
+/*
+ * Leave the shared query q belongs to, if any.  The transaction is
+ * cancelled when its last member leaves.
+ */
+void
+val_inflight_release(struct val_query_chain *q)
+{
+    struct val_inflight *e;
+    int             last;
+
+    if (NULL == q || NULL == (e = q->qc_inflight))
+        return;
+    q->qc_inflight = NULL;
+
+    IF_LOCK();
+    last = (--e->refs == 0);
+    if (last)
+        _if_unlink(e);
+    IF_UNLOCK();
+
+    if (last)
+        _if_free(e);
+}
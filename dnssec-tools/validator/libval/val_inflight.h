@@ -0,0 +1,25 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_INFLIGHT_H
+#define VAL_INFLIGHT_H
+
+int             val_inflight_send(struct val_query_chain *q,
+                                  struct name_server *nslist,
+                                  const char *name_p, int *joined);
+int             val_inflight_recv(struct val_query_chain *q,
+                                  fd_set *pending_desc,
+                                  struct timeval *closest_event,
+                                  struct name_server **respondent,
+                                  u_char **answer, size_t *answer_length);
+int             val_inflight_fallback(struct val_query_chain *q,
+                                      struct timeval *closest_event,
+                                      struct name_server *server,
+                                      const char *name_p);
+void            val_inflight_done(struct val_query_chain *q,
+                                  struct name_server *server,
+                                  const u_char *answer, size_t answer_length);
+void            val_inflight_release(struct val_query_chain *q);
+
+#endif /* VAL_INFLIGHT_H */
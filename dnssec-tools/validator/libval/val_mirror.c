@@ -0,0 +1,396 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Local copies of whole zones, such as a copy of the root zone kept
+ * next to the validator as described in RFC 8806.  Each zone-mirror
+ * global option names a zone file; the files are read along with the
+ * rest of the configuration, and queries that would go to the name
+ * servers of a mirrored zone are answered from the copy instead.
+ *
+ * A copy is only used if it checks out when it is read: its DNSKEY
+ * RRset has to be signed by a key that matches a trust anchor for the
+ * zone apex, and every authoritative RRset has to carry a signature
+ * that verifies with one of those DNSKEYs.  Zones that the
+ * zone-security-expectation policy says to ignore are used without
+ * these checks.  Answers are built by the authoritative answering code
+ * in val_zone.c, with RRSIGs and NSEC or NSEC3 proofs, and go through
+ * digest_response() and validation like answers from the network; the
+ * checks at load time only keep a damaged or stale copy from being
+ * preferred over the live zone.
+ *
+ * A copy is retired once the earliest of its signatures expires, or
+ * once the SOA expire interval has passed since it was read, and the
+ * zone is then looked up on the network again until the configuration
+ * is next read.
+ *
+ * Referrals from a copy are only used in iterative mode, when the
+ * query would otherwise have gone to the servers of the mirrored zone
+ * or of one of its ancestors; a recursive name server from resolv.conf
+ * is only bypassed for authoritative answers.
+ */
+#include "validator-internal.h"
+
+#include "val_support.h"
+#include "val_verify.h"
+#include "val_assertion.h"
+#include "validator/val_zone.h"
+#include "val_mirror.h"
+
+#define VM_MAX_RESPONSE     65535
+
+struct val_mirror {
+    struct val_zone *vm_zone;
+    u_int32_t       vm_expires;     /* absolute time the copy is retired */
+    struct val_mirror *vm_next;
+};
+
+void
+val_mirror_free(struct val_mirror *mirrors)
+{
+    struct val_mirror *m;
+
+    while ((m = mirrors) != NULL) {
+        mirrors = m->vm_next;
+        val_zone_free(m->vm_zone);
+        FREE(m);
+    }
+}
+
+static int
+vm_name_under(const u_char *child, const u_char *parent)
+{
+    const u_char   *p;
+
+    for (p = child; ; p += p[0] + 1) {
+        if (namecmp(p, parent) == 0)
+            return 1;
+        if (p[0] == 0)
+            return 0;
+    }
+}
+
+/*
+ * Turn one RRset of the zone into the canonical form the verifier
+ * expects
+ */
+static struct rrset_rec *
+vm_make_rrset(u_char *owner, const struct vz_rrset *set)
+{
+    struct rrset_rec *rr, *canon = NULL;
+    int             i;
+
+    rr = (struct rrset_rec *) MALLOC(sizeof(struct rrset_rec));
+    if (rr == NULL)
+        return NULL;
+    memset(rr, 0, sizeof(struct rrset_rec));
+
+    if (VAL_NO_ERROR != init_rr_set(rr, owner, set->type_h, set->type_h,
+                                    set->rr[0]->class_h, set->rr[0]->ttl,
+                                    NULL, VAL_FROM_ANSWER, 1, 0, NULL))
+        goto done;
+    for (i = 0; i < set->nrr; i++)
+        if (VAL_NO_ERROR != add_to_set(rr, set->rr[i]->rdlen,
+                                       set->rr[i]->rdata))
+            goto done;
+    for (i = 0; i < set->nsig; i++)
+        if (VAL_NO_ERROR != add_as_sig(rr, set->sig[i]->rdlen,
+                                       set->sig[i]->rdata))
+            goto done;
+    canon = copy_rrset_rec(rr);
+
+  done:
+    res_sq_free_rrset_recs(&rr);
+    return canon;
+}
+
+/*
+ * Return the SOA expire interval of the zone, or 0 if it has no SOA
+ */
+static u_int32_t
+vm_soa_expire(const struct val_zone *z)
+{
+    struct vz_rrset *soa;
+    const u_char   *cp, *end;
+    u_int32_t       expire;
+
+    soa = val_zone_find_rrset(z, z->apex, ns_t_soa);
+    if (soa == NULL)
+        return 0;
+    cp = soa->rr[0]->rdata;
+    end = cp + soa->rr[0]->rdlen;
+    cp += wire_name_length(cp);
+    if (cp >= end)
+        return 0;
+    cp += wire_name_length(cp);
+    /* serial, refresh and retry come before expire */
+    cp += 3 * sizeof(u_int32_t);
+    if (cp + sizeof(u_int32_t) > end)
+        return 0;
+    NS_GET32(expire, cp);
+    return expire;
+}
+
+/*
+ * Decide whether a zone that was just read may be used, and until when
+ */
+static int
+vm_check_zone(val_context_t *context, struct val_zone *z, const char *zone_p,
+              u_int32_t *expires)
+{
+    struct rrset_rec *keys = NULL, *the_set;
+    struct vz_rrset *keyset;
+    const u_char   *cut = NULL;
+    u_int16_t       zse;
+    u_char         *match = NULL;
+    u_int32_t       ttl_x = 0, sig_expr = 0, set_expr;
+    u_int32_t       expire, now = (u_int32_t) time(NULL);
+    val_astatus_t   status;
+    int             i, j, verified, ok = 0;
+
+    if ((expire = vm_soa_expire(z)) == 0) {
+        val_log(context, LOG_WARNING,
+                "val_mirror_configure(): %s has no usable SOA", z->file);
+        return 0;
+    }
+    *expires = now + expire;
+
+    if (VAL_NO_ERROR != get_zse(context, z->apex, 0, &zse, &match, &ttl_x))
+        return 0;
+    if (zse == VAL_AC_IGNORE_VALIDATION) {
+        val_log(context, LOG_INFO,
+                "val_mirror_configure(): Validation of %s is ignored; "
+                "not checking signatures in %s", zone_p, z->file);
+        return 1;
+    }
+    if (zse == VAL_AC_UNTRUSTED_ZONE) {
+        val_log(context, LOG_WARNING,
+                "val_mirror_configure(): %s is untrusted; not using %s",
+                zone_p, z->file);
+        return 0;
+    }
+
+    keyset = val_zone_find_rrset(z, z->apex, ns_t_dnskey);
+    if (keyset == NULL || NULL == (keys = vm_make_rrset(z->apex, keyset))) {
+        val_log(context, LOG_WARNING,
+                "val_mirror_configure(): %s has no DNSKEY RRset", z->file);
+        return 0;
+    }
+    if (VAL_NO_ERROR != is_trusted_key(context, z->apex, keys->rrs_data,
+                                       &status, 0, &ttl_x) ||
+        status != VAL_AC_TRUST_NOCHK ||
+        !verify_rrset_with_keys(context, keys, keys->rrs_data, 1,
+                                &sig_expr)) {
+        val_log(context, LOG_WARNING,
+                "val_mirror_configure(): The DNSKEY RRset in %s is not "
+                "signed by a trust anchor for %s", z->file, zone_p);
+        goto done;
+    }
+
+    /*
+     * Nodes are in canonical order, so everything below a delegation
+     * follows it directly
+     */
+    for (i = 0; i < z->nnodes; i++) {
+        struct vz_node *node = &z->nodes[i];
+        int             at_cut = 0;
+
+        if (cut != NULL && vm_name_under(node->name, cut))
+            continue;           /* glue */
+        cut = NULL;
+        if (namecmp(node->name, z->apex) != 0 &&
+            val_zone_find_rrset(z, node->name, ns_t_ns) != NULL) {
+            cut = node->name;
+            at_cut = 1;
+        }
+
+        for (j = 0; j < node->nsets; j++) {
+            struct vz_rrset *set = &node->sets[j];
+            char            name_p[NS_MAXDNAME];
+
+            if (set->nrr == 0)
+                continue;
+            /* only the DS and NSEC RRsets at a delegation are ours */
+            if (at_cut && set->type_h != ns_t_ds &&
+                set->type_h != ns_t_nsec)
+                continue;
+            if (NULL == (the_set = vm_make_rrset(node->name, set)))
+                goto done;
+            set_expr = 0;
+            verified = verify_rrset_with_keys(context, the_set,
+                                              keys->rrs_data, 0, &set_expr);
+            res_sq_free_rrset_recs(&the_set);
+            if (!verified) {
+                if (-1 == ns_name_ntop(node->name, name_p, sizeof(name_p)))
+                    snprintf(name_p, sizeof(name_p), "unknown/error");
+                val_log(context, LOG_WARNING,
+                        "val_mirror_configure(): No valid signature for "
+                        "%s %s in %s", name_p, p_type(set->type_h),
+                        z->file);
+                goto done;
+            }
+            if (set_expr < sig_expr)
+                sig_expr = set_expr;
+        }
+    }
+    ok = 1;
+    if (sig_expr < *expires)
+        *expires = sig_expr;
+
+  done:
+    res_sq_free_rrset_recs(&keys);
+    return ok;
+}
+
+/*
+ * (Re)load the zone mirrors named in the global options of the context.
+ * Called whenever the validator configuration has been read.
+ */
+void
+val_mirror_configure(val_context_t *context)
+{
+    struct val_mirror *m, **tail;
+    struct val_zone *z;
+    char           *list, *file, *last = NULL;
+    char            zone_p[NS_MAXDNAME];
+    u_int32_t       expires;
+
+    if (context == NULL)
+        return;
+
+    val_mirror_free(context->mirrors);
+    context->mirrors = NULL;
+    tail = &context->mirrors;
+
+    if (context->g_opt == NULL || context->g_opt->zone_mirror == NULL)
+        return;
+    if (NULL == (list = STRDUP(context->g_opt->zone_mirror)))
+        return;
+
+#ifdef HAVE_STRTOK_R
+    for (file = strtok_r(list, " ", &last); file;
+         file = strtok_r(NULL, " ", &last)) {
+#else
+    for (file = strtok(list, " "); file; file = strtok(NULL, " ")) {
+#endif
+        z = NULL;
+        if (val_zone_load(file, &z) < 0) {
+            val_log(context, LOG_WARNING,
+                    "val_mirror_configure(): Could not read zone mirror %s",
+                    file);
+            continue;
+        }
+        if (-1 == ns_name_ntop(z->apex, zone_p, sizeof(zone_p)))
+            snprintf(zone_p, sizeof(zone_p), "unknown/error");
+        if (!vm_check_zone(context, z, zone_p, &expires) ||
+            NULL == (m = (struct val_mirror *)
+                     MALLOC(sizeof(struct val_mirror)))) {
+            val_zone_free(z);
+            continue;
+        }
+        m->vm_zone = z;
+        m->vm_expires = expires;
+        m->vm_next = NULL;
+        *tail = m;
+        tail = &m->vm_next;
+        val_log(context, LOG_NOTICE,
+                "val_mirror_configure(): Answering for %s from %s "
+                "(%d records) for %ld seconds", zone_p, file, z->nrrs,
+                (long) (expires - (u_int32_t) time(NULL)));
+    }
+    FREE(list);
+}
+
+/*
+ * Answer q from a zone mirror, if one can.  On success *answer is a
+ * response in wire format that the caller has to FREE; otherwise it is
+ * left NULL.
+ */
+int
+val_mirror_answer(val_context_t *context, struct val_query_chain *q,
+                  u_char **answer, size_t *answer_length)
+{
+    struct val_mirror *m, *best = NULL;
+    u_char          query[NS_HFIXEDSZ + NS_MAXCDNAME + NS_QFIXEDSZ +
+                                  NS_RRFIXEDSZ + 1];
+    u_char         *cp, *resp;
+    HEADER         *hp;
+    size_t          len;
+    u_int32_t       now;
+    int             n;
+
+    if ((context == NULL) || (q == NULL) || (answer == NULL) ||
+        (answer_length == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    *answer = NULL;
+    *answer_length = 0;
+    if (context->mirrors == NULL || q->qc_class_h != ns_c_in)
+        return VAL_NO_ERROR;
+
+    /*
+     * The deepest zone that holds the name; DS records are in the parent
+     */
+    now = (u_int32_t) time(NULL);
+    for (m = context->mirrors; m; m = m->vm_next) {
+        if (m->vm_expires <= now ||
+            !vm_name_under(q->qc_name_n, m->vm_zone->apex))
+            continue;
+        if (q->qc_type_h == ns_t_ds && m->vm_zone->apex_labels > 0 &&
+            namecmp(q->qc_name_n, m->vm_zone->apex) == 0)
+            continue;
+        if (best == NULL ||
+            m->vm_zone->apex_labels > best->vm_zone->apex_labels)
+            best = m;
+    }
+    if (best == NULL)
+        return VAL_NO_ERROR;
+
+    /*
+     * Ask for the answer as a client would, with the DO bit set
+     */
+    memset(query, 0, HFIXEDSZ);
+    hp = (HEADER *) query;
+    hp->opcode = ns_o_query;
+    hp->qdcount = htons(1);
+    hp->arcount = htons(1);
+    len = wire_name_length(q->qc_name_n);
+    memcpy(query + HFIXEDSZ, q->qc_name_n, len);
+    cp = query + HFIXEDSZ + len;
+    NS_PUT16(q->qc_type_h, cp);
+    NS_PUT16(q->qc_class_h, cp);
+    *cp++ = 0;                  /* OPT owner */
+    NS_PUT16(ns_t_opt, cp);
+    NS_PUT16(VM_MAX_RESPONSE, cp);
+    NS_PUT32(0x8000, cp);       /* DO */
+    NS_PUT16(0, cp);
+
+    resp = (u_char *) MALLOC(VM_MAX_RESPONSE);
+    if (resp == NULL)
+        return VAL_OUT_OF_MEMORY;
+    n = val_zone_respond(best->vm_zone, query, cp - query, resp,
+                         VM_MAX_RESPONSE, 1, 0);
+    hp = (HEADER *) resp;
+    if (n < HFIXEDSZ ||
+        (hp->rcode != ns_r_noerror && hp->rcode != ns_r_nxdomain))
+        goto not_here;
+
+    /*
+     * A referral only helps in iterative mode, and only if it does not
+     * lead back up above the servers the query would have gone to
+     */
+    if (!hp->aa &&
+        (!(q->qc_flags & VAL_QUERY_ITERATE) || q->qc_zonecut_n == NULL ||
+         !vm_name_under(best->vm_zone->apex, q->qc_zonecut_n)))
+        goto not_here;
+
+    *answer = resp;
+    *answer_length = n;
+    return VAL_NO_ERROR;
+
+  not_here:
+    FREE(resp);
+    return VAL_NO_ERROR;
+}
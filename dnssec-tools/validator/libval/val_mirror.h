@@ -0,0 +1,16 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_MIRROR_H
+#define VAL_MIRROR_H
+
+struct val_mirror;
+
+void            val_mirror_configure(val_context_t *context);
+void            val_mirror_free(struct val_mirror *mirrors);
+int             val_mirror_answer(val_context_t *context,
+                                  struct val_query_chain *q,
+                                  u_char **answer, size_t *answer_length);
+
+#endif /* VAL_MIRROR_H */
@@ -17,6 +17,10 @@
 #include "val_context.h"
 #include "val_assertion.h"
 #include "val_parse.h"
+#include "val_rcache.h"
+#include "val_tcache.h"
+#include "val_mirror.h"
+#include "val_prefetch.h"
 
 #if !defined(WIN32) || defined(LIBVAL_CONFIGURED)
 #include "val_inline_conf.h"
@@ -244,6 +248,14 @@ set_global_opt_defaults(val_global_opt_t *gopt)
     gopt->rec_fallback = 1;
     gopt->max_refresh = VAL_POL_GOPT_MAXREFRESH;
     gopt->proto = VAL_POL_GOPT_PROTO_ANY;
+    gopt->prefetch = VAL_POL_GOPT_PREFETCH;
+    gopt->prefetch_hits = VAL_POL_GOPT_PREFETCH_HITS;
+    gopt->serve_stale = VAL_POL_GOPT_SERVE_STALE;
+    gopt->stale_timeout = VAL_POL_GOPT_STALE_TIMEOUT;
+    gopt->cache_file = NULL;
+    gopt->cache_save_interval = VAL_POL_GOPT_CACHE_SAVE_INTERVAL;
+    gopt->zone_mirror = NULL;
+    gopt->pinned_zones = NULL;
 }
 
 int 
@@ -260,7 +272,10 @@ update_dynamic_gopt(val_global_opt_t **g_new, val_global_opt_t *g)
         set_global_opt_defaults(*g_new);
     }
 
-    /* NOTE: We must not update log_target */
+    /*
+     * NOTE: We must not update log_target, cache_file, zone_mirror or
+     * pinned_zones
+     */
 
     if (g->local_is_trusted != VAL_POL_GOPT_UNSET)
         (*g_new)->local_is_trusted = g->local_is_trusted;        
@@ -278,6 +293,16 @@ update_dynamic_gopt(val_global_opt_t **g_new, val_global_opt_t *g)
         (*g_new)->max_refresh = g->max_refresh;        
     if (g->proto != VAL_POL_GOPT_UNSET)
         (*g_new)->proto = g->proto;        
+    if (g->prefetch != VAL_POL_GOPT_UNSET)
+        (*g_new)->prefetch = g->prefetch;        
+    if (g->prefetch_hits != VAL_POL_GOPT_UNSET)
+        (*g_new)->prefetch_hits = g->prefetch_hits;        
+    if (g->serve_stale != VAL_POL_GOPT_UNSET)
+        (*g_new)->serve_stale = g->serve_stale;        
+    if (g->stale_timeout != VAL_POL_GOPT_UNSET)
+        (*g_new)->stale_timeout = g->stale_timeout;        
+    if (g->cache_save_interval != VAL_POL_GOPT_UNSET)
+        (*g_new)->cache_save_interval = g->cache_save_interval;        
 
     return VAL_NO_ERROR;
 }
@@ -288,6 +313,12 @@ free_global_options(val_global_opt_t *g)
     if (g) {
         if (g->log_target)
             FREE(g->log_target);
+        if (g->cache_file)
+            FREE(g->cache_file);
+        if (g->zone_mirror)
+            FREE(g->zone_mirror);
+        if (g->pinned_zones)
+            FREE(g->pinned_zones);
     }
 }
 
@@ -945,14 +976,14 @@ parse_enable_disable_gopt(int *type, char **buf_ptr, char *end_ptr, int *line_nu
 }
 
 static int
-parse_log_target_gopt(char **buf_ptr, char *end_ptr, int *line_number,
-                      int *endst, val_global_opt_t *g_opt)
+parse_string_gopt(char **value, char **buf_ptr, char *end_ptr,
+                  int *line_number, int *endst)
 {
     char            token[TOKEN_MAX];
     int retval;
 
     if ((buf_ptr == NULL) || (*buf_ptr == NULL) || (end_ptr == NULL) || 
-        (g_opt == NULL) || (endst == NULL) || (line_number == NULL))
+        (value == NULL) || (endst == NULL) || (line_number == NULL))
         return VAL_BAD_ARGUMENT;
 
     /* read the next token */
@@ -967,10 +998,47 @@ parse_log_target_gopt(char **buf_ptr, char *end_ptr, int *line_number,
         return VAL_CONF_PARSE_ERROR;
     }
 
-    g_opt->log_target = (char *) MALLOC (strlen(token) + 1);
-    if (g_opt->log_target == NULL)
+    if (*value)
+        FREE(*value);
+    *value = (char *) MALLOC (strlen(token) + 1);
+    if (*value == NULL)
+        return VAL_OUT_OF_MEMORY;
+    strcpy(*value, token);
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Like parse_string_gopt(), but for options that may be given more
+ * than once; the values are kept in one space separated string.
+ */
+static int
+parse_list_gopt(char **value, char **buf_ptr, char *end_ptr,
+                int *line_number, int *endst)
+{
+    char           *item = NULL;
+    char           *list;
+    int             retval;
+
+    if (value == NULL)
+        return VAL_BAD_ARGUMENT;
+
+    if (VAL_NO_ERROR != (retval = parse_string_gopt(&item, buf_ptr, end_ptr,
+                                                    line_number, endst)))
+        return retval;
+    if (*value == NULL) {
+        *value = item;
+        return VAL_NO_ERROR;
+    }
+
+    list = (char *) MALLOC(strlen(*value) + strlen(item) + 2);
+    if (list == NULL) {
+        FREE(item);
         return VAL_OUT_OF_MEMORY;
-    strcpy(g_opt->log_target, token);
+    }
+    sprintf(list, "%s %s", *value, item);
+    FREE(*value);
+    FREE(item);
+    *value = list;
     return VAL_NO_ERROR;
 }
 
@@ -1102,6 +1170,41 @@ parse_proto(char **buf_ptr, char *end_ptr, int *line_number,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Read the value of one of the numeric options, between 0 and max
+ */
+static int
+parse_number_gopt(int *value, int max, char **buf_ptr, char *end_ptr,
+                  int *line_number, int *endst)
+{
+    char            token[TOKEN_MAX];
+    char           *end;
+    long            n;
+    int retval;
+
+    if ((value == NULL) || (buf_ptr == NULL) || (*buf_ptr == NULL) || 
+        (end_ptr == NULL) || (endst == NULL) || (line_number == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    if (VAL_NO_ERROR != (retval = 
+        val_get_token(buf_ptr, end_ptr, line_number, 
+                      token, sizeof(token), endst,
+                      CONF_COMMENT, CONF_END_STMT, 0))) {
+        return retval;
+    }
+    if ((endst && (strlen(token) == 0)) ||
+        (*buf_ptr >= end_ptr)) { 
+        return VAL_CONF_PARSE_ERROR;
+    }
+
+    n = strtol(token, &end, 10);
+    if (*end != '\0' || n < 0 || n > max)
+        return VAL_CONF_PARSE_ERROR;
+    *value = (int) n;
+    
+    return VAL_NO_ERROR;
+}
+
 static int
 get_global_options(char **buf_ptr, char *end_ptr, 
                    int *line_number, val_global_opt_t **g_opt) 
@@ -1164,8 +1267,9 @@ get_global_options(char **buf_ptr, char *end_ptr,
             }
         } else if (!strcmp(token, GOPT_LOGTARGET_STR)) {
             if (VAL_NO_ERROR != 
-                    (retval = parse_log_target_gopt(buf_ptr, end_ptr, 
-                                                    line_number, &endst, *g_opt))) {
+                    (retval = parse_string_gopt(&((*g_opt)->log_target),
+                                                buf_ptr, end_ptr,
+                                                line_number, &endst))) {
                 goto err;
             }
         } else if (!strcmp(token, GOPT_CLOSEST_TA_ONLY_STR)) {
@@ -1196,6 +1300,72 @@ get_global_options(char **buf_ptr, char *end_ptr,
                 goto err;
             }
 
+        } else if (!strcmp(token, GOPT_PREFETCH_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_number_gopt(&((*g_opt)->prefetch), 100,
+                                                buf_ptr, end_ptr,
+                                                line_number, &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_PREFETCH_HITS_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_number_gopt(&((*g_opt)->prefetch_hits),
+                                                1000000, buf_ptr, end_ptr,
+                                                line_number, &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_SERVE_STALE_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_number_gopt(&((*g_opt)->serve_stale),
+                                                7 * 24 * 3600, buf_ptr,
+                                                end_ptr, line_number,
+                                                &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_STALE_TIMEOUT_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_number_gopt(&((*g_opt)->stale_timeout),
+                                                600000, buf_ptr, end_ptr,
+                                                line_number, &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_CACHE_FILE_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_string_gopt(&((*g_opt)->cache_file),
+                                                buf_ptr, end_ptr,
+                                                line_number, &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_ZONE_MIRROR_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_list_gopt(&((*g_opt)->zone_mirror),
+                                              buf_ptr, end_ptr,
+                                              line_number, &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_PINNED_ZONES_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_list_gopt(&((*g_opt)->pinned_zones),
+                                              buf_ptr, end_ptr,
+                                              line_number, &endst))) {
+                goto err;
+            }
+
+        } else if (!strcmp(token, GOPT_CACHE_SAVE_INTERVAL_STR)) {
+            if (VAL_NO_ERROR != 
+                    (retval = parse_number_gopt(&((*g_opt)->cache_save_interval),
+                                                7 * 24 * 3600, buf_ptr,
+                                                end_ptr, line_number,
+                                                &endst))) {
+                goto err;
+            }
+
         } else {
             retval = VAL_CONF_PARSE_ERROR;
             goto err;
@@ -2090,6 +2260,12 @@ skipfileread:
         free_query_chain_structure(q);
         q = NULL;
     }
+    val_rcache_flush(ctx);
+    val_tcache_flush(ctx);
+
+    /* read the zone mirrors against the new trust anchors */
+    val_mirror_configure(ctx);
+    val_prefetch_pin(ctx);
 
     ctx->dnsval_l = dlist;
 
@@ -3060,6 +3236,8 @@ val_add_valpolicy(val_context_t *context,
             q->qc_flags |= VAL_QUERY_MARK_FOR_DELETION;
         }
     }
+    val_rcache_flush(ctx);
+    val_tcache_flush(ctx);
     
     CTX_UNLOCK_ACACHE(ctx);
     CTX_UNLOCK_POL(ctx);
@@ -3115,6 +3293,8 @@ val_remove_valpolicy(val_context_t *context, val_policy_handle_t *pol)
             q->qc_flags |= VAL_QUERY_MARK_FOR_DELETION;
         }
     }
+    val_rcache_flush(ctx);
+    val_tcache_flush(ctx);
 
     FREE(p);
     FREE(pol);
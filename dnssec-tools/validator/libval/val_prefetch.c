@@ -0,0 +1,616 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Refresh popular answers before they expire.
+ *
+ * Answers served from a context's query list and from its published
+ * snapshots count their hits.  Once an answer has been used at least
+ * prefetch-min-hits times and no more than prefetch percent of its
+ * lifetime is left, it is noted for a refresh.  The refresh is an
+ * asynchronous request that skips the cache, submitted once the
+ * context's locks have been released; its answer lands in the rrset
+ * cache and, if trusted, replaces the snapshot, so that clients keep
+ * getting cache hits instead of waiting for a full resolution when the
+ * old answer expires.
+ *
+ * Refreshes are driven like any other asynchronous request of the
+ * context, except that they are not tied to the thread that submitted
+ * them: by the worker engine if it runs, by the event loop of any
+ * thread with requests of its own, and otherwise by a quick
+ * non-blocking check at the start of each val_resolve_and_check() call
+ * in any thread.  A refresh thus completes, and frees its slot, even if
+ * the thread that noted it never looks anything up again.
+ *
+ * The zones listed in the pinned-zones global option have their chain
+ * of trust resolved when the context is created, by looking up the
+ * zone's DNSKEY RRset, which brings in the DS and DNSKEY RRsets of the
+ * zone and of all its ancestors.  The chain is then refreshed whether
+ * or not it is used, once no more than prefetch percent of the lifetime
+ * of its shortest-lived RRset is left, so that its data is never found
+ * expired.  The refresh skips the cache all the way up to the trust
+ * anchor and lands in the rrset cache, from which the query cache is
+ * rebuilt without going to the network when its own copies expire or
+ * are flushed by a configuration change.  Each pinned zone has a
+ * refresh slot of its own, apart from the PF_MAX_INFLIGHT ones of the
+ * other refreshes, so a burst of those never holds a chain back; the
+ * refreshes that fail are counted in vs_pin_failures and retried after
+ * PF_PIN_RETRY seconds.
+ */
+#include "validator-internal.h"
+
+#include "val_context.h"
+#include "val_rcache.h"
+#include "val_stats.h"
+#include "val_prefetch.h"
+
+#define PF_MAX_PENDING      32  /* refreshes noted but not yet submitted */
+#define PF_MAX_INFLIGHT     64  /* refreshes outstanding per context */
+#define PF_PIN_RETRY        60  /* seconds before a failed pin is retried */
+#define PF_PIN_MIN_WAIT     5   /* seconds between refreshes of a pin, at least */
+
+#ifndef VAL_NO_THREADS
+#define PF_LOCK(pf)     pthread_mutex_lock(&(pf)->lock)
+#define PF_UNLOCK(pf)   pthread_mutex_unlock(&(pf)->lock)
+#else
+#define PF_LOCK(pf)
+#define PF_UNLOCK(pf)
+#endif
+
+struct pf_pending {
+    u_char          name_n[NS_MAXCDNAME];
+    u_int16_t       class_h;
+    u_int16_t       type_h;
+    u_int32_t       flags;
+};
+
+/*
+ * A zone whose chain of trust is kept resolved
+ */
+struct pf_pin {
+    u_char          zone_n[NS_MAXCDNAME];
+    time_t          due;        /* next refresh; 0 if never resolved */
+    int             busy;       /* being resolved or refreshed */
+};
+
+struct val_prefetch {
+#ifndef VAL_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+    struct pf_pending pending[PF_MAX_PENDING];
+    int             npending;
+    int             inflight;
+    int             pin_inflight;   /* pin refreshes, not limited */
+    struct pf_pin  *pins;
+    int             npins;
+};
+
+struct val_prefetch *
+val_prefetch_create(void)
+{
+    struct val_prefetch *pf;
+
+    pf = (struct val_prefetch *) MALLOC(sizeof(struct val_prefetch));
+    if (NULL == pf)
+        return NULL;
+    memset(pf, 0, sizeof(struct val_prefetch));
+#ifndef VAL_NO_THREADS
+    if (0 != pthread_mutex_init(&pf->lock, NULL)) {
+        FREE(pf);
+        return NULL;
+    }
+#endif
+    return pf;
+}
+
+void
+val_prefetch_destroy(struct val_prefetch *pf)
+{
+    if (NULL == pf)
+        return;
+#ifndef VAL_NO_THREADS
+    pthread_mutex_destroy(&pf->lock);
+#endif
+    if (pf->pins)
+        FREE(pf->pins);
+    FREE(pf);
+}
+
+/*
+ * Is an answer that has been used hits times, that became available
+ * at start and that expires at expires, due for a refresh at now?
+ */
+int
+val_prefetch_due(val_context_t *context, unsigned long hits,
+                 long start, long expires, long now)
+{
+#ifdef VAL_NO_ASYNC
+    return 0;
+#else
+    long            percent = VAL_POL_GOPT_PREFETCH;
+    long            min_hits = VAL_POL_GOPT_PREFETCH_HITS;
+
+    if (context && context->g_opt) {
+        percent = context->g_opt->prefetch;
+        min_hits = context->g_opt->prefetch_hits;
+    }
+    if (percent <= 0 || (long) hits < min_hits ||
+        start <= 0 || expires <= now || expires <= start)
+        return 0;
+
+    return (expires - now) * 100 <= (expires - start) * percent;
+#endif
+}
+
+/*
+ * Count a hit on a query in the context's query list and note it for a
+ * refresh when it is due.  Called with the ACACHE lock held.
+ */
+void
+val_prefetch_query_hit(val_context_t *context, struct val_query_chain *q,
+                       long now)
+{
+    if (NULL == q || q->qc_prefetched ||
+        (q->qc_flags & VAL_QUERY_SKIP_CACHE))
+        return;
+
+    if (q->qc_hits++ == 0)
+        q->qc_hit_start = (q->qc_last_sent > 0) ? q->qc_last_sent : now;
+
+    if (val_prefetch_due(context, q->qc_hits, q->qc_hit_start,
+                         (long) q->qc_ttl_x, now)) {
+        q->qc_prefetched = 1;
+        val_prefetch_note(context, q->qc_original_name, q->qc_class_h,
+                          q->qc_type_h,
+                          q->qc_flags & VAL_QFLAGS_USERMASK &
+                          ~VAL_QUERY_ASYNC);
+    }
+}
+
+/*
+ * Remember that {name_n, class_h, type_h} should be refreshed.  Nothing
+ * is sent until val_prefetch_submit() is called.
+ */
+void
+val_prefetch_note(val_context_t *context, u_char *name_n,
+                  u_int16_t class_h, u_int16_t type_h, u_int32_t flags)
+{
+#ifndef VAL_NO_ASYNC
+    struct val_prefetch *pf;
+    struct pf_pending *p;
+    int             i;
+
+    if (NULL == context || NULL == (pf = context->prefetch) ||
+        NULL == name_n)
+        return;
+
+    PF_LOCK(pf);
+    for (i = 0; i < pf->npending; i++) {
+        p = &pf->pending[i];
+        if (p->class_h == class_h && p->type_h == type_h &&
+            p->flags == flags && !namecmp(p->name_n, name_n)) {
+            PF_UNLOCK(pf);
+            return;
+        }
+    }
+    if (pf->npending == PF_MAX_PENDING ||
+        pf->npending + pf->inflight >= PF_MAX_INFLIGHT) {
+        PF_UNLOCK(pf);
+        VAL_STATS_INC(vs_prefetch_dropped);
+        return;
+    }
+    p = &pf->pending[pf->npending++];
+    memcpy(p->name_n, name_n, wire_name_length(name_n));
+    p->class_h = class_h;
+    p->type_h = type_h;
+    p->flags = flags;
+    PF_UNLOCK(pf);
+#endif
+}
+
+/*
+ * Read the list of pinned zones from the context's global options.  The
+ * chains are resolved by val_prefetch_warm() or, after a configuration
+ * change, refreshed by the next val_prefetch_submit().
+ */
+void
+val_prefetch_pin(val_context_t *context)
+{
+    struct val_prefetch *pf;
+    struct pf_pin  *pins = NULL, *old;
+    char           *list, *zone, *last = NULL;
+    u_char          zone_n[NS_MAXCDNAME];
+    int             npins = 0, max = 0, i;
+
+    if (NULL == context || NULL == (pf = context->prefetch))
+        return;
+
+    if (context->g_opt && context->g_opt->pinned_zones &&
+        NULL != (list = STRDUP(context->g_opt->pinned_zones))) {
+#ifdef HAVE_STRTOK_R
+        for (zone = strtok_r(list, " ", &last); zone;
+             zone = strtok_r(NULL, " ", &last)) {
+#else
+        for (zone = strtok(list, " "); zone; zone = strtok(NULL, " ")) {
+#endif
+            if (-1 == ns_name_pton(zone, zone_n, sizeof(zone_n))) {
+                val_log(context, LOG_WARNING,
+                        "val_prefetch_pin(): Cannot parse zone name %s",
+                        zone);
+                continue;
+            }
+            for (i = 0; i < npins; i++)
+                if (!namecmp(pins[i].zone_n, zone_n))
+                    break;
+            if (i < npins)
+                continue;
+            if (npins == max) {
+                max = max ? 2 * max : 8;
+                old = pins;
+                pins = (struct pf_pin *) MALLOC(max * sizeof(struct pf_pin));
+                if (NULL == pins) {
+                    pins = old;
+                    break;
+                }
+                if (old) {
+                    memcpy(pins, old, npins * sizeof(struct pf_pin));
+                    FREE(old);
+                }
+            }
+            memset(&pins[npins], 0, sizeof(struct pf_pin));
+            memcpy(pins[npins].zone_n, zone_n, wire_name_length(zone_n));
+            npins++;
+        }
+        FREE(list);
+    }
+
+    PF_LOCK(pf);
+    old = pf->pins;
+    pf->pins = pins;
+    pf->npins = npins;
+    PF_UNLOCK(pf);
+    if (old)
+        FREE(old);
+}
+
+/*
+ * Schedule the next refresh of the pinned zone zone_n, given the
+ * results of its last lookup.
+ */
+static void
+_pin_update(val_context_t *context, u_char *zone_n,
+            struct val_result_chain *results)
+{
+    struct val_prefetch *pf = context->prefetch;
+    char            zone_p[NS_MAXDNAME];
+    long            ttl, wait, percent = VAL_POL_GOPT_PREFETCH;
+    long            min_wait = PF_PIN_MIN_WAIT;
+    int             i;
+
+    if (context->g_opt && context->g_opt->prefetch > 0)
+        percent = context->g_opt->prefetch;
+    /*
+     * the previous refresh is answered from the query cache until
+     * max-refresh seconds have passed
+     */
+    if (context->g_opt && context->g_opt->max_refresh >= min_wait)
+        min_wait = context->g_opt->max_refresh + 1;
+
+    ttl = val_rcache_results_ttl(results, 0);
+    if (ttl > 0) {
+        wait = ttl - ttl * percent / 100;
+    } else {
+        wait = PF_PIN_RETRY;
+        VAL_STATS_INC(vs_pin_failures);
+    }
+    if (wait < min_wait)
+        wait = min_wait;
+
+    PF_LOCK(pf);
+    for (i = 0; i < pf->npins; i++) {
+        if (!namecmp(pf->pins[i].zone_n, zone_n)) {
+            pf->pins[i].due = time(NULL) + wait;
+            pf->pins[i].busy = 0;
+            break;
+        }
+    }
+    PF_UNLOCK(pf);
+
+    if (-1 == ns_name_ntop(zone_n, zone_p, sizeof(zone_p)))
+        snprintf(zone_p, sizeof(zone_p), "unknown/error");
+    val_log(context, ttl > 0 ? LOG_INFO : LOG_NOTICE,
+            "_pin_update(): Chain of trust for %s %s, next refresh in "
+            "%ld seconds", zone_p, ttl > 0 ? "resolved" : "not resolved",
+            wait);
+}
+
+/*
+ * Resolve the chains of trust of all pinned zones, waiting for the
+ * answers.  Called once the context has been set up, without any of
+ * its locks held.
+ */
+void
+val_prefetch_warm(val_context_t *context)
+{
+    struct val_prefetch *pf;
+    struct val_result_chain *results;
+    u_char          zone_n[NS_MAXCDNAME];
+    char            zone_p[NS_MAXDNAME];
+    int             i;
+
+    if (NULL == context || NULL == (pf = context->prefetch))
+        return;
+
+    /*
+     * keep val_prefetch_submit() from refreshing chains that are
+     * being resolved here
+     */
+    PF_LOCK(pf);
+    for (i = 0; i < pf->npins; i++)
+        pf->pins[i].busy = 1;
+    PF_UNLOCK(pf);
+
+    for (i = 0;; i++) {
+        PF_LOCK(pf);
+        if (i >= pf->npins) {
+            PF_UNLOCK(pf);
+            break;
+        }
+        memcpy(zone_n, pf->pins[i].zone_n,
+               wire_name_length(pf->pins[i].zone_n));
+        PF_UNLOCK(pf);
+
+        results = NULL;
+        if (-1 == ns_name_ntop(zone_n, zone_p, sizeof(zone_p)) ||
+            VAL_NO_ERROR != val_resolve_and_check(context, zone_p, ns_c_in,
+                                                  ns_t_dnskey, 0,
+                                                  &results)) {
+            _pin_update(context, zone_n, NULL);
+        } else {
+            _pin_update(context, zone_n, results);
+        }
+        val_free_result_chain(results);
+    }
+}
+
+#ifndef VAL_NO_ASYNC
+
+/*
+ * Callback for pinned chain refreshes; cb_data is a copy of the zone
+ * name.
+ */
+static int
+_pin_done(val_async_status *as, int event, val_context_t *ctx,
+          void *cb_data, val_cb_params_t *cbp)
+{
+    struct val_prefetch *pf;
+
+    if (NULL != ctx && NULL != (pf = ctx->prefetch)) {
+        _pin_update(ctx, (u_char *) cb_data,
+                    (VAL_AS_EVENT_COMPLETED == event && cbp) ?
+                    cbp->results : NULL);
+        PF_LOCK(pf);
+        if (pf->pin_inflight > 0)
+            pf->pin_inflight--;
+        PF_UNLOCK(pf);
+    }
+    if (cb_data)
+        FREE(cb_data);
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Callback for completed refreshes: publish trusted answers in place
+ * of the old snapshot.
+ */
+static int
+_prefetch_done(val_async_status *as, int event, val_context_t *ctx,
+               void *cb_data, val_cb_params_t *cbp)
+{
+    struct val_prefetch *pf;
+    u_char          name_n[NS_MAXCDNAME];
+
+    if (NULL == ctx)
+        return VAL_NO_ERROR;
+
+    /*
+     * cb_data holds the flags of the query being refreshed, as they
+     * were noted
+     */
+    if (VAL_AS_EVENT_COMPLETED == event && cbp && cbp->results &&
+        cbp->name &&
+        ns_name_pton(cbp->name, name_n, sizeof(name_n)) != -1) {
+        val_rcache_publish(ctx, name_n, cbp->class_h, cbp->type_h,
+                           (u_int32_t) (size_t) cb_data, cbp->results);
+    }
+
+    if (NULL != (pf = ctx->prefetch)) {
+        PF_LOCK(pf);
+        if (pf->inflight > 0)
+            pf->inflight--;
+        PF_UNLOCK(pf);
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Is this one of the library's own refresh requests?
+ */
+int
+val_prefetch_request(val_async_status *as)
+{
+    return (NULL != as && (as->val_as_result_cb == &_prefetch_done ||
+                           as->val_as_result_cb == &_pin_done));
+}
+
+#endif /* VAL_NO_ASYNC */
+
+/*
+ * Send the refreshes noted so far, and those of pinned chains that are
+ * due.  Must be called without any of the context's locks held.
+ */
+void
+val_prefetch_submit(val_context_t *context)
+{
+#ifndef VAL_NO_ASYNC
+    struct val_prefetch *pf;
+    struct pf_pending p;
+    val_async_status *as;
+    char            name_p[NS_MAXDNAME];
+    u_char         *zone_n;
+    time_t          now;
+    int             i;
+
+    if (NULL == context || NULL == (pf = context->prefetch))
+        return;
+
+    for (;;) {
+        PF_LOCK(pf);
+        if (0 == pf->npending) {
+            PF_UNLOCK(pf);
+            break;
+        }
+        p = pf->pending[--pf->npending];
+        pf->inflight++;
+        PF_UNLOCK(pf);
+
+        if (-1 == ns_name_ntop(p.name_n, name_p, sizeof(name_p)) ||
+            VAL_NO_ERROR != val_async_submit(context, name_p, p.class_h,
+                                             p.type_h,
+                                             p.flags | VAL_QUERY_SKIP_CACHE,
+                                             &_prefetch_done,
+                                             (void *) (size_t) p.flags,
+                                             &as)) {
+            PF_LOCK(pf);
+            pf->inflight--;
+            PF_UNLOCK(pf);
+            continue;
+        }
+        VAL_STATS_INC(vs_prefetches);
+        val_log(context, LOG_INFO,
+                "val_prefetch_submit(): Refreshing {%s %s %s} before it expires",
+                name_p, p_class(p.class_h), p_type(p.type_h));
+    }
+
+    now = time(NULL);
+    for (;;) {
+        PF_LOCK(pf);
+        for (i = 0; i < pf->npins; i++)
+            if (!pf->pins[i].busy && pf->pins[i].due <= now)
+                break;
+        if (i == pf->npins) {
+            PF_UNLOCK(pf);
+            break;
+        }
+        zone_n = (u_char *) MALLOC(NS_MAXCDNAME);
+        if (NULL == zone_n) {
+            PF_UNLOCK(pf);
+            break;
+        }
+        memcpy(zone_n, pf->pins[i].zone_n,
+               wire_name_length(pf->pins[i].zone_n));
+        pf->pins[i].busy = 1;
+        pf->pin_inflight++;
+        PF_UNLOCK(pf);
+
+        if (-1 == ns_name_ntop(zone_n, name_p, sizeof(name_p)) ||
+            VAL_NO_ERROR != val_async_submit(context, name_p, ns_c_in,
+                                             ns_t_dnskey,
+                                             VAL_QUERY_SKIP_CACHE,
+                                             &_pin_done, zone_n, &as)) {
+            _pin_update(context, zone_n, NULL);
+            FREE(zone_n);
+            PF_LOCK(pf);
+            pf->pin_inflight--;
+            PF_UNLOCK(pf);
+            continue;
+        }
+        VAL_STATS_INC(vs_prefetches);
+        val_log(context, LOG_INFO,
+                "val_prefetch_submit(): Refreshing the chain of trust for %s",
+                name_p);
+    }
+#endif
+}
+
+/*
+ * Give the refreshes in flight a chance to progress, without waiting,
+ * unless someone else drives them: the worker engine, or the
+ * application itself because the thread has requests of its own.
+ * Refreshes belong to every thread (see val_async_owned()), so they
+ * move on whichever thread looks up next, not only on the one whose
+ * lookup noted them.
+ */
+void
+val_prefetch_poll(val_context_t *context)
+{
+#ifndef VAL_NO_ASYNC
+    struct val_prefetch *pf;
+    val_async_status *as;
+    struct timeval  tv;
+    int             refreshes = 0, others = 0;
+#ifndef VAL_NO_THREADS
+    pthread_t       self = pthread_self();
+#endif
+
+    if (NULL == context || NULL == (pf = context->prefetch))
+        return;
+
+    PF_LOCK(pf);
+    refreshes = pf->inflight + pf->pin_inflight;
+    PF_UNLOCK(pf);
+    if (0 == refreshes)
+        return;
+
+    refreshes = 0;
+    CTX_LOCK_ACACHE(context);
+#ifndef VAL_NO_THREADS
+    if (context->as_engine)
+        others = 1;
+#endif
+    for (as = context->as_list; as && !others; as = as->val_as_next) {
+        if (val_prefetch_request(as))
+            refreshes = 1;
+#ifndef VAL_NO_THREADS
+        else if (pthread_equal(self, as->val_as_tid))
+            others = 1;
+#else
+        else
+            others = 1;
+#endif
+    }
+    CTX_UNLOCK_ACACHE(context);
+
+    if (refreshes && !others) {
+        timerclear(&tv);
+        val_async_check_wait(context, NULL, NULL, &tv, 0);
+    }
+#endif
+}
+
+/*
+ * Cancel all refreshes in flight, e.g. before the context is freed.
+ */
+void
+val_prefetch_cancel(val_context_t *context)
+{
+#ifndef VAL_NO_ASYNC
+    val_async_status *as;
+
+    if (NULL == context)
+        return;
+
+    for (;;) {
+        CTX_LOCK_ACACHE(context);
+        for (as = context->as_list; as; as = as->val_as_next)
+            if (val_prefetch_request(as))
+                break;
+        CTX_UNLOCK_ACACHE(context);
+        if (NULL == as)
+            break;
+        val_async_cancel(context, as, 0);
+    }
+#endif
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_PREFETCH_H
+#define VAL_PREFETCH_H
+
+struct val_prefetch *val_prefetch_create(void);
+void            val_prefetch_destroy(struct val_prefetch *pf);
+
+int             val_prefetch_due(val_context_t *context, unsigned long hits,
+                                 long start, long expires, long now);
+void            val_prefetch_query_hit(val_context_t *context,
+                                       struct val_query_chain *q, long now);
+void            val_prefetch_note(val_context_t *context, u_char *name_n,
+                                  u_int16_t class_h, u_int16_t type_h,
+                                  u_int32_t flags);
+void            val_prefetch_pin(val_context_t *context);
+void            val_prefetch_warm(val_context_t *context);
+void            val_prefetch_submit(val_context_t *context);
+void            val_prefetch_poll(val_context_t *context);
+void            val_prefetch_cancel(val_context_t *context);
+
+#ifndef VAL_NO_ASYNC
+int             val_prefetch_request(val_async_status *as);
+#endif
+
+#endif /* VAL_PREFETCH_H */
@@ -0,0 +1,803 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Snapshots of validated results, shared by all threads of a context.
+ *
+ * When val_resolve_and_check() has built a trusted answer, a private
+ * copy of the result chain is published in a hash table, keyed by the
+ * query name, class, type and flags.  Published snapshots are never
+ * modified, so later queries for the same data copy the snapshot out
+ * without taking the context's policy-cache lock and without walking
+ * the query list and re-validating the cached rrsets.
+ *
+ * With serve-stale enabled, snapshots are kept for a bounded window
+ * after they expire.  They are no longer used for normal lookups, but
+ * val_resolve_and_check() can fall back on them when the name servers
+ * do not answer in time.
+ *
+ * Readers take no locks.  Writers are serialized by a mutex, link new
+ * snapshots in with a single pointer store and unlink old ones the same
+ * way.  Unlinked snapshots are freed with epoch based reclamation: every
+ * reader announces the epoch it started in, in one of a fixed number of
+ * reader slots, and a snapshot retired in epoch e is only freed once the
+ * global epoch has moved to e + 2, which can only happen after every
+ * reader active in epoch e has finished.  Without compiler support for
+ * atomic operations readers fall back to the writer mutex.
+ */
+#include "validator-internal.h"
+
+#include "val_rcache.h"
+#include "val_prefetch.h"
+
+#define RC_BUCKETS      1024    /* must be a power of two */
+#define RC_MAX_ENTRIES  8192
+#define RC_READERS      128
+#define RC_STALE_TTL    30      /* TTL of stale answers, as in RFC 8767, and
+                                 * how long to keep serving them without
+                                 * waiting for the name servers again */
+
+#if !defined(VAL_NO_THREADS) && defined(__GNUC__) && defined(__ATOMIC_SEQ_CST)
+#define RC_LOCKFREE 1
+#define RC_LOAD(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define RC_STORE(p, v)  __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RC_HIT(p)       __atomic_add_fetch(&(p), 1, __ATOMIC_RELAXED)
+#define RC_CLAIM(p)     __atomic_exchange_n(&(p), 1, __ATOMIC_RELAXED)
+#else
+#define RC_LOAD(p)      (p)
+#define RC_STORE(p, v)  ((p) = (v))
+#define RC_HIT(p)       (++(p))
+#define RC_CLAIM(p)     _rc_claim(&(p))
+#endif
+
+#ifndef VAL_NO_THREADS
+#define RC_LOCK(rc)     pthread_mutex_lock(&(rc)->lock)
+#define RC_UNLOCK(rc)   pthread_mutex_unlock(&(rc)->lock)
+#else
+#define RC_LOCK(rc)
+#define RC_UNLOCK(rc)
+#endif
+
+struct rc_entry {
+    struct rc_entry    *next;       /* bucket chain, written by writers only */
+    struct rc_entry    *retired_next;
+    u_int32_t           hash;
+    u_int16_t           class_h;
+    u_int16_t           type_h;
+    u_int32_t           flags;
+    time_t              created;
+    time_t              expires;
+    time_t              stale_until; /* kept for serve-stale until then */
+    time_t              stale_served; /* last served stale */
+    unsigned long       hits;       /* lookups served, for prefetching */
+    int                 prefetched; /* a refresh has been requested */
+    struct val_result_chain *results;
+    u_char              name_n[NS_MAXCDNAME];
+};
+
+#ifndef RC_LOCKFREE
+static int
+_rc_claim(int *flag)
+{
+    int             old = *flag;
+
+    *flag = 1;
+    return old;
+}
+#endif
+
+#ifdef RC_LOCKFREE
+/* one cache line per slot, so that readers do not share lines */
+struct rc_reader {
+    unsigned long       epoch;      /* 0 if the slot is free */
+    char                pad[64 - sizeof(unsigned long)];
+};
+#endif
+
+struct val_rcache {
+#ifndef VAL_NO_THREADS
+    pthread_mutex_t     lock;       /* serializes writers */
+#endif
+    struct rc_entry    *buckets[RC_BUCKETS];
+    int                 count;
+#ifdef RC_LOCKFREE
+    unsigned long       epoch;
+    struct rc_entry    *retired[3]; /* indexed by retirement epoch % 3 */
+    struct rc_reader    readers[RC_READERS];
+#endif
+};
+
+/*============================================================================
+ *
+ * COPYING RESULT CHAINS
+ *
+ *===========================================================================*/
+
+/*
+ * copy a list of rr_recs into a single block, like copy_rr_rec_list()
+ */
+static struct val_rr_rec *
+_rc_copy_rr_list(const struct val_rr_rec *o_rr, int *err)
+{
+    const struct val_rr_rec *c_rr;
+    struct val_rr_rec *n_rr, *head_rr;
+    size_t          siz = 0;
+    u_char         *buf;
+
+    if (NULL == o_rr)
+        return NULL;
+
+    for (c_rr = o_rr; c_rr; c_rr = c_rr->rr_next)
+        siz += c_rr->rr_rdata_length + sizeof(struct val_rr_rec);
+
+    buf = (u_char *) MALLOC(siz * sizeof(u_char));
+    if (NULL == buf) {
+        *err = 1;
+        return NULL;
+    }
+    head_rr = (struct val_rr_rec *) buf;
+
+    for (c_rr = o_rr; c_rr; c_rr = c_rr->rr_next) {
+        n_rr = (struct val_rr_rec *) buf;
+        n_rr->rr_rdata = buf + sizeof(struct val_rr_rec);
+        memcpy(n_rr->rr_rdata, c_rr->rr_rdata, c_rr->rr_rdata_length);
+        n_rr->rr_rdata_length = c_rr->rr_rdata_length;
+        n_rr->rr_status = c_rr->rr_status;
+        buf += sizeof(struct val_rr_rec) + n_rr->rr_rdata_length;
+        n_rr->rr_next = c_rr->rr_next ? (struct val_rr_rec *) buf : NULL;
+    }
+
+    return head_rr;
+}
+
+/*
+ * Copy an rrset, reducing its TTL by the given number of seconds
+ */
+static struct val_rrset_rec *
+_rc_copy_rrset(const struct val_rrset_rec *o, long elapsed)
+{
+    struct val_rrset_rec *n;
+    int             err = 0;
+
+    n = (struct val_rrset_rec *) MALLOC(sizeof(struct val_rrset_rec));
+    if (NULL == n)
+        return NULL;
+    memcpy(n, o, sizeof(struct val_rrset_rec));
+    n->val_rrset_server = NULL;
+    n->val_rrset_ttl = (o->val_rrset_ttl > elapsed) ?
+        o->val_rrset_ttl - elapsed : 0;
+
+    n->val_rrset_data = _rc_copy_rr_list(o->val_rrset_data, &err);
+    n->val_rrset_sig = _rc_copy_rr_list(o->val_rrset_sig, &err);
+    if (o->val_rrset_server) {
+        n->val_rrset_server =
+            (struct sockaddr *) MALLOC(sizeof(struct sockaddr_storage));
+        if (NULL == n->val_rrset_server)
+            err = 1;
+        else
+            memcpy(n->val_rrset_server, o->val_rrset_server,
+                   sizeof(struct sockaddr_storage));
+    }
+
+    if (err) {
+        if (n->val_rrset_data)
+            FREE(n->val_rrset_data);
+        if (n->val_rrset_sig)
+            FREE(n->val_rrset_sig);
+        if (n->val_rrset_server)
+            FREE(n->val_rrset_server);
+        FREE(n);
+        return NULL;
+    }
+    return n;
+}
+
+/*
+ * Copy an authentication chain into *n_ac.  On error the partial copy
+ * is left in *n_ac for the caller to free with the rest of the result.
+ */
+static int
+_rc_copy_ac(const struct val_authentication_chain *o_ac,
+            struct val_authentication_chain **n_ac, long elapsed)
+{
+    struct val_authentication_chain *ac;
+
+    *n_ac = NULL;
+    for (; o_ac; o_ac = o_ac->val_ac_trust) {
+        ac = (struct val_authentication_chain *)
+            MALLOC(sizeof(struct val_authentication_chain));
+        if (NULL == ac)
+            return VAL_OUT_OF_MEMORY;
+        ac->val_ac_status = o_ac->val_ac_status;
+        ac->val_ac_rrset = NULL;
+        ac->val_ac_trust = NULL;
+        *n_ac = ac;
+        n_ac = &ac->val_ac_trust;
+
+        if (o_ac->val_ac_rrset &&
+            NULL == (ac->val_ac_rrset =
+                     _rc_copy_rrset(o_ac->val_ac_rrset, elapsed)))
+            return VAL_OUT_OF_MEMORY;
+    }
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Make a deep copy of a result chain that can be released with
+ * val_free_result_chain().  TTLs are reduced by elapsed seconds.
+ */
+static struct val_result_chain *
+_rc_copy_results(const struct val_result_chain *o_res, long elapsed)
+{
+    struct val_result_chain *head = NULL, *prev = NULL, *res;
+    int             i;
+
+    for (; o_res; o_res = o_res->val_rc_next) {
+        res = (struct val_result_chain *)
+            MALLOC(sizeof(struct val_result_chain));
+        if (NULL == res)
+            goto err;
+        memset(res, 0, sizeof(struct val_result_chain));
+        if (prev)
+            prev->val_rc_next = res;
+        else
+            head = res;
+        prev = res;
+
+        res->val_rc_status = o_res->val_rc_status;
+        if (o_res->val_rc_alias) {
+            size_t          alen = strlen(o_res->val_rc_alias) + 1;
+            res->val_rc_alias = (char *) MALLOC(alen);
+            if (NULL == res->val_rc_alias)
+                goto err;
+            memcpy(res->val_rc_alias, o_res->val_rc_alias, alen);
+        }
+
+        if (o_res->val_rc_answer) {
+            if (VAL_NO_ERROR != _rc_copy_ac(o_res->val_rc_answer,
+                                            &res->val_rc_answer, elapsed))
+                goto err;
+            /* val_rc_rrset only ever points into the answer chain */
+            if (o_res->val_rc_rrset == o_res->val_rc_answer->val_ac_rrset)
+                res->val_rc_rrset = res->val_rc_answer->val_ac_rrset;
+        } else if (o_res->val_rc_rrset &&
+                   NULL == (res->val_rc_rrset =
+                            _rc_copy_rrset(o_res->val_rc_rrset, elapsed))) {
+            goto err;
+        }
+
+        res->val_rc_proof_count = o_res->val_rc_proof_count;
+        for (i = 0; i < MAX_PROOFS && o_res->val_rc_proofs[i]; i++) {
+            if (VAL_NO_ERROR != _rc_copy_ac(o_res->val_rc_proofs[i],
+                                            &res->val_rc_proofs[i], elapsed))
+                goto err;
+        }
+    }
+    return head;
+
+  err:
+    val_free_result_chain(head);
+    return NULL;
+}
+
+/*
+ * Give every rrset in a private copy of a result chain the same TTL
+ */
+static void
+_rc_set_results_ttl(struct val_result_chain *res, long ttl)
+{
+    struct val_authentication_chain *ac;
+    int             i;
+
+    for (; res; res = res->val_rc_next) {
+        for (i = -1; i < MAX_PROOFS; i++) {
+            ac = (i < 0) ? res->val_rc_answer : res->val_rc_proofs[i];
+            if (i >= 0 && NULL == ac)
+                break;
+            for (; ac; ac = ac->val_ac_trust) {
+                if (ac->val_ac_rrset)
+                    ac->val_ac_rrset->val_rrset_ttl = ttl;
+            }
+        }
+        if (!res->val_rc_answer && res->val_rc_rrset)
+            res->val_rc_rrset->val_rrset_ttl = ttl;
+    }
+}
+
+/*
+ * The smallest TTL of all the RRsets in a result chain, including those
+ * in its authentication chains, or 0 if the chain has no data or, when
+ * trusted_only is set, if any of its results is not trusted.
+ */
+long
+val_rcache_results_ttl(const struct val_result_chain *res, int trusted_only)
+{
+    const struct val_authentication_chain *ac;
+    long            ttl = -1;
+    int             i;
+
+    if (NULL == res)
+        return 0;
+
+    for (; res; res = res->val_rc_next) {
+        int             have_data = 0;
+
+        if (trusted_only && !val_istrusted(res->val_rc_status))
+            return 0;
+
+        for (i = -1; i < MAX_PROOFS; i++) {
+            ac = (i < 0) ? res->val_rc_answer : res->val_rc_proofs[i];
+            if (i >= 0 && NULL == ac)
+                break;
+            for (; ac; ac = ac->val_ac_trust) {
+                if (NULL == ac->val_ac_rrset)
+                    continue;
+                have_data = 1;
+                if (ttl < 0 || ac->val_ac_rrset->val_rrset_ttl < ttl)
+                    ttl = ac->val_ac_rrset->val_rrset_ttl;
+            }
+        }
+        if (!res->val_rc_answer && res->val_rc_rrset) {
+            have_data = 1;
+            if (ttl < 0 || res->val_rc_rrset->val_rrset_ttl < ttl)
+                ttl = res->val_rc_rrset->val_rrset_ttl;
+        }
+        if (!have_data)
+            return 0;
+    }
+
+    return (ttl > 0) ? ttl : 0;
+}
+
+/*============================================================================
+ *
+ * READERS AND RECLAMATION
+ *
+ *===========================================================================*/
+
+static u_int32_t
+_rc_hash(const struct canon_name *cn, u_int16_t class_h, u_int16_t type_h,
+         u_int32_t flags)
+{
+    u_int32_t       h = cn->cn_hash;
+
+    h = (h ^ class_h) * 16777619U;
+    h = (h ^ type_h) * 16777619U;
+    h = (h ^ flags) * 16777619U;
+    return h;
+}
+
+static int
+_rc_match(const struct rc_entry *e, u_int32_t hash,
+          const struct canon_name *cn, u_int16_t class_h, u_int16_t type_h,
+          u_int32_t flags)
+{
+    return e->hash == hash && e->class_h == class_h &&
+        e->type_h == type_h && e->flags == flags &&
+        canon_name_equal(cn, e->name_n);
+}
+
+static void
+_rc_entry_free(struct rc_entry *e)
+{
+    val_free_result_chain(e->results);
+    FREE(e);
+}
+
+#ifdef RC_LOCKFREE
+
+/*
+ * Announce a reader in the current epoch.  Returns the reader slot, or
+ * NULL if all slots are busy, in which case the cache is not used.
+ */
+static struct rc_reader *
+_rc_read_begin(struct val_rcache *rc)
+{
+    struct rc_reader *r;
+    unsigned long   e, cur, zero;
+    size_t          h;
+    int             i;
+
+    /* spread threads over the slots by the address of their stack */
+    h = (size_t) &h;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+
+    e = __atomic_load_n(&rc->epoch, __ATOMIC_SEQ_CST);
+    for (i = 0; i < RC_READERS; i++) {
+        r = &rc->readers[(h + i) % RC_READERS];
+        zero = 0;
+        if (__atomic_load_n(&r->epoch, __ATOMIC_RELAXED) != 0 ||
+            !__atomic_compare_exchange_n(&r->epoch, &zero, e, 0,
+                                         __ATOMIC_SEQ_CST,
+                                         __ATOMIC_RELAXED))
+            continue;
+        /* the epoch may have moved on before our slot became visible */
+        while ((cur = __atomic_load_n(&rc->epoch, __ATOMIC_SEQ_CST)) != e) {
+            e = cur;
+            __atomic_store_n(&r->epoch, e, __ATOMIC_SEQ_CST);
+        }
+        return r;
+    }
+    return NULL;
+}
+
+static void
+_rc_read_end(struct rc_reader *r)
+{
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Free snapshots that no reader can still see and move to the next
+ * epoch, if every active reader has caught up with the current one.
+ * Must be called with the writer lock held.
+ */
+static void
+_rc_reclaim(struct val_rcache *rc)
+{
+    struct rc_entry *e;
+    unsigned long   epoch = rc->epoch, r;
+    int             i;
+
+    for (i = 0; i < RC_READERS; i++) {
+        r = __atomic_load_n(&rc->readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (r != 0 && r != epoch)
+            return;
+    }
+
+    /* snapshots retired two epochs ago */
+    while (NULL != (e = rc->retired[(epoch + 1) % 3])) {
+        rc->retired[(epoch + 1) % 3] = e->retired_next;
+        _rc_entry_free(e);
+    }
+    __atomic_store_n(&rc->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Must be called with the writer lock held, after e was unlinked.
+ */
+static void
+_rc_retire(struct val_rcache *rc, struct rc_entry *e)
+{
+    e->retired_next = rc->retired[rc->epoch % 3];
+    rc->retired[rc->epoch % 3] = e;
+}
+
+#define RC_READ_BEGIN(rc, r)    (NULL != ((r) = _rc_read_begin(rc)))
+#define RC_READ_END(rc, r)      _rc_read_end(r)
+
+#else /* RC_LOCKFREE */
+
+struct rc_reader;
+#define _rc_reclaim(rc)
+#define _rc_retire(rc, e)       _rc_entry_free(e)
+#ifndef VAL_NO_THREADS
+#define RC_READ_BEGIN(rc, r)    (pthread_mutex_lock(&(rc)->lock), (r) = NULL, 1)
+#else
+#define RC_READ_BEGIN(rc, r)    ((r) = NULL, 1)
+#endif
+#define RC_READ_END(rc, r)      RC_UNLOCK(rc)
+
+#endif /* RC_LOCKFREE */
+
+/*
+ * Unlink and retire entries in a bucket that have expired (or, if
+ * stale is set, that have only been kept for serve-stale), or that
+ * match the given key if cn is not NULL.  Must be called with the
+ * writer lock held.
+ */
+static void
+_rc_prune_bucket(struct val_rcache *rc, struct rc_entry **bucket,
+                 time_t now, int stale, u_int32_t hash,
+                 const struct canon_name *cn,
+                 u_int16_t class_h, u_int16_t type_h, u_int32_t flags)
+{
+    struct rc_entry *e, *next, *prev = NULL;
+
+    for (e = *bucket; e; e = next) {
+        next = e->next;
+        if (e->stale_until <= now || (stale && e->expires <= now) ||
+            (cn && _rc_match(e, hash, cn, class_h, type_h, flags))) {
+            if (prev)
+                RC_STORE(prev->next, next);
+            else
+                RC_STORE(*bucket, next);
+            _rc_retire(rc, e);
+            rc->count--;
+        } else
+            prev = e;
+    }
+}
+
+/*============================================================================
+ *
+ * INTERFACE
+ *
+ *===========================================================================*/
+
+struct val_rcache *
+val_rcache_create(void)
+{
+    struct val_rcache *rc;
+
+    rc = (struct val_rcache *) MALLOC(sizeof(struct val_rcache));
+    if (NULL == rc)
+        return NULL;
+    memset(rc, 0, sizeof(struct val_rcache));
+#ifdef RC_LOCKFREE
+    rc->epoch = 1;
+#endif
+#ifndef VAL_NO_THREADS
+    if (0 != pthread_mutex_init(&rc->lock, NULL)) {
+        FREE(rc);
+        return NULL;
+    }
+#endif
+    return rc;
+}
+
+/*
+ * Free the cache.  There must be no readers left.
+ */
+void
+val_rcache_destroy(struct val_rcache *rc)
+{
+    struct rc_entry *e;
+    int             i;
+
+    if (NULL == rc)
+        return;
+
+    for (i = 0; i < RC_BUCKETS; i++) {
+        while (NULL != (e = rc->buckets[i])) {
+            rc->buckets[i] = e->next;
+            _rc_entry_free(e);
+        }
+    }
+#ifdef RC_LOCKFREE
+    for (i = 0; i < 3; i++) {
+        while (NULL != (e = rc->retired[i])) {
+            rc->retired[i] = e->retired_next;
+            _rc_entry_free(e);
+        }
+    }
+#endif
+#ifndef VAL_NO_THREADS
+    pthread_mutex_destroy(&rc->lock);
+#endif
+    FREE(rc);
+}
+
+/*
+ * Drop all snapshots, e.g. because the context's policy has changed.
+ */
+void
+val_rcache_flush(val_context_t *context)
+{
+    struct val_rcache *rc;
+    struct rc_entry *e;
+    int             i;
+
+    if (NULL == context || NULL == (rc = context->rcache))
+        return;
+
+    RC_LOCK(rc);
+    for (i = 0; i < RC_BUCKETS; i++) {
+        while (NULL != (e = rc->buckets[i])) {
+            RC_STORE(rc->buckets[i], e->next);
+            _rc_retire(rc, e);
+        }
+    }
+    rc->count = 0;
+    _rc_reclaim(rc);
+    RC_UNLOCK(rc);
+}
+
+/*
+ * Look for a published snapshot of the results for a query.  Returns 1
+ * and a private copy of the results in *results if one was found, 0
+ * otherwise.  If prefetch is not NULL, it is set to 1 when the caller
+ * should have the snapshot refreshed before it expires.
+ */
+int
+val_rcache_lookup(val_context_t *context, u_char *name_n,
+                  u_int16_t class_h, u_int16_t type_h, u_int32_t flags,
+                  struct val_result_chain **results, int *prefetch)
+{
+    struct val_rcache *rc;
+    struct rc_reader *r;
+    struct rc_entry *e;
+    struct canon_name cn;
+    u_int32_t       hash;
+    time_t          now;
+    int             found = 0;
+
+    if (prefetch)
+        *prefetch = 0;
+    if (NULL == context || NULL == (rc = context->rcache) ||
+        NULL == name_n || NULL == results ||
+        canon_name_init(&cn, name_n) != 0)
+        return 0;
+
+    hash = _rc_hash(&cn, class_h, type_h, flags);
+    now = time(NULL);
+
+    if (!RC_READ_BEGIN(rc, r))
+        return 0;
+    for (e = RC_LOAD(rc->buckets[hash & (RC_BUCKETS - 1)]); e;
+         e = RC_LOAD(e->next)) {
+        if (e->expires > now &&
+            _rc_match(e, hash, &cn, class_h, type_h, flags)) {
+            *results = _rc_copy_results(e->results, (long) (now - e->created));
+            found = (*results != NULL);
+            if (found && prefetch &&
+                val_prefetch_due(context, RC_HIT(e->hits), (long) e->created,
+                                 (long) e->expires, (long) now) &&
+                !RC_CLAIM(e->prefetched))
+                *prefetch = 1;
+            break;
+        }
+    }
+    RC_READ_END(rc, r);
+
+    return found;
+}
+
+/*
+ * Look for a snapshot of the results for a query that has expired but
+ * is still within the serve-stale window.  Returns 1 and a private
+ * copy of the results, with the TTL of stale answers, in *results if
+ * one was found, 0 otherwise.  *recent is set if the snapshot was
+ * served stale so recently that the caller should not wait for the
+ * name servers before serving it again.
+ */
+int
+val_rcache_lookup_stale(val_context_t *context, u_char *name_n,
+                        u_int16_t class_h, u_int16_t type_h, u_int32_t flags,
+                        struct val_result_chain **results, int *recent)
+{
+    struct val_rcache *rc;
+    struct rc_reader *r;
+    struct rc_entry *e;
+    struct canon_name cn;
+    u_int32_t       hash;
+    time_t          now;
+    int             found = 0;
+
+    if (NULL == context || NULL == (rc = context->rcache) ||
+        NULL == name_n || NULL == results ||
+        canon_name_init(&cn, name_n) != 0)
+        return 0;
+
+    hash = _rc_hash(&cn, class_h, type_h, flags);
+    now = time(NULL);
+
+    if (!RC_READ_BEGIN(rc, r))
+        return 0;
+    for (e = RC_LOAD(rc->buckets[hash & (RC_BUCKETS - 1)]); e;
+         e = RC_LOAD(e->next)) {
+        if (e->stale_until > now &&
+            _rc_match(e, hash, &cn, class_h, type_h, flags)) {
+            *results = _rc_copy_results(e->results, 0);
+            found = (*results != NULL);
+            if (recent)
+                *recent = (RC_LOAD(e->stale_served) + RC_STALE_TTL > now);
+            break;
+        }
+    }
+    RC_READ_END(rc, r);
+
+    if (found)
+        _rc_set_results_ttl(*results, RC_STALE_TTL);
+    return found;
+}
+
+/*
+ * Remember that the snapshot for a query has just been served stale.
+ */
+void
+val_rcache_stale_served(val_context_t *context, u_char *name_n,
+                        u_int16_t class_h, u_int16_t type_h, u_int32_t flags)
+{
+    struct val_rcache *rc;
+    struct rc_reader *r;
+    struct rc_entry *e;
+    struct canon_name cn;
+    u_int32_t       hash;
+    time_t          now;
+
+    if (NULL == context || NULL == (rc = context->rcache) ||
+        NULL == name_n || canon_name_init(&cn, name_n) != 0)
+        return;
+
+    hash = _rc_hash(&cn, class_h, type_h, flags);
+    now = time(NULL);
+
+    if (!RC_READ_BEGIN(rc, r))
+        return;
+    for (e = RC_LOAD(rc->buckets[hash & (RC_BUCKETS - 1)]); e;
+         e = RC_LOAD(e->next)) {
+        if (_rc_match(e, hash, &cn, class_h, type_h, flags)) {
+            RC_STORE(e->stale_served, now);
+            break;
+        }
+    }
+    RC_READ_END(rc, r);
+}
+
+/*
+ * Publish a snapshot of the results of a query, replacing any older
+ * snapshot for the same query.  Results that are not trusted, or that
+ * have no TTL left, are not published.
+ */
+void
+val_rcache_publish(val_context_t *context, u_char *name_n,
+                   u_int16_t class_h, u_int16_t type_h, u_int32_t flags,
+                   struct val_result_chain *results)
+{
+    struct val_rcache *rc;
+    struct rc_entry *n, **bucket;
+    struct canon_name cn;
+    long            ttl;
+    int             i;
+
+    if (NULL == context || NULL == (rc = context->rcache) ||
+        NULL == name_n)
+        return;
+
+    if (0 == (ttl = val_rcache_results_ttl(results, 1)))
+        return;
+
+    if (canon_name_init(&cn, name_n) != 0)
+        return;
+
+    n = (struct rc_entry *) MALLOC(sizeof(struct rc_entry));
+    if (NULL == n)
+        return;
+    memset(n, 0, sizeof(struct rc_entry));
+    memcpy(n->name_n, name_n, cn.cn_len);
+    n->hash = _rc_hash(&cn, class_h, type_h, flags);
+    n->class_h = class_h;
+    n->type_h = type_h;
+    n->flags = flags;
+    n->created = time(NULL);
+    n->expires = n->created + ttl;
+    n->stale_until = n->expires;
+    if (context->g_opt && context->g_opt->serve_stale > 0)
+        n->stale_until += context->g_opt->serve_stale;
+    if (NULL == (n->results = _rc_copy_results(results, 0))) {
+        FREE(n);
+        return;
+    }
+
+    RC_LOCK(rc);
+    bucket = &rc->buckets[n->hash & (RC_BUCKETS - 1)];
+    _rc_prune_bucket(rc, bucket, n->created, 0, n->hash, &cn,
+                     class_h, type_h, flags);
+    if (rc->count >= RC_MAX_ENTRIES) {
+        for (i = 0; i < RC_BUCKETS; i++)
+            _rc_prune_bucket(rc, &rc->buckets[i], n->created, 0,
+                             0, NULL, 0, 0, 0);
+    }
+    /* fresh snapshots are worth more than stale ones */
+    if (rc->count >= RC_MAX_ENTRIES) {
+        for (i = 0; i < RC_BUCKETS; i++)
+            _rc_prune_bucket(rc, &rc->buckets[i], n->created, 1,
+                             0, NULL, 0, 0, 0);
+    }
+    if (rc->count < RC_MAX_ENTRIES) {
+        n->next = *bucket;
+        RC_STORE(*bucket, n);
+        rc->count++;
+        n = NULL;
+    }
+    _rc_reclaim(rc);
+    RC_UNLOCK(rc);
+
+    if (n)
+        _rc_entry_free(n);
+}
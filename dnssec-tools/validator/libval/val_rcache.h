@@ -0,0 +1,32 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_RCACHE_H
+#define VAL_RCACHE_H
+
+struct val_rcache *val_rcache_create(void);
+void            val_rcache_destroy(struct val_rcache *rc);
+void            val_rcache_flush(val_context_t *context);
+
+int             val_rcache_lookup(val_context_t *context, u_char *name_n,
+                                  u_int16_t class_h, u_int16_t type_h,
+                                  u_int32_t flags,
+                                  struct val_result_chain **results,
+                                  int *prefetch);
+int             val_rcache_lookup_stale(val_context_t *context,
+                                        u_char *name_n, u_int16_t class_h,
+                                        u_int16_t type_h, u_int32_t flags,
+                                        struct val_result_chain **results,
+                                        int *recent);
+void            val_rcache_stale_served(val_context_t *context,
+                                        u_char *name_n, u_int16_t class_h,
+                                        u_int16_t type_h, u_int32_t flags);
+void            val_rcache_publish(val_context_t *context, u_char *name_n,
+                                   u_int16_t class_h, u_int16_t type_h,
+                                   u_int32_t flags,
+                                   struct val_result_chain *results);
+long            val_rcache_results_ttl(const struct val_result_chain *res,
+                                       int trusted_only);
+
+#endif /* VAL_RCACHE_H */
@@ -29,6 +29,14 @@
 #include "val_cache.h"
 #include "val_assertion.h"
 #include "val_context.h"
+#include "val_stats.h"
+#include "val_inflight.h"
+#include "val_mirror.h"
+
+#if !defined(VAL_NO_ASYNC) && defined(__linux__)
+#include <sys/epoll.h>
+#define VAL_HAVE_EPOLL 1
+#endif
 
 #define MERGE_RR(old_rr, new_rr) do{ \
 	if (old_rr == NULL) \
@@ -42,6 +50,10 @@
 	}\
 } while (0)
 
+#ifndef VAL_NO_ASYNC
+static void _async_sock_event(struct expected_arrival *ea, SOCKET sock,
+                              int event, void *cb_data);
+#endif
 static int _process_rcvd_response(val_context_t * context,
                                   struct queries_for_query *matched_qfq,
                                   struct domain_info **response,
@@ -1225,7 +1237,6 @@ follow_referral_or_alias_link(val_context_t * context,
                         zonecut_n)                                      \
     do {                                                                \
         struct rrset_rec *rr_set;                                       \
-        int ret_val;                                                    \
         u_char *r;                                                      \
         rr_set = find_rr_set (respondent_server, listtype, name_n,  \
                               type_h, set_type_h, class_h, ttl_h, hptr, \
@@ -1256,9 +1267,7 @@ follow_referral_or_alias_link(val_context_t * context,
             }                                                           \
         }                                                               \
         if (ret_val != VAL_NO_ERROR) {                                  \
-            res_sq_free_rrset_recs(&learned_zones);                     \
-            FREE(rdata);                                                \
-            return ret_val;                                             \
+            goto done;                                                  \
         }                                                               \
     } while (0)
 
@@ -1431,6 +1440,7 @@ prepare_empty_nonexistence(struct rrset_rec **answers,
     *answers = (struct rrset_rec *) MALLOC(sizeof(struct rrset_rec));
     if (*answers == NULL)
         return VAL_OUT_OF_MEMORY;
+    memset(*answers, 0, sizeof(struct rrset_rec));
 
     (*answers)->rrs_zonecut_n = NULL;
     (*answers)->rrs_name_n = (u_char *) MALLOC(length * sizeof(u_char));
@@ -1555,6 +1565,8 @@ digest_response(val_context_t * context,
     int             authoritive = 0;
     int             iterative = 0;
     u_char         *rdata;
+    int             rdata_allocated = 0;
+    u_char          rdata_buf[2 * NS_MAXCDNAME + NS_RRFIXEDSZ];
     u_char         *hptr;
     int             ret_val;
     int             nothing_other_than_alias;
@@ -1704,6 +1716,7 @@ digest_response(val_context_t * context,
     for (i = 0; i < rrs_to_go; i++) {
 
         rdata = NULL;
+        rdata_allocated = 0;
 
         /*
          * Determine what part of the response I'm reading 
@@ -1735,10 +1748,13 @@ digest_response(val_context_t * context,
          * response[rdata_index] is the first byte of the RDATA of the
          * record.  The data may contain domain names in compressed format,
          * so they need to be expanded.  This is type-dependent...
+         * Uncompressed RDATA is used in place; the RRset code makes its
+         * own copy of whatever it keeps.
          */
         if ((ret_val =
-             decompress(&rdata, response_data, rdata_index, end, type_h,
-                        &rdata_len_h)) != VAL_NO_ERROR) {
+             rdata_view(&rdata, &rdata_allocated, rdata_buf,
+                        sizeof(rdata_buf), response_data, rdata_index, end,
+                        type_h, &rdata_len_h)) != VAL_NO_ERROR) {
             matched_q->qc_state = Q_RESPONSE_ERROR;
             ret_val = VAL_NO_ERROR;
             goto done;
@@ -2046,7 +2062,8 @@ digest_response(val_context_t * context,
             }
         }
 
-        FREE(rdata);
+        if (rdata_allocated)
+            FREE(rdata);
         rdata = NULL;
 
     } 
@@ -2170,7 +2187,7 @@ digest_response(val_context_t * context,
     return ret_val;
 
   done:
-    if (rdata)
+    if (rdata && rdata_allocated)
         FREE(rdata);
     res_sq_free_rrset_recs(&learned_answers);
     res_sq_free_rrset_recs(&learned_proofs);
@@ -2191,6 +2208,7 @@ val_resquery_send(val_context_t * context,
     char            zone_p[NS_MAXDNAME];
     char            name_buf[INET6_ADDRSTRLEN + 1];
     int             ret_val;
+    int             joined = 0;
     struct name_server *tempns;
     struct val_query_chain *matched_q;
     struct name_server *nslist;
@@ -2240,10 +2258,13 @@ val_resquery_send(val_context_t * context,
     gettimeofday(&now, NULL);
     matched_q->qc_last_sent = now.tv_sec;
 
-    if ((ret_val =
-         query_send(name_p, matched_q->qc_type_h, matched_q->qc_class_h,
-                    nslist, &(matched_q->qc_trans_id))) == SR_UNSET)
+    if ((ret_val = val_inflight_send(matched_q, nslist, name_p,
+                                     &joined)) == SR_UNSET) {
+        /* queries that joined an identical one did not send anything */
+        if (!joined)
+            VAL_STATS_INC(vs_net_queries);
         return VAL_NO_ERROR;
+    }
 
     /*
      * ret_val contains a resolver error 
@@ -2283,8 +2304,14 @@ val_resquery_rcv(val_context_t * context,
 
     matched_q = matched_qfq->qfq_query; /* Can never be NULL if matched_qfq is not NULL */
     *response = NULL;
-    ret_val = response_recv(&(matched_q->qc_trans_id), pending_desc, closest_event,
-                            &server, &response_data, &response_length);
+    if (matched_q->qc_inflight)
+        ret_val = val_inflight_recv(matched_q, pending_desc, closest_event,
+                                    &server, &response_data,
+                                    &response_length);
+    else
+        ret_val = response_recv(&(matched_q->qc_trans_id), pending_desc,
+                                closest_event, &server, &response_data,
+                                &response_length);
 
     if (ret_val == SR_NO_ANSWER_YET)
         return VAL_NO_ERROR;
@@ -2328,6 +2355,8 @@ val_res_cancel(struct val_query_chain *matched_q)
 #endif
     if (matched_q->qc_trans_id != -1)
         res_cancel(&(matched_q->qc_trans_id));
+
+    val_inflight_release(matched_q);
 }
 
 void
@@ -2345,6 +2374,7 @@ val_res_nsfallback(val_context_t *context, struct val_query_chain *matched_q,
      */
     if (matched_q->qc_flags & VAL_QUERY_NO_EDNS0_FALLBACK) {
         matched_q->qc_state = Q_RESPONSE_ERROR;
+        val_inflight_done(matched_q, NULL, NULL, 0);
         val_res_cancel(matched_q);
         return;
     }
@@ -2356,11 +2386,17 @@ val_res_nsfallback(val_context_t *context, struct val_query_chain *matched_q,
                                     matched_q->qc_type_h);
     else
 #endif
+    if (matched_q->qc_inflight)
+        ret_val = val_inflight_fallback(matched_q, closest_event, server,
+                                        name_p);
+    else
         ret_val = res_nsfallback(matched_q->qc_trans_id, closest_event, server,
                                  name_p, matched_q->qc_class_h, 
                                  matched_q->qc_type_h);
     if (ret_val < 0) {
         matched_q->qc_state = Q_RESPONSE_ERROR;
+        /* let the queries that share this one know they are out of luck */
+        val_inflight_done(matched_q, NULL, NULL, 0);
         val_res_cancel(matched_q);
     }
     else if (1 == ret_val) {
@@ -2373,6 +2409,119 @@ val_res_nsfallback(val_context_t *context, struct val_query_chain *matched_q,
     }
 }
 
+/*
+ * Initialize the response structure for an answer to matched_q
+ */
+static struct domain_info *
+_new_response(struct val_query_chain *matched_q, const char *name_p)
+{
+    struct domain_info *response;
+
+    response = (struct domain_info *) MALLOC(sizeof(struct domain_info));
+    if (response == NULL)
+        return NULL;
+
+    response->di_answers = NULL;
+    response->di_proofs = NULL;
+    response->di_qnames = NULL;
+    response->di_requested_type_h = matched_q->qc_type_h;
+    response->di_requested_class_h = matched_q->qc_class_h;
+
+    if ((response->di_requested_name_h = STRDUP(name_p)) == NULL) {
+        FREE(response);
+        return NULL;
+    }
+    return response;
+}
+
+/*
+ * Answer a query from a local copy of its zone (see val_mirror.c)
+ * instead of sending it.  The answer is digested just like one from
+ * the name servers in qc_ns_list, the first of which is recorded as
+ * the respondent.  *answered is set if the copy had something to say;
+ * the query is then either Q_ANSWERED with the answer in *response, or
+ * back in Q_INIT after a referral.  Otherwise the query is left as it
+ * was, to be sent to the network.
+ */
+int
+val_resquery_mirror(val_context_t * context,
+                    struct queries_for_query *matched_qfq,
+                    struct domain_info **response,
+                    struct queries_for_query **queries,
+                    int *answered)
+{
+    struct val_query_chain *matched_q;
+    struct name_server *server = NULL;
+    u_char         *response_data = NULL;
+    size_t          response_length = 0;
+    char            name_p[NS_MAXDNAME];
+    int             ret_val;
+
+    if ((context == NULL) || (matched_qfq == NULL) || (response == NULL) ||
+        (queries == NULL) || (answered == NULL))
+        return VAL_BAD_ARGUMENT;
+
+    matched_q = matched_qfq->qfq_query;
+    *response = NULL;
+    *answered = 0;
+
+    if (context->mirrors == NULL || matched_q->qc_ns_list == NULL ||
+        matched_q->qc_state != Q_INIT)
+        return VAL_NO_ERROR;
+
+    if (VAL_NO_ERROR != (ret_val = val_mirror_answer(context, matched_q,
+                                                     &response_data,
+                                                     &response_length)) ||
+        response_data == NULL)
+        return ret_val;
+
+    if (ns_name_ntop(matched_q->qc_name_n, name_p, sizeof(name_p)) == -1 ||
+        SR_UNSET != clone_ns(&server, matched_q->qc_ns_list)) {
+        FREE(response_data);
+        return VAL_NO_ERROR;
+    }
+
+    val_log(context, LOG_INFO,
+            "val_resquery_mirror(): Answering {%s %s(%d) %s(%d)} from a zone mirror",
+            name_p, p_class(matched_q->qc_class_h), matched_q->qc_class_h,
+            p_type(matched_q->qc_type_h), matched_q->qc_type_h);
+
+    if (matched_q->qc_respondent_server)
+        free_name_server(&matched_q->qc_respondent_server);
+    matched_q->qc_respondent_server = server;
+    matched_q->qc_last_sent = time(NULL);
+
+    *response = _new_response(matched_q, name_p);
+    if (*response == NULL) {
+        FREE(response_data);
+        return VAL_OUT_OF_MEMORY;
+    }
+
+    if ((ret_val = digest_response(context, matched_qfq, queries,
+                                   response_data, response_length,
+                                   *response)) != VAL_NO_ERROR ||
+        matched_q->qc_state == Q_RESPONSE_ERROR) {
+        free_domain_info_ptrs(*response);
+        FREE(*response);
+        *response = NULL;
+        FREE(response_data);
+        if (ret_val != VAL_NO_ERROR)
+            return ret_val;
+        /* let the network have a go */
+        if (matched_q->qc_respondent_server)
+            free_name_server(&matched_q->qc_respondent_server);
+        matched_q->qc_respondent_server = NULL;
+        matched_q->qc_state = Q_INIT;
+        return VAL_NO_ERROR;
+    }
+
+    (*response)->di_res_error = SR_UNSET;
+    *answered = 1;
+    VAL_STATS_INC(vs_mirror_answers);
+    FREE(response_data);
+    return VAL_NO_ERROR;
+}
+
 static int
 _process_rcvd_response(val_context_t * context,
                        struct queries_for_query *matched_qfq,
@@ -2384,41 +2533,34 @@ _process_rcvd_response(val_context_t * context,
                        u_char *response_data, size_t response_length)
 {
     struct val_query_chain *matched_q = matched_qfq->qfq_query;
+    struct name_server *shared_server = NULL;
     int ret_val;
 
     val_log(NULL, LOG_DEBUG, __FUNCTION__);
 
     matched_q->qc_respondent_server = server;
 
-    *response = (struct domain_info *) MALLOC(sizeof(struct domain_info));
+    /* we have an answer, that we need to process */
+    *response = _new_response(matched_q, name_p);
     if (*response == NULL) {
         if (response_data)
             FREE(response_data);
         return VAL_OUT_OF_MEMORY;
     }
 
-    /* we have an answer, that we need to process */
-
     /*
-     * Initialize the response structure 
+     * Queries sharing this one need to know who answered, but
+     * digest_response() may let go of the respondent
      */
-    (*response)->di_answers = NULL;
-    (*response)->di_proofs = NULL;
-    (*response)->di_qnames = NULL;
-    (*response)->di_requested_type_h = matched_q->qc_type_h;
-    (*response)->di_requested_class_h = matched_q->qc_class_h;
-
-    if (((*response)->di_requested_name_h = STRDUP(name_p)) == NULL) {
-        FREE(*response);
-        *response = NULL;
-        if (response_data)
-            FREE(response_data);
-        return VAL_OUT_OF_MEMORY;
-    }
+    if (matched_q->qc_inflight && server &&
+        SR_UNSET != clone_ns(&shared_server, server))
+        shared_server = NULL;
 
     if ((ret_val = digest_response(context, matched_qfq,
                                    queries, response_data, response_length,
                                    *response) != VAL_NO_ERROR)) {
+        if (shared_server)
+            free_name_server(&shared_server);
         free_domain_info_ptrs(*response);
         FREE(*response);
         *response = NULL;
@@ -2437,10 +2579,15 @@ _process_rcvd_response(val_context_t * context,
     }
     else {
         /* we're good to go, cancel pending query transactions */
+        if (shared_server)
+            val_inflight_done(matched_q, shared_server, response_data,
+                              response_length);
         val_res_cancel(matched_q);
         (*response)->di_res_error = SR_UNSET;
     }
 
+    if (shared_server)
+        free_name_server(&shared_server);
     FREE(response_data);
 
     /*
@@ -2499,11 +2646,26 @@ val_resquery_async_send(val_context_t * context,
         }
     }
 
-    matched_q->qc_ea = res_async_query_send(name_p, matched_q->qc_type_h,
-                                            matched_q->qc_class_h, 
-                                            matched_q->qc_ns_list);
+    /*
+     * Update the qc_last_sent timestamp, as val_resquery_send() does
+     */
+    matched_q->qc_last_sent = time(NULL);
+
+    /*
+     * same as res_async_query_send, but ask to be told about sockets
+     * before any are opened.
+     */
+    matched_q->qc_ea = res_async_query_create(name_p, matched_q->qc_type_h,
+                                              matched_q->qc_class_h, 
+                                              matched_q->qc_ns_list, 0);
     if (!matched_q->qc_ea)
         matched_q->qc_state = Q_QUERY_ERROR;
+    else {
+        res_async_query_set_sock_cb(matched_q->qc_ea, _async_sock_event,
+                                    context);
+        res_io_check_ea_list(matched_q->qc_ea, NULL, NULL, NULL, NULL);
+        VAL_STATS_INC(vs_net_queries);
+    }
 
     return VAL_NO_ERROR;
 }
@@ -2526,8 +2688,11 @@ val_resquery_async_rcv(val_context_t * context,
     struct val_query_chain *matched_q;
     int             ret_val, handled;
 
-    if ((matched_qfq == NULL) || (response == NULL) || (queries == NULL) ||
-        (pending_desc == NULL))
+    /*
+     * pending_desc may be NULL, in which case sockets marked ready by
+     * val_async_process_events are read.
+     */
+    if ((matched_qfq == NULL) || (response == NULL) || (queries == NULL))
         return VAL_BAD_ARGUMENT;
 
     val_log(NULL, LOG_DEBUG, __FUNCTION__);
@@ -2573,61 +2738,37 @@ val_resquery_async_rcv(val_context_t * context,
  }
 
 /*
+ * Add the sockets for all pending async requests to activefds (if not
+ * NULL) and move closest_event (if not NULL) to the time of the next
+ * retry or timeout.
  *
- * timeout is a relative value. e.g. 5 seconds
- */ 
-int
-val_async_select_info(val_context_t *ctx, fd_set *activefds,
-                      int *nfds, struct timeval *timeout)
+ * Must be called with the ACACHE lock held.
+ *
+ * Returns the number of requests that haven't completed.
+ */
+static int
+_async_collect_events(val_context_t *context, fd_set *activefds, int *nfds,
+                      struct timeval *closest_event)
 {
     val_async_status *as;
     struct queries_for_query *qfq;
-    val_context_t *context;
-    struct timeval   now, closest, *closest_event = &closest;
+    int               pending = 0;
 #ifndef VAL_NO_THREADS
     pthread_t                 self = pthread_self();
 #endif
 
-    /*
-     * get context, if needed
-     */
-    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
-    if (NULL == context)
-        return VAL_BAD_ARGUMENT;
-
-    val_log(NULL, LOG_DEBUG, __FUNCTION__);
-    gettimeofday(&now, NULL);
-
-    /** need to adjust relative timeout to absolute time used by libval */
-    if (timeout) {
-        if(timeout->tv_sec < LONG_MAX) {
-            /* add current time to delay */
-            timeradd(&now, timeout, &closest);
-        } else
-            memcpy(closest_event, timeout, sizeof(struct timeval));
-        if (closest.tv_sec < 0) {
-            closest.tv_sec = 0;
-            closest.tv_usec = 0;
-        }
-        else if (closest.tv_usec < 0)
-            closest.tv_usec = 0;
-    } else
-        closest_event = NULL;
-
-    CTX_LOCK_ACACHE(context);
-
     for (as = context->as_list; as; as = as->val_as_next) {
 
         int cache_only = 1;
 
 #ifndef VAL_NO_THREADS
-        if (! (as->val_as_ctx->ctx_flags & CTX_PROCESS_ALL_THREADS) &&
-            (! pthread_equal(self, as->val_as_tid)))
+        if (! val_async_owned(as, self))
             continue;
 #endif
+        ++pending;
         if (as->val_as_flags & VAL_AS_DONE) {
-            closest.tv_sec = 0;
-            closest.tv_usec = 0;
+            if (closest_event)
+                timerclear(closest_event);
             continue;
         }
         for (qfq = as->val_as_queries; qfq; qfq = qfq->qfq_next) {
@@ -2652,12 +2793,52 @@ val_async_select_info(val_context_t *ctx, fd_set *activefds,
             res_async_query_select_info(qfq->qfq_query->qc_ea, nfds, activefds,
                                         closest_event);
         }
-        if (cache_only) {
+        if (cache_only && closest_event)
+            timerclear(closest_event);
+    }
+
+    return pending;
+}
+
+/*
+ *
+ * timeout is a relative value. e.g. 5 seconds
+ */ 
+int
+val_async_select_info(val_context_t *ctx, fd_set *activefds,
+                      int *nfds, struct timeval *timeout)
+{
+    val_context_t *context;
+    struct timeval   now, closest, *closest_event = &closest;
+
+    /*
+     * get context, if needed
+     */
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_BAD_ARGUMENT;
+
+    val_log(NULL, LOG_DEBUG, __FUNCTION__);
+    gettimeofday(&now, NULL);
+
+    /** need to adjust relative timeout to absolute time used by libval */
+    if (timeout) {
+        if(timeout->tv_sec < LONG_MAX) {
+            /* add current time to delay */
+            timeradd(&now, timeout, &closest);
+        } else
+            memcpy(closest_event, timeout, sizeof(struct timeval));
+        if (closest.tv_sec < 0) {
             closest.tv_sec = 0;
             closest.tv_usec = 0;
         }
-    }
+        else if (closest.tv_usec < 0)
+            closest.tv_usec = 0;
+    } else
+        closest_event = NULL;
 
+    CTX_LOCK_ACACHE(context);
+    _async_collect_events(context, activefds, nfds, closest_event);
     CTX_UNLOCK_ACACHE(context);
     CTX_UNLOCK_POL(context);
 
@@ -2679,5 +2860,277 @@ val_async_select_info(val_context_t *ctx, fd_set *activefds,
     return VAL_NO_ERROR;
 }
 
+/*
+ * Function: val_async_next_timeout
+ *
+ * Purpose:  find out how long an event loop may wait for socket activity
+ *           before libval needs to run again to retry or time out queries.
+ *
+ * Parameters: context  -- context for pending async requests
+ *             timeout -- set to the time remaining until the next event,
+ *                        which may be zero if there is work to do now.
+ *                        Left untouched if there are no pending requests.
+ *
+ * Returns:  < 0  : VAL_* error
+ *             0  : no pending requests found
+ *           > 0  : number of requests pending
+ */
+int
+val_async_next_timeout(val_context_t *ctx, struct timeval *timeout)
+{
+    val_context_t *context;
+    struct timeval   now, closest;
+    int              pending;
+
+    if (NULL == timeout)
+        return VAL_BAD_ARGUMENT;
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+
+    closest.tv_sec = LONG_MAX;
+    closest.tv_usec = 0;
+
+    CTX_LOCK_ACACHE(context);
+    pending = _async_collect_events(context, NULL, NULL, &closest);
+    CTX_UNLOCK_ACACHE(context);
+    CTX_UNLOCK_POL(context);
+
+    if (pending) {
+        gettimeofday(&now, NULL);
+        if (timercmp(&closest, &now, >))
+            timersub(&closest, &now, timeout);
+        else
+            timerclear(timeout);
+        val_log(context, LOG_DEBUG,
+                "val_async_next_timeout: %d pending, next event in %ld.%06ld",
+                pending, timeout->tv_sec, timeout->tv_usec);
+    }
+
+    return pending;
+}
+
+/*
+ * libsres callback, called (with the ACACHE lock held) whenever a socket
+ * for one of this context's async queries is opened or closed.  Keep
+ * the socket to query map, the epoll set and the application up to date.
+ */
+static void
+_async_sock_event(struct expected_arrival *ea, SOCKET sock, int event,
+                  void *cb_data)
+{
+    val_context_t *context = (val_context_t *) cb_data;
+    int            s = (int) sock;
+
+    if ((NULL == context) || (s < 0))
+        return;
+
+    if (RES_IO_SOCK_OPEN == event) {
+        if (s >= context->as_sock_map_len) {
+            struct expected_arrival **map;
+            int len = context->as_sock_map_len ? context->as_sock_map_len : 64;
+
+            while (len <= s)
+                len *= 2;
+            map = (struct expected_arrival **) MALLOC(len * sizeof(*map));
+            if (NULL == map) {
+                val_log(context, LOG_ERR,
+                        "_async_sock_event(): could not track socket %d", s);
+                return;
+            }
+            memset(map, 0, len * sizeof(*map));
+            if (context->as_sock_map) {
+                memcpy(map, context->as_sock_map,
+                       context->as_sock_map_len * sizeof(*map));
+                FREE(context->as_sock_map);
+            }
+            context->as_sock_map = map;
+            context->as_sock_map_len = len;
+        }
+        context->as_sock_map[s] = ea;
+    } else {
+        /** ignore sockets we never saw opened */
+        if ((s >= context->as_sock_map_len) || (context->as_sock_map[s] != ea))
+            return;
+        context->as_sock_map[s] = NULL;
+    }
+
+#ifdef VAL_HAVE_EPOLL
+    if (context->as_event_fd != -1) {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = s;
+        if (epoll_ctl(context->as_event_fd,
+                      (RES_IO_SOCK_OPEN == event) ? EPOLL_CTL_ADD :
+                      EPOLL_CTL_DEL, s, &ev) < 0)
+            val_log(context, LOG_WARNING,
+                    "_async_sock_event(): epoll_ctl for socket %d failed: %s",
+                    s, strerror(errno));
+    }
+#endif
+
+    if (context->as_sock_cb)
+        (*context->as_sock_cb)(context, s,
+                               (RES_IO_SOCK_OPEN == event) ? VAL_AS_SOCK_ADD :
+                               VAL_AS_SOCK_DEL, context->as_sock_cb_data);
+}
+
+/*
+ * Function: val_async_set_sock_cb
+ *
+ * Purpose:  register a function to be called whenever a socket used by
+ *           async requests in the context is opened (VAL_AS_SOCK_ADD) or
+ *           is about to be closed (VAL_AS_SOCK_DEL), so that an event loop
+ *           can watch it for input. Sockets that are already open are
+ *           reported straight away.  The callback is made with internal
+ *           locks held and must not call back into libval.
+ *
+ * Parameters: context  -- context for async requests
+ *             callback -- function to call, or NULL to stop callbacks
+ *             cb_data -- passed to the callback
+ *
+ * Returns:  VAL_NO_ERROR or a VAL_* error
+ */
+int
+val_async_set_sock_cb(val_context_t *ctx, val_async_sock_cb callback,
+                      void *cb_data)
+{
+    val_context_t *context;
+    int            i;
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+
+    CTX_LOCK_ACACHE(context);
+
+    for (i = 0; i < context->as_sock_map_len; ++i) {
+        if (NULL == context->as_sock_map[i])
+            continue;
+        if (context->as_sock_cb)
+            (*context->as_sock_cb)(context, i, VAL_AS_SOCK_DEL,
+                                   context->as_sock_cb_data);
+        if (callback)
+            (*callback)(context, i, VAL_AS_SOCK_ADD, cb_data);
+    }
+    context->as_sock_cb = callback;
+    context->as_sock_cb_data = cb_data;
+
+    CTX_UNLOCK_ACACHE(context);
+    CTX_UNLOCK_POL(context);
+
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Function: val_async_event_fd
+ *
+ * Purpose:  get a single descriptor that becomes readable whenever any
+ *           socket used by async requests in the context has data. On
+ *           readability, call val_async_process_events() with a NULL
+ *           ready list.  The descriptor belongs to the context.
+ *
+ * Returns:  the descriptor, or VAL_NOT_IMPLEMENTED where the platform
+ *           has no epoll, or another VAL_* error
+ */
+int
+val_async_event_fd(val_context_t *ctx)
+{
+#ifdef VAL_HAVE_EPOLL
+    val_context_t *context;
+    int            i, retval;
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+
+    CTX_LOCK_ACACHE(context);
+
+    if (context->as_event_fd == -1) {
+        context->as_event_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (context->as_event_fd < 0) {
+            val_log(context, LOG_ERR, "val_async_event_fd(): epoll_create: %s",
+                    strerror(errno));
+            context->as_event_fd = -1;
+        }
+        for (i = 0; context->as_event_fd != -1 &&
+                 i < context->as_sock_map_len; ++i) {
+            struct epoll_event ev;
+
+            if (NULL == context->as_sock_map[i])
+                continue;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = i;
+            epoll_ctl(context->as_event_fd, EPOLL_CTL_ADD, i, &ev);
+        }
+    }
+    retval = (context->as_event_fd != -1) ?
+        context->as_event_fd : VAL_INTERNAL_ERROR;
+
+    CTX_UNLOCK_ACACHE(context);
+    CTX_UNLOCK_POL(context);
+
+    return retval;
+#else
+    return VAL_NOT_IMPLEMENTED;
+#endif
+}
+
+/*
+ * Mark the queries owning the given sockets as having data waiting.
+ * If ready is NULL, the sockets are collected from the context's epoll
+ * descriptor instead (without waiting).
+ *
+ * Must be called with the ACACHE lock held.
+ *
+ * Returns the number of sockets marked.
+ */
+int
+val_async_mark_ready(val_context_t *context, const int *ready, int nready)
+{
+    int i, marked = 0;
+#ifdef VAL_HAVE_EPOLL
+    struct epoll_event events[64];
+
+    if ((NULL == ready) && (context->as_event_fd != -1)) {
+        int n, max = sizeof(events)/sizeof(events[0]);
+        int rounds = context->as_sock_map_len / max + 1;
+
+        /*
+         * the set is level triggered, so sockets already marked are
+         * reported again until read; epoll rotates through the ready
+         * list, so a bounded number of rounds covers every socket.
+         */
+        do {
+            n = epoll_wait(context->as_event_fd, events, max, 0);
+            for (i = 0; i < n; ++i) {
+                int s = events[i].data.fd;
+                if ((s < context->as_sock_map_len) && context->as_sock_map[s]) {
+                    res_async_ea_set_ready(context->as_sock_map[s]);
+                    ++marked;
+                }
+            }
+        } while ((n == max) && (--rounds > 0));
+
+        return marked;
+    }
+#endif
+
+    for (i = 0; ready && i < nready; ++i) {
+        int s = ready[i];
+        if ((s >= 0) && (s < context->as_sock_map_len) &&
+            context->as_sock_map[s]) {
+            res_async_ea_set_ready(context->as_sock_map[s]);
+            ++marked;
+        }
+    }
+
+    return marked;
+}
+
 
 #endif /* VAL_NO_ASYNC */
@@ -51,6 +51,11 @@ int             val_resquery_rcv(val_context_t * context,
                                  struct queries_for_query **queries,
                                  fd_set *pending_desc,
                                  struct timeval *closest_event);
+int             val_resquery_mirror(val_context_t * context,
+                                    struct queries_for_query *matched_qfq,
+                                    struct domain_info **response,
+                                    struct queries_for_query **queries,
+                                    int *answered);
 void            val_res_cancel(struct val_query_chain *matched_q);
 void            val_res_nsfallback(val_context_t *context, 
                                    struct val_query_chain *matched_q,
@@ -68,6 +73,8 @@ int             val_resquery_async_rcv(val_context_t * context,
                                        struct queries_for_query **queries,
                                        fd_set *pending_desc,
                                        struct timeval *closest_event);
+int             val_async_mark_ready(val_context_t *context,
+                                     const int *ready, int nready);
 #endif /* VAL_NO_ASYNC */
 
 #endif                          /* VAL_RESQUERY_H */
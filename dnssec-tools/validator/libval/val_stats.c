@@ -0,0 +1,131 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Process-wide query statistics.  The counters describe the work done
+ * by all contexts, since the rrset and name server caches they measure
+ * are shared by all contexts.
+ */
+#include "validator-internal.h"
+
+#include "val_stats.h"
+
+static val_stats_t val_stats;
+
+#if !defined(VAL_NO_THREADS) && defined(__GNUC__) && defined(__ATOMIC_SEQ_CST)
+#define VAL_STATS_ATOMIC 1
+#endif
+
+#if !defined(VAL_NO_THREADS) && !defined(VAL_STATS_ATOMIC)
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#define VAL_STATS_LOCK()    pthread_mutex_lock(&stats_lock)
+#define VAL_STATS_UNLOCK()  pthread_mutex_unlock(&stats_lock)
+#else
+#define VAL_STATS_LOCK()
+#define VAL_STATS_UNLOCK()
+#endif
+
+/*
+ * Add count to the counter at the given offset within val_stats_t.
+ * Use the VAL_STATS_INC() macro instead of calling this directly.
+ */
+void
+val_stats_add(size_t offset, unsigned long count)
+{
+#ifdef VAL_STATS_ATOMIC
+    /* keep counting off the lock on the lookup fast path */
+    __atomic_add_fetch((unsigned long *) ((char *) &val_stats + offset),
+                       count, __ATOMIC_RELAXED);
+#else
+    VAL_STATS_LOCK();
+    *(unsigned long *) ((char *) &val_stats + offset) += count;
+    VAL_STATS_UNLOCK();
+#endif
+}
+
+/*
+ * Account for a result chain that is about to be returned to the
+ * application
+ */
+void
+val_stats_count_results(struct val_result_chain *results)
+{
+    unsigned long   answers = 0, validated = 0;
+
+    for (; results; results = results->val_rc_next) {
+        ++answers;
+        if (val_isvalidated(results->val_rc_status))
+            ++validated;
+    }
+
+    val_stats_add(offsetof(val_stats_t, vs_answers), answers);
+    val_stats_add(offsetof(val_stats_t, vs_validated), validated);
+}
+
+#define VAL_STATS_COUNTERS  (sizeof(val_stats_t) / sizeof(unsigned long))
+
+/*
+ * Function: val_get_stats
+ *
+ * Purpose:   Return the libval query statistics.  Each counter is
+ *            read atomically on its own; the set is not a consistent
+ *            snapshot, since lookups in other threads may update some
+ *            counters while the others are being read.
+ *
+ * Parameters: stats -- structure to fill in
+ *             size -- sizeof the caller's val_stats_t; counters the
+ *                     library does not know of are set to 0, those the
+ *                     caller does not know of are left out
+ *
+ * Returns: VAL_NO_ERROR or VAL_BAD_ARGUMENT.
+ */
+int
+val_get_stats(val_stats_t *stats, size_t size)
+{
+    unsigned long  *from = (unsigned long *) &val_stats;
+    unsigned long  *to = (unsigned long *) stats;
+    size_t          i, n;
+
+    if (NULL == stats || size < sizeof(unsigned long))
+        return VAL_BAD_ARGUMENT;
+
+    n = size / sizeof(unsigned long);
+    memset(stats, 0, size);
+    if (n > VAL_STATS_COUNTERS)
+        n = VAL_STATS_COUNTERS;
+
+#ifdef VAL_STATS_ATOMIC
+    for (i = 0; i < n; i++)
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+#else
+    VAL_STATS_LOCK();
+    for (i = 0; i < n; i++)
+        to[i] = from[i];
+    VAL_STATS_UNLOCK();
+#endif
+    return VAL_NO_ERROR;
+}
+
+/*
+ * Function: val_reset_stats
+ *
+ * Purpose:   Reset all libval query statistics to zero.
+ */
+void
+val_reset_stats(void)
+{
+    unsigned long  *counters = (unsigned long *) &val_stats;
+    size_t          i;
+
+#ifdef VAL_STATS_ATOMIC
+    for (i = 0; i < VAL_STATS_COUNTERS; i++)
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+#else
+    VAL_STATS_LOCK();
+    for (i = 0; i < VAL_STATS_COUNTERS; i++)
+        counters[i] = 0;
+    VAL_STATS_UNLOCK();
+#endif
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_STATS_H
+#define VAL_STATS_H
+
+#define VAL_STATS_INC(field) \
+    val_stats_add(offsetof(val_stats_t, field), 1)
+
+void            val_stats_add(size_t offset, unsigned long count);
+void            val_stats_count_results(struct val_result_chain *results);
+
+#endif
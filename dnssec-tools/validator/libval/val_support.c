@@ -23,33 +23,66 @@
 
 #include "val_support.h"
 
+/*
+ * Count the labels of a wire format name, including the root label,
+ * and return its length in *len.  Returns 0, with *len set to 0, if the
+ * name is malformed.
+ */
+static size_t
+name_scan(const u_char * name, size_t * len)
+{
+    size_t          i = 0;
+    size_t          labels = 1;
+
+    *len = 0;
+    while (name[i]) {
+        if ((name[i] & 0xc0) || i + name[i] + 1 >= NS_MAXCDNAME)
+            return 0;
+        i += name[i] + 1;
+        labels++;
+    }
+    *len = i + 1;
+    return labels;
+}
+
+/*
+ * Return a pointer to little_name within big_name if little_name is
+ * big_name itself or one of its ancestors, NULL otherwise.
+ */
 u_char * 
 namename(u_char * big_name, u_char * little_name)
 {
-    u_char *p = big_name;
+    size_t          big_labels, little_labels;
+    size_t          big_len, little_len;
+    size_t          i;
+    u_char         *p;
+    u_char          b, l;
     
     if (!big_name || !little_name)
         return NULL;
 
-    /* if the name only consists of the root, move to the last label */
-    if (*little_name == '\0') {
-        size_t d = wire_name_length(p);
-        if (d >= 1)
-            return p+d-1;
+    big_labels = name_scan(big_name, &big_len);
+    little_labels = name_scan(little_name, &little_len);
+    if (big_labels == 0 || little_labels == 0 ||
+        little_labels > big_labels)
         return NULL;
-    }
-    
-    while (*p != '\0') {
-        int d = namecmp(p, little_name);
-        if (d == 0) {
-            return p;
-        }
-        else if (d < 0)
-            break; 
-        p = p + p[0] + 1;
+
+    /* the only candidate is the suffix with as many labels */
+    p = big_name;
+    for (i = little_labels; i < big_labels; i++)
+        p += p[0] + 1;
+
+    if ((size_t) (big_name + big_len - p) != little_len)
+        return NULL;
+    for (i = 0; i < little_len; i++) {
+        b = p[i];
+        l = little_name[i];
+        if (b != l && ((b | 0x20) != (l | 0x20) ||
+                       (u_char) ((b | 0x20) - 'a') >= 26))
+            return NULL;
     }
 
-    return NULL;
+    return p;
 }
 
 
@@ -67,7 +100,7 @@ base32hex_encode(u_char * in, size_t inlen, u_char ** out,
     u_char       *in_ch, *buf;
     u_char       *out_ch;
     u_char        padbuf[5];
-    size_t        i, rem, extra;
+    size_t        i, rem, extra, bufsize, done;
     int           len = inlen;
 
     *out = NULL;
@@ -83,19 +116,30 @@ base32hex_encode(u_char * in, size_t inlen, u_char ** out,
     extra = rem ? (40 - rem) : 0;
 
     *outlen = inlen + ((inlen * 8 + extra) / 40) * 3;
-    *out = (u_char *) MALLOC(*outlen * sizeof(u_char));
+    /*
+     * a partial last group is still encoded as 8 characters 
+     */
+    bufsize = (inlen + 4) / 5 * 8;
+    if (bufsize < *outlen)
+        bufsize = *outlen;
+    *out = (u_char *) MALLOC(bufsize * sizeof(u_char));
     if (*out == NULL) {
         *outlen = 0;
         return;
     }
 
-    memset(*out, 0, *outlen);
-    out_ch = *out;
+    memset(*out, 0, bufsize);
+
+    /*
+     * encode whole blocks with vector instructions where possible 
+     */
+    done = res_b32hex_encode_blocks(in, inlen, *out);
+    out_ch = *out + done / 5 * 8;
 
     memset(padbuf, 0, 5);
-    in_ch = in;
+    in_ch = in + done;
 
-    len = inlen;
+    len = inlen - done;
     while (len > 0) {
 
         if (len - 5 < 0) {
@@ -182,7 +226,7 @@ res_sq_free_rr_recs(struct rrset_rr **rr)
         return;
 
     if (*rr) {
-        if ((*rr)->rr_rdata)
+        if ((*rr)->rr_rdata && (*rr)->rr_rdata != RR_INLINE_RDATA(*rr))
             FREE((*rr)->rr_rdata);
         if ((*rr)->rr_next)
             res_sq_free_rr_recs(&((*rr)->rr_next));
@@ -191,6 +235,26 @@ res_sq_free_rr_recs(struct rrset_rr **rr)
     }
 }
 
+/*
+ * Drop the cached canonical form of the set's RRs and the signature
+ * hashes made over it; must be called whenever rrs_data changes.
+ */
+void
+free_rrset_canon(struct rrset_rec *set)
+{
+    struct rrset_digest *rd;
+
+    if (set == NULL)
+        return;
+    if (set->rrs_canon)
+        FREE(set->rrs_canon);
+    set->rrs_canon = NULL;
+    set->rrs_canon_len = 0;
+    while ((rd = set->rrs_digests) != NULL) {
+        set->rrs_digests = rd->rd_next;
+        FREE(rd);
+    }
+}
 
 void
 res_sq_free_rrset_recs(struct rrset_rec **set)
@@ -199,6 +263,9 @@ res_sq_free_rrset_recs(struct rrset_rec **set)
         return;
 
     if (*set) {
+        /* no index may keep pointing at a freed set */
+        if ((*set)->rrs_index_ref)
+            *(*set)->rrs_index_ref = NULL;
         if ((*set)->rrs_zonecut_n)
             FREE((*set)->rrs_zonecut_n);
         if ((*set)->rrs_name_n)
@@ -209,6 +276,7 @@ res_sq_free_rrset_recs(struct rrset_rec **set)
             res_sq_free_rr_recs(&((*set)->rrs_data));
         if ((*set)->rrs_sig)
             res_sq_free_rr_recs(&((*set)->rrs_sig));
+        free_rrset_canon(*set);
         if ((*set)->rrs_next)
             res_sq_free_rrset_recs(&((*set)->rrs_next));
         FREE(*set);
@@ -293,30 +361,7 @@ free_domain_info_ptrs(struct domain_info *di)
 int
 is_tail(u_char * full, u_char * tail)
 {
-    size_t             f_len = wire_name_length(full);
-    size_t             t_len = wire_name_length(tail);
-
-    if (f_len == t_len) {
-        if (f_len)
-            return namecmp(full, tail) == 0;
-        else
-            return 0;
-    }
-
-    if (t_len > f_len)
-        return FALSE;
-
-    if (namecmp(&full[f_len - t_len], tail) == 0) {
-        size_t        index = 0;
-
-        while (index < (f_len - t_len)) {
-            index += (full[index]) + (u_char) 1;
-            if (index == f_len - t_len)
-                return TRUE;
-        }
-    }
-
-    return FALSE;
+    return (namename(full, tail) != NULL);
 }
 
 int
@@ -331,19 +376,16 @@ add_to_set(struct rrset_rec *rr_set, size_t rdata_len_h,
     /*
      * Make sure we got the memory for it 
      */
-    rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr));
+    rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr) +
+                                    rdata_len_h * sizeof(u_char));
     if (rr == NULL)
         return VAL_OUT_OF_MEMORY;
-
-    rr->rr_rdata = (u_char *) MALLOC(rdata_len_h * sizeof(u_char));
-    if (rr->rr_rdata == NULL) {
-        FREE(rr);
-        return VAL_OUT_OF_MEMORY;
-    }
+    rr->rr_rdata = RR_INLINE_RDATA(rr);
 
     /*
      * Add it to the end of the current list of RR's 
      */
+    free_rrset_canon(rr_set);
     if (rr_set->rrs_data == NULL) {
         rr_set->rrs_data = rr;
     } else {
@@ -378,15 +420,11 @@ add_as_sig(struct rrset_rec *rr_set, size_t rdata_len_h,
     /*
      * Make sure we got the memory for it 
      */
-    rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr));
+    rr = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr) +
+                                    rdata_len_h * sizeof(u_char));
     if (rr == NULL)
         return VAL_OUT_OF_MEMORY;
-
-    rr->rr_rdata = (u_char *) MALLOC(rdata_len_h * sizeof(u_char));
-    if (rr->rr_rdata == NULL) {
-        FREE(rr);
-        return VAL_OUT_OF_MEMORY;
-    }
+    rr->rr_rdata = RR_INLINE_RDATA(rr);
 
     if (rr_set->rrs_sig == NULL) {
         rr_set->rrs_sig = rr;
@@ -642,92 +680,64 @@ find_rr_set(struct name_server *respondent_server,
     return new_one;
 }
 
+/*
+ * Locate the RDATA at response[rdata_index] in uncompressed form.
+ *
+ * RDATA whose embedded domain names (if any) are not compressed is
+ * already in its canonical wire layout, so *rdata is simply pointed at
+ * the bytes inside the response and nothing is copied.  Only when a
+ * compression pointer has to be followed are the names expanded, into
+ * buf when it is large enough or else into newly allocated memory.
+ * *allocated is set when the caller must FREE *rdata.  Any names must
+ * lie entirely within the RDATA; *rdata_len_h is updated to the length
+ * of the uncompressed RDATA.
+ */
 int
-decompress(u_char ** rdata,
+rdata_view(u_char ** rdata,
+           int *allocated,
+           u_char * buf,
+           size_t buf_len,
            u_char * response,
            size_t rdata_index,
-           u_char * end, 
-           u_int16_t type_h, 
+           u_char * end,
+           u_int16_t type_h,
            size_t * rdata_len_h)
 {
-    u_char        expanded_name[NS_MAXCDNAME];
-    u_char        other_expanded_name[NS_MAXCDNAME];
-    u_char        prefix[6];
-    size_t        p_index = 0;
-    size_t        new_size;
-    size_t        working_index = rdata_index;
-    size_t        other_name_length = 0;
-    size_t        name_length = 0;
-    size_t        insert_index = 0;
-    int           working_increment;
-    size_t        expansion = 0;
-    size_t        len = 0;
-
-    if ((rdata == NULL) || (response == NULL) || (rdata_len_h == NULL))
+    u_char          names[2][NS_MAXCDNAME];
+    size_t          name_len[2];
+    size_t          prefix_len = 0;
+    size_t          rest_len;
+    size_t          new_size;
+    int             nnames = 0;
+    int             compressed = 0;
+    int             consumed;
+    int             i;
+    u_char         *rdstart;
+    u_char         *rdend;
+    u_char         *cp;
+    u_char         *out;
+
+    if ((rdata == NULL) || (allocated == NULL) || (response == NULL) ||
+        (rdata_len_h == NULL))
         return VAL_BAD_ARGUMENT;
 
-    switch (type_h) {
-        /*
-         * The first group has no domain names to convert 
-         */
-
-    case ns_t_nsap:
-    case ns_t_eid:
-    case ns_t_nimloc:
-    case ns_t_dnskey:
-    case ns_t_aaaa:
-    case ns_t_loc:
-    case ns_t_atma:
-    case ns_t_a:
-    case ns_t_wks:
-    case ns_t_hinfo:
-    case ns_t_txt:
-    case ns_t_x25:
-    case ns_t_isdn:
-    case ns_t_ds:
-    /* No decompression must happen */
-    case ns_t_a6: 
-    case ns_t_naptr:
-    case ns_t_nsec:
-    case ns_t_tlsa:
-    default:
-        new_size = (size_t) * rdata_len_h;
-        if (new_size == 0)
-            return VAL_NO_ERROR;
-
-        *rdata = (u_char *) MALLOC(new_size * sizeof(u_char));
-        if (*rdata == NULL)
-            return VAL_OUT_OF_MEMORY;
+    *rdata = NULL;
+    *allocated = 0;
 
-        if (response + working_index + new_size > end)
-            return VAL_BAD_ARGUMENT;
-        memcpy(&(*rdata)[insert_index], &response[working_index], new_size);
-        *rdata_len_h = *rdata_len_h;    /* No change */
-        break;
+    rdstart = response + rdata_index;
+    rdend = rdstart + *rdata_len_h;
+    if (rdend > end)
+        return VAL_BAD_ARGUMENT;
 
+    switch (type_h) {
         /*
-         * The next group starts with one or two domain names 
+         * These start with one or two domain names 
          */
-
     case ns_t_soa:
     case ns_t_minfo:
     case ns_t_rp:
-
-        working_increment = ns_name_unpack(response, end,
-                                           &response[working_index],
-                                           other_expanded_name,
-                                           sizeof(other_expanded_name));
-
-        if (working_increment < 0)
-            return VAL_BAD_ARGUMENT;
-
-        working_index += working_increment;
-        other_name_length = wire_name_length(other_expanded_name);
-        expansion += other_name_length - working_increment;
-
-        /*
-         * fall through 
-         */
+        nnames = 2;
+        break;
     case ns_t_ns:
     case ns_t_cname:
     case ns_t_dname:
@@ -737,180 +747,127 @@ decompress(u_char ** rdata,
     case ns_t_md:
     case ns_t_mf:
     case ns_t_ptr:
-
-        working_increment = ns_name_unpack(response, end,
-                                           &response[working_index],
-                                           expanded_name,
-                                           sizeof(expanded_name));
-        if (working_increment < 0)
-            return VAL_BAD_ARGUMENT;
-
-        working_index += working_increment;
-        name_length = wire_name_length(expanded_name);
-        expansion += name_length - working_increment;
-
-        /*
-         * Make the new data area 
-         */
-
-        new_size = (size_t) (*rdata_len_h + expansion);
-
-        *rdata = (u_char *) MALLOC(new_size * sizeof(u_char));
-        if (*rdata == NULL)
-            return VAL_OUT_OF_MEMORY;
-
-        /*
-         * Copy in the names 
-         */
-
-        memcpy(&(*rdata)[insert_index], other_expanded_name,
-               other_name_length);
-        insert_index += other_name_length;
-
-        memcpy(&(*rdata)[insert_index], expanded_name, name_length);
-        insert_index += name_length;
-
-        /*
-         * Copy any remaining data 
-         */
-
-        len = *rdata_len_h + expansion - other_name_length - name_length;
-        if (response + working_index + len  > end)
-            return VAL_BAD_ARGUMENT;
-        memcpy(&(*rdata)[insert_index], &response[working_index], len);
-
-        *rdata_len_h += expansion;
-
+        nnames = 1;
         break;
 
         /*
-         * The following group ends with one or two domain names 
+         * These have a fixed length prefix before the name(s)
          */
     case ns_t_srv:
-
-        if (response + working_index + (2 * sizeof(u_int16_t)) > end)
-            return VAL_BAD_ARGUMENT;
-        memcpy(&prefix[p_index], &response[working_index],
-               2 * sizeof(u_int16_t));
-        working_index += 2 * sizeof(u_int16_t);
-        p_index += 2 * sizeof(u_int16_t);
-        /*
-         * fall through 
-         */
-
+        prefix_len = 3 * sizeof(u_int16_t);
+        nnames = 1;
+        break;
     case ns_t_rt:
     case ns_t_mx:
     case ns_t_afsdb:
     case ns_t_kx:
+        prefix_len = sizeof(u_int16_t);
+        nnames = 1;
+        break;
     case ns_t_px:
-
-        if (response + working_index + sizeof(u_int16_t) > end)
-            return VAL_BAD_ARGUMENT;
-        memcpy(&prefix[p_index], &response[working_index],
-               sizeof(u_int16_t));
-        working_index += sizeof(u_int16_t);
-        p_index += sizeof(u_int16_t);
-
-        working_increment = ns_name_unpack(response, end,
-                                           &response[working_index],
-                                           expanded_name,
-                                           sizeof(expanded_name));
-        if (working_increment < 0)
-            return VAL_BAD_ARGUMENT;
-
-        working_index += working_increment;
-        name_length = wire_name_length(expanded_name);
-        expansion += name_length - working_increment;
-
-        if (type_h == ns_t_px) {
-            working_increment = ns_name_unpack(response, end,
-                                               &response[working_index],
-                                               other_expanded_name,
-                                               sizeof
-                                               (other_expanded_name));
-            if (working_increment < 0)
-                return VAL_BAD_ARGUMENT;
-
-            working_index += working_increment;
-            other_name_length = wire_name_length(other_expanded_name);
-            expansion += other_name_length - working_increment;
-        }
-
-        /*
-         * Make the new data area 
-         */
-
-        new_size = (size_t) (*rdata_len_h + expansion);
-
-        *rdata = (u_char *) MALLOC(new_size * sizeof(u_char));
-        if (*rdata == NULL)
-            return VAL_OUT_OF_MEMORY;
-
-        /*
-         * Copy in the prefix 
-         */
-        memcpy(&*rdata[insert_index], prefix, p_index);
-        insert_index += p_index;
+        prefix_len = sizeof(u_int16_t);
+        nnames = 2;
+        break;
+    case ns_t_rrsig:
+        prefix_len = SIGNBY;
+        nnames = 1;
+        break;
 
         /*
-         * Copy in the names 
+         * Everything else has no domain names to convert 
          */
-
-        memcpy(&(*rdata)[insert_index], expanded_name, name_length);
-        insert_index += name_length;
-
-        memcpy(&(*rdata)[insert_index], other_expanded_name,
-               other_name_length);
-        insert_index += other_name_length;
-
-        *rdata_len_h += expansion;
-
+    default:
         break;
+    }
 
-        /*
-         * The special case - the SIG record 
-         */
-    case ns_t_rrsig:
+    if (nnames == 0) {
+        if (*rdata_len_h != 0)
+            *rdata = rdstart;
+        return VAL_NO_ERROR;
+    }
+
+    if (prefix_len > *rdata_len_h)
+        return VAL_BAD_ARGUMENT;
 
-        working_increment = ns_name_unpack(response, end,
-                                           &response[working_index +
-                                                     SIGNBY],
-                                           expanded_name,
-                                           sizeof(expanded_name));
-        if (working_increment < 0)
+    cp = rdstart + prefix_len;
+    new_size = prefix_len;
+    for (i = 0; i < nnames; i++) {
+        consumed = ns_name_unpack(response, end, cp, names[i], NS_MAXCDNAME);
+        if (consumed < 0 || cp + consumed > rdend)
             return VAL_BAD_ARGUMENT;
+        name_len[i] = wire_name_length(names[i]);
+        if (name_len[i] == 0)
+            return VAL_BAD_ARGUMENT;
+        if (name_len[i] != (size_t) consumed)
+            compressed = 1;
+        cp += consumed;
+        new_size += name_len[i];
+    }
+    rest_len = rdend - cp;
+    new_size += rest_len;
 
-        name_length = wire_name_length(expanded_name);
-        expansion += name_length - working_increment;
+    if (!compressed) {
+        *rdata = rdstart;
+        return VAL_NO_ERROR;
+    }
 
-        /*
-         * Make the new data area 
-         */
+    if (buf != NULL && new_size <= buf_len) {
+        out = buf;
+    } else {
+        out = (u_char *) MALLOC(new_size * sizeof(u_char));
+        if (out == NULL)
+            return VAL_OUT_OF_MEMORY;
+        *allocated = 1;
+    }
 
-        new_size = (size_t) (*rdata_len_h + expansion);
+    memcpy(out, rdstart, prefix_len);
+    new_size = prefix_len;
+    for (i = 0; i < nnames; i++) {
+        memcpy(&out[new_size], names[i], name_len[i]);
+        new_size += name_len[i];
+    }
+    memcpy(&out[new_size], cp, rest_len);
+    new_size += rest_len;
 
-        *rdata = (u_char *) MALLOC(new_size * sizeof(u_char));
-        if (*rdata == NULL)
-            return VAL_OUT_OF_MEMORY;
+    *rdata = out;
+    *rdata_len_h = new_size;
+    return VAL_NO_ERROR;
+}
 
-        if (response + working_index + SIGNBY > end)
-            return VAL_BAD_ARGUMENT;
-        memcpy(&(*rdata)[insert_index], &response[working_index], SIGNBY);
-        insert_index += SIGNBY;
-        working_index += SIGNBY;
+/*
+ * Same as rdata_view(), but always return a separately allocated copy
+ * of the uncompressed RDATA in *rdata.
+ */
+int
+decompress(u_char ** rdata,
+           u_char * response,
+           size_t rdata_index,
+           u_char * end, 
+           u_int16_t type_h, 
+           size_t * rdata_len_h)
+{
+    u_char         *view;
+    int             allocated;
+    int             retval;
 
-        memcpy(&(*rdata)[insert_index], expanded_name, name_length);
-        insert_index += name_length;
-        working_index += working_increment;
+    if ((rdata == NULL) || (response == NULL) || (rdata_len_h == NULL))
+        return VAL_BAD_ARGUMENT;
 
-        len = *rdata_len_h - working_increment - SIGNBY;
-        if (response + working_index + len > end)
-            return VAL_BAD_ARGUMENT;
-        memcpy(&(*rdata)[insert_index], &response[working_index], len);
+    if ((retval = rdata_view(&view, &allocated, NULL, 0, response,
+                             rdata_index, end, type_h,
+                             rdata_len_h)) != VAL_NO_ERROR)
+        return retval;
 
-        *rdata_len_h += expansion;
+    if (view == NULL || allocated) {
+        *rdata = view;
+        return VAL_NO_ERROR;
     }
 
+    *rdata = (u_char *) MALLOC(*rdata_len_h * sizeof(u_char));
+    if (*rdata == NULL)
+        return VAL_OUT_OF_MEMORY;
+    memcpy(*rdata, view, *rdata_len_h);
+
     return VAL_NO_ERROR;
 }
 
@@ -942,6 +899,9 @@ extract_from_rr(u_char * response,
          ns_name_unpack(response, end, &response[*response_index], name_n,
                         NS_MAXCDNAME)) == -1)
         return VAL_BAD_ARGUMENT;
+    /* reject label types that the rest of the code cannot handle */
+    if (wire_name_length(name_n) == 0)
+        return VAL_BAD_ARGUMENT;
 
     *response_index += ret_val;
 
@@ -1023,10 +983,12 @@ lower_name(u_char rdata[], size_t * index)
 
     length = wire_name_length(&rdata[(*index)]);
 
-    while (length-- > 0) {
-        rdata[(*index)] = tolower(rdata[(*index)]);
-        (*index)++;
-    }
+    /*
+     * The label length octets are all below 'A', so the whole name can
+     * be folded in one go 
+     */
+    res_lower_bytes(&rdata[(*index)], length);
+    (*index) += length;
 }
 
 void
@@ -1079,15 +1041,11 @@ lower(u_int16_t type_h, u_char * rdata, size_t len)
     case ns_t_rp:
 
         lower_name(rdata, &index);
-        /*
-         * fall through 
-         */
-
 
         /*
          * These have one name (and are joined by the code above) 
          */
-
+        /* FALLTHROUGH */
     case ns_t_ns:
     case ns_t_cname:
     case ns_t_dname:
@@ -1109,7 +1067,7 @@ lower(u_int16_t type_h, u_char * rdata, size_t len)
     case ns_t_srv:
 
         index = 4;              /* SRV has three preceeding 16 bit quantities */
-
+        /* FALLTHROUGH */
     case ns_t_rt:
     case ns_t_mx:
     case ns_t_afsdb:
@@ -1153,19 +1111,14 @@ copy_rr_rec(u_int16_t type_h, struct rrset_rr *r, int dolower)
 
     if (r == NULL)
         return NULL;
-    the_copy = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr));
+    the_copy = (struct rrset_rr *) MALLOC(sizeof(struct rrset_rr) +
+                                          r->rr_rdata_length * sizeof(u_char));
 
     if (the_copy == NULL)
         return NULL;
 
     the_copy->rr_rdata_length = r->rr_rdata_length;
-    the_copy->rr_rdata = (u_char *) MALLOC(the_copy->rr_rdata_length * sizeof
-            (u_char));
-
-    if (the_copy->rr_rdata == NULL) {
-        FREE(the_copy);
-        return NULL;
-    }
+    the_copy->rr_rdata = RR_INLINE_RDATA(the_copy);
 
     memcpy(the_copy->rr_rdata, r->rr_rdata, r->rr_rdata_length);
 
@@ -1186,7 +1139,7 @@ link_rr(struct rrset_rr **cs, struct rrset_rr *cr)
      * is an implementation of an insertion sort.
      */
     int             ret_val;
-    int             length;
+    size_t          length;
     struct rrset_rr  *temp_rr;
 
     if (cs == NULL)
@@ -1571,6 +1524,8 @@ merge_rrset_recs(struct rrset_rec **dest, struct rrset_rec *new_info)
                     rr_exchange = old->rrs_data;
                     old->rrs_data = new_rr->rrs_data;
                     new_rr->rrs_data = rr_exchange;
+                    free_rrset_canon(old);
+                    free_rrset_canon(new_rr);
                     rr_exchange = old->rrs_sig;
                     old->rrs_sig = new_rr->rrs_sig;
                     new_rr->rrs_sig = rr_exchange;
@@ -68,6 +68,7 @@ size_t          wire_name_labels(const u_char * field);
 size_t          wire_name_length(const u_char * field);
 
 void            res_sq_free_rr_recs(struct rrset_rr **rr);
+void            free_rrset_canon(struct rrset_rec *set);
 void            res_sq_free_rrset_recs(struct rrset_rec **set);
 int             add_to_qname_chain(struct qname_chain **qnames,
                                    const u_char * name_n);
@@ -103,6 +104,15 @@ struct rrset_rec *find_rr_set(struct name_server *respondent_server,
                               int iterative_answer,
                               u_char * zonecut_n);
 
+int             rdata_view(u_char ** rdata,
+                           int *allocated,
+                           u_char * buf,
+                           size_t buf_len,
+                           u_char * response,
+                           size_t rdata_index,
+                           u_char * end,
+                           u_int16_t type_h,
+                           size_t * rdata_len_h);
 int             decompress(u_char ** rdata,
                            u_char * response,
                            size_t rdata_index,
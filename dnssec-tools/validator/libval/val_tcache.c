@@ -0,0 +1,424 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Links of authentication chains that have already been validated,
+ * shared by all threads of a context.
+ *
+ * When an authentication chain ends at a trust anchor, every DNSKEY
+ * RRset on the way up has been shown to be trusted.  The RDATA of each
+ * such key set is remembered here with the time at which the part of
+ * the chain above it expires.  When a later chain reaches a zone whose
+ * DNSKEY RRset is exactly one that was remembered, the key set is taken
+ * as trusted and the chain ends there, without asking for the DS and
+ * the parent's keys again and without checking their signatures.
+ *
+ * Only the RDATA is compared, so a key set that changed in any way is
+ * validated again in full.
+ *
+ * In the same way, when verify_provably_insecure() has shown that a
+ * delegation has no DS, the name of the zone cut is remembered for as
+ * long as the proof and its own authentication chain remain valid.
+ * Answers from any name at or below that cut are then known to be
+ * provably insecure without walking down from the trust point and
+ * asking for the DS of every zone cut again.
+ *
+ * Entries are dropped when the context's trust anchors or policy
+ * change, and queries made with VAL_QUERY_SKIP_CACHE always do the
+ * whole work, which also brings the entries they touch up to date.
+ */
+#include "validator-internal.h"
+
+#include "val_stats.h"
+#include "val_tcache.h"
+
+#define TC_BUCKETS      256     /* must be a power of two */
+#define TC_MAX_ENTRIES  4096
+
+#ifndef VAL_NO_THREADS
+#define TC_LOCK(tc)     pthread_mutex_lock(&(tc)->lock)
+#define TC_UNLOCK(tc)   pthread_mutex_unlock(&(tc)->lock)
+#else
+#define TC_LOCK(tc)
+#define TC_UNLOCK(tc)
+#endif
+
+#define TC_KEYSET       1       /* a trusted DNSKEY RRset */
+#define TC_INSECURE     2       /* a delegation without a DS */
+
+struct tc_entry {
+    struct tc_entry    *next;
+    u_int32_t           hash;
+    u_int16_t           class_h;
+    int                 kind;
+    time_t              expires;
+    u_char             *keys;       /* TC_KEYSET only, see _tc_keys() */
+    size_t              keys_len;
+    u_char              zone_n[NS_MAXCDNAME];
+};
+
+struct val_tcache {
+#ifndef VAL_NO_THREADS
+    pthread_mutex_t     lock;
+#endif
+    struct tc_entry    *buckets[TC_BUCKETS];
+    int                 count;
+};
+
+static int
+_tc_rdata_cmp(const void *a, const void *b)
+{
+    const struct rrset_rr *ra = *(const struct rrset_rr * const *) a;
+    const struct rrset_rr *rb = *(const struct rrset_rr * const *) b;
+    size_t          len;
+    int             ret;
+
+    len = ra->rr_rdata_length < rb->rr_rdata_length ?
+        ra->rr_rdata_length : rb->rr_rdata_length;
+    if (0 != (ret = memcmp(ra->rr_rdata, rb->rr_rdata, len)))
+        return ret;
+    if (ra->rr_rdata_length == rb->rr_rdata_length)
+        return 0;
+    return ra->rr_rdata_length < rb->rr_rdata_length ? -1 : 1;
+}
+
+/*
+ * Put the RDATA of a key set in a single block, each preceded by its
+ * length, in canonical order, so that two key sets hold the same keys
+ * if and only if their blocks are the same.
+ */
+static u_char  *
+_tc_keys(const struct rrset_rr *rrs, size_t *len)
+{
+    const struct rrset_rr *rr;
+    const struct rrset_rr **sorted;
+    u_char         *keys, *p;
+    size_t          n = 0, i;
+
+    *len = 0;
+    for (rr = rrs; rr; rr = rr->rr_next) {
+        if (rr->rr_rdata == NULL || rr->rr_rdata_length > 0xffff)
+            return NULL;
+        *len += 2 + rr->rr_rdata_length;
+        n++;
+    }
+    if (n == 0)
+        return NULL;
+
+    sorted = (const struct rrset_rr **)
+        MALLOC(n * sizeof(struct rrset_rr *));
+    if (sorted == NULL)
+        return NULL;
+    for (i = 0, rr = rrs; rr; rr = rr->rr_next)
+        sorted[i++] = rr;
+    qsort(sorted, n, sizeof(struct rrset_rr *), _tc_rdata_cmp);
+
+    keys = (u_char *) MALLOC(*len * sizeof(u_char));
+    if (keys != NULL) {
+        for (i = 0, p = keys; i < n; i++) {
+            NS_PUT16(sorted[i]->rr_rdata_length, p);
+            memcpy(p, sorted[i]->rr_rdata, sorted[i]->rr_rdata_length);
+            p += sorted[i]->rr_rdata_length;
+        }
+    }
+    FREE(sorted);
+    return keys;
+}
+
+static u_int32_t
+_tc_hash(const struct canon_name *cn, u_int16_t class_h)
+{
+    return (cn->cn_hash ^ class_h) * 16777619U;
+}
+
+static void
+_tc_entry_free(struct tc_entry *e)
+{
+    if (e->keys)
+        FREE(e->keys);
+    FREE(e);
+}
+
+static void
+_tc_clear(struct val_tcache *tc)
+{
+    struct tc_entry *e;
+    int             i;
+
+    for (i = 0; i < TC_BUCKETS; i++) {
+        while (NULL != (e = tc->buckets[i])) {
+            tc->buckets[i] = e->next;
+            _tc_entry_free(e);
+        }
+    }
+    tc->count = 0;
+}
+
+/*
+ * Drop the expired entries.  Called with the lock held.
+ */
+static void
+_tc_purge(struct val_tcache *tc, time_t now)
+{
+    struct tc_entry **ep, *e;
+    int             i;
+
+    for (i = 0; i < TC_BUCKETS; i++) {
+        for (ep = &tc->buckets[i]; NULL != (e = *ep);) {
+            if (e->expires <= now) {
+                *ep = e->next;
+                _tc_entry_free(e);
+                tc->count--;
+            } else
+                ep = &e->next;
+        }
+    }
+}
+
+static struct tc_entry *
+_tc_find(struct val_tcache *tc, u_int32_t hash, const struct canon_name *cn,
+         u_int16_t class_h, int kind)
+{
+    struct tc_entry *e;
+
+    for (e = tc->buckets[hash & (TC_BUCKETS - 1)]; e; e = e->next) {
+        if (e->hash == hash && e->class_h == class_h && e->kind == kind &&
+            canon_name_equal(cn, e->zone_n))
+            break;
+    }
+    return e;
+}
+
+/*
+ * Find the entry to update for a zone, adding one if there is none and
+ * the table is not full.  Called with the lock held.
+ */
+static struct tc_entry *
+_tc_insert(struct val_tcache *tc, u_int32_t hash, const struct canon_name *cn,
+           const u_char *zone_n, u_int16_t class_h, int kind, time_t now)
+{
+    struct tc_entry *e;
+
+    if (NULL != (e = _tc_find(tc, hash, cn, class_h, kind)))
+        return e;
+
+    if (tc->count >= TC_MAX_ENTRIES)
+        _tc_purge(tc, now);
+    if (tc->count >= TC_MAX_ENTRIES ||
+        NULL == (e = (struct tc_entry *) MALLOC(sizeof(struct tc_entry))))
+        return NULL;
+    memset(e, 0, sizeof(struct tc_entry));
+    e->hash = hash;
+    e->class_h = class_h;
+    e->kind = kind;
+    memcpy(e->zone_n, zone_n, wire_name_length((u_char *) zone_n));
+    e->next = tc->buckets[hash & (TC_BUCKETS - 1)];
+    tc->buckets[hash & (TC_BUCKETS - 1)] = e;
+    tc->count++;
+    return e;
+}
+
+struct val_tcache *
+val_tcache_create(void)
+{
+    struct val_tcache *tc;
+
+    tc = (struct val_tcache *) MALLOC(sizeof(struct val_tcache));
+    if (NULL == tc)
+        return NULL;
+    memset(tc, 0, sizeof(struct val_tcache));
+#ifndef VAL_NO_THREADS
+    if (0 != pthread_mutex_init(&tc->lock, NULL)) {
+        FREE(tc);
+        return NULL;
+    }
+#endif
+    return tc;
+}
+
+void
+val_tcache_destroy(struct val_tcache *tc)
+{
+    if (NULL == tc)
+        return;
+
+    _tc_clear(tc);
+#ifndef VAL_NO_THREADS
+    pthread_mutex_destroy(&tc->lock);
+#endif
+    FREE(tc);
+}
+
+/*
+ * Forget everything, e.g. because the trust anchors have changed.
+ */
+void
+val_tcache_flush(val_context_t *context)
+{
+    struct val_tcache *tc;
+
+    if (NULL == context || NULL == (tc = context->tcache))
+        return;
+
+    TC_LOCK(tc);
+    _tc_clear(tc);
+    TC_UNLOCK(tc);
+}
+
+/*
+ * Returns 1 if exactly this DNSKEY RRset has already been shown to be
+ * trusted, and sets *ttl_x to the time at which that stops being known.
+ */
+int
+val_tcache_keyset_trusted(val_context_t *context, struct rrset_rec *keyset,
+                          u_int32_t flags, u_int32_t *ttl_x)
+{
+    struct val_tcache *tc;
+    struct tc_entry *e;
+    struct canon_name cn;
+    u_int32_t       hash;
+    u_char         *keys;
+    size_t          keys_len;
+    time_t          now;
+    int             found = 0;
+
+    if (NULL == context || NULL == (tc = context->tcache) ||
+        NULL == keyset || NULL == ttl_x ||
+        (flags & (VAL_QUERY_SKIP_CACHE | VAL_QUERY_USING_DLV |
+                  VAL_QUERY_CHECK_ALL_RRSIGS)) ||
+        canon_name_init(&cn, keyset->rrs_name_n) != 0)
+        return 0;
+
+    hash = _tc_hash(&cn, keyset->rrs_class_h);
+    now = time(NULL);
+
+    if (NULL == (keys = _tc_keys(keyset->rrs_data, &keys_len)))
+        return 0;
+
+    TC_LOCK(tc);
+    e = _tc_find(tc, hash, &cn, keyset->rrs_class_h, TC_KEYSET);
+    if (e != NULL && e->expires > now && e->keys_len == keys_len &&
+        !memcmp(e->keys, keys, keys_len)) {
+        *ttl_x = (u_int32_t) e->expires;
+        found = 1;
+    }
+    TC_UNLOCK(tc);
+    FREE(keys);
+
+    if (found)
+        VAL_STATS_INC(vs_trust_cache_hits);
+    return found;
+}
+
+/*
+ * Remember that a DNSKEY RRset is trusted until ttl_x.  A zone has a
+ * single entry, which holds the key set that was validated last.
+ */
+void
+val_tcache_add_keyset(val_context_t *context, struct rrset_rec *keyset,
+                      u_int32_t flags, u_int32_t ttl_x)
+{
+    struct val_tcache *tc;
+    struct tc_entry *e;
+    struct canon_name cn;
+    u_int32_t       hash;
+    u_char         *keys;
+    size_t          keys_len;
+    time_t          now;
+
+    now = time(NULL);
+    if (NULL == context || NULL == (tc = context->tcache) ||
+        NULL == keyset || (time_t) ttl_x <= now ||
+        (flags & (VAL_QUERY_USING_DLV | VAL_QUERY_IGNORE_SKEW)) ||
+        canon_name_init(&cn, keyset->rrs_name_n) != 0 ||
+        NULL == (keys = _tc_keys(keyset->rrs_data, &keys_len)))
+        return;
+
+    hash = _tc_hash(&cn, keyset->rrs_class_h);
+
+    TC_LOCK(tc);
+    e = _tc_insert(tc, hash, &cn, keyset->rrs_name_n, keyset->rrs_class_h,
+                   TC_KEYSET, now);
+    if (e == NULL) {
+        TC_UNLOCK(tc);
+        FREE(keys);
+        return;
+    }
+    if (e->keys)
+        FREE(e->keys);
+    e->keys = keys;
+    e->keys_len = keys_len;
+    e->expires = (time_t) ttl_x;
+    TC_UNLOCK(tc);
+}
+
+/*
+ * Returns 1 if name_n is at or below a zone cut that is itself below
+ * top_n and has been shown to have no DS, and sets *ttl_x to the time
+ * at which that stops being known.
+ */
+int
+val_tcache_insecure(val_context_t *context, const u_char *name_n,
+                    const u_char *top_n, u_int16_t class_h,
+                    u_int32_t flags, u_int32_t *ttl_x)
+{
+    struct val_tcache *tc;
+    struct tc_entry *e;
+    struct canon_name cn;
+    const u_char   *p;
+    time_t          now;
+    int             found = 0;
+
+    if (NULL == context || NULL == (tc = context->tcache) ||
+        NULL == name_n || NULL == top_n || NULL == ttl_x ||
+        (flags & (VAL_QUERY_SKIP_CACHE | VAL_QUERY_USING_DLV)))
+        return 0;
+
+    now = time(NULL);
+
+    TC_LOCK(tc);
+    for (p = name_n; *p != '\0' && namecmp(p, top_n); p += *p + 1) {
+        if (canon_name_init(&cn, p) != 0)
+            break;
+        e = _tc_find(tc, _tc_hash(&cn, class_h), &cn, class_h, TC_INSECURE);
+        if (e != NULL && e->expires > now) {
+            *ttl_x = (u_int32_t) e->expires;
+            found = 1;
+            break;
+        }
+    }
+    TC_UNLOCK(tc);
+
+    if (found)
+        VAL_STATS_INC(vs_insecure_cache_hits);
+    return found;
+}
+
+/*
+ * Remember until ttl_x that the delegation to cut_n has no DS.
+ */
+void
+val_tcache_add_insecure(val_context_t *context, const u_char *cut_n,
+                        u_int16_t class_h, u_int32_t flags, u_int32_t ttl_x)
+{
+    struct val_tcache *tc;
+    struct tc_entry *e;
+    struct canon_name cn;
+    time_t          now;
+
+    now = time(NULL);
+    if (NULL == context || NULL == (tc = context->tcache) ||
+        NULL == cut_n || (time_t) ttl_x <= now ||
+        (flags & (VAL_QUERY_USING_DLV | VAL_QUERY_IGNORE_SKEW)) ||
+        canon_name_init(&cn, cut_n) != 0)
+        return;
+
+    TC_LOCK(tc);
+    e = _tc_insert(tc, _tc_hash(&cn, class_h), &cn, cut_n, class_h,
+                   TC_INSECURE, now);
+    if (e != NULL)
+        e->expires = (time_t) ttl_x;
+    TC_UNLOCK(tc);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+#ifndef VAL_TCACHE_H
+#define VAL_TCACHE_H
+
+struct val_tcache *val_tcache_create(void);
+void            val_tcache_destroy(struct val_tcache *tc);
+void            val_tcache_flush(val_context_t *context);
+
+int             val_tcache_keyset_trusted(val_context_t *context,
+                                          struct rrset_rec *keyset,
+                                          u_int32_t flags,
+                                          u_int32_t *ttl_x);
+void            val_tcache_add_keyset(val_context_t *context,
+                                      struct rrset_rec *keyset,
+                                      u_int32_t flags, u_int32_t ttl_x);
+int             val_tcache_insecure(val_context_t *context,
+                                    const u_char *name_n,
+                                    const u_char *top_n, u_int16_t class_h,
+                                    u_int32_t flags, u_int32_t *ttl_x);
+void            val_tcache_add_insecure(val_context_t *context,
+                                        const u_char *cut_n,
+                                        u_int16_t class_h, u_int32_t flags,
+                                        u_int32_t ttl_x);
+
+#endif /* VAL_TCACHE_H */
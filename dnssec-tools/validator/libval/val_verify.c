@@ -14,6 +14,7 @@
 #include "val_crypto.h"
 #include "val_policy.h"
 #include "val_parse.h"
+#include "val_stats.h"
 
 
 #define ZONE_KEY_FLAG 0x0100    /* Zone Key Flag, RFC 4034 */
@@ -29,7 +30,7 @@ get_clock_skew(val_context_t *ctx,
                u_int32_t *ttl_x)
 {
     policy_entry_t *cs_pol, *cs_cur;
-    u_char       *p;
+    struct canon_name cname;
     size_t       name_len;
 
     if (ctx == NULL || name_n == NULL || skew == NULL || ttl_x == NULL) {
@@ -38,7 +39,7 @@ get_clock_skew(val_context_t *ctx,
     }
     
     RETRIEVE_POLICY(ctx, P_CLOCK_SKEW, cs_pol);
-    if (cs_pol) {
+    if (cs_pol && canon_name_init(&cname, name_n) == 0) {
 
         name_len = wire_name_length(name_n);
 
@@ -52,21 +53,7 @@ get_clock_skew(val_context_t *ctx,
          * Because of the ordering, the longest match is found first 
          */
         for (; cs_cur; cs_cur = cs_cur->next) {
-            int             root_zone = 0;
-            if (!namecmp(cs_cur->zone_n, (const u_char *) ""))
-                root_zone = 1;
-            else {
-                /*
-                 * Find the last occurrence of cs_cur->zone_n in name_n 
-                 */
-                p = name_n;
-                while (p && (*p != '\0')) {
-                    if (!namecmp(p, cs_cur->zone_n))
-                        break;
-                    p = p + *p + 1;
-                }
-            }
-            if (root_zone || (!namecmp(p, cs_cur->zone_n))) {
+            if (canon_name_tail(&cname, cs_cur->zone_n) >= 0) {
                 val_log(ctx, LOG_DEBUG, "get_clock_skew(): Found clock skew policy"); 
                 if (cs_cur->pol) {
                     *skew = ((struct clock_skew_policy *)(cs_cur->pol))->clock_skew;
@@ -87,8 +74,7 @@ get_clock_skew(val_context_t *ctx,
 static int 
 val_sigverify(val_context_t * ctx,
               int is_a_wildcard,
-              const u_char *data,
-              size_t data_len,
+              const struct val_sigfield *sf,
               const val_dnskey_rdata_t * dnskey,
               const val_rrsig_rdata_t * rrsig,
               val_astatus_t * dnskey_status, val_astatus_t * sig_status,
@@ -188,48 +174,7 @@ val_sigverify(val_context_t * ctx,
                 "val_sigverify(): Not checking inception and expiration times on signatures.");
     }
 
-    switch (rrsig->algorithm) {
-
-    case ALG_RSAMD5:
-        rsamd5_sigverify(ctx, data, data_len, dnskey, rrsig, 
-                         dnskey_status, sig_status);
-        break;
-
-#ifdef LIBVAL_NSEC3
-    case ALG_NSEC3_DSASHA1:
-#endif
-    case ALG_DSASHA1:
-        dsasha1_sigverify(ctx, data, data_len, dnskey, rrsig,
-                          dnskey_status, sig_status);
-        break;
-
-#ifdef LIBVAL_NSEC3
-    case ALG_NSEC3_RSASHA1:
-#endif
-    case ALG_RSASHA1:
-#ifdef HAVE_SHA_2
-    case ALG_RSASHA256:
-    case ALG_RSASHA512:
-#endif
-        rsasha_sigverify(ctx, data, data_len, dnskey, rrsig,
-                          dnskey_status, sig_status);
-        break;
-
-#if defined(HAVE_ECDSA) && defined(HAVE_OPENSSL_ECDSA_H)
-    case ALG_ECDSAP256SHA256:
-    case ALG_ECDSAP384SHA384:
-        ecdsa_sigverify(ctx, data, data_len, dnskey, rrsig,
-                        dnskey_status, sig_status);
-        break;
-#endif
-
-    default:
-        val_log(ctx, LOG_INFO, "val_sigverify(): Unsupported algorithm %d.",
-                rrsig->algorithm);
-        *sig_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
-        *dnskey_status = VAL_AC_ALGORITHM_NOT_SUPPORTED;
-        break;
-    }
+    val_crypto_sigverify(ctx, sf, dnskey, rrsig, dnskey_status, sig_status);
 
     if (*sig_status == VAL_AC_RRSIG_VERIFIED) {
         if (is_a_wildcard) {
@@ -249,73 +194,144 @@ val_sigverify(val_context_t * ctx,
 }
 
 /*
- * Calculate the size of the field over which the verification
- * is done.  This is the sum of
- * the number of bytes through the signer name in the SIG RDATA
- * the length of the signer name (uncompressed)
- * the sum of the fully uncompressed lengths of the RRs in the set
- * *field_length is the field length
- * *signer_length is the length of the signer's name (used externally)
+ * Build the canonical form of the RRs in the set, as covered by an RRSIG
+ * with the given original TTL and wildcard label count.  The result is
+ * kept in rr_set->rrs_canon so that every RRSIG and every key tried
+ * against the set shares one copy; it is rebuilt only when a signature
+ * with a different TTL or wildcard expansion comes along.  The RDATA has
+ * already been lower-cased and sorted by copy_rrset_rec().  The RRs
+ * start CANON_ROOM bytes into the buffer, so that an algorithm that
+ * needs the data covered by a signature in one piece can put the RRSIG
+ * part right in front of them.
  */
 static int
-predict_sigbuflength(struct rrset_rec *rr_set,
-                     size_t * field_length, size_t *signer_length)
+make_canon_rrs(struct rrset_rec *rr_set, u_int32_t ttl_n,
+               int is_a_wildcard)
 {
-    struct rrset_rr  *rr;
-    int             owner_length;
+    struct rrset_rr  *curr_rr;
+    u_char          owner_n[NS_MAXCDNAME];
+    u_char         *np;
+    size_t          owner_length;
+    size_t          length;
+    size_t          index;
+    size_t          l_index;
+    u_int16_t       type_n;
+    u_int16_t       class_n;
+    u_int16_t       rdata_length_n;
+    int             i;
+
+    if (rr_set->rrs_canon != NULL) {
+        if (rr_set->rrs_canon_ttl_n == ttl_n &&
+            rr_set->rrs_canon_wcard == is_a_wildcard)
+            return VAL_NO_ERROR;
+        /*
+         * the hashes in rrs_digests depend only on the RRSIG and
+         * rrs_data, so they stay
+         */
+        FREE(rr_set->rrs_canon);
+        rr_set->rrs_canon = NULL;
+    }
 
-    /** Input has already been NULL-checked **/
     owner_length = wire_name_length(rr_set->rrs_name_n);
+    if (owner_length == 0)
+        return VAL_BAD_ARGUMENT;
 
-    *signer_length =
-        wire_name_length(&rr_set->rrs_sig->rr_rdata[SIGNBY]);
+    if (is_a_wildcard) {
+        /*
+         * Construct the original name 
+         */
+        np = rr_set->rrs_name_n;
+        for (i = 0; i < is_a_wildcard && np[0] != 0; i++)
+            np += np[0] + 1;
+        if (i < is_a_wildcard)
+            return VAL_BAD_ARGUMENT;
+        owner_length = wire_name_length(np);
+        if ((owner_length + 2) > sizeof(owner_n))
+            return VAL_BAD_ARGUMENT;
+        owner_n[0] = (u_char) 1;
+        owner_n[1] = '*';
+        memcpy(&owner_n[2], np, owner_length);
+        owner_length += 2;
+    } else {
+        memcpy(owner_n, rr_set->rrs_name_n, owner_length);
+    }
+    l_index = 0;
+    lower_name(owner_n, &l_index);
 
-    if (*signer_length == 0)
-        return VAL_BAD_ARGUMENT;
+    length = 0;
+    for (curr_rr = rr_set->rrs_data; curr_rr; curr_rr = curr_rr->rr_next) {
+        if (curr_rr->rr_rdata == NULL)
+            return VAL_BAD_ARGUMENT;
+        length += owner_length + ENVELOPE + curr_rr->rr_rdata_length;
+    }
 
-    *field_length = SIGNBY + (*signer_length);
+    rr_set->rrs_canon = (u_char *) MALLOC((CANON_ROOM + length) *
+                                          sizeof(u_char));
+    if (rr_set->rrs_canon == NULL)
+        return VAL_OUT_OF_MEMORY;
 
-    for (rr = rr_set->rrs_data; rr; rr = rr->rr_next)
-        *field_length += owner_length + ENVELOPE + rr->rr_rdata_length;
+    type_n = htons(rr_set->rrs_type_h);
+    class_n = htons(rr_set->rrs_class_h);
+
+    /*
+     * For each record of data, copy in the envelope & the rdata 
+     */
+    index = CANON_ROOM;
+    for (curr_rr = rr_set->rrs_data; curr_rr; curr_rr = curr_rr->rr_next) {
+        memcpy(&rr_set->rrs_canon[index], owner_n, owner_length);
+        index += owner_length;
+        memcpy(&rr_set->rrs_canon[index], &type_n, sizeof(u_int16_t));
+        index += sizeof(u_int16_t);
+        memcpy(&rr_set->rrs_canon[index], &class_n, sizeof(u_int16_t));
+        index += sizeof(u_int16_t);
+        memcpy(&rr_set->rrs_canon[index], &ttl_n, sizeof(u_int32_t));
+        index += sizeof(u_int32_t);
+        rdata_length_n = htons(curr_rr->rr_rdata_length);
+        memcpy(&rr_set->rrs_canon[index], &rdata_length_n,
+               sizeof(u_int16_t));
+        index += sizeof(u_int16_t);
+        memcpy(&rr_set->rrs_canon[index], curr_rr->rr_rdata,
+               curr_rr->rr_rdata_length);
+        index += curr_rr->rr_rdata_length;
+    }
+
+    rr_set->rrs_canon_len = index - CANON_ROOM;
+    rr_set->rrs_canon_ttl_n = ttl_n;
+    rr_set->rrs_canon_wcard = is_a_wildcard;
+    val_stats_add(offsetof(val_stats_t, vs_sig_bytes),
+                  rr_set->rrs_canon_len);
 
     return VAL_NO_ERROR;
 }
 
 /*
- * Create the buffer over which the signature is to be verified
+ * Describe the data over which the signature is to be verified: the
+ * RRSIG RDATA up to and including the (lower-cased) signer name, which
+ * is placed in the caller-supplied prefix buffer, followed by the
+ * canonical RRs held on the set.
  */
 static int
-make_sigfield(u_char ** field,
-              size_t * field_length,
+make_sigfield(struct val_sigfield *sf,
+              u_char *prefix,
               struct rrset_rec *rr_set,
-              struct rrset_rr *rr_sig, int is_a_wildcard)
+              struct rrset_rr *rr_sig, int is_a_wildcard,
+              struct val_digest_cache **dcache)
 {
-    struct rrset_rr  *curr_rr;
-    size_t          index;
     size_t          signer_length;
-    size_t          owner_length;
-    u_int16_t       type_n;
-    u_int16_t       class_n;
     u_int32_t       ttl_n;
-    u_int16_t       rdata_length_n;
-    u_char          lowered_owner_n[NS_MAXCDNAME];
     size_t          l_index;
     int             retval;
 
-    if ((field == NULL) || (field_length == NULL) || (rr_set == NULL) ||
+    if ((sf == NULL) || (prefix == NULL) || (rr_set == NULL) ||
         (rr_sig == NULL) || (rr_set->rrs_name_n == NULL) ||
-        (rr_set->rrs_sig == NULL) || 
-        (rr_set->rrs_sig->rr_rdata == NULL))
+        (rr_sig->rr_rdata == NULL) || (rr_sig->rr_rdata_length <= SIGNBY))
         return VAL_BAD_ARGUMENT;
 
-    if ((retval = predict_sigbuflength(rr_set, field_length, &signer_length)) !=
-        VAL_NO_ERROR)
-        return retval;
-
-    *field = (u_char *) MALLOC(*field_length * sizeof(u_char));
-
-    if (*field == NULL)
-        return VAL_OUT_OF_MEMORY;
+    signer_length = wire_name_length(&rr_sig->rr_rdata[SIGNBY]);
+    if (signer_length == 0 ||
+        (SIGNBY + signer_length) > rr_sig->rr_rdata_length ||
+        signer_length > NS_MAXCDNAME)
+        return VAL_BAD_ARGUMENT;
 
     /*
      * Make sure we are using the correct TTL 
@@ -324,111 +340,29 @@ make_sigfield(u_char ** field,
     memcpy(&ttl_n, &rr_sig->rr_rdata[TTL], sizeof(u_int32_t));
     rr_set->rrs_ttl_h = ntohl(ttl_n);
 
-    /*
-     * While we're at it, we'll gather other common info, specifically
-     * network ordered numbers (type, class) and name length.
-     */
-
-    owner_length = wire_name_length(rr_set->rrs_name_n);
-
-    if (owner_length == 0)
-        goto err;
-
-    memcpy(lowered_owner_n, rr_set->rrs_name_n, owner_length);
-    l_index = 0;
-    lower_name(lowered_owner_n, &l_index);
-
-    type_n = htons(rr_set->rrs_type_h);
-    class_n = htons(rr_set->rrs_class_h);
+    if ((retval = make_canon_rrs(rr_set, ttl_n, is_a_wildcard)) !=
+        VAL_NO_ERROR)
+        return retval;
 
     /*
-     * Copy in the SIG RDATA (up to the signature 
+     * Copy in the SIG RDATA (up to the signature)
      */
-
-    index = 0;
-    if ((index + SIGNBY + signer_length) > *field_length)
-        goto err;
-    memcpy(&(*field)[index], rr_sig->rr_rdata, SIGNBY + signer_length);
+    memcpy(prefix, rr_sig->rr_rdata, SIGNBY + signer_length);
     l_index = 0;
-    lower_name(&(*field)[index+SIGNBY], &l_index);
-    index += SIGNBY + signer_length;
+    lower_name(&prefix[SIGNBY], &l_index);
 
-    /*
-     * For each record of data, copy in the envelope & the lower cased rdata 
-     */
+    sf->sf_prefix = prefix;
+    sf->sf_prefix_len = SIGNBY + signer_length;
+    sf->sf_room = rr_set->rrs_canon;
+    sf->sf_rrs = rr_set->rrs_canon + CANON_ROOM;
+    sf->sf_rrs_len = rr_set->rrs_canon_len;
+    sf->sf_set = rr_set;
+    sf->sf_dcache = dcache;
 
-    for (curr_rr = rr_set->rrs_data; curr_rr;
-         curr_rr = curr_rr->rr_next) {
-        if (curr_rr->rr_rdata == NULL)
-            goto err;
-
-        /*
-         * Copy in the envelope information 
-         */
+    VAL_STATS_INC(vs_sig_checks);
+    val_stats_add(offsetof(val_stats_t, vs_sig_bytes), sf->sf_prefix_len);
 
-        if (is_a_wildcard) {
-            /*
-             * Construct the original name 
-             */
-            u_char wcard_n[NS_MAXCDNAME];
-            u_char *np = lowered_owner_n;
-            int    i;
-            size_t outer_len;
-
-            for (i = 0; i < is_a_wildcard; i++)
-                np += np[0] + 1;
-            outer_len = wire_name_length(np);
-
-            wcard_n[0] = (u_char) 1;
-            wcard_n[1] = '*';
-            if ((outer_len + 2) > sizeof(wcard_n))
-                goto err;
-            memcpy(&wcard_n[2], np, outer_len);
-            if ((index + outer_len + 2) > *field_length)
-                goto err;
-            memcpy(&(*field)[index], wcard_n, outer_len + 2);
-            index += outer_len + 2;
-        } else {
-            if ((index + owner_length) > *field_length)
-                goto err;
-            memcpy(&(*field)[index], lowered_owner_n, owner_length);
-            index += owner_length;
-        }
-
-        if ((index + sizeof(u_int16_t) + sizeof(u_int16_t) +
-             sizeof(u_int32_t))
-            > *field_length)
-            goto err;
-        memcpy(&(*field)[index], &type_n, sizeof(u_int16_t));
-        index += sizeof(u_int16_t);
-        memcpy(&(*field)[index], &class_n, sizeof(u_int16_t));
-        index += sizeof(u_int16_t);
-        memcpy(&(*field)[index], &ttl_n, sizeof(u_int32_t));
-        index += sizeof(u_int32_t);
-
-        /*
-         * Now the RR-specific info, the length and the data 
-         */
-
-        rdata_length_n = htons(curr_rr->rr_rdata_length);
-        if ((index + sizeof(u_int16_t) + curr_rr->rr_rdata_length)
-            > *field_length)
-            goto err;
-        memcpy(&(*field)[index], &rdata_length_n, sizeof(u_int16_t));
-        index += sizeof(u_int16_t);
-        memcpy(&(*field)[index], curr_rr->rr_rdata,
-               curr_rr->rr_rdata_length);
-        index += curr_rr->rr_rdata_length;
-    }
-
-    *field_length = index;
     return VAL_NO_ERROR;
-
-  err:
-    FREE(*field);
-    *field = NULL;
-    *field_length = 0;
-    return VAL_BAD_ARGUMENT;
 }
 
 /*
@@ -465,14 +399,14 @@ do_verify(val_context_t * ctx,
           struct rrset_rec *the_set,
           struct rrset_rr *the_sig,
           val_dnskey_rdata_t * the_key, int is_a_wildcard,
-          u_int32_t flags)
+          u_int32_t flags, struct val_digest_cache **dcache)
 {
     /*
      * Use the crypto routines to verify the signature
      */
 
-    u_char       *ver_field = NULL;
-    size_t          ver_length;
+    struct val_sigfield sf;
+    u_char          prefix[SIGNBY + NS_MAXCDNAME];
     int             ret_val;
     val_rrsig_rdata_t rrsig_rdata;
     int clock_skew = 0;
@@ -489,16 +423,12 @@ do_verify(val_context_t * ctx,
         return 0;
     }
 
-    if ((ret_val = make_sigfield(&ver_field, &ver_length, the_set, the_sig,
-                                 is_a_wildcard)) != VAL_NO_ERROR ||
-        ver_field == NULL || 
-        ver_length == 0) {
+    if ((ret_val = make_sigfield(&sf, prefix, the_set, the_sig,
+                                 is_a_wildcard, dcache)) != VAL_NO_ERROR) {
 
         val_log(ctx, LOG_INFO, 
                 "do_verify(): Could not construct signature field for verification: %s", 
                 p_val_err(ret_val));
-        if (ver_field)
-            FREE(ver_field);
         *sig_status = VAL_AC_INVALID_RRSIG;
         return 0;
     }
@@ -510,8 +440,6 @@ do_verify(val_context_t * ctx,
     if (VAL_NO_ERROR != val_parse_rrsig_rdata(the_sig->rr_rdata, 
                                    the_sig->rr_rdata_length,
                                    &rrsig_rdata)) {
-        if (ver_field)
-            FREE(ver_field);
         val_log(ctx, LOG_INFO, 
                 "do_verify(): Could not parse signature field");
         *sig_status = VAL_AC_INVALID_RRSIG;
@@ -532,7 +460,7 @@ do_verify(val_context_t * ctx,
     /*
      * Perform the verification 
      */
-    ret_val = val_sigverify(ctx, is_a_wildcard, ver_field, ver_length, the_key,
+    ret_val = val_sigverify(ctx, is_a_wildcard, &sf, the_key,
                   &rrsig_rdata, dnskey_status, sig_status, clock_skew);
 
     if (rrsig_rdata.signature != NULL) {
@@ -540,7 +468,6 @@ do_verify(val_context_t * ctx,
         rrsig_rdata.signature = NULL;
     }
 
-    FREE(ver_field);
     return ret_val;
 }
 
@@ -663,6 +590,7 @@ verify_next_assertion(val_context_t * ctx,
     u_int16_t       tag_h;
     char            name_p[NS_MAXDNAME];
     int success = 0;
+    struct val_digest_cache *dcache = NULL;
 
     if ((as == NULL) || (as->val_ac_rrset.ac_data == NULL) || (the_trust == NULL)) {
         val_log(ctx, LOG_INFO, "verify_next_assertion(): Cannot verify assertion - no data");
@@ -756,7 +684,8 @@ verify_next_assertion(val_context_t * ctx,
             is_verified = do_verify(ctx, signby_name_n,
                       &nextrr->rr_status,
                       &the_sig->rr_status,
-                      the_set, the_sig, &dnskey, is_a_wildcard, flags);
+                      the_set, the_sig, &dnskey, is_a_wildcard, flags,
+                      &dcache);
 
             /*
              * There might be multiple keys with the same key tag; set this as
@@ -875,4 +804,81 @@ verify_next_assertion(val_context_t * ctx,
     if (!success && the_set->rrs_type_h == ns_t_dnskey){
         as->val_ac_status = VAL_AC_NO_LINK;
     }
+
+    val_digest_cache_free(dcache);
+}
+
+/*
+ * Check the_set against a DNSKEY RRset that is already known to belong
+ * to the zone that signed it, as when a whole zone is read from a file
+ * rather than learned one RRset at a time.  With trusted_only set, only
+ * keys marked VAL_AC_TRUST_POINT are used.  Returns 1 if one of the
+ * RRSIGs verifies, and sets *sig_expr to the earliest expiration time
+ * among the RRSIGs that did.
+ */
+int
+verify_rrset_with_keys(val_context_t * ctx, struct rrset_rec *the_set,
+                       struct rrset_rr *keyrr, int trusted_only,
+                       u_int32_t * sig_expr)
+{
+    struct rrset_rr  *the_sig;
+    struct rrset_rr  *nextrr;
+    u_char           *signby_name_n;
+    u_int16_t         signby_footprint_n;
+    val_dnskey_rdata_t dnskey;
+    val_rrsig_rdata_t rrsig_rdata;
+    int               is_a_wildcard;
+    int               success = 0;
+    struct val_digest_cache *dcache = NULL;
+
+    if ((the_set == NULL) || (keyrr == NULL) || (sig_expr == NULL))
+        return 0;
+
+    for (the_sig = the_set->rrs_sig; the_sig; the_sig = the_sig->rr_next) {
+
+        if (!check_label_count(the_set, the_sig, &is_a_wildcard) ||
+            VAL_NO_ERROR != identify_key_from_sig(the_sig, &signby_name_n,
+                                                  &signby_footprint_n))
+            continue;
+
+        for (nextrr = keyrr; nextrr; nextrr = nextrr->rr_next) {
+            val_astatus_t   key_status = VAL_AC_UNSET;
+            val_astatus_t   sig_status = VAL_AC_UNSET;
+            int             is_verified;
+
+            if (trusted_only && nextrr->rr_status != VAL_AC_TRUST_POINT)
+                continue;
+            if (VAL_NO_ERROR != val_parse_dnskey_rdata(nextrr->rr_rdata,
+                                                       nextrr->rr_rdata_length,
+                                                       &dnskey))
+                continue;
+            dnskey.next = NULL;
+            if (dnskey.key_tag != ntohs(signby_footprint_n)) {
+                if (dnskey.public_key != NULL)
+                    FREE(dnskey.public_key);
+                continue;
+            }
+
+            is_verified = do_verify(ctx, signby_name_n, &key_status,
+                                    &sig_status, the_set, the_sig, &dnskey,
+                                    is_a_wildcard, 0, &dcache);
+            if (dnskey.public_key != NULL)
+                FREE(dnskey.public_key);
+
+            if (is_verified &&
+                VAL_NO_ERROR == val_parse_rrsig_rdata(the_sig->rr_rdata,
+                                                      the_sig->rr_rdata_length,
+                                                      &rrsig_rdata)) {
+                if (rrsig_rdata.signature != NULL)
+                    FREE(rrsig_rdata.signature);
+                if (!success || rrsig_rdata.sig_expr < *sig_expr)
+                    *sig_expr = rrsig_rdata.sig_expr;
+                success = 1;
+                break;
+            }
+        }
+    }
+
+    val_digest_cache_free(dcache);
+    return success;
 }
@@ -56,4 +56,13 @@ void            verify_next_assertion(val_context_t * ctx,
                                       struct val_digested_auth_chain *the_trust,
                                       u_int flags);
 
+/*
+ * Check an RRset from a zone file against the zone's own keys
+ */
+int             verify_rrset_with_keys(val_context_t * ctx,
+                                       struct rrset_rec *the_set,
+                                       struct rrset_rr *keyrr,
+                                       int trusted_only,
+                                       u_int32_t * sig_expr);
+
 #endif
@@ -0,0 +1,479 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Warm a context's caches from a list of names known ahead of time,
+ * so that a new instance can fill them before it takes any traffic.
+ *
+ * The list is sorted by the parent domain of each name, then by the
+ * name, class and type in canonical order.  Identical queries end up
+ * next to each other and only the first of them is resolved; the rest
+ * are given its status.  The names that share a parent domain, which
+ * are nearly always in the same zone, form a group.  Only the first
+ * query of each group is submitted at first; the other queries of the
+ * group wait until it has completed.  By then the chain of trust of the
+ * zone is in the rrset cache, its DNSKEY set is in the trust cache and
+ * any insecure delegation above it is known, so the rest of the group
+ * only needs its own answers fetched and checked.  Meanwhile the
+ * leading queries of other groups fill the remaining window, and the
+ * chain queries they have in common (the TLD keys, say) are shared in
+ * flight through the context's query list.
+ *
+ * The queries go through the asynchronous interface of the context,
+ * with at most a given number outstanding, and are driven by
+ * val_async_check_wait() in the calling thread.  Without asynchronous
+ * support the list is resolved one query at a time in the same order.
+ */
+#include "validator-internal.h"
+
+#include "val_context.h"
+#include "val_support.h"
+
+#define VW_DEFAULT_CONCURRENCY  100
+#define VW_PROGRESS_INTERVAL    1.0     /* seconds between progress calls */
+
+struct vw_run;
+
+struct vw_item {
+    u_char         *name_n;
+    const u_char   *parent_n;
+    u_int16_t       class_h;
+    u_int16_t       type_h;
+    int             qi;         /* index in the caller's list */
+    int             group;
+    int             ndup;       /* identical queries that follow it */
+    int             dup;        /* answered by an earlier item */
+    int             done;
+    struct vw_run  *run;
+#ifndef VAL_NO_ASYNC
+    val_async_status *as;
+#endif
+};
+
+struct vw_group {
+    int             first;      /* the leading query */
+    int             end;        /* one past the last item */
+    int             next;       /* next item to submit */
+};
+
+struct vw_run {
+    val_context_t  *context;
+    val_warm_query_t *queries;
+    struct vw_item *items;
+    int             nitems;
+    struct vw_group *groups;
+    int             ngroups;
+    int             next_group; /* next group whose leader is due */
+    int            *open;       /* groups whose leader has completed */
+    int             open_head;
+    int             open_tail;
+    u_int32_t       flags;
+    struct timeval  start;
+    struct timeval  last_progress;
+    val_warm_progress_t progress;
+    val_warm_progress_cb progress_cb;
+    void           *cb_data;
+};
+
+static int
+_vw_cmp(const void *a, const void *b)
+{
+    const struct vw_item *ia = (const struct vw_item *) a;
+    const struct vw_item *ib = (const struct vw_item *) b;
+    int             c;
+
+    if ((c = namecmp(ia->parent_n, ib->parent_n)) != 0)
+        return c;
+    if ((c = namecmp(ia->name_n, ib->name_n)) != 0)
+        return c;
+    if (ia->class_h != ib->class_h)
+        return (ia->class_h < ib->class_h) ? -1 : 1;
+    if (ia->type_h != ib->type_h)
+        return (ia->type_h < ib->type_h) ? -1 : 1;
+    /* keep the caller's order otherwise, so that the result is stable */
+    return (ia->qi < ib->qi) ? -1 : (ia->qi > ib->qi);
+}
+
+static double
+_vw_elapsed(const struct timeval *start, const struct timeval *now)
+{
+    return (now->tv_sec - start->tv_sec) +
+        (now->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+_vw_report(struct vw_run *run, int final)
+{
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    if (!final &&
+        _vw_elapsed(&run->last_progress, &now) < VW_PROGRESS_INTERVAL)
+        return;
+    run->last_progress = now;
+    run->progress.vwp_elapsed = _vw_elapsed(&run->start, &now);
+    if (run->progress_cb)
+        (*run->progress_cb) (run->context, &run->progress, run->cb_data);
+}
+
+/*
+ * Record the outcome of an item; the leader of a group lets the rest
+ * of its group go.
+ */
+static void
+_vw_complete(struct vw_run *run, struct vw_item *item, val_status_t status,
+             int retval)
+{
+    val_warm_query_t *q = &run->queries[item->qi];
+
+    item->done = 1;
+    q->vw_status = status;
+    q->vw_retval = retval;
+    run->progress.vwp_done += 1 + item->ndup;
+    if (retval != VAL_NO_ERROR)
+        run->progress.vwp_failed += 1 + item->ndup;
+
+    if (item == &run->items[run->groups[item->group].first] &&
+        run->groups[item->group].next < run->groups[item->group].end)
+        run->open[run->open_tail++] = item->group;
+}
+
+/*
+ * Pick the next item to resolve: the followers of groups whose chain
+ * is already in place come first, then the leader of a new group.
+ * Returns NULL once every item has been handed out.
+ */
+static struct vw_item *
+_vw_next(struct vw_run *run)
+{
+    struct vw_group *g;
+    struct vw_item *item;
+
+    while (run->open_head < run->open_tail) {
+        g = &run->groups[run->open[run->open_head]];
+        while (g->next < g->end && run->items[g->next].dup)
+            g->next++;
+        if (g->next < g->end)
+            return &run->items[g->next++];
+        run->open_head++;
+    }
+    if (run->next_group < run->ngroups) {
+        g = &run->groups[run->next_group++];
+        item = &run->items[g->next++];
+        return item;
+    }
+    return NULL;
+}
+
+static val_status_t
+_vw_status(struct vw_item *item, struct val_result_chain *results)
+{
+    struct val_result_chain *res;
+
+    /* the result that holds the requested type, if any */
+    for (res = results; res; res = res->val_rc_next) {
+        if (res->val_rc_rrset &&
+            res->val_rc_rrset->val_rrset_type == item->type_h)
+            return res->val_rc_status;
+    }
+    return results ? results->val_rc_status : VAL_DONT_KNOW;
+}
+
+#ifndef VAL_NO_ASYNC
+static int
+_vw_callback(val_async_status *as, int event, val_context_t *ctx,
+             void *cb_data, val_cb_params_t *cbp)
+{
+    struct vw_item *item = (struct vw_item *) cb_data;
+    struct vw_run  *run;
+
+    if ((NULL == item) || (NULL == item->run))
+        return VAL_BAD_ARGUMENT;
+    run = item->run;
+
+    if (event != VAL_AS_EVENT_COMPLETED || NULL == cbp)
+        _vw_complete(run, item, VAL_DONT_KNOW, VAL_INTERNAL_ERROR);
+    else if (cbp->retval != VAL_NO_ERROR)
+        _vw_complete(run, item, VAL_DONT_KNOW, cbp->retval);
+    else
+        _vw_complete(run, item, _vw_status(item, cbp->results),
+                     VAL_NO_ERROR);
+    if (cbp) {
+        val_free_result_chain(cbp->results);
+        cbp->results = NULL;
+    }
+
+    item->as = NULL;
+    --run->progress.vwp_in_flight;
+
+    return VAL_NO_ERROR;
+}
+
+static int
+_vw_run_async(struct vw_run *run, int concurrency)
+{
+    struct vw_item *item;
+    struct timeval  tv;
+    char            name_p[NS_MAXDNAME];
+    int             i, rc, retval = VAL_NO_ERROR;
+
+    while (1) {
+        while (run->progress.vwp_in_flight < concurrency &&
+               NULL != (item = _vw_next(run))) {
+            if (ns_name_ntop(item->name_n, name_p, sizeof(name_p)) < 0) {
+                _vw_complete(run, item, VAL_DONT_KNOW, VAL_BAD_ARGUMENT);
+                continue;
+            }
+            ++run->progress.vwp_in_flight;
+            rc = val_async_submit(run->context, name_p, item->class_h,
+                                  item->type_h, run->flags, &_vw_callback,
+                                  item, &item->as);
+            if (rc != VAL_NO_ERROR && !item->done) {
+                item->as = NULL;
+                --run->progress.vwp_in_flight;
+                _vw_complete(run, item, VAL_DONT_KNOW, rc);
+            }
+        }
+        if (run->progress.vwp_in_flight == 0)
+            break;
+
+        tv.tv_sec = 0;
+        tv.tv_usec = 250000;
+        rc = val_async_check_wait(run->context, NULL, NULL, &tv, 0);
+        if (rc < 0) {
+            val_log(run->context, LOG_WARNING,
+                    "val_cache_warm(): cannot wait for answers: %s",
+                    p_val_err(rc));
+            retval = rc;
+            break;
+        }
+        _vw_report(run, 0);
+    }
+
+    if (run->progress.vwp_in_flight) {
+        for (i = 0; i < run->nitems; i++) {
+            item = &run->items[i];
+            if (item->done || NULL == item->as)
+                continue;
+            val_async_cancel(run->context, item->as,
+                             VAL_AS_CANCEL_NO_CALLBACKS);
+            item->as = NULL;
+            --run->progress.vwp_in_flight;
+            _vw_complete(run, item, VAL_DONT_KNOW, retval);
+        }
+    }
+    return retval;
+}
+#else
+
+static int
+_vw_run_sync(struct vw_run *run)
+{
+    struct val_result_chain *results;
+    struct vw_item *item;
+    char            name_p[NS_MAXDNAME];
+    int             rc;
+
+    while (NULL != (item = _vw_next(run))) {
+        if (ns_name_ntop(item->name_n, name_p, sizeof(name_p)) < 0) {
+            _vw_complete(run, item, VAL_DONT_KNOW, VAL_BAD_ARGUMENT);
+            continue;
+        }
+        results = NULL;
+        rc = val_resolve_and_check(run->context, name_p, item->class_h,
+                                   item->type_h, run->flags, &results);
+        if (rc != VAL_NO_ERROR)
+            _vw_complete(run, item, VAL_DONT_KNOW, rc);
+        else
+            _vw_complete(run, item, _vw_status(item, results), rc);
+        val_free_result_chain(results);
+        _vw_report(run, 0);
+    }
+    return VAL_NO_ERROR;
+}
+#endif /* VAL_NO_ASYNC */
+
+/*
+ * Function: val_cache_warm
+ *
+ * Purpose:  Resolve a list of queries into the caches of a context,
+ *           with at most concurrency of them outstanding at a time.
+ *
+ * Parameters: ctx -- the context to warm; NULL for the default one
+ *             queries -- the queries; vw_status and vw_retval are set
+ *                        for each of them
+ *             count -- number of queries
+ *             concurrency -- requests in flight at most; 0 for the
+ *                            default
+ *             flags -- VAL_QUERY_* flags for every query
+ *             progress -- called about once a second and at the end,
+ *                         may be NULL
+ *             cb_data -- passed to progress
+ *
+ * Returns: VAL_NO_ERROR once every query has been answered or has
+ *          failed on its own, or the error that stopped the run.
+ */
+int
+val_cache_warm(val_context_t *ctx, val_warm_query_t *queries, int count,
+               int concurrency, unsigned int flags,
+               val_warm_progress_cb progress, void *cb_data)
+{
+    val_context_t  *context;
+    struct vw_run   run;
+    u_char          name_n[NS_MAXCDNAME];
+    u_char         *buf = NULL, *p;
+    size_t          buflen = 0, len;
+    int             i, n, retval;
+
+    if ((count < 0) || (count > 0 && NULL == queries) || (concurrency < 0))
+        return VAL_BAD_ARGUMENT;
+    if (concurrency == 0)
+        concurrency = VW_DEFAULT_CONCURRENCY;
+
+    context = val_create_or_refresh_context(ctx); /* does CTX_LOCK_POL_SH */
+    if (NULL == context)
+        return VAL_INTERNAL_ERROR;
+    CTX_UNLOCK_POL(context);
+
+#if !defined(VAL_NO_ASYNC) && !defined(VAL_NO_THREADS)
+    /** callbacks would be called from the workers */
+    if (context->as_engine) {
+        val_log(context, LOG_WARNING,
+                "val_cache_warm(): context has async worker threads");
+        return VAL_BAD_ARGUMENT;
+    }
+#endif
+
+    memset(&run, 0, sizeof(run));
+    run.context = context;
+    run.queries = queries;
+    run.flags = flags;
+    run.progress_cb = progress;
+    run.cb_data = cb_data;
+    run.progress.vwp_total = count;
+    gettimeofday(&run.start, NULL);
+    run.last_progress = run.start;
+
+    /*
+     * convert the names, and weed out those that cannot be looked up
+     */
+    for (i = 0; i < count; i++) {
+        queries[i].vw_status = VAL_DONT_KNOW;
+        queries[i].vw_retval = VAL_NO_ERROR;
+        if (NULL == queries[i].vw_name ||
+            queries[i].vw_class_h < 0 || queries[i].vw_class_h > ns_c_max ||
+            queries[i].vw_type_h < 0 || queries[i].vw_type_h > ns_t_max ||
+            ns_name_pton(queries[i].vw_name, name_n, sizeof(name_n)) == -1) {
+            queries[i].vw_retval = VAL_BAD_ARGUMENT;
+            run.progress.vwp_done++;
+            run.progress.vwp_failed++;
+            continue;
+        }
+        buflen += wire_name_length(name_n);
+        run.nitems++;
+    }
+
+    retval = VAL_OUT_OF_MEMORY;
+    if (run.nitems) {
+        buf = (u_char *) MALLOC(buflen);
+        run.items = (struct vw_item *)
+            MALLOC(run.nitems * sizeof(struct vw_item));
+        run.groups = (struct vw_group *)
+            MALLOC(run.nitems * sizeof(struct vw_group));
+        run.open = (int *) MALLOC(run.nitems * sizeof(int));
+        if (NULL == buf || NULL == run.items || NULL == run.groups ||
+            NULL == run.open)
+            goto err;
+        memset(run.items, 0, run.nitems * sizeof(struct vw_item));
+    }
+
+    for (i = 0, n = 0, p = buf; i < count; i++) {
+        struct vw_item *item;
+
+        if (queries[i].vw_retval != VAL_NO_ERROR ||
+            ns_name_pton(queries[i].vw_name, name_n, sizeof(name_n)) == -1)
+            continue;
+        len = wire_name_length(name_n);
+        memcpy(p, name_n, len);
+        item = &run.items[n++];
+        item->name_n = p;
+        item->parent_n = (*p == 0) ? p : p + *p + 1;
+        item->class_h = (u_int16_t) queries[i].vw_class_h;
+        item->type_h = (u_int16_t) queries[i].vw_type_h;
+        item->qi = i;
+        item->run = &run;
+        p += len;
+    }
+
+    /*
+     * sort, then mark duplicates and the groups of a parent domain
+     */
+    if (run.nitems > 1)
+        qsort(run.items, run.nitems, sizeof(struct vw_item), _vw_cmp);
+    for (i = 0, n = 0; i < run.nitems; i++) {
+        struct vw_item *item = &run.items[i];
+
+        if (i > 0 && !namecmp(item->parent_n, run.items[i - 1].parent_n)) {
+            struct vw_item *lead = &run.items[n];
+
+            item->group = run.items[i - 1].group;
+            run.groups[item->group].end = i + 1;
+            if (!namecmp(item->name_n, lead->name_n) &&
+                item->class_h == lead->class_h &&
+                item->type_h == lead->type_h) {
+                item->dup = 1;
+                lead->ndup++;
+                run.progress.vwp_duplicates++;
+                continue;
+            }
+        } else {
+            item->group = run.ngroups++;
+            run.groups[item->group].first = i;
+            run.groups[item->group].next = i;
+            run.groups[item->group].end = i + 1;
+        }
+        n = i;
+    }
+    run.progress.vwp_groups = run.ngroups;
+
+    val_log(context, LOG_INFO,
+            "val_cache_warm(): %d queries, %d duplicates, %d parent domains",
+            count, run.progress.vwp_duplicates, run.ngroups);
+
+#ifndef VAL_NO_ASYNC
+    retval = _vw_run_async(&run, concurrency);
+#else
+    retval = _vw_run_sync(&run);
+#endif
+
+    /** duplicates share the status of the query they follow */
+    for (i = 0, n = 0; i < run.nitems; i++) {
+        if (!run.items[i].dup) {
+            n = i;
+            continue;
+        }
+        queries[run.items[i].qi].vw_status =
+            queries[run.items[n].qi].vw_status;
+        queries[run.items[i].qi].vw_retval =
+            queries[run.items[n].qi].vw_retval;
+    }
+    _vw_report(&run, 1);
+
+    val_log(context, LOG_INFO,
+            "val_cache_warm(): %d of %d queries resolved in %.3f sec",
+            run.progress.vwp_done - run.progress.vwp_failed, count,
+            run.progress.vwp_elapsed);
+
+  err:
+    if (buf)
+        FREE(buf);
+    if (run.items)
+        FREE(run.items);
+    if (run.groups)
+        FREE(run.groups);
+    if (run.open)
+        FREE(run.open);
+    return retval;
+}
@@ -0,0 +1,1770 @@
+/*
+ * Copyright 2013 SPARTA, Inc.  All rights reserved.
+ * See the COPYING file distributed with this software for details.
+ */
+/*
+ * DESCRIPTION
+ * Zone files held in memory, and answers built from them.
+ *
+ * The loader understands enough of the master file format to read the
+ * output of zonesigner/dnssec-signzone, and the responder implements
+ * the parts of the authoritative answering algorithm that matter for
+ * validation: referrals (with DS or a denial of DS), CNAME and DNAME
+ * processing, wildcard synthesis, NODATA/NXDOMAIN responses with NSEC
+ * or NSEC3 proofs, EDNS0 with the DO bit, and truncation over UDP.
+ *
+ * When several zones are chained together, a query is answered from
+ * the deepest zone that contains the query name (DS queries for a zone
+ * apex are answered from the parent).
+ *
+ * This is used by dt-authserv, and by libval itself to answer from a
+ * local copy of a zone (see val_mirror.c).
+ */
+#include "validator-internal.h"
+
+#include <openssl/sha.h>
+
+#include "val_crypto.h"
+#include "validator/val_zone.h"
+
+#define VZ_DEFAULT_TTL      3600
+#define VZ_MAX_TOKENS       1024
+#define VZ_MAX_CHAIN        8
+#define VZ_MAX_ADDED        64
+#define VZ_NSEC3_HASHLEN    SHA_DIGEST_LENGTH
+
+/*
+ * A response under construction
+ */
+struct vz_msg {
+    u_char         *buf;
+    size_t          size;
+    size_t          len;
+    int             overflow;
+    int             do_bit;
+    int             aa;
+    int             rcode;
+    u_int16_t       count[4];   /* question, answer, authority, additional */
+    const u_char   *dnptrs[128];
+    int             nadded;
+    const struct vz_rrset *added[VZ_MAX_ADDED];
+    const u_char   *added_owner[VZ_MAX_ADDED];
+};
+
+#define VZ_SEC_AN 1
+#define VZ_SEC_NS 2
+#define VZ_SEC_AR 3
+
+/*
+ * ==================================================================
+ * Name helpers
+ * ==================================================================
+ */
+
+static size_t
+vz_name_len(const u_char *name)
+{
+    const u_char   *cp = name;
+
+    while (*cp)
+        cp += *cp + 1;
+    return (cp - name) + 1;
+}
+
+static int
+vz_name_labels(const u_char *name)
+{
+    int             n = 0;
+
+    while (*name) {
+        name += *name + 1;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Return a pointer to the suffix of name that is left after the first
+ * skip labels have been removed.
+ */
+static const u_char *
+vz_name_skip(const u_char *name, int skip)
+{
+    while (skip-- > 0 && *name)
+        name += *name + 1;
+    return name;
+}
+
+/*
+ * Is child equal to or below parent?
+ */
+static int
+vz_name_under(const u_char *child, const u_char *parent)
+{
+    int             cl = vz_name_labels(child);
+    int             pl = vz_name_labels(parent);
+
+    if (cl < pl)
+        return 0;
+    return (namecmp(vz_name_skip(child, cl - pl), parent) == 0);
+}
+
+static void
+vz_name_print(const u_char *name, char *buf, size_t buflen)
+{
+    if (ns_name_ntop(name, buf, buflen) < 0)
+        snprintf(buf, buflen, "<bad name>");
+}
+
+/*
+ * Convert a presentation format name to wire format, making it
+ * absolute with respect to origin if necessary.
+ */
+int
+val_zone_text2name(const char *text, const char *origin, u_char *name)
+{
+    char            buf[NS_MAXDNAME * 2];
+    size_t          l = strlen(text);
+
+    if (!strcmp(text, "@")) {
+        if (origin == NULL)
+            return -1;
+        text = origin;
+    } else if (l == 0 || text[l - 1] != '.' ||
+               (l > 1 && text[l - 2] == '\\')) {
+        if (origin == NULL)
+            return -1;
+        if (!strcmp(origin, "."))
+            snprintf(buf, sizeof(buf), "%s.", text);
+        else
+            snprintf(buf, sizeof(buf), "%s.%s", text, origin);
+        text = buf;
+    }
+    if (ns_name_pton(text, name, NS_MAXCDNAME) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * ==================================================================
+ * Zone file lexer
+ * ==================================================================
+ */
+
+struct vz_lexer {
+    const char     *file;
+    char           *data;
+    char           *cp;
+    int             line;
+    char           *tbuf;
+    char           *tok[VZ_MAX_TOKENS];
+    int             quoted[VZ_MAX_TOKENS];
+    int             ntok;
+    int             leading_ws;
+};
+
+/*
+ * Read the next logical line (a record may span physical lines if it
+ * is enclosed in parentheses) and split it into tokens.
+ * Returns 1 if a line was read, 0 at end of file and -1 on error.
+ */
+static int
+vz_lex_line(struct vz_lexer *lx)
+{
+    char           *out = lx->tbuf;
+    int             depth = 0;
+
+    for (;;) {
+        lx->ntok = 0;
+        lx->leading_ws = (*lx->cp == ' ' || *lx->cp == '\t');
+
+        while (*lx->cp) {
+            char            c = *lx->cp;
+
+            if (c == '\n') {
+                lx->line++;
+                lx->cp++;
+                if (depth == 0)
+                    break;
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\r') {
+                lx->cp++;
+                continue;
+            }
+            if (c == ';') {
+                while (*lx->cp && *lx->cp != '\n')
+                    lx->cp++;
+                continue;
+            }
+            if (c == '(') {
+                depth++;
+                lx->cp++;
+                continue;
+            }
+            if (c == ')') {
+                if (--depth < 0) {
+                    val_log(NULL, LOG_WARNING,
+                            "val_zone_load(): %s:%d: unbalanced ')'", lx->file,
+                            lx->line);
+                    return -1;
+                }
+                lx->cp++;
+                continue;
+            }
+            if (lx->ntok == VZ_MAX_TOKENS) {
+                val_log(NULL, LOG_WARNING,
+                        "val_zone_load(): %s:%d: too many tokens", lx->file,
+                        lx->line);
+                return -1;
+            }
+            lx->tok[lx->ntok] = out;
+            lx->quoted[lx->ntok] = 0;
+            if (c == '"') {
+                lx->quoted[lx->ntok] = 1;
+                lx->cp++;
+                while (*lx->cp && *lx->cp != '"') {
+                    if (*lx->cp == '\\' && lx->cp[1])
+                        *out++ = *lx->cp++;
+                    if (*lx->cp == '\n')
+                        lx->line++;
+                    *out++ = *lx->cp++;
+                }
+                if (*lx->cp != '"') {
+                    val_log(NULL, LOG_WARNING,
+                            "val_zone_load(): %s:%d: unterminated string",
+                            lx->file, lx->line);
+                    return -1;
+                }
+                lx->cp++;
+            } else {
+                while (*lx->cp && !strchr(" \t\r\n;()\"", *lx->cp)) {
+                    if (*lx->cp == '\\' && lx->cp[1])
+                        *out++ = *lx->cp++;
+                    *out++ = *lx->cp++;
+                }
+            }
+            *out++ = '\0';
+            lx->ntok++;
+        }
+
+        if (depth != 0) {
+            val_log(NULL, LOG_WARNING,
+                    "val_zone_load(): %s:%d: unbalanced '('", lx->file,
+                    lx->line);
+            return -1;
+        }
+        if (lx->ntok > 0)
+            return 1;
+        if (*lx->cp == '\0')
+            return 0;
+    }
+}
+
+/*
+ * ==================================================================
+ * RDATA encoders
+ * ==================================================================
+ */
+
+struct vz_rdbuf {
+    u_char          data[65535];
+    size_t          len;
+};
+
+static int
+vz_rd_put(struct vz_rdbuf *rd, const void *p, size_t l)
+{
+    if (rd->len + l > sizeof(rd->data))
+        return -1;
+    memcpy(rd->data + rd->len, p, l);
+    rd->len += l;
+    return 0;
+}
+
+static int
+vz_rd_num(struct vz_rdbuf *rd, const char *tok, int bytes)
+{
+    char           *end;
+    unsigned long   v;
+    u_char          b[4];
+
+    errno = 0;
+    v = strtoul(tok, &end, 10);
+    if (errno || *end != '\0' || end == tok)
+        return -1;
+    if ((bytes == 1 && v > 0xff) || (bytes == 2 && v > 0xffff) ||
+        (bytes == 4 && v > 0xffffffffUL))
+        return -1;
+    b[0] = (v >> 24) & 0xff;
+    b[1] = (v >> 16) & 0xff;
+    b[2] = (v >> 8) & 0xff;
+    b[3] = v & 0xff;
+    return vz_rd_put(rd, b + (4 - bytes), bytes);
+}
+
+static int
+vz_rd_ttl(struct vz_rdbuf *rd, const char *tok)
+{
+    u_long          v;
+    u_char          b[4];
+
+    if (ns_parse_ttl(tok, &v) < 0)
+        return -1;
+    b[0] = (v >> 24) & 0xff;
+    b[1] = (v >> 16) & 0xff;
+    b[2] = (v >> 8) & 0xff;
+    b[3] = v & 0xff;
+    return vz_rd_put(rd, b, 4);
+}
+
+static int
+vz_rd_name(struct vz_rdbuf *rd, const char *tok, const char *origin)
+{
+    u_char          name[NS_MAXCDNAME];
+
+    if (val_zone_text2name(tok, origin, name) < 0)
+        return -1;
+    return vz_rd_put(rd, name, vz_name_len(name));
+}
+
+static int
+vz_hexval(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int
+vz_rd_hex(struct vz_rdbuf *rd, char **tok, int ntok)
+{
+    int             i, hi = -1;
+    const char     *cp;
+
+    for (i = 0; i < ntok; i++) {
+        for (cp = tok[i]; *cp; cp++) {
+            int             v = vz_hexval(*cp);
+            u_char          b;
+
+            if (v < 0)
+                return -1;
+            if (hi < 0) {
+                hi = v;
+                continue;
+            }
+            b = (hi << 4) | v;
+            hi = -1;
+            if (vz_rd_put(rd, &b, 1) < 0)
+                return -1;
+        }
+    }
+    return (hi < 0) ? 0 : -1;
+}
+
+static int
+vz_rd_base64(struct vz_rdbuf *rd, char **tok, int ntok)
+{
+    char           *joined;
+    size_t          l = 0;
+    int             i, n;
+
+    for (i = 0; i < ntok; i++)
+        l += strlen(tok[i]);
+    joined = (char *) MALLOC(l + 1);
+    if (joined == NULL)
+        return -1;
+    joined[0] = '\0';
+    for (i = 0; i < ntok; i++)
+        strcat(joined, tok[i]);
+    n = decode_base64_key(joined, rd->data + rd->len,
+                          sizeof(rd->data) - rd->len);
+    FREE(joined);
+    if (n <= 0)
+        return -1;
+    rd->len += n;
+    return 0;
+}
+
+/*
+ * RFC 4648 base32 with the "extended hex" alphabet, as used in NSEC3
+ */
+static int
+vz_b32hex_pton(const char *src, u_char *dst, size_t dstlen)
+{
+    u_int32_t       acc = 0;
+    int             bits = 0;
+    size_t          n = 0;
+
+    for (; *src; src++) {
+        int             v;
+
+        if (*src >= '0' && *src <= '9')
+            v = *src - '0';
+        else if (*src >= 'a' && *src <= 'v')
+            v = *src - 'a' + 10;
+        else if (*src >= 'A' && *src <= 'V')
+            v = *src - 'A' + 10;
+        else if (*src == '=')
+            break;
+        else
+            return -1;
+        acc = (acc << 5) | v;
+        bits += 5;
+        if (bits >= 8) {
+            bits -= 8;
+            if (n == dstlen)
+                return -1;
+            dst[n++] = (acc >> bits) & 0xff;
+        }
+    }
+    return (int) n;
+}
+
+static void
+vz_b32hex_ntop(const u_char *src, size_t srclen, char *dst)
+{
+    static const char b32[] = "0123456789abcdefghijklmnopqrstuv";
+    u_int32_t       acc = 0;
+    int             bits = 0;
+    size_t          i;
+
+    for (i = 0; i < srclen; i++) {
+        acc = (acc << 8) | src[i];
+        bits += 8;
+        while (bits >= 5) {
+            bits -= 5;
+            *dst++ = b32[(acc >> bits) & 0x1f];
+        }
+    }
+    if (bits > 0)
+        *dst++ = b32[(acc << (5 - bits)) & 0x1f];
+    *dst = '\0';
+}
+
+static int
+vz_str2type(const char *s)
+{
+    int             success = 0;
+    int             t;
+
+    if (!strcasecmp(s, "NSEC3"))
+        return VZ_T_NSEC3;
+    if (!strcasecmp(s, "NSEC3PARAM"))
+        return VZ_T_NSEC3PARAM;
+    if (!strcasecmp(s, "ZONEMD"))
+        return VZ_T_ZONEMD;
+    if (!strcasecmp(s, "DLV"))
+        return VZ_T_DLV;
+    t = res_nametotype(s, &success);
+    return success ? t : -1;
+}
+
+/*
+ * Encode a list of type mnemonics as an NSEC/NSEC3 type bitmap
+ */
+static int
+vz_rd_typemap(struct vz_rdbuf *rd, char **tok, int ntok)
+{
+    u_char          map[256][32];
+    int             used[256];
+    int             i, w;
+
+    memset(map, 0, sizeof(map));
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < ntok; i++) {
+        int             t = vz_str2type(tok[i]);
+
+        if (t < 0)
+            return -1;
+        map[t >> 8][(t & 0xff) >> 3] |= 0x80 >> (t & 7);
+        if (((t & 0xff) >> 3) + 1 > used[t >> 8])
+            used[t >> 8] = ((t & 0xff) >> 3) + 1;
+    }
+    for (w = 0; w < 256; w++) {
+        u_char          hdr[2];
+
+        if (!used[w])
+            continue;
+        hdr[0] = w;
+        hdr[1] = used[w];
+        if (vz_rd_put(rd, hdr, 2) < 0 ||
+            vz_rd_put(rd, map[w], used[w]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Convert a YYYYMMDDHHmmSS time stamp (or a plain number of seconds) to
+ * seconds since the epoch.
+ */
+static int
+vz_rd_sigtime(struct vz_rdbuf *rd, const char *tok)
+{
+    static const int mdays[] =
+        { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+    int             y, mo, d, h, mi, s;
+    u_int32_t       days, t;
+    u_char          b[4];
+
+    if (strlen(tok) != 14)
+        return vz_rd_num(rd, tok, 4);
+    if (sscanf(tok, "%4d%2d%2d%2d%2d%2d", &y, &mo, &d, &h, &mi, &s) != 6 ||
+        y < 1970 || mo < 1 || mo > 12 || d < 1 || d > 31)
+        return -1;
+    days = (y - 1970) * 365 + (y - 1969) / 4 - (y - 1901) / 100 +
+        (y - 1601) / 400 + mdays[mo - 1] + d - 1;
+    if (mo > 2 && (y % 4 == 0) && ((y % 100 != 0) || (y % 400 == 0)))
+        days++;
+    t = days * 86400 + h * 3600 + mi * 60 + s;
+    b[0] = (t >> 24) & 0xff;
+    b[1] = (t >> 16) & 0xff;
+    b[2] = (t >> 8) & 0xff;
+    b[3] = t & 0xff;
+    return vz_rd_put(rd, b, 4);
+}
+
+static int
+vz_rd_charstr(struct vz_rdbuf *rd, const char *tok)
+{
+    u_char          s[256];
+    int             n = 0;
+
+    while (*tok) {
+        int             c = (u_char) *tok++;
+
+        if (c == '\\' && *tok) {
+            if (isdigit((u_char) tok[0]) && isdigit((u_char) tok[1]) &&
+                isdigit((u_char) tok[2])) {
+                c = (tok[0] - '0') * 100 + (tok[1] - '0') * 10 +
+                    (tok[2] - '0');
+                tok += 3;
+            } else
+                c = (u_char) *tok++;
+        }
+        if (n == 255)
+            return -1;
+        s[1 + n++] = c;
+    }
+    s[0] = n;
+    return vz_rd_put(rd, s, n + 1);
+}
+
+/*
+ * Encode the RDATA of a record of the given type from its presentation
+ * format tokens.
+ */
+static int
+vz_encode_rdata(struct vz_rdbuf *rd, int type_h, char **tok, int ntok,
+                const char *origin)
+{
+    int             i;
+
+    rd->len = 0;
+
+    /*
+     * RFC 3597 unknown record format
+     */
+    if (ntok >= 2 && !strcmp(tok[0], "\\#")) {
+        if (vz_rd_hex(rd, tok + 2, ntok - 2) < 0 ||
+            rd->len != strtoul(tok[1], NULL, 10))
+            return -1;
+        return 0;
+    }
+
+    switch (type_h) {
+    case ns_t_a:
+        if (ntok != 1 || inet_pton(AF_INET, tok[0], rd->data) != 1)
+            return -1;
+        rd->len = 4;
+        return 0;
+
+#ifdef VAL_IPV6
+    case ns_t_aaaa:
+        if (ntok != 1 || inet_pton(AF_INET6, tok[0], rd->data) != 1)
+            return -1;
+        rd->len = 16;
+        return 0;
+#endif
+
+    case ns_t_ns:
+    case ns_t_cname:
+    case ns_t_dname:
+    case ns_t_ptr:
+        if (ntok != 1)
+            return -1;
+        return vz_rd_name(rd, tok[0], origin);
+
+    case ns_t_mx:
+        if (ntok != 2 || vz_rd_num(rd, tok[0], 2) < 0)
+            return -1;
+        return vz_rd_name(rd, tok[1], origin);
+
+    case ns_t_srv:
+        if (ntok != 4 || vz_rd_num(rd, tok[0], 2) < 0 ||
+            vz_rd_num(rd, tok[1], 2) < 0 || vz_rd_num(rd, tok[2], 2) < 0)
+            return -1;
+        return vz_rd_name(rd, tok[3], origin);
+
+    case ns_t_soa:
+        if (ntok != 7 || vz_rd_name(rd, tok[0], origin) < 0 ||
+            vz_rd_name(rd, tok[1], origin) < 0 ||
+            vz_rd_num(rd, tok[2], 4) < 0)
+            return -1;
+        for (i = 3; i < 7; i++)
+            if (vz_rd_ttl(rd, tok[i]) < 0)
+                return -1;
+        return 0;
+
+    case ns_t_txt:
+        if (ntok < 1)
+            return -1;
+        for (i = 0; i < ntok; i++)
+            if (vz_rd_charstr(rd, tok[i]) < 0)
+                return -1;
+        return 0;
+
+    case ns_t_ds:
+    case VZ_T_DLV:
+        if (ntok < 4 || vz_rd_num(rd, tok[0], 2) < 0 ||
+            vz_rd_num(rd, tok[1], 1) < 0 || vz_rd_num(rd, tok[2], 1) < 0)
+            return -1;
+        return vz_rd_hex(rd, tok + 3, ntok - 3);
+
+    case ns_t_dnskey:
+        if (ntok < 4 || vz_rd_num(rd, tok[0], 2) < 0 ||
+            vz_rd_num(rd, tok[1], 1) < 0 || vz_rd_num(rd, tok[2], 1) < 0)
+            return -1;
+        return vz_rd_base64(rd, tok + 3, ntok - 3);
+
+    case ns_t_rrsig:
+        {
+            int             t;
+            u_char          b[2];
+
+            if (ntok < 9 || (t = vz_str2type(tok[0])) < 0)
+                return -1;
+            b[0] = (t >> 8) & 0xff;
+            b[1] = t & 0xff;
+            if (vz_rd_put(rd, b, 2) < 0 ||
+                vz_rd_num(rd, tok[1], 1) < 0 ||
+                vz_rd_num(rd, tok[2], 1) < 0 ||
+                vz_rd_ttl(rd, tok[3]) < 0 ||
+                vz_rd_sigtime(rd, tok[4]) < 0 ||
+                vz_rd_sigtime(rd, tok[5]) < 0 ||
+                vz_rd_num(rd, tok[6], 2) < 0 ||
+                vz_rd_name(rd, tok[7], origin) < 0)
+                return -1;
+            return vz_rd_base64(rd, tok + 8, ntok - 8);
+        }
+
+    case VZ_T_ZONEMD:
+        if (ntok < 4 || vz_rd_num(rd, tok[0], 4) < 0 ||
+            vz_rd_num(rd, tok[1], 1) < 0 || vz_rd_num(rd, tok[2], 1) < 0)
+            return -1;
+        return vz_rd_hex(rd, tok + 3, ntok - 3);
+
+    case ns_t_nsec:
+        if (ntok < 1 || vz_rd_name(rd, tok[0], origin) < 0)
+            return -1;
+        return vz_rd_typemap(rd, tok + 1, ntok - 1);
+
+    case VZ_T_NSEC3:
+    case VZ_T_NSEC3PARAM:
+        {
+            u_char          l;
+            size_t          lenpos;
+            int             n;
+
+            if (ntok < 4 || vz_rd_num(rd, tok[0], 1) < 0 ||
+                vz_rd_num(rd, tok[1], 1) < 0 ||
+                vz_rd_num(rd, tok[2], 2) < 0)
+                return -1;
+            lenpos = rd->len;
+            l = 0;
+            if (vz_rd_put(rd, &l, 1) < 0)
+                return -1;
+            if (strcmp(tok[3], "-")) {
+                if (vz_rd_hex(rd, tok + 3, 1) < 0)
+                    return -1;
+                rd->data[lenpos] = rd->len - lenpos - 1;
+            }
+            if (type_h == VZ_T_NSEC3PARAM)
+                return (ntok == 4) ? 0 : -1;
+            if (ntok < 5)
+                return -1;
+            lenpos = rd->len;
+            if (vz_rd_put(rd, &l, 1) < 0)
+                return -1;
+            n = vz_b32hex_pton(tok[4], rd->data + rd->len,
+                               sizeof(rd->data) - rd->len);
+            if (n <= 0)
+                return -1;
+            rd->data[lenpos] = n;
+            rd->len += n;
+            return vz_rd_typemap(rd, tok + 5, ntok - 5);
+        }
+
+    default:
+        break;
+    }
+    return -1;
+}
+
+/*
+ * ==================================================================
+ * Zone loading
+ * ==================================================================
+ */
+
+static int
+vz_rr_sortkey(const struct vz_rr *rr)
+{
+    if (rr->type_h == ns_t_rrsig)
+        return (rr->covered << 1) | 1;
+    return rr->type_h << 1;
+}
+
+static int
+vz_rr_cmp(const void *a, const void *b)
+{
+    const struct vz_rr *ra = *(const struct vz_rr * const *) a;
+    const struct vz_rr *rb = *(const struct vz_rr * const *) b;
+    int             c, ka, kb;
+    size_t          l;
+
+    if ((c = namecmp(ra->owner, rb->owner)) != 0)
+        return c;
+    ka = vz_rr_sortkey(ra);
+    kb = vz_rr_sortkey(rb);
+    if (ka != kb)
+        return (ka < kb) ? -1 : 1;
+    l = (ra->rdlen < rb->rdlen) ? ra->rdlen : rb->rdlen;
+    if ((c = memcmp(ra->rdata, rb->rdata, l)) != 0)
+        return c;
+    return (int) ra->rdlen - (int) rb->rdlen;
+}
+
+void
+val_zone_free(struct val_zone *z)
+{
+    int             i;
+
+    if (z == NULL)
+        return;
+    for (i = 0; i < z->nnodes; i++) {
+        int             j;
+
+        for (j = 0; j < z->nodes[i].nsets; j++) {
+            FREE(z->nodes[i].sets[j].rr);
+            FREE(z->nodes[i].sets[j].sig);
+        }
+        FREE(z->nodes[i].sets);
+    }
+    FREE(z->nodes);
+    FREE(z->nsec3);
+    for (i = 0; i < z->nrrs; i++) {
+        FREE(z->rrs[i]->rdata);
+        FREE(z->rrs[i]);
+    }
+    FREE(z->rrs);
+    FREE(z->file);
+    FREE(z);
+}
+
+static struct vz_rrset *
+vz_find_set(const struct vz_node *node, u_int16_t type_h)
+{
+    int             i;
+
+    if (node == NULL)
+        return NULL;
+    for (i = 0; i < node->nsets; i++)
+        if (node->sets[i].type_h == type_h && node->sets[i].nrr > 0)
+            return &node->sets[i];
+    return NULL;
+}
+
+/*
+ * Group the sorted records into nodes and RRsets
+ */
+static int
+vz_index_zone(struct val_zone *z)
+{
+    int             i, j, k;
+    struct vz_rrset *set = NULL;
+
+    qsort(z->rrs, z->nrrs, sizeof(struct vz_rr *), vz_rr_cmp);
+
+    /*
+     * drop exact duplicates
+     */
+    for (i = 0, j = 0; i < z->nrrs; i++) {
+        if (j > 0 && vz_rr_cmp(&z->rrs[j - 1], &z->rrs[i]) == 0) {
+            FREE(z->rrs[i]->rdata);
+            FREE(z->rrs[i]);
+            continue;
+        }
+        z->rrs[j++] = z->rrs[i];
+    }
+    z->nrrs = j;
+
+    z->nodes = (struct vz_node *) MALLOC(z->nrrs * sizeof(struct vz_node));
+    if (z->nodes == NULL)
+        return -1;
+    memset(z->nodes, 0, z->nrrs * sizeof(struct vz_node));
+
+    for (i = 0; i < z->nrrs; i++) {
+        struct vz_rr   *rr = z->rrs[i];
+        struct vz_node *node;
+        u_int16_t       t = (rr->type_h == ns_t_rrsig) ?
+            rr->covered : rr->type_h;
+
+        if (z->nnodes == 0 ||
+            namecmp(z->nodes[z->nnodes - 1].name, rr->owner) != 0) {
+            node = &z->nodes[z->nnodes++];
+            node->name = rr->owner;
+            set = NULL;
+        } else
+            node = &z->nodes[z->nnodes - 1];
+
+        if (set == NULL || set->type_h != t) {
+            struct vz_rrset *sets = (struct vz_rrset *)
+                MALLOC((node->nsets + 1) * sizeof(struct vz_rrset));
+            if (sets == NULL)
+                return -1;
+            if (node->nsets)
+                memcpy(sets, node->sets,
+                       node->nsets * sizeof(struct vz_rrset));
+            FREE(node->sets);
+            node->sets = sets;
+            set = &node->sets[node->nsets++];
+            memset(set, 0, sizeof(*set));
+            set->type_h = t;
+        }
+
+        if (rr->type_h == ns_t_rrsig) {
+            struct vz_rr  **l = (struct vz_rr **)
+                MALLOC((set->nsig + 1) * sizeof(struct vz_rr *));
+            if (l == NULL)
+                return -1;
+            if (set->nsig)
+                memcpy(l, set->sig, set->nsig * sizeof(struct vz_rr *));
+            FREE(set->sig);
+            set->sig = l;
+            set->sig[set->nsig++] = rr;
+        } else {
+            struct vz_rr  **l = (struct vz_rr **)
+                MALLOC((set->nrr + 1) * sizeof(struct vz_rr *));
+            if (l == NULL)
+                return -1;
+            if (set->nrr)
+                memcpy(l, set->rr, set->nrr * sizeof(struct vz_rr *));
+            FREE(set->rr);
+            set->rr = l;
+            set->rr[set->nrr++] = rr;
+        }
+    }
+
+    /*
+     * Collect NSEC3 owners and the hash parameters
+     */
+    for (i = 0; i < z->nnodes; i++) {
+        if (vz_find_set(&z->nodes[i], VZ_T_NSEC3))
+            z->nnsec3++;
+        if (vz_find_set(&z->nodes[i], ns_t_nsec))
+            z->has_nsec = 1;
+    }
+    if (z->nnsec3) {
+        struct vz_rrset *p;
+        const u_char   *rd = NULL;
+
+        z->nsec3 = (struct vz_node **)
+            MALLOC(z->nnsec3 * sizeof(struct vz_node *));
+        if (z->nsec3 == NULL)
+            return -1;
+        for (i = 0, k = 0; i < z->nnodes; i++)
+            if (vz_find_set(&z->nodes[i], VZ_T_NSEC3))
+                z->nsec3[k++] = &z->nodes[i];
+
+        p = vz_find_set(&z->nodes[0], VZ_T_NSEC3PARAM);
+        if (p)
+            rd = p->rr[0]->rdata;
+        else
+            rd = vz_find_set(z->nsec3[0], VZ_T_NSEC3)->rr[0]->rdata;
+        z->n3_alg = rd[0];
+        z->n3_iter = (rd[2] << 8) | rd[3];
+        z->n3_saltlen = rd[4];
+        memcpy(z->n3_salt, rd + 5, rd[4]);
+    }
+    return 0;
+}
+
+int
+val_zone_load(const char *file, struct val_zone **zp)
+{
+    FILE           *fp;
+    long            size;
+    struct vz_lexer lx;
+    struct vz_rdbuf *rd = NULL;
+    struct val_zone *z = NULL;
+    char            origin[NS_MAXDNAME] = "";
+    u_char          owner[NS_MAXCDNAME];
+    int             have_owner = 0, have_apex = 0;
+    u_int32_t       default_ttl = VZ_DEFAULT_TTL;
+    int             alloc = 0, rc, ret = -1;
+
+    *zp = NULL;
+    memset(&lx, 0, sizeof(lx));
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        val_log(NULL, LOG_WARNING,
+                "val_zone_load(): %s: %s", file, strerror(errno));
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    lx.data = (char *) MALLOC(size + 1);
+    lx.tbuf = (char *) MALLOC(size + 1);
+    rd = (struct vz_rdbuf *) MALLOC(sizeof(struct vz_rdbuf));
+    z = (struct val_zone *) MALLOC(sizeof(struct val_zone));
+    if (lx.data == NULL || lx.tbuf == NULL || rd == NULL || z == NULL ||
+        fread(lx.data, 1, size, fp) != (size_t) size) {
+        val_log(NULL, LOG_WARNING,
+                "val_zone_load(): %s: could not read file", file);
+        fclose(fp);
+        goto err;
+    }
+    fclose(fp);
+    lx.data[size] = '\0';
+    lx.cp = lx.data;
+    lx.file = file;
+    lx.line = 1;
+    memset(z, 0, sizeof(*z));
+    z->file = STRDUP(file);
+
+    while ((rc = vz_lex_line(&lx)) > 0) {
+        int             i = 0, t, success;
+        u_int32_t       ttl = default_ttl;
+        u_int16_t       class_h = ns_c_in;
+        struct vz_rr   *rr;
+
+        if (lx.tok[0][0] == '$' && !lx.leading_ws) {
+            if (!strcasecmp(lx.tok[0], "$ORIGIN") && lx.ntok == 2) {
+                u_char          n[NS_MAXCDNAME];
+
+                if (val_zone_text2name(lx.tok[1], origin[0] ? origin : NULL,
+                                 n) < 0 ||
+                    ns_name_ntop(n, origin, sizeof(origin)) < 0)
+                    goto syntax;
+                if (strcmp(origin, "."))
+                    strcat(origin, ".");
+            } else if (!strcasecmp(lx.tok[0], "$TTL") && lx.ntok == 2) {
+                u_long          v;
+
+                if (ns_parse_ttl(lx.tok[1], &v) < 0)
+                    goto syntax;
+                default_ttl = v;
+            } else {
+                val_log(NULL, LOG_WARNING,
+                        "val_zone_load(): %s:%d: unsupported directive %s",
+                        file, lx.line, lx.tok[0]);
+                goto err;
+            }
+            continue;
+        }
+
+        if (!lx.leading_ws) {
+            if (val_zone_text2name(lx.tok[0], origin[0] ? origin : NULL,
+                             owner) < 0)
+                goto syntax;
+            have_owner = 1;
+            i = 1;
+        } else if (!have_owner)
+            goto syntax;
+
+        /*
+         * optional TTL and class, in either order
+         */
+        for (; i < lx.ntok && i < 3; i++) {
+            u_long          v;
+            unsigned short  c;
+
+            c = res_nametoclass(lx.tok[i], &success);
+            if (success && !isdigit((u_char) lx.tok[i][0])) {
+                class_h = c;
+                continue;
+            }
+            if (isdigit((u_char) lx.tok[i][0]) &&
+                ns_parse_ttl(lx.tok[i], &v) == 0) {
+                ttl = v;
+                continue;
+            }
+            break;
+        }
+        if (i >= lx.ntok || (t = vz_str2type(lx.tok[i])) < 0)
+            goto syntax;
+        i++;
+
+        if (vz_encode_rdata(rd, t, lx.tok + i, lx.ntok - i,
+                            origin[0] ? origin : NULL) < 0) {
+            val_log(NULL, LOG_WARNING,
+                    "val_zone_load(): %s:%d: bad %s record data", file,
+                    lx.line, lx.tok[i - 1]);
+            goto err;
+        }
+
+        if (t == ns_t_soa && !have_apex) {
+            memcpy(z->apex, owner, vz_name_len(owner));
+            z->apex_labels = vz_name_labels(owner);
+            have_apex = 1;
+        }
+
+        if (z->nrrs == alloc) {
+            struct vz_rr  **l;
+
+            alloc = alloc ? alloc * 2 : 256;
+            l = (struct vz_rr **) MALLOC(alloc * sizeof(struct vz_rr *));
+            if (l == NULL)
+                goto err;
+            if (z->nrrs)
+                memcpy(l, z->rrs, z->nrrs * sizeof(struct vz_rr *));
+            FREE(z->rrs);
+            z->rrs = l;
+        }
+        rr = (struct vz_rr *) MALLOC(sizeof(struct vz_rr));
+        if (rr == NULL)
+            goto err;
+        memset(rr, 0, sizeof(*rr));
+        memcpy(rr->owner, owner, vz_name_len(owner));
+        rr->type_h = t;
+        rr->class_h = class_h;
+        rr->ttl = ttl;
+        rr->rdlen = rd->len;
+        rr->rdata = (u_char *) MALLOC(rd->len ? rd->len : 1);
+        if (rr->rdata == NULL) {
+            FREE(rr);
+            goto err;
+        }
+        memcpy(rr->rdata, rd->data, rd->len);
+        if (t == ns_t_rrsig)
+            rr->covered = (rd->data[0] << 8) | rd->data[1];
+        z->rrs[z->nrrs++] = rr;
+        continue;
+
+      syntax:
+        val_log(NULL, LOG_WARNING,
+                "val_zone_load(): %s:%d: syntax error", file, lx.line);
+        goto err;
+    }
+    if (rc < 0)
+        goto err;
+
+    if (!have_apex) {
+        val_log(NULL, LOG_WARNING,
+                "val_zone_load(): %s: no SOA record found", file);
+        goto err;
+    }
+
+    /*
+     * Ignore anything that is out of zone
+     */
+    {
+        int             i, j;
+
+        for (i = 0, j = 0; i < z->nrrs; i++) {
+            if (!vz_name_under(z->rrs[i]->owner, z->apex)) {
+                char            buf[NS_MAXDNAME];
+
+                vz_name_print(z->rrs[i]->owner, buf, sizeof(buf));
+                val_log(NULL, LOG_WARNING,
+                        "val_zone_load(): %s: ignoring out-of-zone name %s",
+                        file, buf);
+                FREE(z->rrs[i]->rdata);
+                FREE(z->rrs[i]);
+                continue;
+            }
+            z->rrs[j++] = z->rrs[i];
+        }
+        z->nrrs = j;
+    }
+
+    if (vz_index_zone(z) < 0) {
+        val_log(NULL, LOG_WARNING, "val_zone_load(): %s: out of memory", file);
+        goto err;
+    }
+
+    *zp = z;
+    z = NULL;
+    ret = 0;
+
+  err:
+    val_zone_free(z);
+    FREE(lx.data);
+    FREE(lx.tbuf);
+    FREE(rd);
+    return ret;
+}
+
+/*
+ * ==================================================================
+ * Lookups
+ * ==================================================================
+ */
+
+/*
+ * Return the index of the first node that sorts at or after name
+ */
+static int
+vz_node_index(const struct val_zone *z, const u_char *name)
+{
+    int             lo = 0, hi = z->nnodes;
+
+    while (lo < hi) {
+        int             mid = (lo + hi) / 2;
+
+        if (namecmp(z->nodes[mid].name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static struct vz_node *
+vz_find_node(const struct val_zone *z, const u_char *name)
+{
+    int             i = vz_node_index(z, name);
+
+    if (i < z->nnodes && namecmp(z->nodes[i].name, name) == 0)
+        return &z->nodes[i];
+    return NULL;
+}
+
+/*
+ * Does name exist in the zone, either as a node with data or as an
+ * empty non-terminal?
+ */
+static int
+vz_name_exists(const struct val_zone *z, const u_char *name)
+{
+    int             i = vz_node_index(z, name);
+
+    return (i < z->nnodes && vz_name_under(z->nodes[i].name, name));
+}
+
+/*
+ * Find the NSEC record that matches or covers name
+ */
+static struct vz_node *
+vz_find_nsec(const struct val_zone *z, const u_char *name)
+{
+    int             i = vz_node_index(z, name);
+
+    if (i < z->nnodes && namecmp(z->nodes[i].name, name) == 0 &&
+        vz_find_set(&z->nodes[i], ns_t_nsec))
+        return &z->nodes[i];
+    for (i = i - 1; i >= 0; i--)
+        if (vz_find_set(&z->nodes[i], ns_t_nsec))
+            return &z->nodes[i];
+    for (i = z->nnodes - 1; i >= 0; i--)
+        if (vz_find_set(&z->nodes[i], ns_t_nsec))
+            return &z->nodes[i];
+    return NULL;
+}
+
+static void
+vz_nsec3_hash(const struct val_zone *z, const u_char *name,
+              u_char *hash)
+{
+    u_char          buf[NS_MAXCDNAME + 255];
+    size_t          l = vz_name_len(name), i;
+    int             it;
+
+    memcpy(buf, name, l);
+    /*
+     * canonical (lower case) form of the name
+     */
+    for (i = 0; i < l;) {
+        size_t          j, ll = buf[i];
+
+        for (j = i + 1; j <= i + ll; j++)
+            buf[j] = tolower(buf[j]);
+        i += ll + 1;
+        if (ll == 0)
+            break;
+    }
+    memcpy(buf + l, z->n3_salt, z->n3_saltlen);
+    SHA1(buf, l + z->n3_saltlen, hash);
+    for (it = 0; it < z->n3_iter; it++) {
+        memcpy(buf, hash, VZ_NSEC3_HASHLEN);
+        memcpy(buf + VZ_NSEC3_HASHLEN, z->n3_salt, z->n3_saltlen);
+        SHA1(buf, VZ_NSEC3_HASHLEN + z->n3_saltlen, hash);
+    }
+}
+
+/*
+ * Find the NSEC3 record that matches (*exact set) or covers name
+ */
+static struct vz_node *
+vz_find_nsec3(const struct val_zone *z, const u_char *name, int *exact)
+{
+    u_char          hash[VZ_NSEC3_HASHLEN];
+    u_char          owner[NS_MAXCDNAME];
+    char            label[64];
+    int             lo = 0, hi = z->nnsec3;
+
+    *exact = 0;
+    if (z->nnsec3 == 0)
+        return NULL;
+
+    vz_nsec3_hash(z, name, hash);
+    vz_b32hex_ntop(hash, sizeof(hash), label);
+    owner[0] = strlen(label);
+    memcpy(owner + 1, label, owner[0]);
+    memcpy(owner + 1 + owner[0], z->apex, vz_name_len(z->apex));
+
+    while (lo < hi) {
+        int             mid = (lo + hi) / 2;
+
+        if (namecmp(z->nsec3[mid]->name, owner) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    /*
+     * lo is the first NSEC3 that sorts after the hash; the one before it
+     * either matches or covers.  Wrap around to the last one if needed.
+     */
+    if (lo == 0)
+        return z->nsec3[z->nnsec3 - 1];
+    if (namecmp(z->nsec3[lo - 1]->name, owner) == 0)
+        *exact = 1;
+    return z->nsec3[lo - 1];
+}
+
+/*
+ * Return the RRset of type type_h at name, or NULL if there is none
+ */
+struct vz_rrset *
+val_zone_find_rrset(const struct val_zone *z, const u_char *name,
+                    u_int16_t type_h)
+{
+    if (z == NULL || name == NULL)
+        return NULL;
+    return vz_find_set(vz_find_node(z, name), type_h);
+}
+
+/*
+ * Pick the zone to answer from
+ */
+static struct val_zone *
+vz_find_zone(struct val_zone *zones, const u_char *qname, u_int16_t qtype)
+{
+    struct val_zone *z, *best = NULL;
+
+    for (z = zones; z; z = z->next) {
+        if (!vz_name_under(qname, z->apex))
+            continue;
+        /*
+         * DS records live in the parent
+         */
+        if (qtype == ns_t_ds && namecmp(qname, z->apex) == 0 &&
+            z->apex_labels > 0)
+            continue;
+        if (best == NULL || z->apex_labels > best->apex_labels)
+            best = z;
+    }
+    return best;
+}
+
+/*
+ * ==================================================================
+ * Response construction
+ * ==================================================================
+ */
+
+static void
+vz_put_rr(struct vz_msg *m, int section, const u_char *owner,
+          const struct vz_rr *rr, u_int32_t ttl, int corrupt)
+{
+    u_char         *cp = m->buf + m->len;
+    const u_char  **lastdnptr =
+        &m->dnptrs[sizeof(m->dnptrs) / sizeof(m->dnptrs[0]) - 1];
+    int             n;
+
+    if (m->overflow)
+        return;
+    n = ns_name_pack(owner, cp, m->size - m->len, m->dnptrs, lastdnptr);
+    if (n < 0 || m->len + n + 10 + rr->rdlen > m->size) {
+        m->overflow = 1;
+        return;
+    }
+    cp += n;
+    NS_PUT16(rr->type_h, cp);
+    NS_PUT16(rr->class_h, cp);
+    NS_PUT32(ttl, cp);
+    NS_PUT16(rr->rdlen, cp);
+    memcpy(cp, rr->rdata, rr->rdlen);
+    if (corrupt && rr->rdlen > 0)
+        cp[rr->rdlen - 1] ^= 0xff;
+    cp += rr->rdlen;
+    m->len = cp - m->buf;
+    m->count[section]++;
+}
+
+/*
+ * Add an RRset (and, if DO was set, its signatures) to a section.
+ * owner overrides the owner name of the set, for wildcard synthesis.
+ * A non-zero ttl_cap limits the TTL (used for the negative SOA).
+ */
+static void
+vz_put_rrset(struct vz_msg *m, int section, const struct val_zone *z,
+             const u_char *owner, const struct vz_rrset *set,
+             u_int32_t ttl_cap)
+{
+    int             i;
+
+    if (set == NULL)
+        return;
+    if (owner == NULL)
+        owner = set->rr[0]->owner;
+    for (i = 0; i < m->nadded; i++)
+        if (m->added[i] == set && namecmp(m->added_owner[i], owner) == 0)
+            return;
+    if (m->nadded < VZ_MAX_ADDED) {
+        m->added[m->nadded] = set;
+        m->added_owner[m->nadded++] = owner;
+    }
+
+    for (i = 0; i < set->nrr; i++) {
+        u_int32_t       ttl = set->rr[i]->ttl;
+
+        if (ttl_cap && ttl > ttl_cap)
+            ttl = ttl_cap;
+        vz_put_rr(m, section, owner, set->rr[i], ttl, 0);
+    }
+    if (!m->do_bit)
+        return;
+    for (i = 0; i < set->nsig; i++) {
+        u_int32_t       ttl = set->sig[i]->ttl;
+
+        if (ttl_cap && ttl > ttl_cap)
+            ttl = ttl_cap;
+        vz_put_rr(m, section, owner, set->sig[i], ttl, z->bogus);
+    }
+}
+
+static void
+vz_put_soa(struct vz_msg *m, const struct val_zone *z)
+{
+    struct vz_rrset *soa = vz_find_set(&z->nodes[vz_node_index(z, z->apex)],
+                                       ns_t_soa);
+    u_int32_t       min;
+    const u_char   *rd;
+
+    if (soa == NULL)
+        return;
+    /*
+     * RFC 2308: use the lesser of the SOA TTL and the SOA minimum
+     */
+    rd = soa->rr[0]->rdata;
+    rd += vz_name_len(rd);
+    rd += vz_name_len(rd);
+    min = ((u_int32_t) rd[16] << 24) | (rd[17] << 16) | (rd[18] << 8) |
+        rd[19];
+    if (min == 0)
+        min = 1;
+    vz_put_rrset(m, VZ_SEC_NS, z, NULL, soa, min);
+}
+
+/*
+ * Add the denial of existence proof for name.  For NSEC zones this is
+ * the NSEC that matches or covers name; for NSEC3 zones the NSEC3 that
+ * matches name, or if there is none, the closest encloser proof.
+ */
+static void
+vz_put_nsec_proof(struct vz_msg *m, const struct val_zone *z,
+                  const u_char *name)
+{
+    struct vz_node *n;
+
+    if (!m->do_bit)
+        return;
+    if (z->has_nsec) {
+        if ((n = vz_find_nsec(z, name)) != NULL)
+            vz_put_rrset(m, VZ_SEC_NS, z, NULL,
+                         vz_find_set(n, ns_t_nsec), 0);
+    } else if (z->nnsec3) {
+        int             exact;
+
+        n = vz_find_nsec3(z, name, &exact);
+        if (n)
+            vz_put_rrset(m, VZ_SEC_NS, z, NULL,
+                         vz_find_set(n, VZ_T_NSEC3), 0);
+    }
+}
+
+/*
+ * NSEC3 closest encloser proof (RFC 5155 section 7.2.1)
+ */
+static void
+vz_put_nsec3_ce_proof(struct vz_msg *m, const struct val_zone *z,
+                      const u_char *ce, const u_char *qname)
+{
+    int             ql = vz_name_labels(qname);
+    int             cl = vz_name_labels(ce);
+
+    vz_put_nsec_proof(m, z, ce);
+    if (ql > cl)
+        vz_put_nsec_proof(m, z, vz_name_skip(qname, ql - cl - 1));
+}
+
+/*
+ * Add the glue for the name servers in an NS RRset
+ */
+static void
+vz_put_glue(struct vz_msg *m, const struct val_zone *z,
+            const struct vz_rrset *ns)
+{
+    int             i;
+
+    for (i = 0; i < ns->nrr; i++) {
+        const u_char   *target = ns->rr[i]->rdata;
+        struct vz_node *n;
+
+        if (!vz_name_under(target, z->apex))
+            continue;
+        n = vz_find_node(z, target);
+        vz_put_rrset(m, VZ_SEC_AR, z, NULL, vz_find_set(n, ns_t_a), 0);
+        vz_put_rrset(m, VZ_SEC_AR, z, NULL, vz_find_set(n, ns_t_aaaa),
+                     0);
+    }
+}
+
+/*
+ * Answer qname/qtype from zone z, following CNAMEs and DNAMEs.
+ * Returns the name to chase in next (and 1), or 0 when done.
+ */
+static int
+vz_lookup(struct vz_msg *m, const struct val_zone *z, const u_char *qname,
+          u_int16_t qtype, u_char *next)
+{
+    int             ql = vz_name_labels(qname);
+    int             k;
+    struct vz_node *node;
+    struct vz_rrset *set;
+    u_char          ce[NS_MAXCDNAME];
+    u_char          wild[NS_MAXCDNAME];
+
+    /*
+     * Look for a zone cut or DNAME between the apex and qname
+     */
+    for (k = z->apex_labels + 1; k <= ql; k++) {
+        const u_char   *anc = vz_name_skip(qname, ql - k);
+
+        node = vz_find_node(z, anc);
+        if (node == NULL)
+            continue;
+        set = vz_find_set(node, ns_t_ns);
+        if (set && !(k == ql && qtype == ns_t_ds)) {
+            /*
+             * referral
+             */
+            m->aa = 0;
+            vz_put_rrset(m, VZ_SEC_NS, z, NULL, set, 0);
+            if (vz_find_set(node, ns_t_ds))
+                vz_put_rrset(m, VZ_SEC_NS, z, NULL,
+                             vz_find_set(node, ns_t_ds), 0);
+            else
+                vz_put_nsec_proof(m, z, anc);
+            vz_put_glue(m, z, set);
+            return 0;
+        }
+        set = vz_find_set(node, ns_t_dname);
+        if (set && k < ql) {
+            /*
+             * DNAME: synthesize a CNAME from qname to the new target
+             */
+            struct vz_rr    cname;
+            size_t          pl = (size_t) (anc - qname);
+            const u_char   *target = set->rr[0]->rdata;
+            size_t          tl = vz_name_len(target);
+
+            vz_put_rrset(m, VZ_SEC_AN, z, NULL, set, 0);
+            if (pl + tl > NS_MAXCDNAME) {
+                m->rcode = ns_r_yxdomain;
+                return 0;
+            }
+            memcpy(next, qname, pl);
+            memcpy(next + pl, target, tl);
+            memset(&cname, 0, sizeof(cname));
+            cname.type_h = ns_t_cname;
+            cname.class_h = set->rr[0]->class_h;
+            cname.rdlen = pl + tl;
+            cname.rdata = next;
+            vz_put_rr(m, VZ_SEC_AN, qname, &cname, set->rr[0]->ttl, 0);
+            return 1;
+        }
+    }
+
+    node = vz_find_node(z, qname);
+    if (node) {
+        if (qtype == ns_t_any) {
+            int             i;
+
+            for (i = 0; i < node->nsets; i++)
+                if (node->sets[i].nrr)
+                    vz_put_rrset(m, VZ_SEC_AN, z, NULL, &node->sets[i], 0);
+            return 0;
+        }
+        if ((set = vz_find_set(node, qtype)) != NULL) {
+            vz_put_rrset(m, VZ_SEC_AN, z, NULL, set, 0);
+            return 0;
+        }
+        if ((set = vz_find_set(node, ns_t_cname)) != NULL) {
+            vz_put_rrset(m, VZ_SEC_AN, z, NULL, set, 0);
+            memcpy(next, set->rr[0]->rdata, set->rr[0]->rdlen);
+            return 1;
+        }
+        /*
+         * NODATA
+         */
+        vz_put_soa(m, z);
+        vz_put_nsec_proof(m, z, qname);
+        return 0;
+    }
+
+    if (vz_name_exists(z, qname)) {
+        /*
+         * empty non-terminal: NODATA
+         */
+        vz_put_soa(m, z);
+        vz_put_nsec_proof(m, z, qname);
+        return 0;
+    }
+
+    /*
+     * Find the closest encloser and try the wildcard below it
+     */
+    for (k = ql - 1; k > z->apex_labels; k--)
+        if (vz_name_exists(z, vz_name_skip(qname, ql - k)))
+            break;
+    memcpy(ce, vz_name_skip(qname, ql - k),
+           vz_name_len(vz_name_skip(qname, ql - k)));
+    wild[0] = 1;
+    wild[1] = '*';
+    memcpy(wild + 2, ce, vz_name_len(ce));
+
+    node = vz_find_node(z, wild);
+    if (node) {
+        set = vz_find_set(node, qtype);
+        if (set == NULL)
+            set = vz_find_set(node, ns_t_cname);
+        if (set) {
+            vz_put_rrset(m, VZ_SEC_AN, z, qname, set, 0);
+            /*
+             * prove that qname itself does not exist
+             */
+            if (m->do_bit) {
+                if (z->has_nsec)
+                    vz_put_nsec_proof(m, z, qname);
+                else if (ql > k)
+                    vz_put_nsec_proof(m, z,
+                                      vz_name_skip(qname, ql - k - 1));
+            }
+            if (set->type_h == ns_t_cname && qtype != ns_t_cname) {
+                memcpy(next, set->rr[0]->rdata, set->rr[0]->rdlen);
+                return 1;
+            }
+            return 0;
+        }
+        /*
+         * wildcard NODATA
+         */
+        vz_put_soa(m, z);
+        if (z->has_nsec) {
+            vz_put_nsec_proof(m, z, qname);
+            vz_put_nsec_proof(m, z, wild);
+        } else {
+            vz_put_nsec3_ce_proof(m, z, ce, qname);
+            vz_put_nsec_proof(m, z, wild);
+        }
+        return 0;
+    }
+
+    /*
+     * NXDOMAIN
+     */
+    m->rcode = ns_r_nxdomain;
+    vz_put_soa(m, z);
+    if (z->has_nsec) {
+        vz_put_nsec_proof(m, z, qname);
+        vz_put_nsec_proof(m, z, wild);
+    } else {
+        vz_put_nsec3_ce_proof(m, z, ce, qname);
+        vz_put_nsec_proof(m, z, wild);
+    }
+    return 0;
+}
+
+/*
+ * Build the response to the query in q.  Returns the length of the
+ * response, or -1 if no response should be sent.
+ */
+int
+val_zone_respond(struct val_zone *zones, const u_char *q, size_t qlen,
+                 u_char *resp, size_t resplen, int is_tcp, size_t udp_limit)
+{
+    struct vz_msg   m;
+    HEADER         *qh = (HEADER *) q;
+    HEADER         *rh = (HEADER *) resp;
+    u_char          qname[NS_MAXCDNAME];
+    u_char          cur[NS_MAXCDNAME], next[NS_MAXCDNAME];
+    const u_char   *cp, *eom = q + qlen;
+    u_char         *wp;
+    u_int16_t       qtype, qclass;
+    int             n, edns = 0, chain;
+    u_int16_t       edns_size = 512;
+    size_t          qend, limit;
+    struct val_zone *z;
+    char            nbuf[NS_MAXDNAME];
+
+    if (qlen < HFIXEDSZ || qh->qr)
+        return -1;
+
+    memset(&m, 0, sizeof(m));
+    m.buf = resp;
+    m.size = resplen;
+    memset(resp, 0, HFIXEDSZ);
+    rh->id = qh->id;
+    rh->qr = 1;
+    rh->opcode = qh->opcode;
+    rh->rd = qh->rd;
+
+    if (qh->opcode != ns_o_query || ntohs(qh->qdcount) != 1) {
+        rh->rcode = ns_r_notimpl;
+        return HFIXEDSZ;
+    }
+
+    cp = q + HFIXEDSZ;
+    n = ns_name_unpack(q, eom, cp, qname, sizeof(qname));
+    if (n < 0 || cp + n + 4 > eom) {
+        rh->rcode = ns_r_formerr;
+        return HFIXEDSZ;
+    }
+    cp += n;
+    NS_GET16(qtype, cp);
+    NS_GET16(qclass, cp);
+
+    /*
+     * copy the question
+     */
+    m.dnptrs[0] = resp;
+    m.dnptrs[1] = NULL;
+    n = ns_name_pack(qname, resp + HFIXEDSZ, resplen - HFIXEDSZ,
+                     m.dnptrs, &m.dnptrs[127]);
+    if (n < 0)
+        return -1;
+    wp = resp + HFIXEDSZ + n;
+    NS_PUT16(qtype, wp);
+    NS_PUT16(qclass, wp);
+    m.len = wp - resp;
+    m.count[0] = 1;
+    qend = m.len;
+
+    /*
+     * Look for an OPT record in the additional section
+     */
+    if (ntohs(qh->arcount) > 0) {
+        int             i, skip;
+
+        skip = ntohs(qh->ancount) + ntohs(qh->nscount);
+        for (i = 0; i < skip + ntohs(qh->arcount) && cp < eom; i++) {
+            u_int16_t       t, c, rdlen;
+            u_int32_t       ttl;
+
+            if (ns_name_skip(&cp, eom) < 0 || cp + 10 > eom)
+                break;
+            NS_GET16(t, cp);
+            NS_GET16(c, cp);
+            NS_GET32(ttl, cp);
+            NS_GET16(rdlen, cp);
+            cp += rdlen;
+            if (i >= skip && t == ns_t_opt) {
+                edns = 1;
+                edns_size = (c < 512) ? 512 : c;
+                m.do_bit = (ttl & 0x8000) ? 1 : 0;
+            }
+        }
+    }
+
+    m.aa = 1;
+    m.rcode = ns_r_noerror;
+    memcpy(cur, qname, vz_name_len(qname));
+
+    z = vz_find_zone(zones, cur, qtype);
+    if (z == NULL || qclass != ns_c_in) {
+        m.aa = 0;
+        m.rcode = ns_r_refused;
+    } else {
+        for (chain = 0; z && chain < VZ_MAX_CHAIN; chain++) {
+            if (!vz_lookup(&m, z, cur, qtype, next))
+                break;
+            memcpy(cur, next, vz_name_len(next));
+            z = vz_find_zone(zones, cur, qtype);
+            if (m.rcode != ns_r_noerror)
+                break;
+        }
+    }
+
+    /*
+     * Truncate if the response does not fit
+     */
+    limit = is_tcp ? resplen : (edns ? edns_size : 512);
+    if (!is_tcp && udp_limit && udp_limit < limit)
+        limit = udp_limit;
+    if (m.overflow || m.len + (edns ? 11 : 0) > limit) {
+        rh->tc = 1;
+        m.len = qend;
+        m.count[1] = m.count[2] = m.count[3] = 0;
+        m.overflow = 0;
+    }
+
+    if (edns && m.len + 11 <= resplen) {
+        u_char         *op = resp + m.len;
+
+        *op++ = 0;
+        NS_PUT16(ns_t_opt, op);
+        NS_PUT16(4096, op);
+        NS_PUT32(m.do_bit ? 0x8000 : 0, op);
+        NS_PUT16(0, op);
+        m.len += 11;
+        m.count[3]++;
+    }
+
+    rh->aa = m.aa;
+    rh->ra = qh->rd;
+    rh->rcode = m.rcode;
+    rh->qdcount = htons(m.count[0]);
+    rh->ancount = htons(m.count[1]);
+    rh->nscount = htons(m.count[2]);
+    rh->arcount = htons(m.count[3]);
+
+    if (val_log_debug_level() >= LOG_DEBUG) {
+        vz_name_print(qname, nbuf, sizeof(nbuf));
+        val_log(NULL, LOG_DEBUG,
+                "val_zone_respond(): %s %s%s%s -> %s%s an=%d ns=%d ar=%d",
+                nbuf, p_sres_type(qtype), edns ? " +edns" : "",
+                m.do_bit ? " +do" : "", p_rcode(m.rcode),
+                rh->tc ? " TC" : "", m.count[1], m.count[2], m.count[3]);
+    }
+
+    return (int) m.len;
+}
@@ -3,6 +3,16 @@
 #include <validator/resolver.h>
 
 #include <dlfcn.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifndef VAL_NO_THREADS
+#include <pthread.h>
+#endif
 
 #ifdef __linux__
 #define getprogname() program_invocation_short_name 
@@ -12,12 +22,192 @@ typedef struct libval_context ValContext;
 
 static ValContext *libval_shim_ctx = NULL;
 
+/*
+ * Front cache of final answers.
+ *
+ * Busy programs look up the same few names over and over, and every
+ * lookup through libval takes the context locks, walks the validator
+ * caches and logs.  The shim keeps the answers it has handed out,
+ * trusted positive answers and trusted proofs that the name or type
+ * does not exist alike, and answers repeats from a table of its own.
+ * The table is direct mapped on a hash of the function, name and
+ * arguments, and is guarded by a set of striped locks held only
+ * while an entry is copied in or out.  Untrusted results and errors
+ * are never kept.
+ *
+ * An entry lives for the smallest TTL of the records it was built
+ * from, but no longer than VAL_SHIM_CACHE_TTL seconds (default
+ * SHIM_CACHE_TTL); setting that to 0 turns the cache off.  A res_query
+ * answer carries its TTLs in the message.  The hostent and addrinfo
+ * functions do not hand the TTLs back, so they are read from the
+ * validator's result for the name, which is in its cache by then.  A
+ * proof of non-existence lives for the SOA minimum of its zone.
+ *
+ * Setting VAL_SHIM_STATS to a file name (or "stderr") writes the
+ * cache statistics there when the program exits, and, if
+ * VAL_SHIM_STATS_SIGNAL is set to a signal number, on the first call
+ * into the shim after that signal is received.
+ */
+#define SHIM_CACHE_TTL      10
+#define SHIM_CACHE_SLOTS    1024
+#define SHIM_CACHE_STRIPES  16
+#define SHIM_KEY_MAX        (NS_MAXDNAME + 128)
+
+#define SHIM_CACHE_TTL_ENV      "VAL_SHIM_CACHE_TTL"
+#define SHIM_STATS_ENV          "VAL_SHIM_STATS"
+#define SHIM_STATS_SIGNAL_ENV   "VAL_SHIM_STATS_SIGNAL"
+
+#define SHIM_KIND_HOSTENT   'h'
+#define SHIM_KIND_ADDRINFO  'a'
+#define SHIM_KIND_RESQUERY  'q'
+
+struct shim_entry {
+  u_int32_t se_hash;
+  char     *se_key;
+  int       se_negative;
+  int       se_ret;             /* h_errno of a negative answer */
+  u_char   *se_data;
+  size_t    se_datalen;
+  time_t    se_expiry;
+};
+
+struct shim_stats {
+  unsigned long ss_hits;
+  unsigned long ss_negative_hits;
+  unsigned long ss_misses;
+  unsigned long ss_stored;
+  unsigned long ss_hit_usec;
+  unsigned long ss_hit_usec_max;
+  unsigned long ss_miss_usec;
+  unsigned long ss_miss_usec_max;
+};
+
+static struct shim_entry shim_cache[SHIM_CACHE_SLOTS];
+static struct shim_stats shim_stats;
+static int shim_cache_ttl = SHIM_CACHE_TTL;
+static const char *shim_stats_file = NULL;
+static volatile sig_atomic_t shim_stats_pending = 0;
+
+#ifndef VAL_NO_THREADS
+#define SHIM_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+static pthread_mutex_t shim_cache_locks[SHIM_CACHE_STRIPES] = {
+  SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT,
+  SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT,
+  SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT,
+  SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT, SHIM_MUTEX_INIT
+};
+static pthread_mutex_t shim_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+#define SHIM_CACHE_LOCK(slot) \
+  pthread_mutex_lock(&shim_cache_locks[(slot) % SHIM_CACHE_STRIPES])
+#define SHIM_CACHE_UNLOCK(slot) \
+  pthread_mutex_unlock(&shim_cache_locks[(slot) % SHIM_CACHE_STRIPES])
+#define SHIM_INIT_LOCK()    pthread_mutex_lock(&shim_init_lock)
+#define SHIM_INIT_UNLOCK()  pthread_mutex_unlock(&shim_init_lock)
+#else
+#define SHIM_CACHE_LOCK(slot)
+#define SHIM_CACHE_UNLOCK(slot)
+#define SHIM_INIT_LOCK()
+#define SHIM_INIT_UNLOCK()
+#endif
+
+#if !defined(VAL_NO_THREADS) && defined(__GNUC__) && defined(__ATOMIC_SEQ_CST)
+#define SHIM_STATS_ADD(field, n) \
+  __atomic_add_fetch(&shim_stats.field, (n), __ATOMIC_RELAXED)
+#define SHIM_STATS_MAX(field, n) do {                                   \
+    unsigned long _old = __atomic_load_n(&shim_stats.field, __ATOMIC_RELAXED); \
+    while ((n) > _old &&                                                \
+           !__atomic_compare_exchange_n(&shim_stats.field, &_old, (n), 0, \
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) \
+      ;                                                                 \
+  } while (0)
+#else
+#define SHIM_STATS_ADD(field, n) (shim_stats.field += (n))
+#define SHIM_STATS_MAX(field, n) do {                                   \
+    if ((n) > shim_stats.field)                                         \
+      shim_stats.field = (n);                                           \
+  } while (0)
+#endif
+
+static void
+shim_stats_dump(void)
+{
+  struct shim_stats s;
+  FILE *fp;
+  unsigned long lookups;
+
+  if (shim_stats_file == NULL)
+    return;
+  if (!strcmp(shim_stats_file, "stderr"))
+    fp = stderr;
+  else if ((fp = fopen(shim_stats_file, "a")) == NULL)
+    return;
+
+  memcpy(&s, &shim_stats, sizeof(s));
+  lookups = s.ss_hits + s.ss_misses;
+  fprintf(fp, "libval_shim: %s[%ld] cache statistics\n",
+          getprogname(), (long) getpid());
+  fprintf(fp, "   %lu lookups, %lu hits (%lu negative), %lu misses, "
+          "hit ratio %.4f\n", lookups, s.ss_hits, s.ss_negative_hits,
+          s.ss_misses, lookups ? (double) s.ss_hits / lookups : 0.0);
+  fprintf(fp, "   hit latency us: mean %.1f max %lu\n",
+          s.ss_hits ? (double) s.ss_hit_usec / s.ss_hits : 0.0,
+          s.ss_hit_usec_max);
+  fprintf(fp, "   miss latency us: mean %.1f max %lu\n",
+          s.ss_misses ? (double) s.ss_miss_usec / s.ss_misses : 0.0,
+          s.ss_miss_usec_max);
+  fprintf(fp, "   %lu answers stored, kept %d sec at most\n", s.ss_stored,
+          shim_cache_ttl);
+  if (fp == stderr)
+    fflush(fp);
+  else
+    fclose(fp);
+}
+
+static void
+shim_stats_signal(int sig)
+{
+  shim_stats_pending = 1;
+}
+
+static void
+libval_shim_setup(void)
+{
+  char *cp;
+  int sig;
+
+  if ((cp = getenv(SHIM_CACHE_TTL_ENV)) != NULL)
+    shim_cache_ttl = atoi(cp) > 0 ? atoi(cp) : 0;
+
+  if ((shim_stats_file = getenv(SHIM_STATS_ENV)) != NULL &&
+      *shim_stats_file != '\0') {
+    atexit(shim_stats_dump);
+    if ((cp = getenv(SHIM_STATS_SIGNAL_ENV)) != NULL &&
+        (sig = atoi(cp)) > 0) {
+      struct sigaction sa;
+
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = shim_stats_signal;
+      sigemptyset(&sa.sa_mask);
+      sa.sa_flags = SA_RESTART;
+      sigaction(sig, &sa, NULL);
+    }
+  } else
+    shim_stats_file = NULL;
+}
+
 static int
 libval_shim_context(void)
 {
   if (libval_shim_ctx == NULL) {
-      if (val_create_context(NULL, &libval_shim_ctx) != VAL_NO_ERROR)
-	return -1;
+    SHIM_INIT_LOCK();
+    if (libval_shim_ctx == NULL &&
+        val_create_context(NULL, &libval_shim_ctx) != VAL_NO_ERROR) {
+      libval_shim_ctx = NULL;
+      SHIM_INIT_UNLOCK();
+      return -1;
+    }
+    SHIM_INIT_UNLOCK();
   }
   return 0;
 }
@@ -25,24 +215,619 @@ libval_shim_context(void)
 static int 
 libval_shim_init(void)
 {
+#ifndef VAL_NO_THREADS
+  pthread_once(&shim_once, libval_shim_setup);
+#else
+  static int setup = 0;
+  if (!setup) {
+    setup = 1;
+    libval_shim_setup();
+  }
+#endif
+  if (shim_stats_pending) {
+    shim_stats_pending = 0;
+    shim_stats_dump();
+  }
 
   return (libval_shim_context());
 }
 
+/*
+ * Build the cache key for a lookup.  Returns 0 if the lookup is not
+ * to be cached.
+ */
+static int
+shim_cache_key(char *key, int kind, const char *name, const char *extra,
+               int a, int b, int c, int d)
+{
+  char *cp;
+  int len;
+
+  if (shim_cache_ttl <= 0 || name == NULL || strlen(name) >= NS_MAXDNAME)
+    return 0;
+  if (extra != NULL && strlen(extra) >= 64)
+    return 0;
+  len = snprintf(key, SHIM_KEY_MAX, "%c|%d|%d|%d|%d|%s|%s", kind, a, b, c, d,
+                 extra ? extra : "", name);
+  if (len <= 0 || len >= SHIM_KEY_MAX)
+    return 0;
+  /* names are case insensitive; the rest of the key is digits */
+  for (cp = key + len - strlen(name); *cp; cp++)
+    *cp = tolower((unsigned char) *cp);
+  return 1;
+}
+
+static u_int32_t
+shim_hash(const char *key)
+{
+  u_int32_t h = 2166136261U;
+
+  for (; *key; key++)
+    h = (h ^ (u_char) *key) * 16777619U;
+  return h;
+}
+
+static unsigned long
+shim_elapsed_usec(const struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000000UL +
+    (now.tv_usec - start->tv_usec);
+}
+
+static void
+shim_count(int hit, int negative, const struct timeval *start)
+{
+  unsigned long usec = shim_elapsed_usec(start);
+
+  if (hit) {
+    SHIM_STATS_ADD(ss_hits, 1);
+    if (negative)
+      SHIM_STATS_ADD(ss_negative_hits, 1);
+    SHIM_STATS_ADD(ss_hit_usec, usec);
+    SHIM_STATS_MAX(ss_hit_usec_max, usec);
+  } else {
+    SHIM_STATS_ADD(ss_misses, 1);
+    SHIM_STATS_ADD(ss_miss_usec, usec);
+    SHIM_STATS_MAX(ss_miss_usec_max, usec);
+  }
+}
+
+/*
+ * Look for a live answer to the lookup.  On a hit the answer is copied
+ * into *data, which the caller must free, and 1 is returned.
+ */
+static int
+shim_cache_get(const char *key, int *negative, int *ret,
+               u_char **data, size_t *datalen)
+{
+  u_int32_t h = shim_hash(key);
+  int slot = h % SHIM_CACHE_SLOTS;
+  struct shim_entry *se = &shim_cache[slot];
+  struct timeval now;
+  int found = 0;
+
+  *data = NULL;
+  *datalen = 0;
+  gettimeofday(&now, NULL);
+
+  SHIM_CACHE_LOCK(slot);
+  if (se->se_key != NULL && se->se_hash == h && se->se_expiry > now.tv_sec &&
+      !strcmp(se->se_key, key)) {
+    *negative = se->se_negative;
+    *ret = se->se_ret;
+    if (se->se_datalen == 0 ||
+        (*data = (u_char *) malloc(se->se_datalen)) != NULL) {
+      if (se->se_datalen)
+        memcpy(*data, se->se_data, se->se_datalen);
+      *datalen = se->se_datalen;
+      found = 1;
+    }
+  }
+  SHIM_CACHE_UNLOCK(slot);
+  return found;
+}
+
+/*
+ * Remember an answer for ttl seconds at most; data (which may be NULL
+ * for a negative answer) is taken over by the cache.  Nothing is kept
+ * if ttl is 0.
+ */
+static void
+shim_cache_put(const char *key, u_int32_t ttl, int negative, int ret,
+               u_char *data, size_t datalen)
+{
+  u_int32_t h = shim_hash(key);
+  int slot = h % SHIM_CACHE_SLOTS;
+  struct shim_entry *se = &shim_cache[slot];
+  struct timeval now;
+  char *k;
+  char *oldkey;
+  u_char *olddata;
+
+  if (ttl > (u_int32_t) shim_cache_ttl)
+    ttl = shim_cache_ttl;
+  if (ttl == 0 || (k = strdup(key)) == NULL) {
+    free(data);
+    return;
+  }
+  gettimeofday(&now, NULL);
+
+  SHIM_CACHE_LOCK(slot);
+  oldkey = se->se_key;
+  olddata = se->se_data;
+  se->se_hash = h;
+  se->se_key = k;
+  se->se_negative = negative;
+  se->se_ret = ret;
+  se->se_data = data;
+  se->se_datalen = datalen;
+  se->se_expiry = now.tv_sec + ttl;
+  SHIM_CACHE_UNLOCK(slot);
+
+  SHIM_STATS_ADD(ss_stored, 1);
+  free(oldkey);
+  free(olddata);
+}
+
+/*
+ * TTLs of the answers.  Each returns the number of seconds an answer
+ * may be kept, or 0 if it is not to be kept.
+ */
+static void
+shim_ttl_min(u_int32_t *min, u_int32_t ttl)
+{
+  if (ttl < *min)
+    *min = ttl;
+}
+
+/*
+ * The smallest TTL of the records in a response message, other than
+ * the OPT pseudo-record
+ */
+static u_int32_t
+shim_msg_ttl(const u_char *msg, size_t msglen)
+{
+  const u_char *cp = msg + HFIXEDSZ;
+  const u_char *eom = msg + msglen;
+  const HEADER *hp = (const HEADER *) msg;
+  u_int16_t type, rdlen;
+  u_int32_t ttl, min = 0xffffffff;
+  int i, n, qdcount, count, found = 0;
+
+  if (msglen < HFIXEDSZ)
+    return 0;
+  qdcount = ntohs(hp->qdcount);
+  count = qdcount + ntohs(hp->ancount) + ntohs(hp->nscount) +
+    ntohs(hp->arcount);
+  for (i = 0; i < count; i++) {
+    if ((n = dn_skipname(cp, eom)) < 0 || cp + n + QFIXEDSZ > eom)
+      return 0;
+    cp += n;
+    NS_GET16(type, cp);
+    cp += INT16SZ;              /* class */
+    if (i < qdcount)
+      continue;
+    if (cp + INT32SZ + INT16SZ > eom)
+      return 0;
+    NS_GET32(ttl, cp);
+    NS_GET16(rdlen, cp);
+    if (cp + rdlen > eom)
+      return 0;
+    cp += rdlen;
+    if (type != ns_t_opt) {
+      shim_ttl_min(&min, ttl);
+      found = 1;
+    }
+  }
+  return found ? min : 0;
+}
+
+/*
+ * Fold the TTL of an RRset into *min; the minimum field of an SOA,
+ * which bounds the negative answers of its zone, as well.
+ */
+static void
+shim_rrset_ttl(u_int32_t *min, int *found, struct val_rrset_rec *rrset)
+{
+  struct val_rr_rec *rr;
+  const u_char *mp;
+  u_int32_t ttl;
+
+  if (rrset == NULL || rrset->val_rrset_ttl < 0)
+    return;
+  shim_ttl_min(min, (u_int32_t) rrset->val_rrset_ttl);
+  *found = 1;
+  if (rrset->val_rrset_type != ns_t_soa)
+    return;
+  for (rr = rrset->val_rrset_data; rr; rr = rr->rr_next) {
+    if (rr->rr_rdata == NULL || rr->rr_rdata_length < 5 * INT32SZ)
+      continue;
+    mp = rr->rr_rdata + rr->rr_rdata_length - INT32SZ;
+    NS_GET32(ttl, mp);
+    shim_ttl_min(min, ttl);
+  }
+}
+
+/*
+ * The smallest TTL of the records behind an answer for name, read back
+ * from the validator, which has them in its cache by now.  A proof of
+ * non-existence is only returned with the authentication chain
+ * details, so a negative answer asks for those.  errno and h_errno
+ * are kept as the lookup being cached set them.
+ */
+static u_int32_t
+shim_query_ttl(const char *name, int class_h, int type_h, int negative)
+{
+  struct val_result_chain *results, *res;
+  u_int32_t min = 0xffffffff;
+  int saved_errno = errno, saved_h_errno = h_errno;
+  int found = 0, i;
+
+  if (val_resolve_and_check(libval_shim_ctx, name, class_h, type_h,
+                            negative ? VAL_QUERY_AC_DETAIL : 0,
+                            &results) == VAL_NO_ERROR) {
+    for (res = results; res; res = res->val_rc_next) {
+      shim_rrset_ttl(&min, &found, res->val_rc_rrset);
+      for (i = 0; i < res->val_rc_proof_count; i++)
+        if (res->val_rc_proofs[i])
+          shim_rrset_ttl(&min, &found, res->val_rc_proofs[i]->val_ac_rrset);
+    }
+    val_free_result_chain(results);
+  }
+  errno = saved_errno;
+  h_errno = saved_h_errno;
+  return found ? min : 0;
+}
+
+/*
+ * The same for a hostent or addrinfo answer, over the address types
+ * of family.  Addresses in numeric form have no records.
+ */
+static u_int32_t
+shim_name_ttl(const char *name, int family, int negative)
+{
+  struct in6_addr addr;
+  u_int32_t ttl = shim_cache_ttl;
+
+  if (inet_pton(AF_INET, name, &addr) == 1 ||
+      inet_pton(AF_INET6, name, &addr) == 1)
+    return ttl;
+  if (family != AF_INET6)
+    ttl = shim_query_ttl(name, ns_c_in, ns_t_a, negative);
+  if (family != AF_INET && ttl > 0) {
+    u_int32_t ttl6 = shim_query_ttl(name, ns_c_in, ns_t_aaaa, negative);
+
+    shim_ttl_min(&ttl, ttl6);
+  }
+  return ttl;
+}
+
+/*
+ * Flat copies of the structures handed back to the caller
+ */
+static void
+shim_put_bytes(u_char **cp, const void *p, size_t len)
+{
+  if (*cp != NULL) {
+    memcpy(*cp, p, len);
+    *cp += len;
+  }
+}
+
+static size_t
+shim_put_int(u_char **cp, int v)
+{
+  shim_put_bytes(cp, &v, sizeof(v));
+  return sizeof(v);
+}
+
+static size_t
+shim_put_str(u_char **cp, const char *s)
+{
+  size_t len = s ? strlen(s) + 1 : 0;
+
+  shim_put_int(cp, (int) len);
+  if (len)
+    shim_put_bytes(cp, s, len);
+  return sizeof(int) + len;
+}
+
+static int
+shim_get_int(const u_char **cp, const u_char *end, int *v)
+{
+  if (end - *cp < (int) sizeof(int))
+    return -1;
+  memcpy(v, *cp, sizeof(int));
+  *cp += sizeof(int);
+  return 0;
+}
+
+/* 
+ * The string is returned in place; NULL if it was NULL
+ */
+static int
+shim_get_str(const u_char **cp, const u_char *end, const char **s)
+{
+  int len;
+
+  if (shim_get_int(cp, end, &len) != 0 || len < 0 || end - *cp < len ||
+      (len > 0 && (*cp)[len - 1] != '\0'))
+    return -1;
+  *s = len ? (const char *) *cp : NULL;
+  *cp += len;
+  return 0;
+}
+
+static u_char *
+shim_encode_hostent(const struct hostent *h, size_t *len)
+{
+  u_char *buf = NULL, *cp;
+  int pass, i;
+
+  for (pass = 0; pass < 2; pass++) {
+    cp = buf;
+    *len = shim_put_int(&cp, h->h_addrtype);
+    *len += shim_put_int(&cp, h->h_length);
+    *len += shim_put_str(&cp, h->h_name);
+    for (i = 0; h->h_aliases && h->h_aliases[i]; i++)
+      ;
+    *len += shim_put_int(&cp, i);
+    for (i = 0; h->h_aliases && h->h_aliases[i]; i++)
+      *len += shim_put_str(&cp, h->h_aliases[i]);
+    for (i = 0; h->h_addr_list && h->h_addr_list[i]; i++)
+      ;
+    *len += shim_put_int(&cp, i);
+    for (i = 0; h->h_addr_list && h->h_addr_list[i]; i++) {
+      shim_put_bytes(&cp, h->h_addr_list[i], h->h_length);
+      *len += h->h_length;
+    }
+    if (pass == 0 && (buf = (u_char *) malloc(*len)) == NULL)
+      return NULL;
+  }
+  return buf;
+}
+
+/*
+ * Rebuild a hostent in the caller's buffer.  Returns ERANGE if the
+ * buffer is too small, EINVAL if the copy is damaged.
+ */
+static int
+shim_decode_hostent(const u_char *data, size_t datalen, struct hostent *h,
+                    char *buf, size_t buflen)
+{
+  const u_char *cp = data, *end = data + datalen;
+  const char *s;
+  char *bp = buf, *bend = buf + buflen;
+  char **aliases, **addrs;
+  int addrtype, length, naliases, naddrs, i;
+  size_t align;
+
+  if (shim_get_int(&cp, end, &addrtype) != 0 ||
+      shim_get_int(&cp, end, &length) != 0 ||
+      shim_get_str(&cp, end, &s) != 0 || length < 0)
+    return EINVAL;
+
+  align = (sizeof(char *) - ((size_t) bp % sizeof(char *))) % sizeof(char *);
+  if ((size_t) (bend - bp) < align)
+    return ERANGE;
+  bp += align;
+
+  /* the strings are copied in after the pointer arrays */
+  h->h_name = (char *) s;
+  h->h_addrtype = addrtype;
+  h->h_length = length;
+
+  if (shim_get_int(&cp, end, &naliases) != 0 || naliases < 0 ||
+      naliases > (int) datalen)
+    return EINVAL;
+  if ((size_t) (bend - bp) < (naliases + 1) * sizeof(char *))
+    return ERANGE;
+  aliases = (char **) bp;
+  bp += (naliases + 1) * sizeof(char *);
+  for (i = 0; i < naliases; i++) {
+    if (shim_get_str(&cp, end, &s) != 0 || s == NULL)
+      return EINVAL;
+    aliases[i] = (char *) s;
+  }
+  aliases[naliases] = NULL;
+
+  if (shim_get_int(&cp, end, &naddrs) != 0 || naddrs < 0 ||
+      (size_t) (end - cp) != (size_t) naddrs * length)
+    return EINVAL;
+  if ((size_t) (bend - bp) < (naddrs + 1) * sizeof(char *))
+    return ERANGE;
+  addrs = (char **) bp;
+  bp += (naddrs + 1) * sizeof(char *);
+  for (i = 0; i < naddrs; i++) {
+    if ((size_t) (bend - bp) < (size_t) length)
+      return ERANGE;
+    memcpy(bp, cp, length);
+    addrs[i] = bp;
+    bp += length;
+    cp += length;
+  }
+  addrs[naddrs] = NULL;
+
+  /* now the strings, which still point into data */
+  if (h->h_name) {
+    size_t len = strlen(h->h_name) + 1;
+    if ((size_t) (bend - bp) < len)
+      return ERANGE;
+    memcpy(bp, h->h_name, len);
+    h->h_name = bp;
+    bp += len;
+  }
+  for (i = 0; i < naliases; i++) {
+    size_t len = strlen(aliases[i]) + 1;
+    if ((size_t) (bend - bp) < len)
+      return ERANGE;
+    memcpy(bp, aliases[i], len);
+    aliases[i] = bp;
+    bp += len;
+  }
+  h->h_aliases = aliases;
+  h->h_addr_list = addrs;
+  return 0;
+}
+
+static u_char *
+shim_encode_addrinfo(const struct addrinfo *ai, size_t *len)
+{
+  const struct addrinfo *a;
+  u_char *buf = NULL, *cp;
+  int pass, n;
+
+  for (pass = 0; pass < 2; pass++) {
+    cp = buf;
+    for (n = 0, a = ai; a; a = a->ai_next)
+      n++;
+    *len = shim_put_int(&cp, n);
+    for (a = ai; a; a = a->ai_next) {
+      *len += shim_put_int(&cp, a->ai_flags);
+      *len += shim_put_int(&cp, a->ai_family);
+      *len += shim_put_int(&cp, a->ai_socktype);
+      *len += shim_put_int(&cp, a->ai_protocol);
+      *len += shim_put_int(&cp, (int) a->ai_addrlen);
+      shim_put_bytes(&cp, a->ai_addr, a->ai_addrlen);
+      *len += a->ai_addrlen;
+      *len += shim_put_str(&cp, a->ai_canonname);
+    }
+    if (pass == 0 && (buf = (u_char *) malloc(*len)) == NULL)
+      return NULL;
+  }
+  return buf;
+}
+
+/*
+ * Rebuild an addrinfo list, allocated the way val_getaddrinfo()
+ * allocates it
+ */
+static struct addrinfo *
+shim_decode_addrinfo(const u_char *data, size_t datalen)
+{
+  const u_char *cp = data, *end = data + datalen;
+  struct addrinfo *head = NULL, **tail = &head, *a;
+  const char *canon;
+  int n, i, addrlen;
+
+  if (shim_get_int(&cp, end, &n) != 0 || n <= 0)
+    return NULL;
+  for (i = 0; i < n; i++) {
+    if ((a = (struct addrinfo *) malloc(sizeof(struct addrinfo))) == NULL)
+      goto err;
+    memset(a, 0, sizeof(struct addrinfo));
+    *tail = a;
+    tail = &a->ai_next;
+    if (shim_get_int(&cp, end, &a->ai_flags) != 0 ||
+        shim_get_int(&cp, end, &a->ai_family) != 0 ||
+        shim_get_int(&cp, end, &a->ai_socktype) != 0 ||
+        shim_get_int(&cp, end, &a->ai_protocol) != 0 ||
+        shim_get_int(&cp, end, &addrlen) != 0 ||
+        addrlen <= 0 || end - cp < addrlen)
+      goto err;
+    if ((a->ai_addr = (struct sockaddr *) malloc(addrlen)) == NULL)
+      goto err;
+    memcpy(a->ai_addr, cp, addrlen);
+    a->ai_addrlen = addrlen;
+    cp += addrlen;
+    if (shim_get_str(&cp, end, &canon) != 0)
+      goto err;
+    if (canon && (a->ai_canonname = strdup(canon)) == NULL)
+      goto err;
+  }
+  return head;
+
+err:
+  val_freeaddrinfo(head);
+  return NULL;
+}
+
+
+/*
+ * Look for a cached hostent and rebuild it in buf.  Returns 1 with
+ * *result set (NULL for a negative answer) on a hit, and sets *err to
+ * ERANGE if buf is too small.
+ */
+static int
+shim_hostent_get(const char *key, struct hostent *result_buf, char *buf,
+                 size_t buflen, struct hostent **result, int *h_errnop,
+                 int *err)
+{
+  u_char *data;
+  size_t datalen;
+  int negative, ret;
+
+  *err = 0;
+  if (!shim_cache_get(key, &negative, &ret, &data, &datalen))
+    return 0;
+  *result = NULL;
+  if (negative) {
+    *h_errnop = ret;
+  } else if ((*err = shim_decode_hostent(data, datalen, result_buf, buf,
+                                         buflen)) == 0) {
+    *result = result_buf;
+    *h_errnop = NETDB_SUCCESS;
+  } else if (*err == ERANGE) {
+    *h_errnop = NETDB_INTERNAL;
+  } else {
+    free(data);
+    return 0;
+  }
+  free(data);
+  return 1;
+}
+
+static void
+shim_hostent_put(const char *key, const char *name, val_status_t val_status,
+                 const struct hostent *res, int h_err)
+{
+  u_char *data;
+  size_t datalen;
+
+  if (!val_istrusted(val_status))
+    return;
+  if (val_does_not_exist(val_status))
+    shim_cache_put(key, shim_name_ttl(name, AF_INET, 1), 1,
+                   h_err ? h_err : HOST_NOT_FOUND, NULL, 0);
+  else if (res != NULL &&
+           (data = shim_encode_hostent(res, &datalen)) != NULL)
+    shim_cache_put(key, shim_name_ttl(name, AF_INET, 0), 0, 0, data, datalen);
+}
 
 struct hostent *
 gethostbyname(const char *name)
 {
+  static struct hostent shim_hostent;
+  static char           shim_hostbuf[8192];
   val_status_t          val_status;
   struct hostent *      res;
+  struct timeval        start;
+  char                  key[SHIM_KEY_MAX];
+  int                   cached, err;
 
   if (libval_shim_init())
     return NULL;
 
+  gettimeofday(&start, NULL);
+  cached = shim_cache_key(key, SHIM_KIND_HOSTENT, name, NULL, AF_INET, 0, 0, 0);
+  if (cached && shim_hostent_get(key, &shim_hostent, shim_hostbuf,
+                                 sizeof(shim_hostbuf), &res, &h_errno,
+                                 &err) && err == 0) {
+    shim_count(1, res == NULL, &start);
+    return res;
+  }
+
   val_log(NULL, LOG_DEBUG, "libval_shim: gethostbyname(%s) called: wrapper\n", name);
   
   res = val_gethostbyname(libval_shim_ctx, name, &val_status);
 
+  if (cached)
+    shim_hostent_put(key, name, val_status, res, h_errno);
+  shim_count(0, 0, &start);
+
   if (val_istrusted(val_status) && !val_does_not_exist(val_status)) {
       return res;
   }
@@ -59,10 +844,23 @@ gethostbyname_r(const char * name,struct hostent * result_buf, char * buf,
   val_status_t          val_status;
   int                   ret;
   struct hostent *result = NULL;
+  struct timeval        start;
+  char                  key[SHIM_KEY_MAX];
+  int                   cached, err;
   
   if (libval_shim_init())
       return NULL;
 
+  gettimeofday(&start, NULL);
+  cached = shim_cache_key(key, SHIM_KIND_HOSTENT, name, NULL, AF_INET, 0, 0, 0);
+  if (cached && shim_hostent_get(key, result_buf, buf, buflen, &result,
+                                 h_errnop, &err)) {
+    shim_count(1, result == NULL && err == 0, &start);
+    if (err)
+      errno = err;
+    return result;
+  }
+
   val_log(NULL, LOG_DEBUG, "libval_shim: gethostbyname_r(%s) called: wrapper\n", name);
 
   ret = 
@@ -70,6 +868,10 @@ gethostbyname_r(const char * name,struct hostent * result_buf, char * buf,
 			&result, h_errnop,
 			&val_status);
 
+  if (cached)
+    shim_hostent_put(key, name, val_status, ret == 0 ? result : NULL, *h_errnop);
+  shim_count(0, 0, &start);
+
   if (val_istrusted(val_status) && !val_does_not_exist(val_status)) {
       return result;
   }
@@ -84,10 +886,23 @@ gethostbyname_r(__const char * name,struct hostent * result_buf, char * buf,
 {
   val_status_t          val_status;
   int                   ret;
+  struct timeval        start;
+  char                  key[SHIM_KEY_MAX];
+  int                   cached, err;
 
   if (libval_shim_init())
     return NO_RECOVERY;
 
+  gettimeofday(&start, NULL);
+  cached = shim_cache_key(key, SHIM_KIND_HOSTENT, name, NULL, AF_INET, 0, 0, 0);
+  if (cached && shim_hostent_get(key, result_buf, buf, buflen, result,
+                                 h_errnop, &err)) {
+    shim_count(1, *result == NULL && err == 0, &start);
+    if (err)
+      return err;
+    return *result ? 0 : HOST_NOT_FOUND;
+  }
+
   val_log(NULL, LOG_DEBUG, "libval_shim: gethostbyname_r(%s) called: wrapper\n", name);
 
   ret = 
@@ -95,6 +910,10 @@ gethostbyname_r(__const char * name,struct hostent * result_buf, char * buf,
 			result, h_errnop,
 			&val_status);
 
+  if (cached)
+    shim_hostent_put(key, name, val_status, ret == 0 ? *result : NULL, *h_errnop);
+  shim_count(0, 0, &start);
+
   if (val_istrusted(val_status) && !val_does_not_exist(val_status)) {
       return ret;
   }
@@ -158,15 +977,47 @@ getaddrinfo(const char *node, const char *service, const struct addrinfo *hints,
 {
   val_status_t          val_status;
   int                   ret;
+  struct timeval        start;
+  char                  key[SHIM_KEY_MAX];
+  int                   cached, negative, err;
+  u_char               *data;
+  size_t                datalen;
 
   if (libval_shim_init())
     return EAI_FAIL;
 
+  gettimeofday(&start, NULL);
+  cached = res != NULL &&
+    shim_cache_key(key, SHIM_KIND_ADDRINFO, node, service,
+                   hints ? hints->ai_flags : 0, hints ? hints->ai_family : 0,
+                   hints ? hints->ai_socktype : 0,
+                   hints ? hints->ai_protocol : 0);
+  if (cached && shim_cache_get(key, &negative, &err, &data, &datalen)) {
+    *res = negative ? NULL : shim_decode_addrinfo(data, datalen);
+    free(data);
+    if (negative || *res != NULL) {
+      shim_count(1, negative, &start);
+      return negative ? EAI_NONAME : 0;
+    }
+  }
+
   val_log(NULL, LOG_DEBUG, "libval_shim: getaddrinfo(%s, %s) called: wrapper\n",
 	  node, service);
 
   ret = val_getaddrinfo(libval_shim_ctx, node, service, hints, res, &val_status);
 
+  if (cached && val_istrusted(val_status)) {
+    int family = hints ? hints->ai_family : AF_UNSPEC;
+
+    if (val_does_not_exist(val_status))
+      shim_cache_put(key, shim_name_ttl(node, family, 1), 1, 0, NULL, 0);
+    else if (ret == 0 && *res != NULL &&
+             (data = shim_encode_addrinfo(*res, &datalen)) != NULL)
+      shim_cache_put(key, shim_name_ttl(node, family, 0), 0, 0, data,
+                     datalen);
+  }
+  shim_count(0, 0, &start);
+
   if (val_istrusted(val_status) && !val_does_not_exist(val_status)) {
       return ret;
   }
@@ -245,18 +1096,60 @@ int
 res_query(const char *dname, int class_h, int type_h, 
 	  unsigned char *answer, int anslen)
 {
-  val_status_t          val_status;
+  val_status_t          val_status = VAL_DONT_KNOW;
   int ret;
+  struct timeval        start;
+  char                  key[SHIM_KEY_MAX];
+  int                   cached, negative, err;
+  u_char               *data;
+  size_t                datalen;
 
   if (libval_shim_init())
     return -1;
 
+  gettimeofday(&start, NULL);
+  cached = answer != NULL &&
+    shim_cache_key(key, SHIM_KIND_RESQUERY, dname, NULL, class_h, type_h, 0, 0);
+  if (cached && shim_cache_get(key, &negative, &err, &data, &datalen)) {
+    if (negative || datalen <= (size_t) anslen) {
+      if (!negative)
+        memcpy(answer, data, datalen);
+      else
+        h_errno = err;
+      free(data);
+      shim_count(1, negative, &start);
+      return negative ? -1 : (int) datalen;
+    }
+    free(data);
+  }
+
   val_log(NULL, LOG_DEBUG, "libval_shim: res_query(%s,%d,%d) called: wrapper\n",
 	  dname, class_h, type_h);
 
   ret = val_res_query(libval_shim_ctx, dname, class_h, type_h, answer, anslen,
 			&val_status);
 
+  /*
+   * val_res_query() merges the statuses of a proof of non-existence
+   * into a trusted one and leaves the proof out of the message, so a
+   * negative answer is told by its header.
+   */
+  if (cached && val_istrusted(val_status)) {
+    HEADER *hp = (HEADER *) answer;
+
+    if (ret < 0 && anslen >= HFIXEDSZ &&
+        (hp->rcode == ns_r_nxdomain ||
+         (hp->rcode == ns_r_noerror && hp->ancount == 0))) {
+      shim_cache_put(key, shim_query_ttl(dname, class_h, type_h, 1), 1,
+                     h_errno ? h_errno : HOST_NOT_FOUND, NULL, 0);
+    } else if (ret > 0 && ret <= anslen &&
+               (data = (u_char *) malloc(ret)) != NULL) {
+      memcpy(data, answer, ret);
+      shim_cache_put(key, shim_msg_ttl(answer, ret), 0, 0, data, ret);
+    }
+  }
+  shim_count(0, 0, &start);
+
   if (val_istrusted(val_status) && !val_does_not_exist(val_status)) {
     return ret;
   }
@@ -38,6 +38,7 @@ LIBSRES_OBJS = $(TMP_LIBSRES_D)\base64.obj \
 	$(TMP_LIBSRES_D)\res_io_manager.obj \
 	$(TMP_LIBSRES_D)\res_mkquery.obj \
 	$(TMP_LIBSRES_D)\res_query.obj \
+	$(TMP_LIBSRES_D)\res_simd.obj \
 	$(TMP_LIBSRES_D)\res_support.obj \
 	$(TMP_LIBSRES_D)\res_tsig.obj
 
@@ -55,6 +56,16 @@ LIBVAL_OBJS = $(TMP_LIBVAL_D)\dllmain.obj \
 	$(TMP_LIBVAL_D)\val_parse.obj \
 	$(TMP_LIBVAL_D)\val_policy.obj \
 	$(TMP_LIBVAL_D)\val_resquery.obj \
+	$(TMP_LIBVAL_D)\val_stats.obj \
+	$(TMP_LIBVAL_D)\val_async_engine.obj \
+	$(TMP_LIBVAL_D)\val_rcache.obj \
+	$(TMP_LIBVAL_D)\val_prefetch.obj \
+	$(TMP_LIBVAL_D)\val_inflight.obj \
+	$(TMP_LIBVAL_D)\val_cache_file.obj \
+	$(TMP_LIBVAL_D)\val_zone.obj \
+	$(TMP_LIBVAL_D)\val_mirror.obj \
+	$(TMP_LIBVAL_D)\val_tcache.obj \
+	$(TMP_LIBVAL_D)\val_warm.obj \
 	$(TMP_LIBVAL_D)\val_support.obj \
 	$(TMP_LIBVAL_D)\val_verify.obj \
 	$(TMP_LIBVAL_D)\val_x_query.obj